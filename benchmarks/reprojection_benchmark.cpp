@@ -0,0 +1,128 @@
+#include "parallel_for.h"
+#include "reprojection_service.h"
+
+#include "qgsapplication.h"
+#include "qgscoordinatereferencesystem.h"
+#include "qgscoordinatetransform.h"
+#include "qgscoordinatetransformcontext.h"
+#include "qgsexception.h"
+#include "qgsrectangle.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+/// A square grid of count points over the extent, so the points hit the grid shift files of real data.
+void grid_points(const QgsRectangle& extent, std::size_t count, std::vector<double>& x, std::vector<double>& y) {
+   const std::size_t side = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+   x.resize(count);
+   y.resize(count);
+   for (std::size_t i = 0; i < count; ++i) {
+      x[i] = extent.xMinimum() + extent.width() * (static_cast<double>(i % side) + 0.5) / static_cast<double>(side);
+      y[i] = extent.yMinimum() + extent.height() * (static_cast<double>(i / side) + 0.5) / static_cast<double>(side);
+   }
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+   return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+/// @brief Measures the throughput of ReprojectionService for chunk sizes and thread counts.
+///
+/// A grid of points over the area of use of the destination CRS is transformed once per point
+/// with QgsCoordinateTransform::transformInPlace() on one thread, then with transform_coords()
+/// for every combination of thread count and chunk size, exactly and with the approximation.
+/// Usage: reprojection_benchmark [points] [source CRS] [destination CRS] [max error], by
+/// default 10 million points from EPSG:4326 to EPSG:32633 with a max error of 0.01.
+int main(int argc, char* argv[]) {
+   QgsApplication application(argc, argv, false);
+   QgsApplication::initQgis();
+
+   const std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+   const QgsCoordinateReferenceSystem source(argc > 2 ? QString(argv[2]) : QStringLiteral("EPSG:4326"));
+   const QgsCoordinateReferenceSystem destination(argc > 3 ? QString(argv[3]) : QStringLiteral("EPSG:32633"));
+   const double max_error = argc > 4 ? std::strtod(argv[4], nullptr) : 0.01;
+   if (count == 0 || !source.isValid() || !destination.isValid()) {
+      std::fprintf(stderr, "usage: reprojection_benchmark [points] [source CRS] [destination CRS] [max error]\n");
+      return EXIT_FAILURE;
+   }
+
+   const QgsCoordinateTransformContext context;
+   const QgsCoordinateTransform transform(source, destination, context);
+   QgsRectangle extent;
+   try {
+      const QgsCoordinateTransform to_source(QgsCoordinateReferenceSystem(QStringLiteral("EPSG:4326")), source, context);
+      extent = to_source.transformBoundingBox(destination.bounds());
+   } catch (QgsCsException&) {
+   }
+   if (extent.isEmpty()) {
+      std::fprintf(stderr, "the area of use of the destination CRS has no extent in the source CRS\n");
+      return EXIT_FAILURE;
+   }
+
+   std::vector<double> source_x;
+   std::vector<double> source_y;
+   grid_points(extent, count, source_x, source_y);
+
+   const auto start = std::chrono::steady_clock::now();
+   for (std::size_t i = 0; i < count; ++i) {
+      double x = source_x[i];
+      double y = source_y[i];
+      double z = 0.0;
+      try {
+         transform.transformInPlace(x, y, z);
+      } catch (QgsCsException&) {
+      }
+   }
+   std::printf("%zu points, transformInPlace() per point on 1 thread: %.0f points/s\n\n", count,
+               static_cast<double>(count) / seconds_since(start));
+
+   std::vector<int> thread_counts;
+   for (int threads = 1; threads < resolve_thread_count(0); threads *= 2) {
+      thread_counts.push_back(threads);
+   }
+   thread_counts.push_back(resolve_thread_count(0));
+
+   std::printf("%8s %10s %16s %16s %12s\n", "threads", "chunk", "exact [pts/s]", "approx [pts/s]", "max error");
+   std::vector<double> exact_x;
+   std::vector<double> exact_y;
+   std::vector<double> x;
+   std::vector<double> y;
+   for (int threads : thread_counts) {
+      for (int chunk_size : {1024, 4096, 16384, 65536, 262144}) {
+         ReprojectionSettings settings;
+         settings.chunk_size = chunk_size;
+         settings.thread_count = threads;
+         ReprojectionService exact(transform, settings);
+         exact_x = source_x;
+         exact_y = source_y;
+         exact.transform_coords(exact_x.data(), exact_y.data(), nullptr, count);
+
+         settings.approximation.max_error = max_error;
+         ReprojectionService approximate(transform, settings);
+         x = source_x;
+         y = source_y;
+         approximate.transform_coords(x.data(), y.data(), nullptr, count);
+         double error = 0.0;
+         for (std::size_t i = 0; i < count; ++i) {
+            if (std::isfinite(exact_x[i]) && std::isfinite(exact_y[i])) {
+               error = std::max(error, std::hypot(x[i] - exact_x[i], y[i] - exact_y[i]));
+            }
+         }
+
+         std::printf("%8d %10d %16.0f %16.0f %12.3g\n", threads, chunk_size, exact.stats().points_per_second(),
+                     approximate.stats().points_per_second(), error);
+         std::fflush(stdout);
+      }
+   }
+
+   QgsApplication::exitQgis();
+   return EXIT_SUCCESS;
+}
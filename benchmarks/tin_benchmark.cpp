@@ -0,0 +1,97 @@
+#include "delaunay_tin.h"
+#include "hilbert_curve.h"
+
+#include "qgsdualedgetriangulation.h"
+#include "qgspoint.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace {
+
+/// Random points on a smooth surface, sorted along a Hilbert curve.
+void hilbert_sorted_points(std::size_t count, std::vector<double>& x, std::vector<double>& y, std::vector<double>& z) {
+   static constexpr double s_extent = 100000.0;
+   std::mt19937_64 random(7);
+   std::uniform_real_distribution<double> coordinate(0.0, s_extent);
+   std::vector<double> unsorted_x(count);
+   std::vector<double> unsorted_y(count);
+   std::vector<std::uint64_t> keys(count);
+   for (std::size_t i = 0; i < count; ++i) {
+      unsorted_x[i] = coordinate(random);
+      unsorted_y[i] = coordinate(random);
+      keys[i] = hilbert_index(static_cast<std::uint32_t>(unsorted_x[i] * (65535.0 / s_extent)),
+                              static_cast<std::uint32_t>(unsorted_y[i] * (65535.0 / s_extent)));
+   }
+   std::vector<std::size_t> order(count);
+   std::iota(order.begin(), order.end(), 0);
+   std::sort(order.begin(), order.end(), [&keys](std::size_t a, std::size_t b) { return keys[a] < keys[b]; });
+
+   x.resize(count);
+   y.resize(count);
+   z.resize(count);
+   for (std::size_t i = 0; i < count; ++i) {
+      x[i] = unsorted_x[order[i]];
+      y[i] = unsorted_y[order[i]];
+      z[i] = 100.0 * std::sin(x[i] * 0.0001) * std::cos(y[i] * 0.00013);
+   }
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+   return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+/// @brief Compares the build time of DelaunayTin and QgsDualEdgeTriangulation.
+///
+/// Both triangulate the same Hilbert sorted random points, which is the best input order for
+/// the walk of QgsDualEdgeTriangulation. Usage: tin_benchmark [largest point count] [largest
+/// point count for QgsDualEdgeTriangulation], both 50 million by default.
+int main(int argc, char* argv[]) {
+   const std::size_t largest = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 50000000;
+   const std::size_t largest_qgis = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : largest;
+
+   std::printf("%12s %16s %16s %10s %12s\n", "points", "QGIS [s]", "DelaunayTin [s]", "speedup", "triangles");
+   for (std::size_t count : {100000ull, 1000000ull, 10000000ull, 50000000ull}) {
+      if (count > largest) {
+         break;
+      }
+      std::vector<double> x;
+      std::vector<double> y;
+      std::vector<double> z;
+      hilbert_sorted_points(count, x, y, z);
+
+      double qgis_seconds = -1.0;
+      if (count <= largest_qgis) {
+         const auto start = std::chrono::steady_clock::now();
+         QgsDualEdgeTriangulation triangulation(static_cast<int>(count));
+         for (std::size_t i = 0; i < count; ++i) {
+            triangulation.addPoint(QgsPoint(x[i], y[i], z[i]));
+         }
+         qgis_seconds = seconds_since(start);
+      }
+
+      const auto start = std::chrono::steady_clock::now();
+      DelaunayTin tin;
+      tin.build(std::move(x), std::move(y), std::move(z));
+      const double tin_seconds = seconds_since(start);
+
+      if (qgis_seconds >= 0.0) {
+         std::printf("%12zu %16.3f %16.3f %9.1fx %12d\n", count, qgis_seconds, tin_seconds, qgis_seconds / tin_seconds,
+                     tin.triangle_count());
+      } else {
+         std::printf("%12zu %16s %16.3f %10s %12d\n", count, "-", tin_seconds, "-", tin.triangle_count());
+      }
+      std::fflush(stdout);
+   }
+   return EXIT_SUCCESS;
+}
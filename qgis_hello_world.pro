@@ -6,7 +6,16 @@ CONFIG += c++17
 QT += xml widgets core
 
 # Install "qgis-dev" to find these libs.
-LIBS += -L$${QGIS_DEV_DIR}/lib -lqgis_core -lqgis_gui
+LIBS += -L$${QGIS_DEV_DIR}/lib -lqgis_core -lqgis_gui -lqgis_analysis
+
+# GDAL is used directly by the raster engines.
+win32:LIBS += -LC:\OSGeo4W\lib -lgdal_i
+unix:LIBS += -lgdal
+
+# SQLite is used directly by the MBTiles writer.
+win32:LIBS += -LC:\OSGeo4W\lib -lsqlite3_i
+unix:LIBS += -lsqlite3
+INCLUDEPATH += C:\OSGeo4W\include
 
 
 
@@ -24,6 +33,7 @@ INCLUDEPATH += $$QGIS_DIR/src/core/geometry
 INCLUDEPATH += $$QGIS_DIR/src/core/project
 INCLUDEPATH += $$QGIS_DIR/src/core/proj
 INCLUDEPATH += $$QGIS_DIR/src/core/providers
+INCLUDEPATH += $$QGIS_DIR/src/core/raster
 INCLUDEPATH += $$QGIS_DIR/src/core/metadata
 INCLUDEPATH += $$QGIS_DIR/src/core/network
 INCLUDEPATH += $$QGIS_DIR/src/core/labeling
@@ -34,8 +44,102 @@ INCLUDEPATH += $$QGIS_DIR/src/core/settings
 INCLUDEPATH += $$QGIS_DIR/src/core/symbology
 INCLUDEPATH += $$QGIS_DIR/src/core/sensor
 INCLUDEPATH += $$QGIS_DIR/src/core/vector
+INCLUDEPATH += $$QGIS_DIR/src/core/pointcloud
+INCLUDEPATH += $$QGIS_DIR/src/core/mesh
 INCLUDEPATH += $$QGIS_DIR/external/nlohmann
+INCLUDEPATH += $$QGIS_DIR/src/analysis
+INCLUDEPATH += $$QGIS_DIR/src/analysis/vector
+INCLUDEPATH += $$QGIS_DIR/src/analysis/vector/geometry_checker
 
-SOURCES = src/qgis_hello_world.cpp
-HEADERS = src/qgis_hello_world.h
+SOURCES = src/approximate_transform.cpp \
+          src/delaunay_tin.cpp \
+          src/expression_kernel.cpp \
+          src/feature_store.cpp \
+          src/field_stats_engine.cpp \
+          src/geometry_validation_engine.cpp \
+          src/group_by_engine.cpp \
+          src/hilbert_rtree.cpp \
+          src/idw_engine.cpp \
+          src/kde_engine.cpp \
+          src/kde_stencil.cpp \
+          src/las_writer.cpp \
+          src/mbtiles_writer.cpp \
+          src/mesh_contour_engine.cpp \
+          src/mesh_contour_tracer.cpp \
+          src/mvt_encoder.cpp \
+          src/od_matrix.cpp \
+          src/point_cloud_buffer.cpp \
+          src/point_cloud_pipeline.cpp \
+          src/point_cloud_rasterizer.cpp \
+          src/point_cloud_reader.cpp \
+          src/point_cloud_sketch.cpp \
+          src/point_cloud_sketch_cache.cpp \
+          src/point_cloud_stats_engine.cpp \
+          src/point_kd_tree.cpp \
+          src/polygon_rasterizer.cpp \
+          src/qgis_hello_world.cpp \
+          src/raster_calc_engine.cpp \
+          src/raster_program.cpp \
+          src/reprojection_service.cpp \
+          src/road_dijkstra.cpp \
+          src/road_graph.cpp \
+          src/road_hierarchy.cpp \
+          src/snap_index.cpp \
+          src/snapping_engine.cpp \
+          src/spatial_join_engine.cpp \
+          src/terrain_engine.cpp \
+          src/terrain_simd.cpp \
+          src/tile_geometries.cpp \
+          src/tin_engine.cpp \
+          src/vector_tile_engine.cpp \
+          src/worker_pool.cpp \
+          src/zonal_engine.cpp
+HEADERS = src/approximate_transform.h \
+          src/delaunay_tin.h \
+          src/expression_kernel.h \
+          src/feature_store.h \
+          src/field_stats_engine.h \
+          src/geometry_validation_engine.h \
+          src/group_by_engine.h \
+          src/hilbert_curve.h \
+          src/hilbert_rtree.h \
+          src/idw_engine.h \
+          src/interpolator_points.h \
+          src/kde_engine.h \
+          src/kde_stencil.h \
+          src/las_writer.h \
+          src/mbtiles_writer.h \
+          src/mesh_contour_engine.h \
+          src/mesh_contour_tracer.h \
+          src/mvt_encoder.h \
+          src/od_matrix.h \
+          src/parallel_for.h \
+          src/point_cloud_buffer.h \
+          src/point_cloud_pipeline.h \
+          src/point_cloud_rasterizer.h \
+          src/point_cloud_reader.h \
+          src/point_cloud_sketch.h \
+          src/point_cloud_sketch_cache.h \
+          src/point_cloud_stats_engine.h \
+          src/point_kd_tree.h \
+          src/polygon_rasterizer.h \
+          src/qgis_hello_world.h \
+          src/raster_calc_engine.h \
+          src/raster_program.h \
+          src/reprojection_service.h \
+          src/road_dijkstra.h \
+          src/road_graph.h \
+          src/road_hierarchy.h \
+          src/snap_index.h \
+          src/snapping_engine.h \
+          src/spatial_join_engine.h \
+          src/terrain_engine.h \
+          src/terrain_kernels.h \
+          src/terrain_simd.h \
+          src/tile_geometries.h \
+          src/tin_engine.h \
+          src/vector_tile_engine.h \
+          src/worker_pool.h \
+          src/zonal_accumulator.h \
+          src/zonal_engine.h
 DEST = qgis_hello_world.so
\ No newline at end of file
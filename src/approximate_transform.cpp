@@ -0,0 +1,352 @@
+#include "approximate_transform.h"
+
+#include "qgsexception.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define APPROXIMATE_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#ifdef APPROXIMATE_SIMD_X86
+/* MSVC emits any intrinsic without compiler flags, GCC and Clang need the target per function. */
+#if defined(__GNUC__) || defined(__clang__)
+#define APPROXIMATE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define APPROXIMATE_TARGET_AVX2
+#endif
+#endif
+
+namespace {
+
+/// Upper bound of the subdivision depth, the lookup table has 4^depth entries.
+constexpr int s_max_depth = 10;
+/// Lattice points per cell side, sampled at u, v = 0, 1/4, ..., 1.
+constexpr int s_lattice = 5;
+constexpr int s_lattice_points = s_lattice * s_lattice;
+
+/// Lookup table and cells of an approximate transform, shared by the kernels.
+struct Grid {
+   double x_min;
+   double y_min;
+   double scale_x;
+   double scale_y;
+   /// Table cells per side, as a bound of the scaled coordinates.
+   double limit;
+   /// Largest table column and row.
+   double last;
+   int resolution;
+   const std::int32_t* table;
+   const double* cells;
+};
+
+/// Polynomial coefficients of values at 0, 1/2 and 1, constant term first.
+void fit_1d(ApproximationInterpolation interpolation, double f0, double f_half, double f1, double* c) {
+   c[0] = f0;
+   if (interpolation == ApproximationInterpolation::Bilinear) {
+      c[1] = f1 - f0;
+      c[2] = 0.0;
+   } else {
+      c[1] = -3.0 * f0 + 4.0 * f_half - f1;
+      c[2] = 2.0 * f0 - 4.0 * f_half + 2.0 * f1;
+   }
+}
+
+/// Fits the nine coefficients of v^m u^k at index 3 m + k to the lattice values of a cell.
+void fit_cell(ApproximationInterpolation interpolation, const double* lattice, double* c) {
+   double rows[3][3];
+   for (int row = 0; row < 3; ++row) {
+      const double* values = lattice + 2 * row * s_lattice;
+      fit_1d(interpolation, values[0], values[2], values[4], rows[row]);
+   }
+   for (int k = 0; k < 3; ++k) {
+      double column[3];
+      fit_1d(interpolation, rows[0][k], rows[1][k], rows[2][k], column);
+      for (int m = 0; m < 3; ++m) {
+         c[3 * m + k] = column[m];
+      }
+   }
+}
+
+inline double evaluate(const double* c, double u, double v) {
+   const double row0 = c[0] + u * (c[1] + u * c[2]);
+   const double row1 = c[3] + u * (c[4] + u * c[5]);
+   const double row2 = c[6] + u * (c[7] + u * c[8]);
+   return row0 + v * (row1 + v * row2);
+}
+
+/// Interpolates one point, false if it has to be transformed exactly.
+inline bool interpolate_point(const Grid& g, double& x, double& y) {
+   const double fx = (x - g.x_min) * g.scale_x;
+   const double fy = (y - g.y_min) * g.scale_y;
+   if (!(fx >= 0.0 && fx <= g.limit && fy >= 0.0 && fy <= g.limit)) {
+      return false;
+   }
+   const int column = static_cast<int>(std::min(fx, g.last));
+   const int row = static_cast<int>(std::min(fy, g.last));
+   const std::int32_t cell = g.table[row * g.resolution + column];
+   if (cell < 0) {
+      return false;
+   }
+   const double* c = g.cells + static_cast<std::size_t>(cell) * ApproximateTransform::s_cell_stride;
+   const double u = (x - c[0]) * c[2];
+   const double v = (y - c[1]) * c[3];
+   x = evaluate(c + 4, u, v);
+   y = evaluate(c + 13, u, v);
+   return true;
+}
+
+void interpolate_scalar(const Grid& g, double* x, double* y, std::size_t first, std::size_t end,
+                        std::vector<std::size_t>& exact) {
+   for (std::size_t i = first; i < end; ++i) {
+      if (!interpolate_point(g, x[i], y[i])) {
+         exact.push_back(i);
+      }
+   }
+}
+
+#ifdef APPROXIMATE_SIMD_X86
+
+APPROXIMATE_TARGET_AVX2 inline __m256d gather_coefficient(const double* cells, __m128i base, int offset) {
+   // The masked form with a defined source, the unmasked one reads an undefined register.
+   return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), cells, _mm_add_epi32(base, _mm_set1_epi32(offset)),
+                                   _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+}
+
+/// Same arithmetic and order as evaluate().
+APPROXIMATE_TARGET_AVX2 inline __m256d evaluate_avx2(const double* cells, __m128i base, int offset, __m256d u, __m256d v) {
+   __m256d rows[3];
+   for (int m = 0; m < 3; ++m) {
+      const __m256d c0 = gather_coefficient(cells, base, offset + 3 * m);
+      const __m256d c1 = gather_coefficient(cells, base, offset + 3 * m + 1);
+      const __m256d c2 = gather_coefficient(cells, base, offset + 3 * m + 2);
+      rows[m] = _mm256_add_pd(c0, _mm256_mul_pd(u, _mm256_add_pd(c1, _mm256_mul_pd(u, c2))));
+   }
+   return _mm256_add_pd(rows[0], _mm256_mul_pd(v, _mm256_add_pd(rows[1], _mm256_mul_pd(v, rows[2]))));
+}
+
+// AVX2: four points per iteration, blocks with a point outside the grid or in an exact area
+// fall back to the scalar code.
+APPROXIMATE_TARGET_AVX2 void interpolate_avx2(const Grid& g, double* x, double* y, std::size_t count,
+                                              std::vector<std::size_t>& exact) {
+   const __m256d x_min = _mm256_set1_pd(g.x_min);
+   const __m256d y_min = _mm256_set1_pd(g.y_min);
+   const __m256d scale_x = _mm256_set1_pd(g.scale_x);
+   const __m256d scale_y = _mm256_set1_pd(g.scale_y);
+   const __m256d zero = _mm256_setzero_pd();
+   const __m256d limit = _mm256_set1_pd(g.limit);
+   const __m256d last = _mm256_set1_pd(g.last);
+   const __m128i resolution = _mm_set1_epi32(g.resolution);
+   const __m128i stride = _mm_set1_epi32(ApproximateTransform::s_cell_stride);
+   std::size_t i = 0;
+   for (; i + 4 <= count; i += 4) {
+      const __m256d px = _mm256_loadu_pd(x + i);
+      const __m256d py = _mm256_loadu_pd(y + i);
+      const __m256d fx = _mm256_mul_pd(_mm256_sub_pd(px, x_min), scale_x);
+      const __m256d fy = _mm256_mul_pd(_mm256_sub_pd(py, y_min), scale_y);
+      const __m256d inside_x = _mm256_and_pd(_mm256_cmp_pd(fx, zero, _CMP_GE_OQ), _mm256_cmp_pd(fx, limit, _CMP_LE_OQ));
+      const __m256d inside_y = _mm256_and_pd(_mm256_cmp_pd(fy, zero, _CMP_GE_OQ), _mm256_cmp_pd(fy, limit, _CMP_LE_OQ));
+      if (_mm256_movemask_pd(_mm256_and_pd(inside_x, inside_y)) != 0xF) {
+         interpolate_scalar(g, x, y, i, i + 4, exact);
+         continue;
+      }
+      const __m128i column = _mm256_cvttpd_epi32(_mm256_min_pd(fx, last));
+      const __m128i row = _mm256_cvttpd_epi32(_mm256_min_pd(fy, last));
+      const __m128i entry = _mm_add_epi32(_mm_mullo_epi32(row, resolution), column);
+      const __m128i cell = _mm_i32gather_epi32(g.table, entry, 4);
+      if (_mm_movemask_ps(_mm_castsi128_ps(cell)) != 0) {
+         interpolate_scalar(g, x, y, i, i + 4, exact);
+         continue;
+      }
+      const __m128i base = _mm_mullo_epi32(cell, stride);
+      const __m256d u = _mm256_mul_pd(_mm256_sub_pd(px, gather_coefficient(g.cells, base, 0)),
+                                      gather_coefficient(g.cells, base, 2));
+      const __m256d v = _mm256_mul_pd(_mm256_sub_pd(py, gather_coefficient(g.cells, base, 1)),
+                                      gather_coefficient(g.cells, base, 3));
+      _mm256_storeu_pd(x + i, evaluate_avx2(g.cells, base, 4, u, v));
+      _mm256_storeu_pd(y + i, evaluate_avx2(g.cells, base, 13, u, v));
+   }
+   interpolate_scalar(g, x, y, i, count, exact);
+}
+
+#endif
+
+}
+
+ApproximateTransform::ApproximateTransform(const ApproximationSettings& settings)
+   : m_settings(settings),
+     m_simd_level(settings.use_simd ? terrain_simd::detect_simd_level() : SimdLevel::Scalar) {
+}
+
+bool ApproximateTransform::build(const QgsCoordinateTransform& transform, const QgsRectangle& extent, std::size_t max_samples) {
+   m_table.clear();
+   m_cells.clear();
+   m_sample_count = 0;
+   m_resolution = 0;
+   m_transform = transform;
+   m_extent = extent;
+   const double width = extent.width();
+   const double height = extent.height();
+   if (!(m_settings.max_error > 0.0) || !(width > 0.0) || !(height > 0.0) || !std::isfinite(width)
+       || !std::isfinite(height)) {
+      return false;
+   }
+   const int max_depth = std::clamp(m_settings.max_depth, 0, s_max_depth);
+   // Half the tolerance at the lattice points leaves room for the error between them.
+   const double lattice_error = 0.5 * m_settings.max_error;
+   const double max_error_squared = lattice_error * lattice_error;
+
+   struct Leaf {
+      int level;
+      int column;
+      int row;
+      std::int32_t cell;
+   };
+   std::vector<Leaf> leaves;
+   std::vector<Leaf> pending{{0, 0, 0, -1}};
+   std::vector<Leaf> next;
+   std::vector<double> sample_x;
+   std::vector<double> sample_y;
+   std::vector<double> sample_z;
+   double coefficients[18];
+
+   // One level of the quadtree at a time, with all lattice points of the level in one call.
+   while (!pending.empty()) {
+      const std::size_t sample_count = pending.size() * s_lattice_points;
+      sample_x.resize(sample_count);
+      sample_y.resize(sample_count);
+      sample_z.assign(sample_count, 0.0);
+      for (std::size_t i = 0; i < pending.size(); ++i) {
+         const Leaf& leaf = pending[i];
+         const double cell_width = width / static_cast<double>(1 << leaf.level);
+         const double cell_height = height / static_cast<double>(1 << leaf.level);
+         const double x0 = extent.xMinimum() + cell_width * leaf.column;
+         const double y0 = extent.yMinimum() + cell_height * leaf.row;
+         for (int j = 0; j < s_lattice; ++j) {
+            for (int k = 0; k < s_lattice; ++k) {
+               sample_x[i * s_lattice_points + j * s_lattice + k] = x0 + cell_width * k / (s_lattice - 1);
+               sample_y[i * s_lattice_points + j * s_lattice + k] = y0 + cell_height * j / (s_lattice - 1);
+            }
+         }
+      }
+      try {
+         m_transform.transformCoords(static_cast<int>(sample_count), sample_x.data(), sample_y.data(), sample_z.data());
+      } catch (QgsCsException&) {
+         // The failed samples hold infinite coordinates, their cells are split.
+      }
+      m_sample_count += sample_count;
+
+      next.clear();
+      for (std::size_t i = 0; i < pending.size(); ++i) {
+         const Leaf& leaf = pending[i];
+         const double* lattice_x = sample_x.data() + i * s_lattice_points;
+         const double* lattice_y = sample_y.data() + i * s_lattice_points;
+         bool fits = std::all_of(lattice_x, lattice_x + s_lattice_points, [](double value) { return std::isfinite(value); })
+                     && std::all_of(lattice_y, lattice_y + s_lattice_points, [](double value) { return std::isfinite(value); });
+         if (fits) {
+            fit_cell(m_settings.interpolation, lattice_x, coefficients);
+            fit_cell(m_settings.interpolation, lattice_y, coefficients + 9);
+            for (int j = 0; j < s_lattice && fits; ++j) {
+               for (int k = 0; k < s_lattice; ++k) {
+                  const double u = static_cast<double>(k) / (s_lattice - 1);
+                  const double v = static_cast<double>(j) / (s_lattice - 1);
+                  const double dx = evaluate(coefficients, u, v) - lattice_x[j * s_lattice + k];
+                  const double dy = evaluate(coefficients + 9, u, v) - lattice_y[j * s_lattice + k];
+                  if (!(dx * dx + dy * dy <= max_error_squared)) {
+                     fits = false;
+                     break;
+                  }
+               }
+            }
+         }
+         if (fits) {
+            const double cell_width = width / static_cast<double>(1 << leaf.level);
+            const double cell_height = height / static_cast<double>(1 << leaf.level);
+            leaves.push_back({leaf.level, leaf.column, leaf.row, static_cast<std::int32_t>(cell_count())});
+            m_cells.push_back(extent.xMinimum() + cell_width * leaf.column);
+            m_cells.push_back(extent.yMinimum() + cell_height * leaf.row);
+            m_cells.push_back(1.0 / cell_width);
+            m_cells.push_back(1.0 / cell_height);
+            m_cells.insert(m_cells.end(), coefficients, coefficients + 18);
+         } else if (leaf.level < max_depth
+                    && (max_samples == 0 || m_sample_count + (next.size() + 4) * s_lattice_points <= max_samples)) {
+            for (int child = 0; child < 4; ++child) {
+               next.push_back({leaf.level + 1, 2 * leaf.column + child % 2, 2 * leaf.row + child / 2, -1});
+            }
+         } else {
+            leaves.push_back(leaf);
+         }
+      }
+      pending.swap(next);
+   }
+
+   int depth = 0;
+   for (const Leaf& leaf : leaves) {
+      depth = std::max(depth, leaf.level);
+   }
+   m_resolution = 1 << depth;
+   m_table.assign(static_cast<std::size_t>(m_resolution) * m_resolution, -1);
+   for (const Leaf& leaf : leaves) {
+      const int size = 1 << (depth - leaf.level);
+      for (int row = leaf.row * size; row < (leaf.row + 1) * size; ++row) {
+         std::fill_n(m_table.begin() + static_cast<std::size_t>(row) * m_resolution + leaf.column * size, size, leaf.cell);
+      }
+   }
+   m_scale_x = m_resolution / width;
+   m_scale_y = m_resolution / height;
+   return true;
+}
+
+std::size_t ApproximateTransform::transform(double* x, double* y, std::size_t count, std::uint8_t* failed) const {
+   if (failed) {
+      std::fill(failed, failed + count, 0);
+   }
+   std::vector<std::size_t> exact;
+   if (is_valid()) {
+      const Grid grid{m_extent.xMinimum(), m_extent.yMinimum(), m_scale_x, m_scale_y, static_cast<double>(m_resolution),
+                      static_cast<double>(m_resolution - 1), m_resolution, m_table.data(), m_cells.data()};
+#ifdef APPROXIMATE_SIMD_X86
+      if (m_simd_level == SimdLevel::Avx2) {
+         interpolate_avx2(grid, x, y, count, exact);
+      } else {
+         interpolate_scalar(grid, x, y, 0, count, exact);
+      }
+#else
+      interpolate_scalar(grid, x, y, 0, count, exact);
+#endif
+   } else {
+      exact.resize(count);
+      for (std::size_t i = 0; i < count; ++i) {
+         exact[i] = i;
+      }
+   }
+   if (exact.empty()) {
+      return 0;
+   }
+
+   std::vector<double> exact_x(exact.size());
+   std::vector<double> exact_y(exact.size());
+   std::vector<double> exact_z(exact.size(), 0.0);
+   for (std::size_t i = 0; i < exact.size(); ++i) {
+      exact_x[i] = x[exact[i]];
+      exact_y[i] = y[exact[i]];
+   }
+   try {
+      m_transform.transformCoords(static_cast<int>(exact.size()), exact_x.data(), exact_y.data(), exact_z.data());
+   } catch (QgsCsException&) {
+      // All points were transformed, the failed ones hold infinite coordinates.
+   }
+   std::size_t failed_count = 0;
+   for (std::size_t i = 0; i < exact.size(); ++i) {
+      x[exact[i]] = exact_x[i];
+      y[exact[i]] = exact_y[i];
+      const bool point_failed = !std::isfinite(exact_x[i]) || !std::isfinite(exact_y[i]);
+      failed_count += point_failed;
+      if (failed) {
+         failed[exact[i]] = point_failed;
+      }
+   }
+   return failed_count;
+}
@@ -0,0 +1,102 @@
+#ifndef _APPROXIMATE_TRANSFORM_H_
+#define _APPROXIMATE_TRANSFORM_H_
+
+#include "terrain_simd.h"
+
+#include "qgscoordinatetransform.h"
+#include "qgsrectangle.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// Interpolation of the destination coordinates within a cell of an approximate transform.
+enum class ApproximationInterpolation {
+   /// From the exact transform of the four cell corners.
+   Bilinear,
+   /// From the exact transform of the corners, edge midpoints and centre of the cell.
+   Biquadratic
+};
+
+/// @brief Settings of an approximate transform.
+struct ApproximationSettings {
+   /// Largest distance between interpolated and exact destination points, in destination CRS
+   /// units. For a pixel tolerance, multiply the number of pixels by the output pixel size.
+   /// 0 disables the approximation in ReprojectionService.
+   double max_error = 0.0;
+   ApproximationInterpolation interpolation = ApproximationInterpolation::Biquadratic;
+   /// Depth limit of the cell subdivision, at most 10. Cells still too inaccurate at this
+   /// depth transform their points exactly.
+   int max_depth = 8;
+   /// Use the AVX2 kernel when the CPU supports it.
+   bool use_simd = true;
+};
+
+/// @brief Interpolates a coordinate transform from exact samples on an adaptive grid.
+///
+/// Like GDAL's approximate transformer, build() transforms a sparse set of points exactly and
+/// the bulk of the points are interpolated. The source extent is split as a quadtree: every
+/// cell is sampled on a 5 x 5 lattice in one transformCoords() call per level, fitted from the
+/// lattice points at its corners (bilinear) or its corners, edge midpoints and centre
+/// (biquadratic), and split into four while any lattice point misses the fit by more than
+/// half of max_error; the other half covers the error between the lattice points. The leaves
+/// are flattened into a lookup table at the finest depth reached, so locating a point's cell
+/// takes no branches and transform() evaluates four points per AVX2 instruction with gathered
+/// cell coefficients.
+///
+/// Points outside the extent, and in cells with a failed sample or still above the error at
+/// the depth limit, are transformed exactly. Z values are never interpolated.
+class ApproximateTransform
+{
+public:
+   /// @brief Constructor.
+   /// @param settings The tolerance and interpolation.
+   explicit ApproximateTransform(const ApproximationSettings& settings = ApproximationSettings());
+
+   /// @brief Samples the transform over an extent and builds the interpolation grid.
+   /// @param transform The exact transform, copied for the points transformed exactly.
+   /// @param extent Source extent to interpolate, must have a positive width and height.
+   /// @param max_samples Budget of exact samples, 0 for no limit. Cells that cannot be split
+   /// within the budget transform their points exactly.
+   /// @return False if the settings or extent are invalid.
+   bool build(const QgsCoordinateTransform& transform, const QgsRectangle& extent, std::size_t max_samples = 0);
+
+   bool is_valid() const {
+      return !m_table.empty();
+   }
+
+   /// Number of exact transformed samples of the last build().
+   std::size_t sample_count() const {
+      return m_sample_count;
+   }
+
+   /// Number of interpolated cells.
+   std::size_t cell_count() const {
+      return m_cells.size() / s_cell_stride;
+   }
+
+   /// @brief Transforms 2D points in place.
+   /// @param failed Receives 1 for every point that could not be transformed, or null.
+   /// @return The number of points that could not be transformed; they hold infinite coordinates.
+   std::size_t transform(double* x, double* y, std::size_t count, std::uint8_t* failed = nullptr) const;
+
+   /// Coefficients and origin of an interpolated cell: x0, y0, 1/width, 1/height, then nine
+   /// polynomial coefficients in u and v for x and for y.
+   static constexpr int s_cell_stride = 22;
+
+private:
+   ApproximationSettings m_settings;
+   SimdLevel m_simd_level;
+   QgsCoordinateTransform m_transform;
+   QgsRectangle m_extent;
+   /// Cells per side of the lookup table.
+   int m_resolution = 0;
+   double m_scale_x = 0.0;
+   double m_scale_y = 0.0;
+   /// Cell of every table entry, row by row from the south, -1 for exactly transformed areas.
+   std::vector<std::int32_t> m_table;
+   std::vector<double> m_cells;
+   std::size_t m_sample_count = 0;
+};
+
+#endif
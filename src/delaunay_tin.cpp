@@ -0,0 +1,504 @@
+#include "delaunay_tin.h"
+#include "hilbert_curve.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <random>
+
+namespace {
+
+/// Vertex at infinity shared by the ghost triangles outside the convex hull.
+constexpr int s_ghost = -1;
+/// First vertex of a free triangle slot.
+constexpr int s_free = -2;
+
+constexpr double s_epsilon = std::numeric_limits<double>::epsilon() / 2.0;
+/// Error bounds of the double precision predicates, from Shewchuk's robust predicates.
+constexpr double s_orient_bound = (3.0 + 16.0 * s_epsilon) * s_epsilon;
+constexpr double s_in_circle_bound = (10.0 + 96.0 * s_epsilon) * s_epsilon;
+
+inline int next_edge(int edge) {
+   return edge % 3 == 2 ? edge - 2 : edge + 1;
+}
+
+}
+
+void DelaunayTin::build(std::vector<double> x, std::vector<double> y, std::vector<double> z) {
+   m_x = std::move(x);
+   m_y = std::move(y);
+   m_z = std::move(z);
+   m_triangles.clear();
+   m_halfedges.clear();
+   m_gradients.clear();
+   m_free_triangles.clear();
+   m_visited.clear();
+   m_in_cavity.clear();
+   m_visit = 0;
+   m_new_edge_at.assign(m_x.size() + 1, -1);
+
+   std::vector<int> order;
+   insertion_order(order);
+
+   // Start with the first three points that are not collinear and their three ghost triangles.
+   const int a = order.empty() ? -1 : order[0];
+   int b = -1;
+   int c = -1;
+   for (int vertex : order) {
+      if (b < 0 && (m_x[vertex] != m_x[a] || m_y[vertex] != m_y[a])) {
+         b = vertex;
+      } else if (b >= 0 && orient(a, b, m_x[vertex], m_y[vertex]) != 0.0) {
+         c = vertex;
+         break;
+      }
+   }
+   if (c < 0) {
+      m_new_edge_at = {};
+      return;
+   }
+   if (orient(a, b, m_x[c], m_y[c]) < 0.0) {
+      std::swap(b, c);
+   }
+   const int first = add_triangle(a, b, c);
+   const int ghost_ab = add_triangle(b, a, s_ghost);
+   const int ghost_bc = add_triangle(c, b, s_ghost);
+   const int ghost_ca = add_triangle(a, c, s_ghost);
+   link(3 * first, 3 * ghost_ab);
+   link(3 * first + 1, 3 * ghost_bc);
+   link(3 * first + 2, 3 * ghost_ca);
+   link(3 * ghost_ab + 1, 3 * ghost_ca + 2);
+   link(3 * ghost_bc + 1, 3 * ghost_ab + 2);
+   link(3 * ghost_ca + 1, 3 * ghost_bc + 2);
+   m_last_triangle = first;
+
+   for (int vertex : order) {
+      if (vertex != a && vertex != b && vertex != c) {
+         insert(vertex);
+      }
+   }
+
+   compact();
+   estimate_gradients();
+   m_free_triangles = {};
+   m_visited = {};
+   m_in_cavity = {};
+   m_cavity = {};
+   m_boundary = {};
+   m_new_edge_at = {};
+}
+
+void DelaunayTin::insertion_order(std::vector<int>& order) const {
+   const std::size_t count = m_x.size();
+   order.resize(count);
+   std::iota(order.begin(), order.end(), 0);
+   if (count == 0) {
+      return;
+   }
+   const auto [min_x, max_x] = std::minmax_element(m_x.begin(), m_x.end());
+   const auto [min_y, max_y] = std::minmax_element(m_y.begin(), m_y.end());
+   const double scale_x = *max_x > *min_x ? 65535.0 / (*max_x - *min_x) : 0.0;
+   const double scale_y = *max_y > *min_y ? 65535.0 / (*max_y - *min_y) : 0.0;
+   std::vector<std::uint64_t> keys(count);
+   for (std::size_t i = 0; i < count; ++i) {
+      keys[i] = hilbert_index(static_cast<std::uint32_t>((m_x[i] - *min_x) * scale_x),
+                              static_cast<std::uint32_t>((m_y[i] - *min_y) * scale_y));
+   }
+
+   // Rounds of doubling size after a shuffle, the last round holding half of the points, each
+   // sorted along the Hilbert curve. A fixed seed keeps the triangulation reproducible.
+   std::mt19937 random(42);
+   std::shuffle(order.begin(), order.end(), random);
+   auto by_key = [&keys](int a, int b) { return keys[a] < keys[b]; };
+   std::size_t end = count;
+   while (end > 64) {
+      const std::size_t begin = end / 2;
+      std::sort(order.begin() + begin, order.begin() + end, by_key);
+      end = begin;
+   }
+   std::sort(order.begin(), order.begin() + end, by_key);
+}
+
+int DelaunayTin::add_triangle(int a, int b, int c) {
+   int triangle;
+   if (!m_free_triangles.empty()) {
+      triangle = m_free_triangles.back();
+      m_free_triangles.pop_back();
+   } else {
+      triangle = static_cast<int>(m_triangles.size() / 3);
+      m_triangles.resize(m_triangles.size() + 3);
+      m_halfedges.resize(m_halfedges.size() + 3);
+      m_visited.push_back(0);
+      m_in_cavity.push_back(0);
+   }
+   m_triangles[3 * triangle] = a;
+   m_triangles[3 * triangle + 1] = b;
+   m_triangles[3 * triangle + 2] = c;
+   m_halfedges[3 * triangle] = -1;
+   m_halfedges[3 * triangle + 1] = -1;
+   m_halfedges[3 * triangle + 2] = -1;
+   return triangle;
+}
+
+void DelaunayTin::link(int edge, int twin) {
+   m_halfedges[edge] = twin;
+   if (twin >= 0) {
+      m_halfedges[twin] = edge;
+   }
+}
+
+std::uint32_t DelaunayTin::next_random() {
+   m_random ^= m_random << 13;
+   m_random ^= m_random >> 17;
+   m_random ^= m_random << 5;
+   return m_random;
+}
+
+double DelaunayTin::orient(int a, int b, double px, double py) const {
+   const double left = (m_x[b] - m_x[a]) * (py - m_y[a]);
+   const double right = (m_y[b] - m_y[a]) * (px - m_x[a]);
+   const double det = left - right;
+   if (std::abs(det) > s_orient_bound * (std::abs(left) + std::abs(right))) {
+      return det;
+   }
+   const long double exact_left = (static_cast<long double>(m_x[b]) - m_x[a]) * (static_cast<long double>(py) - m_y[a]);
+   const long double exact_right = (static_cast<long double>(m_y[b]) - m_y[a]) * (static_cast<long double>(px) - m_x[a]);
+   return static_cast<double>(exact_left - exact_right);
+}
+
+double DelaunayTin::in_circle(int a, int b, int c, int p) const {
+   const double px = m_x[p];
+   const double py = m_y[p];
+   const double adx = m_x[a] - px;
+   const double ady = m_y[a] - py;
+   const double bdx = m_x[b] - px;
+   const double bdy = m_y[b] - py;
+   const double cdx = m_x[c] - px;
+   const double cdy = m_y[c] - py;
+   const double alift = adx * adx + ady * ady;
+   const double blift = bdx * bdx + bdy * bdy;
+   const double clift = cdx * cdx + cdy * cdy;
+   const double det = alift * (bdx * cdy - cdx * bdy) + blift * (cdx * ady - adx * cdy) + clift * (adx * bdy - bdx * ady);
+   const double permanent = alift * (std::abs(bdx * cdy) + std::abs(cdx * bdy)) + blift * (std::abs(cdx * ady) + std::abs(adx * cdy))
+                            + clift * (std::abs(adx * bdy) + std::abs(bdx * ady));
+   if (std::abs(det) > s_in_circle_bound * permanent) {
+      return det;
+   }
+   const long double eadx = static_cast<long double>(m_x[a]) - px;
+   const long double eady = static_cast<long double>(m_y[a]) - py;
+   const long double ebdx = static_cast<long double>(m_x[b]) - px;
+   const long double ebdy = static_cast<long double>(m_y[b]) - py;
+   const long double ecdx = static_cast<long double>(m_x[c]) - px;
+   const long double ecdy = static_cast<long double>(m_y[c]) - py;
+   return static_cast<double>((eadx * eadx + eady * eady) * (ebdx * ecdy - ecdx * ebdy)
+                              + (ebdx * ebdx + ebdy * ebdy) * (ecdx * eady - eadx * ecdy)
+                              + (ecdx * ecdx + ecdy * ecdy) * (eadx * ebdy - ebdx * eady));
+}
+
+bool DelaunayTin::in_conflict(int triangle, int vertex) const {
+   const int* corners = m_triangles.data() + 3 * triangle;
+   if (corners[0] != s_ghost && corners[1] != s_ghost && corners[2] != s_ghost) {
+      return in_circle(corners[0], corners[1], corners[2], vertex) > 0.0;
+   }
+   // The circumcircle of a ghost triangle is the open half-plane outside its hull edge, plus the
+   // interior of the edge itself.
+   const int ghost_corner = corners[0] == s_ghost ? 0 : (corners[1] == s_ghost ? 1 : 2);
+   const int a = corners[(ghost_corner + 1) % 3];
+   const int b = corners[(ghost_corner + 2) % 3];
+   const double px = m_x[vertex];
+   const double py = m_y[vertex];
+   const double side = orient(a, b, px, py);
+   if (side != 0.0) {
+      return side > 0.0;
+   }
+   return (px - m_x[a]) * (m_x[b] - m_x[a]) + (py - m_y[a]) * (m_y[b] - m_y[a]) > 0.0
+          && (px - m_x[b]) * (m_x[a] - m_x[b]) + (py - m_y[b]) * (m_y[a] - m_y[b]) > 0.0;
+}
+
+int DelaunayTin::locate_conflict(int vertex, bool& duplicate) {
+   const double px = m_x[vertex];
+   const double py = m_y[vertex];
+   int triangle = m_last_triangle;
+   duplicate = false;
+   for (;;) {
+      const int* corners = m_triangles.data() + 3 * triangle;
+      if (corners[0] == s_ghost || corners[1] == s_ghost || corners[2] == s_ghost) {
+         // Only entered across a hull edge the point lies strictly outside of.
+         return triangle;
+      }
+      // Visibility walk, testing the edges in random order so it cannot cycle.
+      const int start = static_cast<int>(next_random() % 3);
+      int next = -1;
+      for (int i = 0; i < 3 && next < 0; ++i) {
+         const int edge = 3 * triangle + (start + i) % 3;
+         if (orient(m_triangles[edge], m_triangles[next_edge(edge)], px, py) < 0.0) {
+            next = m_halfedges[edge] / 3;
+         }
+      }
+      if (next < 0) {
+         for (int i = 0; i < 3; ++i) {
+            duplicate = duplicate || (m_x[corners[i]] == px && m_y[corners[i]] == py);
+         }
+         return triangle;
+      }
+      triangle = next;
+   }
+}
+
+bool DelaunayTin::insert(int vertex) {
+   bool duplicate = false;
+   const int start = locate_conflict(vertex, duplicate);
+   if (duplicate) {
+      return false;
+   }
+   if (++m_visit == 0) {
+      std::fill(m_visited.begin(), m_visited.end(), 0);
+      m_visit = 1;
+   }
+
+   // Collect the cavity: the connected triangles whose circumcircle contains the point.
+   m_cavity.clear();
+   m_cavity.push_back(start);
+   m_visited[start] = m_visit;
+   m_in_cavity[start] = 1;
+   for (std::size_t i = 0; i < m_cavity.size(); ++i) {
+      for (int k = 0; k < 3; ++k) {
+         const int neighbour = m_halfedges[3 * m_cavity[i] + k] / 3;
+         if (m_visited[neighbour] == m_visit) {
+            continue;
+         }
+         m_visited[neighbour] = m_visit;
+         if (in_conflict(neighbour, vertex)) {
+            m_in_cavity[neighbour] = 1;
+            m_cavity.push_back(neighbour);
+         }
+      }
+   }
+
+   // The cavity boundary, as outer half-edges. Rounding in the predicates could leave a boundary
+   // edge the point does not see from inside, which would create an inverted triangle; grow the
+   // cavity across such edges until it is star-shaped.
+   for (bool star_shaped = false; !star_shaped;) {
+      star_shaped = true;
+      m_boundary.clear();
+      for (std::size_t i = 0; i < m_cavity.size() && star_shaped; ++i) {
+         for (int k = 0; k < 3; ++k) {
+            const int edge = 3 * m_cavity[i] + k;
+            const int twin = m_halfedges[edge];
+            if (m_in_cavity[twin / 3]) {
+               continue;
+            }
+            const int a = m_triangles[edge];
+            const int b = m_triangles[next_edge(edge)];
+            if (a != s_ghost && b != s_ghost && orient(a, b, m_x[vertex], m_y[vertex]) <= 0.0) {
+               m_in_cavity[twin / 3] = 1;
+               m_cavity.push_back(twin / 3);
+               star_shaped = false;
+               break;
+            }
+            m_boundary.push_back(twin);
+         }
+      }
+   }
+
+   for (int triangle : m_cavity) {
+      m_in_cavity[triangle] = 0;
+      m_triangles[3 * triangle] = s_free;
+      m_free_triangles.push_back(triangle);
+   }
+
+   // Connect the point to every boundary edge. The outer half-edge twin runs from b to a, the
+   // new triangle (a, b, vertex) gets the opposite direction.
+   for (int twin : m_boundary) {
+      const int a = m_triangles[next_edge(twin)];
+      const int b = m_triangles[twin];
+      const int triangle = add_triangle(a, b, vertex);
+      link(3 * triangle, twin);
+      m_new_edge_at[a + 1] = triangle;
+      if (a != s_ghost && b != s_ghost) {
+         m_last_triangle = triangle;
+      }
+   }
+   for (int twin : m_boundary) {
+      const int triangle = m_halfedges[twin] / 3;
+      const int b = m_triangles[3 * triangle + 1];
+      link(3 * triangle + 1, 3 * m_new_edge_at[b + 1] + 2);
+   }
+   return true;
+}
+
+void DelaunayTin::compact() {
+   const int slot_count = static_cast<int>(m_triangles.size() / 3);
+   std::vector<int> index(slot_count, -1);
+   int count = 0;
+   for (int triangle = 0; triangle < slot_count; ++triangle) {
+      const int* corners = m_triangles.data() + 3 * triangle;
+      if (corners[0] >= 0 && corners[1] >= 0 && corners[2] >= 0) {
+         index[triangle] = count++;
+      }
+   }
+
+   std::vector<int> triangles(3 * static_cast<std::size_t>(count));
+   std::vector<int> halfedges(3 * static_cast<std::size_t>(count));
+   for (int triangle = 0; triangle < slot_count; ++triangle) {
+      if (index[triangle] < 0) {
+         continue;
+      }
+      for (int k = 0; k < 3; ++k) {
+         const int twin = m_halfedges[3 * triangle + k];
+         triangles[3 * index[triangle] + k] = m_triangles[3 * triangle + k];
+         halfedges[3 * index[triangle] + k] = index[twin / 3] >= 0 ? 3 * index[twin / 3] + twin % 3 : -1;
+      }
+   }
+   m_triangles = std::move(triangles);
+   m_halfedges = std::move(halfedges);
+}
+
+void DelaunayTin::estimate_gradients() {
+   std::vector<double> normals(3 * m_x.size(), 0.0);
+   for (std::size_t edge = 0; edge < m_triangles.size(); edge += 3) {
+      const int a = m_triangles[edge];
+      const int b = m_triangles[edge + 1];
+      const int c = m_triangles[edge + 2];
+      const double dx1 = m_x[b] - m_x[a];
+      const double dy1 = m_y[b] - m_y[a];
+      const double dz1 = m_z[b] - m_z[a];
+      const double dx2 = m_x[c] - m_x[a];
+      const double dy2 = m_y[c] - m_y[a];
+      const double dz2 = m_z[c] - m_z[a];
+      // The cross product is twice the triangle area long, which weights the normals by area.
+      const double nx = dy1 * dz2 - dz1 * dy2;
+      const double ny = dz1 * dx2 - dx1 * dz2;
+      const double nz = dx1 * dy2 - dy1 * dx2;
+      for (int vertex : {a, b, c}) {
+         normals[3 * vertex] += nx;
+         normals[3 * vertex + 1] += ny;
+         normals[3 * vertex + 2] += nz;
+      }
+   }
+   m_gradients.assign(2 * m_x.size(), 0.0);
+   for (std::size_t vertex = 0; vertex < m_x.size(); ++vertex) {
+      const double nz = normals[3 * vertex + 2];
+      if (nz > 0.0) {
+         m_gradients[2 * vertex] = -normals[3 * vertex] / nz;
+         m_gradients[2 * vertex + 1] = -normals[3 * vertex + 1] / nz;
+      }
+   }
+}
+
+int DelaunayTin::locate(double x, double y, int hint) const {
+   if (m_triangles.empty()) {
+      return -1;
+   }
+   int triangle = hint >= 0 && hint < triangle_count() ? hint : 0;
+   std::uint32_t random = 2463534242u ^ static_cast<std::uint32_t>(triangle);
+   for (;;) {
+      random ^= random << 13;
+      random ^= random >> 17;
+      random ^= random << 5;
+      const int start = static_cast<int>(random % 3);
+      int next = -2;
+      for (int i = 0; i < 3 && next == -2; ++i) {
+         const int edge = 3 * triangle + (start + i) % 3;
+         if (orient(m_triangles[edge], m_triangles[next_edge(edge)], x, y) < 0.0) {
+            next = m_halfedges[edge] >= 0 ? m_halfedges[edge] / 3 : -1;
+         }
+      }
+      if (next == -2) {
+         return triangle;
+      }
+      if (next == -1) {
+         return -1;
+      }
+      triangle = next;
+   }
+}
+
+bool DelaunayTin::interpolate_linear(double x, double y, double& z, int& hint) const {
+   const int triangle = locate(x, y, hint);
+   if (triangle < 0) {
+      return false;
+   }
+   hint = triangle;
+   const int a = m_triangles[3 * triangle];
+   const int b = m_triangles[3 * triangle + 1];
+   const int c = m_triangles[3 * triangle + 2];
+   const double area = orient(a, b, m_x[c], m_y[c]);
+   const double wa = orient(b, c, x, y) / area;
+   const double wb = orient(c, a, x, y) / area;
+   z = wa * m_z[a] + wb * m_z[b] + (1.0 - wa - wb) * m_z[c];
+   return true;
+}
+
+bool DelaunayTin::interpolate_clough_tocher(double x, double y, double& z, int& hint) const {
+   const int triangle = locate(x, y, hint);
+   if (triangle < 0) {
+      return false;
+   }
+   hint = triangle;
+   const int* v = m_triangles.data() + 3 * triangle;
+   const double vx[3] = {m_x[v[0]], m_x[v[1]], m_x[v[2]]};
+   const double vy[3] = {m_y[v[0]], m_y[v[1]], m_y[v[2]]};
+   const double cx = (vx[0] + vx[1] + vx[2]) / 3.0;
+   const double cy = (vy[0] + vy[1] + vy[2]) / 3.0;
+
+   // Control points next to the vertices, taken from the tangent planes: towards vertex j at
+   // toward[i][j], towards the centroid at toward_centre[i].
+   double toward[3][3];
+   double toward_centre[3];
+   for (int i = 0; i < 3; ++i) {
+      const double gx = m_gradients[2 * v[i]];
+      const double gy = m_gradients[2 * v[i] + 1];
+      for (int j = 0; j < 3; ++j) {
+         toward[i][j] = m_z[v[i]] + (gx * (vx[j] - vx[i]) + gy * (vy[j] - vy[i])) / 3.0;
+      }
+      toward_centre[i] = m_z[v[i]] + (gx * (cx - vx[i]) + gy * (cy - vy[i])) / 3.0;
+   }
+
+   // Interior control point of every edge (i, i + 1), chosen so that the derivative normal to the
+   // edge varies linearly along it. That derivative then only depends on the two vertex gradients,
+   // which makes the patch C1 continuous with the patch of the neighbouring triangle.
+   double edge_point[3];
+   for (int i = 0; i < 3; ++i) {
+      const int j = (i + 1) % 3;
+      const double nx = vy[i] - vy[j];
+      const double ny = vx[j] - vx[i];
+      // Barycentric direction (a1, a2, a3) of the normal in the sub-triangle (vi, vj, centre).
+      const double ux = vx[i] - cx;
+      const double uy = vy[i] - cy;
+      const double wx = vx[j] - cx;
+      const double wy = vy[j] - cy;
+      const double det = ux * wy - uy * wx;
+      const double a1 = (nx * wy - ny * wx) / det;
+      const double a2 = (ux * ny - uy * nx) / det;
+      const double a3 = -a1 - a2;
+      const double d_start = a1 * m_z[v[i]] + a2 * toward[i][j] + a3 * toward_centre[i];
+      const double d_end = a1 * toward[j][i] + a2 * m_z[v[j]] + a3 * toward_centre[j];
+      edge_point[i] = ((d_start + d_end) / 2.0 - a1 * toward[i][j] - a2 * toward[j][i]) / a3;
+   }
+   // Control points between the vertices and the centroid, and the centroid itself, from the
+   // C1 conditions across the three inner edges.
+   double inner[3];
+   for (int i = 0; i < 3; ++i) {
+      inner[i] = (toward_centre[i] + edge_point[i] + edge_point[(i + 2) % 3]) / 3.0;
+   }
+   const double centre = (inner[0] + inner[1] + inner[2]) / 3.0;
+
+   // The point lies in the sub-triangle (vi, vj, centre) opposite to its smallest barycentric coordinate.
+   const double area = orient(v[0], v[1], vx[2], vy[2]);
+   const double lambda[3] = {orient(v[1], v[2], x, y) / area, orient(v[2], v[0], x, y) / area,
+                             orient(v[0], v[1], x, y) / area};
+   const int k = lambda[0] < lambda[1] ? (lambda[0] < lambda[2] ? 0 : 2) : (lambda[1] < lambda[2] ? 1 : 2);
+   const int i = (k + 1) % 3;
+   const int j = (k + 2) % 3;
+   // Barycentric coordinates in the sub-triangle: the centroid takes 3 lambda_k, the others the rest.
+   const double b3 = 3.0 * lambda[k];
+   const double b1 = lambda[i] - lambda[k];
+   const double b2 = lambda[j] - lambda[k];
+
+   z = m_z[v[i]] * b1 * b1 * b1 + m_z[v[j]] * b2 * b2 * b2 + centre * b3 * b3 * b3
+       + 3.0 * (toward[i][j] * b1 * b1 * b2 + toward[j][i] * b1 * b2 * b2 + toward_centre[i] * b1 * b1 * b3
+                + inner[i] * b1 * b3 * b3 + toward_centre[j] * b2 * b2 * b3 + inner[j] * b2 * b3 * b3)
+       + 6.0 * edge_point[i] * b1 * b2 * b3;
+   return true;
+}
@@ -0,0 +1,116 @@
+#ifndef _DELAUNAY_TIN_H_
+#define _DELAUNAY_TIN_H_
+
+#include <cstdint>
+#include <vector>
+
+/// @brief Delaunay triangulation of 2.5D points in flat half-edge arrays.
+///
+/// QgsDualEdgeTriangulation inserts the points in input order and walks to every new point
+/// from the previous triangle, which degrades badly on large unsorted point sets. This TIN
+/// inserts the points in a biased randomized insertion order (BRIO): the points are split into
+/// rounds of doubling size, and every round is sorted along a Hilbert curve. Consecutive points
+/// are then close to each other, so the walk to the next point is short, while the random rounds
+/// keep the expected total work at O(n log n).
+///
+/// Insertion uses the Bowyer-Watson algorithm with ghost triangles for the convex hull, so
+/// points outside the current hull need no special case. Orientation and in-circle tests are
+/// evaluated in double precision and repeated in extended precision when the result is too close
+/// to zero to trust.
+///
+/// The result uses the layout of the delaunator library: triangle t consists of the half-edges
+/// 3t, 3t + 1 and 3t + 2, triangles() holds the start vertex of every half-edge and halfedges()
+/// the opposite half-edge, or -1 on the convex hull. Triangles are counter-clockwise.
+class DelaunayTin
+{
+public:
+   /// @brief Triangulates points.
+   ///
+   /// Duplicate points are ignored, keeping the first one. If all points are collinear the TIN
+   /// has no triangles.
+   /// @param x, y, z Coordinates of the points, the vertex indices of the TIN.
+   void build(std::vector<double> x, std::vector<double> y, std::vector<double> z);
+
+   int vertex_count() const {
+      return static_cast<int>(m_x.size());
+   }
+
+   int triangle_count() const {
+      return static_cast<int>(m_triangles.size() / 3);
+   }
+
+   const std::vector<int>& triangles() const {
+      return m_triangles;
+   }
+
+   const std::vector<int>& halfedges() const {
+      return m_halfedges;
+   }
+
+   double x(int vertex) const {
+      return m_x[vertex];
+   }
+
+   double y(int vertex) const {
+      return m_y[vertex];
+   }
+
+   double z(int vertex) const {
+      return m_z[vertex];
+   }
+
+   /// @brief Finds the triangle containing a location.
+   /// @param hint Triangle to start walking from, e.g. the result of the previous call.
+   /// @return The triangle, -1 if the location lies outside the convex hull.
+   int locate(double x, double y, int hint = 0) const;
+
+   /// @brief Interpolates linearly inside the triangle containing a location.
+   /// @param hint Start triangle of the walk, receives the triangle found.
+   /// @return False if the location lies outside the convex hull.
+   bool interpolate_linear(double x, double y, double& z, int& hint) const;
+
+   /// @brief Interpolates with Clough-Tocher patches, a C1 continuous surface.
+   ///
+   /// Every triangle is split at its centroid into three cubic Bezier patches. The vertex
+   /// gradients are estimated from the area weighted normals of the adjacent triangles, the
+   /// normal derivative along every edge is linear, so neighbouring patches join smoothly.
+   /// @param hint Start triangle of the walk, receives the triangle found.
+   /// @return False if the location lies outside the convex hull.
+   bool interpolate_clough_tocher(double x, double y, double& z, int& hint) const;
+
+private:
+   // Construction, on triangles that may contain the ghost vertex and free slots.
+   void insertion_order(std::vector<int>& order) const;
+   int add_triangle(int a, int b, int c);
+   void link(int edge, int twin);
+   bool insert(int vertex);
+   int locate_conflict(int vertex, bool& duplicate);
+   std::uint32_t next_random();
+   bool in_conflict(int triangle, int vertex) const;
+   void compact();
+   void estimate_gradients();
+
+   double orient(int a, int b, double px, double py) const;
+   double in_circle(int a, int b, int c, int p) const;
+
+   std::vector<double> m_x;
+   std::vector<double> m_y;
+   std::vector<double> m_z;
+   std::vector<int> m_triangles;
+   std::vector<int> m_halfedges;
+   /// Estimated surface gradient of every vertex, x and y interleaved.
+   std::vector<double> m_gradients;
+
+   // Scratch state of the construction.
+   std::vector<int> m_free_triangles;
+   std::vector<std::uint32_t> m_visited;
+   std::vector<char> m_in_cavity;
+   std::uint32_t m_visit = 0;
+   std::vector<int> m_cavity;
+   std::vector<int> m_boundary;
+   std::vector<int> m_new_edge_at;
+   int m_last_triangle = 0;
+   std::uint32_t m_random = 2463534242u;
+};
+
+#endif
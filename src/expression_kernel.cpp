@@ -0,0 +1,1049 @@
+#include "expression_kernel.h"
+
+#include "qgsexpressioncontext.h"
+#include "qgsexpressionfunction.h"
+#include "qgsexpressionnodeimpl.h"
+#include "qgsfeature.h"
+#include "qgsvariantutils.h"
+
+#include <QtGlobal>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+using ValueType = ExpressionKernel::ValueType;
+using Op = ExpressionKernel::Op;
+
+/// Integers below this magnitude are exact as doubles, and so are their sums and products.
+constexpr double s_max_integer = 9007199254740992.0;
+
+/// Tolerance of qgsDoubleNear(), which QGIS uses for numeric equality and truth values.
+constexpr double s_epsilon = 4 * std::numeric_limits<double>::epsilon();
+
+/// qgsDoubleNear(value, 0.0) for values that are not NaN.
+inline bool near_zero(double value) {
+   return value >= -s_epsilon && value <= s_epsilon;
+}
+
+bool is_number(ValueType type) {
+   return type == ValueType::Int || type == ValueType::LongLong || type == ValueType::Double;
+}
+
+bool is_integral(ValueType type) {
+   return type == ValueType::Int || type == ValueType::LongLong;
+}
+
+/// Types QGIS converts to a truth value without an error.
+bool is_truth(ValueType type) {
+   return type == ValueType::Bool || is_number(type) || type == ValueType::Null;
+}
+
+/// Type of the values of a field, Null for fields that are not compiled.
+ValueType field_type(QVariant::Type type) {
+   switch (type) {
+      case QVariant::Bool:
+         return ValueType::Bool;
+      case QVariant::Int:
+         return ValueType::Int;
+      case QVariant::LongLong:
+         return ValueType::LongLong;
+      case QVariant::Double:
+         return ValueType::Double;
+      case QVariant::String:
+         return ValueType::String;
+      default:
+         return ValueType::Null;
+   }
+}
+
+/// Common type of the results of CASE and coalesce, Null if the types differ.
+ValueType common_type(ValueType a, ValueType b) {
+   if (a == ValueType::Null || a == b) {
+      return b;
+   }
+   if (b == ValueType::Null) {
+      return a;
+   }
+   return is_integral(a) && is_integral(b) ? ValueType::LongLong : ValueType::Null;
+}
+
+/// Sets the values and validity of a number register. Both are computed before either is
+/// written, so the target may be one of the arguments.
+template <typename Value, typename Valid>
+inline void fill(double* target, std::uint8_t* target_valid, std::size_t count, Value value, Valid valid) {
+   for (std::size_t i = 0; i < count; ++i) {
+      const double result = value(i);
+      const std::uint8_t result_valid = valid(i);
+      target[i] = result;
+      target_valid[i] = result_valid;
+   }
+}
+
+/// String counterpart of fill().
+template <typename Value, typename Valid>
+inline void fill_strings(QString* target, std::uint8_t* target_valid, std::size_t count, Value value, Valid valid) {
+   for (std::size_t i = 0; i < count; ++i) {
+      QString result = value(i);
+      const std::uint8_t result_valid = valid(i);
+      target[i] = std::move(result);
+      target_valid[i] = result_valid;
+   }
+}
+
+/// Functions of one number argument that return a double, with the null handling of
+/// QgsExpressionFunction: a null argument gives null.
+struct MathFunction {
+   const char* name;
+   Op op;
+};
+
+const MathFunction s_math_functions[] = {
+   {"abs", Op::Abs},   {"sqrt", Op::Sqrt}, {"sin", Op::Sin},     {"cos", Op::Cos},     {"tan", Op::Tan},
+   {"asin", Op::Asin}, {"acos", Op::Acos}, {"atan", Op::Atan},   {"exp", Op::Exp},     {"ln", Op::Log},
+   {"log10", Op::Log10}, {"floor", Op::Floor}, {"ceil", Op::Ceil},
+};
+
+/// Operations whose null operands QGIS handles depending on the type of the null QVariant.
+/// Their rows with a null operand are evaluated by QGIS.
+bool has_typed_null_semantics(Op op) {
+   return op == Op::Negate || op == Op::IntDivide || op == Op::Power || op == Op::Length;
+}
+
+/// Operations producing numbers that may be infinite, NaN or beyond the exact integers.
+bool needs_range_check(Op op) {
+   switch (op) {
+      case Op::Add:
+      case Op::Subtract:
+      case Op::Multiply:
+      case Op::Divide:
+      case Op::IntDivide:
+      case Op::Modulo:
+      case Op::Power:
+      case Op::Negate:
+      case Op::Sqrt:
+      case Op::Sin:
+      case Op::Cos:
+      case Op::Tan:
+      case Op::Asin:
+      case Op::Acos:
+      case Op::Atan:
+      case Op::Atan2:
+      case Op::Exp:
+      case Op::Log:
+      case Op::Log10:
+      case Op::Floor:
+      case Op::Ceil:
+      case Op::Round:
+      case Op::RoundPlaces:
+         return true;
+      default:
+         return false;
+   }
+}
+
+}
+
+ExpressionKernel::ExpressionKernel(const QString& expression) : m_expression(expression) {
+}
+
+bool ExpressionKernel::prepare(QgsExpressionContext* context) {
+   m_context = context;
+   m_compiled = false;
+   if (m_expression.hasParserError()) {
+      m_fallback_reason = m_expression.parserErrorString();
+      return false;
+   }
+   if (!m_expression.prepare(context)) {
+      m_fallback_reason = m_expression.evalErrorString();
+      return false;
+   }
+   m_compiled = context && compile(m_expression.rootNode(), *context);
+   return true;
+}
+
+bool ExpressionKernel::compile(const QgsExpressionNode* root, const QgsExpressionContext& context) {
+   m_fallback_reason.clear();
+   m_columns.clear();
+   m_instructions.clear();
+   m_registers.clear();
+   m_free_numbers.clear();
+   m_free_strings.clear();
+   m_result = Operand();
+
+   const Operand result = compile_node(root, context);
+   if (result.ok && result.type == ValueType::Null) {
+      fail(QStringLiteral("the expression is null"));
+   } else if (result.ok && m_registers.size() > std::numeric_limits<std::uint16_t>::max()) {
+      fail(QStringLiteral("the expression is too large"));
+   }
+   if (!m_fallback_reason.isEmpty()) {
+      m_columns.clear();
+      m_instructions.clear();
+      m_registers.clear();
+      return false;
+   }
+   m_result = result;
+   // A plain field gives the null of its type, like QgsExpressionNodeColumnRef.
+   m_null = QVariant();
+   for (const Column& column : m_columns) {
+      if (column.target == result.reg) {
+         m_null = QVariant(context.fields().at(column.field).type());
+      }
+   }
+   m_fallback.assign(s_batch_size, 0);
+   return true;
+}
+
+ExpressionKernel::Operand ExpressionKernel::compile_node(const QgsExpressionNode* node, const QgsExpressionContext& context) {
+   // Nodes QGIS evaluated once while preparing, such as variables, are constants.
+   if (node->hasCachedStaticValue()) {
+      return compile_literal(node->cachedStaticValue());
+   }
+   node = node->effectiveNode();
+   if (node->hasCachedStaticValue()) {
+      return compile_literal(node->cachedStaticValue());
+   }
+
+   switch (node->nodeType()) {
+      case QgsExpressionNode::ntLiteral:
+         return compile_literal(static_cast<const QgsExpressionNodeLiteral*>(node)->value());
+      case QgsExpressionNode::ntColumnRef: {
+         const QString name = static_cast<const QgsExpressionNodeColumnRef*>(node)->name();
+         const int field = context.fields().lookupField(name);
+         if (field < 0) {
+            return fail(QStringLiteral("unknown field %1").arg(name));
+         }
+         const ValueType type = field_type(context.fields().at(field).type());
+         if (type == ValueType::Null) {
+            return fail(QStringLiteral("field %1 has an unsupported type").arg(name));
+         }
+         for (const Column& column : m_columns) {
+            if (column.field == field) {
+               return {true, column.target, type};
+            }
+         }
+         const int reg = allocate(type == ValueType::String, false);
+         m_columns.push_back({field, type, static_cast<std::uint16_t>(reg)});
+         return {true, reg, type};
+      }
+      case QgsExpressionNode::ntUnaryOperator: {
+         const auto* unary = static_cast<const QgsExpressionNodeUnaryOperator*>(node);
+         const Operand operand = compile_node(unary->operand(), context);
+         if (!operand.ok) {
+            return operand;
+         }
+         if (unary->op() == QgsExpressionNodeUnaryOperator::uNot && is_truth(operand.type)) {
+            return emit(Op::Not, ValueType::Int, materialize(operand, ValueType::Int));
+         }
+         if (unary->op() == QgsExpressionNodeUnaryOperator::uMinus && is_number(operand.type)) {
+            return emit(Op::Negate, is_integral(operand.type) ? ValueType::LongLong : ValueType::Double, operand);
+         }
+         return fail(QStringLiteral("unsupported operand of %1").arg(unary->text()));
+      }
+      case QgsExpressionNode::ntBinaryOperator:
+         return compile_binary(node, context);
+      case QgsExpressionNode::ntInOperator:
+         return compile_in(node, context);
+      case QgsExpressionNode::ntFunction:
+         return compile_function(node, context);
+      case QgsExpressionNode::ntCondition:
+         return compile_condition(node, context);
+      default:
+         return fail(QStringLiteral("unsupported expression %1").arg(node->dump()));
+   }
+}
+
+ExpressionKernel::Operand ExpressionKernel::compile_literal(const QVariant& value) {
+   if (QgsVariantUtils::isNull(value)) {
+      return {true, -1, ValueType::Null};
+   }
+   const ValueType type = field_type(value.type());
+   double number = 0.0;
+   switch (type) {
+      case ValueType::Null:
+         return fail(QStringLiteral("unsupported value %1").arg(value.toString()));
+      case ValueType::Bool:
+         number = value.toBool() ? 1.0 : 0.0;
+         break;
+      case ValueType::String:
+         break;
+      default:
+         number = value.toDouble();
+         if (!(std::abs(number) < (type == ValueType::Double ? std::numeric_limits<double>::infinity() : s_max_integer))) {
+            return fail(QStringLiteral("unsupported value %1").arg(value.toString()));
+         }
+         break;
+   }
+   const int reg = allocate(type == ValueType::String, false);
+   Register& constant = m_registers[reg];
+   if (type == ValueType::String) {
+      std::fill(constant.strings.begin(), constant.strings.end(), value.toString());
+   } else {
+      std::fill(constant.numbers.begin(), constant.numbers.end(), number);
+   }
+   std::fill(constant.valid.begin(), constant.valid.end(), 1);
+   return {true, reg, type};
+}
+
+ExpressionKernel::Operand ExpressionKernel::compile_binary(const QgsExpressionNode* node, const QgsExpressionContext& context) {
+   using Binary = QgsExpressionNodeBinaryOperator;
+   const auto* binary = static_cast<const Binary*>(node);
+   const Operand left = compile_node(binary->opLeft(), context);
+   if (!left.ok) {
+      return left;
+   }
+   const Operand right = compile_node(binary->opRight(), context);
+   if (!right.ok) {
+      return right;
+   }
+   const bool numbers = (is_number(left.type) || left.type == ValueType::Null)
+                        && (is_number(right.type) || right.type == ValueType::Null);
+   const bool strings = (left.type == ValueType::String || left.type == ValueType::Null)
+                        && (right.type == ValueType::String || right.type == ValueType::Null);
+   const bool null = left.type == ValueType::Null || right.type == ValueType::Null;
+
+   switch (binary->op()) {
+      case Binary::boAnd:
+      case Binary::boOr:
+         if (is_truth(left.type) && is_truth(right.type)) {
+            return emit(binary->op() == Binary::boAnd ? Op::And : Op::Or, ValueType::Int,
+                        materialize(left, ValueType::Int), materialize(right, ValueType::Int));
+         }
+         break;
+      case Binary::boEQ:
+      case Binary::boNE:
+      case Binary::boLT:
+      case Binary::boGT:
+      case Binary::boLE:
+      case Binary::boGE: {
+         // Numbers compare numerically and strings by UTF-16 code units, other pairs are
+         // converted by QGIS.
+         const int offset = binary->op() == Binary::boEQ   ? 0
+                            : binary->op() == Binary::boNE ? 1
+                            : binary->op() == Binary::boLT ? 2
+                            : binary->op() == Binary::boGT ? 3
+                            : binary->op() == Binary::boLE ? 4
+                                                           : 5;
+         if (numbers && !(left.type == ValueType::Null && right.type == ValueType::Null)) {
+            return emit(static_cast<Op>(static_cast<int>(Op::Equal) + offset), ValueType::Int,
+                        materialize(left, ValueType::Double), materialize(right, ValueType::Double));
+         }
+         if (strings && !(left.type == ValueType::Null && right.type == ValueType::Null)) {
+            return emit(static_cast<Op>(static_cast<int>(Op::StringEqual) + offset), ValueType::Int,
+                        materialize(left, ValueType::String), materialize(right, ValueType::String));
+         }
+         break;
+      }
+      case Binary::boIs:
+      case Binary::boIsNot: {
+         const bool is = binary->op() == Binary::boIs;
+         if (null && (left.type == ValueType::Null) != (right.type == ValueType::Null)) {
+            const Operand& value = left.type == ValueType::Null ? right : left;
+            if (value.type == ValueType::String) {
+               return emit(is ? Op::StringIsNull : Op::StringIsNotNull, ValueType::Int, value);
+            }
+            return emit(is ? Op::IsNull : Op::IsNotNull, ValueType::Int, value);
+         }
+         if (!null && is_number(left.type) && is_number(right.type)) {
+            return emit(is ? Op::Is : Op::IsNot, ValueType::Int, left, right);
+         }
+         if (!null && left.type == ValueType::String && right.type == ValueType::String) {
+            return emit(is ? Op::StringIs : Op::StringIsNot, ValueType::Int, left, right);
+         }
+         break;
+      }
+      case Binary::boPlus:
+      case Binary::boMinus:
+      case Binary::boMul:
+      case Binary::boMod:
+         // A null operand makes the result null, whatever its type.
+         if (numbers && !strings) {
+            const Op op = binary->op() == Binary::boPlus    ? Op::Add
+                          : binary->op() == Binary::boMinus ? Op::Subtract
+                          : binary->op() == Binary::boMul   ? Op::Multiply
+                                                            : Op::Modulo;
+            const ValueType type = is_integral(left.type) && is_integral(right.type) ? ValueType::LongLong : ValueType::Double;
+            return emit(op, type, materialize(left, type), materialize(right, type));
+         }
+         break;
+      case Binary::boDiv:
+      case Binary::boPow:
+         if (numbers && !null) {
+            return emit(binary->op() == Binary::boDiv ? Op::Divide : Op::Power, ValueType::Double, left, right);
+         }
+         break;
+      case Binary::boIntDiv:
+         if (numbers && !null) {
+            return emit(Op::IntDivide, ValueType::LongLong, left, right);
+         }
+         break;
+      case Binary::boConcat:
+         if (strings) {
+            return emit(Op::Concat, ValueType::String, materialize(left, ValueType::String),
+                        materialize(right, ValueType::String));
+         }
+         break;
+      default:
+         break;
+   }
+   return fail(QStringLiteral("unsupported operator %1").arg(binary->text()));
+}
+
+ExpressionKernel::Operand ExpressionKernel::compile_in(const QgsExpressionNode* node, const QgsExpressionContext& context) {
+   const auto* in = static_cast<const QgsExpressionNodeInOperator*>(node);
+   const QList<QgsExpressionNode*> items = in->list()->list();
+   if (items.isEmpty()) {
+      return fail(QStringLiteral("empty IN list"));
+   }
+   const Operand value = compile_node(in->node(), context);
+   if (!value.ok) {
+      return value;
+   }
+   const bool string = value.type == ValueType::String;
+   if (!string && !is_number(value.type)) {
+      return fail(QStringLiteral("unsupported IN operand"));
+   }
+
+   // x IN (a, b) is (x = a) OR (x = b) in three valued logic: null if x is null, or if no
+   // item matches and one is null. The value stays live until the last comparison.
+   const bool temporary = m_registers[value.reg].temporary;
+   m_registers[value.reg].temporary = false;
+   Operand result;
+   for (const QgsExpressionNode* item_node : items) {
+      const Operand item = compile_node(item_node, context);
+      if (!item.ok) {
+         return item;
+      }
+      if (item.type != ValueType::Null && (item.type == ValueType::String) != string) {
+         return fail(QStringLiteral("unsupported IN item"));
+      }
+      const Operand equal = emit(string ? Op::StringEqual : Op::Equal, ValueType::Int, value,
+                                 materialize(item, value.type));
+      result = result.ok ? emit(Op::Or, ValueType::Int, result, equal) : equal;
+   }
+   m_registers[value.reg].temporary = temporary;
+   release(value);
+   return in->isNotIn() ? emit(Op::Not, ValueType::Int, result) : result;
+}
+
+ExpressionKernel::Operand ExpressionKernel::compile_condition(const QgsExpressionNode* node,
+                                                              const QgsExpressionContext& context) {
+   const auto* condition = static_cast<const QgsExpressionNodeCondition*>(node);
+   std::vector<Operand> whens;
+   std::vector<Operand> thens;
+   ValueType type = ValueType::Null;
+   for (const QgsExpressionNodeCondition::WhenThen* branch : condition->conditions()) {
+      const Operand when = compile_node(branch->whenExp(), context);
+      if (!when.ok) {
+         return when;
+      }
+      if (!is_truth(when.type)) {
+         return fail(QStringLiteral("unsupported CASE condition"));
+      }
+      const Operand then = compile_node(branch->thenExp(), context);
+      if (!then.ok) {
+         return then;
+      }
+      type = common_type(type, then.type);
+      whens.push_back(when);
+      thens.push_back(then);
+   }
+   Operand otherwise = {true, -1, ValueType::Null};
+   if (condition->elseExp()) {
+      otherwise = compile_node(condition->elseExp(), context);
+      if (!otherwise.ok) {
+         return otherwise;
+      }
+      type = common_type(type, otherwise.type);
+   }
+   for (const Operand& then : thens) {
+      if (common_type(type, then.type) != type) {
+         return fail(QStringLiteral("CASE results of different types"));
+      }
+   }
+   if (type == ValueType::Null || common_type(type, otherwise.type) != type) {
+      return fail(QStringLiteral("CASE results of different types"));
+   }
+
+   // The first true condition wins, so the branches are applied from the last one.
+   Operand result = materialize(otherwise, type);
+   for (std::size_t i = whens.size(); i-- > 0;) {
+      if (whens[i].type == ValueType::Null) {
+         release(thens[i]);
+         continue;
+      }
+      result = emit(type == ValueType::String ? Op::StringSelect : Op::Select, type, whens[i],
+                    materialize(thens[i], type), result);
+   }
+   return result;
+}
+
+ExpressionKernel::Operand ExpressionKernel::compile_function(const QgsExpressionNode* node, const QgsExpressionContext& context) {
+   const auto* function = static_cast<const QgsExpressionNodeFunction*>(node);
+   const QgsExpressionFunction* definition = QgsExpression::Functions().value(function->fnIndex());
+   if (!definition) {
+      return fail(QStringLiteral("unknown function"));
+   }
+   const QString name = definition->name();
+   const QList<QgsExpressionNode*> nodes = function->args() ? function->args()->list() : QList<QgsExpressionNode*>();
+   std::vector<Operand> args;
+   for (const QgsExpressionNode* arg : nodes) {
+      args.push_back(compile_node(arg, context));
+      if (!args.back().ok) {
+         return args.back();
+      }
+   }
+   auto all = [&](bool (*accepted)(ValueType)) {
+      return std::all_of(args.begin(), args.end(),
+                         [&](const Operand& arg) { return arg.type == ValueType::Null || accepted(arg.type); });
+   };
+   auto is_string = [](ValueType type) { return type == ValueType::String; };
+
+   for (const MathFunction& math : s_math_functions) {
+      if (name == QLatin1String(math.name) && args.size() == 1 && all(is_number)) {
+         return emit(math.op, ValueType::Double, materialize(args[0], ValueType::Double));
+      }
+   }
+   if (name == QLatin1String("atan2") && args.size() == 2 && all(is_number)) {
+      return emit(Op::Atan2, ValueType::Double, materialize(args[0], ValueType::Double),
+                  materialize(args[1], ValueType::Double));
+   }
+   if (name == QLatin1String("round") && (args.size() == 1 || args.size() == 2) && all(is_number)) {
+      // The number of decimal places must be known, it decides the type of the result.
+      int places = 0;
+      if (args.size() == 2) {
+         const QgsExpressionNode* places_node = nodes[1]->effectiveNode();
+         QVariant value;
+         if (nodes[1]->hasCachedStaticValue()) {
+            value = nodes[1]->cachedStaticValue();
+         } else if (places_node->nodeType() == QgsExpressionNode::ntLiteral) {
+            value = static_cast<const QgsExpressionNodeLiteral*>(places_node)->value();
+         }
+         if (QgsVariantUtils::isNull(value) || !is_integral(field_type(value.type()))) {
+            return fail(QStringLiteral("round() with variable places"));
+         }
+         places = value.toInt();
+      }
+      const Operand value = materialize(args[0], ValueType::Double);
+      if (places == 0) {
+         return emit(Op::Round, ValueType::LongLong, value);
+      }
+      const Operand scaler = compile_literal(std::pow(10.0, places));
+      return emit(Op::RoundPlaces, ValueType::Double, value, scaler);
+   }
+   if ((name == QLatin1String("min") || name == QLatin1String("max")) && !args.empty() && all(is_number)) {
+      // Null arguments are skipped, the result is a double.
+      const Op op = name == QLatin1String("min") ? Op::Min : Op::Max;
+      Operand result = materialize(args[0], ValueType::Double);
+      if (args.size() == 1) {
+         return emit(op, ValueType::Double, result, result);
+      }
+      for (std::size_t i = 1; i < args.size(); ++i) {
+         result = emit(op, ValueType::Double, result, materialize(args[i], ValueType::Double));
+      }
+      return result;
+   }
+   if (name == QLatin1String("clamp") && args.size() == 3 && all(is_number)) {
+      return emit(Op::Clamp, ValueType::Double, materialize(args[0], ValueType::Double),
+                  materialize(args[1], ValueType::Double), materialize(args[2], ValueType::Double));
+   }
+   if (name == QLatin1String("coalesce") && !args.empty()) {
+      ValueType type = ValueType::Null;
+      for (const Operand& arg : args) {
+         type = common_type(type, arg.type);
+         if (type == ValueType::Null && arg.type != ValueType::Null) {
+            return fail(QStringLiteral("coalesce() of different types"));
+         }
+      }
+      if (type == ValueType::Null) {
+         return fail(QStringLiteral("coalesce() of nulls"));
+      }
+      if (args.size() == 1) {
+         return args[0];
+      }
+      Operand result = materialize(args[0], type);
+      for (std::size_t i = 1; i < args.size(); ++i) {
+         result = emit(type == ValueType::String ? Op::StringCoalesce : Op::Coalesce, type, result,
+                       materialize(args[i], type));
+      }
+      return result;
+   }
+   if ((name == QLatin1String("upper") || name == QLatin1String("lower") || name == QLatin1String("trim"))
+       && args.size() == 1 && all(is_string)) {
+      const Op op = name == QLatin1String("upper") ? Op::Upper : name == QLatin1String("lower") ? Op::Lower : Op::Trim;
+      return emit(op, ValueType::String, materialize(args[0], ValueType::String));
+   }
+   if (name == QLatin1String("length") && args.size() == 1 && args[0].type == ValueType::String) {
+      // length() of a geometry is another function, so the argument must be a string.
+      return emit(Op::Length, ValueType::Int, args[0]);
+   }
+   if ((name == QLatin1String("left") || name == QLatin1String("right")) && args.size() == 2
+       && args[0].type == ValueType::String && is_integral(args[1].type)) {
+      return emit(name == QLatin1String("left") ? Op::Left : Op::Right, ValueType::String, args[0], args[1]);
+   }
+   if (name == QLatin1String("concat") && !args.empty() && all(is_string)) {
+      // Null arguments count as empty strings, the result is never null.
+      Operand result = compile_literal(QString(""));
+      for (const Operand& arg : args) {
+         if (arg.type != ValueType::Null) {
+            result = emit(Op::ConcatSkipNull, ValueType::String, result, arg);
+         }
+      }
+      return result;
+   }
+   return fail(QStringLiteral("unsupported function %1").arg(name));
+}
+
+ExpressionKernel::Operand ExpressionKernel::fail(const QString& reason) {
+   if (m_fallback_reason.isEmpty()) {
+      m_fallback_reason = reason;
+   }
+   return Operand();
+}
+
+ExpressionKernel::Operand ExpressionKernel::emit(Op op, ValueType type, Operand a, Operand b, Operand c) {
+   // Instructions work element by element, so the target may be one of the arguments.
+   release(a);
+   release(b);
+   release(c);
+   const int target = allocate(type == ValueType::String);
+   auto index = [](const Operand& operand) { return static_cast<std::uint16_t>(std::max(operand.reg, 0)); };
+   m_instructions.push_back({op, is_integral(type), static_cast<std::uint16_t>(target), index(a), index(b), index(c)});
+   return {true, target, type};
+}
+
+ExpressionKernel::Operand ExpressionKernel::materialize(Operand operand, ValueType type) {
+   if (!operand.ok || operand.type != ValueType::Null) {
+      return operand;
+   }
+   const int reg = allocate(type == ValueType::String, false);
+   std::fill(m_registers[reg].valid.begin(), m_registers[reg].valid.end(), 0);
+   return {true, reg, type};
+}
+
+int ExpressionKernel::allocate(bool string, bool temporary) {
+   // Constant and column registers are written before the instructions run, so they never
+   // reuse the register of a temporary.
+   std::vector<int>& free = string ? m_free_strings : m_free_numbers;
+   if (temporary && !free.empty()) {
+      const int reg = free.back();
+      free.pop_back();
+      return reg;
+   }
+   Register created;
+   created.string = string;
+   created.temporary = temporary;
+   if (string) {
+      created.strings.resize(s_batch_size);
+   } else {
+      created.numbers.resize(s_batch_size);
+   }
+   created.valid.resize(s_batch_size);
+   m_registers.push_back(std::move(created));
+   return static_cast<int>(m_registers.size()) - 1;
+}
+
+void ExpressionKernel::release(const Operand& operand) {
+   if (!operand.ok || operand.reg < 0 || !m_registers[operand.reg].temporary) {
+      return;
+   }
+   std::vector<int>& free = m_registers[operand.reg].string ? m_free_strings : m_free_numbers;
+   if (std::find(free.begin(), free.end(), operand.reg) == free.end()) {
+      free.push_back(operand.reg);
+   }
+}
+
+void ExpressionKernel::run_batch(const QgsFeature* features, std::size_t count) {
+   std::uint8_t* fallback = m_fallback.data();
+   std::fill_n(fallback, count, 0);
+
+   // Values whose type differs from the field are converted by QGIS, so their rows are
+   // evaluated by QGIS too.
+   for (const Column& column : m_columns) {
+      Register& target = m_registers[column.target];
+      for (std::size_t i = 0; i < count; ++i) {
+         const QVariant value = features[i].attribute(column.field);
+         target.valid[i] = 0;
+         if (QgsVariantUtils::isNull(value)) {
+            continue;
+         }
+         if (field_type(value.type()) != column.type) {
+            fallback[i] = 1;
+            continue;
+         }
+         switch (column.type) {
+            case ValueType::String:
+               target.strings[i] = value.toString();
+               break;
+            case ValueType::Bool:
+               target.numbers[i] = value.toBool() ? 1.0 : 0.0;
+               break;
+            case ValueType::LongLong: {
+               const qlonglong number = value.toLongLong();
+               target.numbers[i] = static_cast<double>(number);
+               if (!(std::abs(target.numbers[i]) < s_max_integer)) {
+                  fallback[i] = 1;
+                  continue;
+               }
+               break;
+            }
+            default:
+               target.numbers[i] = value.toDouble();
+               if (!std::isfinite(target.numbers[i])) {
+                  fallback[i] = 1;
+                  continue;
+               }
+               break;
+         }
+         target.valid[i] = 1;
+      }
+   }
+
+   for (const Instruction& instruction : m_instructions) {
+      execute(instruction, count);
+   }
+}
+
+void ExpressionKernel::execute(const Instruction& instruction, std::size_t count) {
+   Register& target_register = m_registers[instruction.target];
+   const Register& a_register = m_registers[instruction.a];
+   const Register& b_register = m_registers[instruction.b];
+   const Register& c_register = m_registers[instruction.c];
+   double* t = target_register.numbers.data();
+   QString* ts = target_register.strings.data();
+   std::uint8_t* tv = target_register.valid.data();
+   const double* a = a_register.numbers.data();
+   const double* b = b_register.numbers.data();
+   const double* c = c_register.numbers.data();
+   const QString* as = a_register.strings.data();
+   const QString* bs = b_register.strings.data();
+   const QString* cs = c_register.strings.data();
+   const std::uint8_t* av = a_register.valid.data();
+   const std::uint8_t* bv = b_register.valid.data();
+   const std::uint8_t* cv = c_register.valid.data();
+   std::uint8_t* fallback = m_fallback.data();
+
+   // Rows QGIS treats differently depending on the type of a null are left to QGIS, before
+   // the target overwrites an argument.
+   if (has_typed_null_semantics(instruction.op)) {
+      const bool binary = instruction.op == Op::IntDivide || instruction.op == Op::Power;
+      for (std::size_t i = 0; i < count; ++i) {
+         fallback[i] |= !av[i] || (binary && !bv[i]);
+      }
+   }
+   // QString::left() and right() take an int, so Int64 counts beyond it are left to QGIS.
+   if (instruction.op == Op::Left || instruction.op == Op::Right) {
+      for (std::size_t i = 0; i < count; ++i) {
+         fallback[i] |= bv[i] & !(std::abs(b[i]) <= static_cast<double>(std::numeric_limits<int>::max()));
+      }
+   }
+
+   auto both = [=](std::size_t i) -> std::uint8_t { return av[i] & bv[i]; };
+   auto first = [=](std::size_t i) -> std::uint8_t { return av[i]; };
+   auto always = [](std::size_t) -> std::uint8_t { return 1; };
+   auto truth = [](double value) { return near_zero(value) ? 0.0 : 1.0; };
+   auto compare = [=](std::size_t i) { return av[i] && bv[i] ? QString::compare(as[i], bs[i]) : 0; };
+   switch (instruction.op) {
+      case Op::Add:
+         fill(t, tv, count, [=](std::size_t i) { return a[i] + b[i]; }, both);
+         break;
+      case Op::Subtract:
+         fill(t, tv, count, [=](std::size_t i) { return a[i] - b[i]; }, both);
+         break;
+      case Op::Multiply:
+         fill(t, tv, count, [=](std::size_t i) { return a[i] * b[i]; }, both);
+         break;
+      case Op::Divide:
+         fill(t, tv, count, [=](std::size_t i) { return a[i] / b[i]; },
+              [=](std::size_t i) -> std::uint8_t { return av[i] & bv[i] & (b[i] != 0.0); });
+         break;
+      case Op::IntDivide:
+         fill(t, tv, count, [=](std::size_t i) { return std::floor(a[i] / b[i]); },
+              [=](std::size_t i) -> std::uint8_t { return av[i] & bv[i] & (b[i] != 0.0); });
+         break;
+      case Op::Modulo:
+         fill(t, tv, count, [=](std::size_t i) { return std::fmod(a[i], b[i]); },
+              [=](std::size_t i) -> std::uint8_t { return av[i] & bv[i] & (b[i] != 0.0); });
+         break;
+      case Op::Power:
+         fill(t, tv, count, [=](std::size_t i) { return std::pow(a[i], b[i]); }, both);
+         break;
+      case Op::Negate:
+         fill(t, tv, count, [=](std::size_t i) { return -a[i]; }, first);
+         break;
+      case Op::Equal:
+         fill(t, tv, count, [=](std::size_t i) { return near_zero(a[i] - b[i]) ? 1.0 : 0.0; }, both);
+         break;
+      case Op::NotEqual:
+         fill(t, tv, count, [=](std::size_t i) { return near_zero(a[i] - b[i]) ? 0.0 : 1.0; }, both);
+         break;
+      case Op::Less:
+         fill(t, tv, count, [=](std::size_t i) { return a[i] < b[i] ? 1.0 : 0.0; }, both);
+         break;
+      case Op::Greater:
+         fill(t, tv, count, [=](std::size_t i) { return a[i] > b[i] ? 1.0 : 0.0; }, both);
+         break;
+      case Op::LessEqual:
+         fill(t, tv, count, [=](std::size_t i) { return a[i] <= b[i] ? 1.0 : 0.0; }, both);
+         break;
+      case Op::GreaterEqual:
+         fill(t, tv, count, [=](std::size_t i) { return a[i] >= b[i] ? 1.0 : 0.0; }, both);
+         break;
+      case Op::Is:
+      case Op::IsNot: {
+         const double match = instruction.op == Op::Is ? 1.0 : 0.0;
+         fill(t, tv, count, [=](std::size_t i) {
+            const bool equal = av[i] && bv[i] ? near_zero(a[i] - b[i]) : av[i] == bv[i];
+            return equal ? match : 1.0 - match;
+         }, always);
+         break;
+      }
+      case Op::StringEqual:
+         fill(t, tv, count, [=](std::size_t i) { return av[i] && bv[i] && as[i] == bs[i] ? 1.0 : 0.0; }, both);
+         break;
+      case Op::StringNotEqual:
+         fill(t, tv, count, [=](std::size_t i) { return av[i] && bv[i] && as[i] != bs[i] ? 1.0 : 0.0; }, both);
+         break;
+      case Op::StringLess:
+         fill(t, tv, count, [=](std::size_t i) { return compare(i) < 0 ? 1.0 : 0.0; }, both);
+         break;
+      case Op::StringGreater:
+         fill(t, tv, count, [=](std::size_t i) { return compare(i) > 0 ? 1.0 : 0.0; }, both);
+         break;
+      case Op::StringLessEqual:
+         fill(t, tv, count, [=](std::size_t i) { return compare(i) <= 0 ? 1.0 : 0.0; }, both);
+         break;
+      case Op::StringGreaterEqual:
+         fill(t, tv, count, [=](std::size_t i) { return compare(i) >= 0 ? 1.0 : 0.0; }, both);
+         break;
+      case Op::StringIs:
+      case Op::StringIsNot: {
+         const double match = instruction.op == Op::StringIs ? 1.0 : 0.0;
+         fill(t, tv, count, [=](std::size_t i) {
+            const bool equal = av[i] && bv[i] ? as[i] == bs[i] : av[i] == bv[i];
+            return equal ? match : 1.0 - match;
+         }, always);
+         break;
+      }
+      case Op::IsNull:
+      case Op::StringIsNull:
+         fill(t, tv, count, [=](std::size_t i) { return av[i] ? 0.0 : 1.0; }, always);
+         break;
+      case Op::IsNotNull:
+      case Op::StringIsNotNull:
+         fill(t, tv, count, [=](std::size_t i) { return av[i] ? 1.0 : 0.0; }, always);
+         break;
+      case Op::And:
+         // False wins over null, which wins over true.
+         fill(t, tv, count, [=](std::size_t i) { return av[i] && bv[i] ? truth(a[i]) * truth(b[i]) : 0.0; },
+              [=](std::size_t i) -> std::uint8_t {
+                 return (av[i] && bv[i]) || (av[i] && near_zero(a[i])) || (bv[i] && near_zero(b[i]));
+              });
+         break;
+      case Op::Or:
+         // True wins over null, which wins over false.
+         fill(t, tv, count, [=](std::size_t i) { return (av[i] && !near_zero(a[i])) || (bv[i] && !near_zero(b[i])) ? 1.0 : 0.0; },
+              [=](std::size_t i) -> std::uint8_t {
+                 return (av[i] && bv[i]) || (av[i] && !near_zero(a[i])) || (bv[i] && !near_zero(b[i]));
+              });
+         break;
+      case Op::Not:
+         fill(t, tv, count, [=](std::size_t i) { return 1.0 - truth(a[i]); }, first);
+         break;
+      case Op::Select:
+         fill(t, tv, count, [=](std::size_t i) { return av[i] && !near_zero(a[i]) ? b[i] : c[i]; },
+              [=](std::size_t i) -> std::uint8_t { return av[i] && !near_zero(a[i]) ? bv[i] : cv[i]; });
+         break;
+      case Op::StringSelect:
+         fill_strings(ts, tv, count, [=](std::size_t i) { return av[i] && !near_zero(a[i]) ? bs[i] : cs[i]; },
+                      [=](std::size_t i) -> std::uint8_t { return av[i] && !near_zero(a[i]) ? bv[i] : cv[i]; });
+         break;
+      case Op::Abs:
+         fill(t, tv, count, [=](std::size_t i) { return std::abs(a[i]); }, first);
+         break;
+      case Op::Sqrt:
+         fill(t, tv, count, [=](std::size_t i) { return std::sqrt(a[i]); }, first);
+         break;
+      case Op::Sin:
+         fill(t, tv, count, [=](std::size_t i) { return std::sin(a[i]); }, first);
+         break;
+      case Op::Cos:
+         fill(t, tv, count, [=](std::size_t i) { return std::cos(a[i]); }, first);
+         break;
+      case Op::Tan:
+         fill(t, tv, count, [=](std::size_t i) { return std::tan(a[i]); }, first);
+         break;
+      case Op::Asin:
+         fill(t, tv, count, [=](std::size_t i) { return std::asin(a[i]); }, first);
+         break;
+      case Op::Acos:
+         fill(t, tv, count, [=](std::size_t i) { return std::acos(a[i]); }, first);
+         break;
+      case Op::Atan:
+         fill(t, tv, count, [=](std::size_t i) { return std::atan(a[i]); }, first);
+         break;
+      case Op::Atan2:
+         fill(t, tv, count, [=](std::size_t i) { return std::atan2(a[i], b[i]); }, both);
+         break;
+      case Op::Exp:
+         fill(t, tv, count, [=](std::size_t i) { return std::exp(a[i]); }, first);
+         break;
+      case Op::Log:
+         fill(t, tv, count, [=](std::size_t i) { return a[i] > 0.0 ? std::log(a[i]) : 0.0; },
+              [=](std::size_t i) -> std::uint8_t { return av[i] & (a[i] > 0.0); });
+         break;
+      case Op::Log10:
+         fill(t, tv, count, [=](std::size_t i) { return a[i] > 0.0 ? std::log10(a[i]) : 0.0; },
+              [=](std::size_t i) -> std::uint8_t { return av[i] & (a[i] > 0.0); });
+         break;
+      case Op::Floor:
+         fill(t, tv, count, [=](std::size_t i) { return std::floor(a[i]); }, first);
+         break;
+      case Op::Ceil:
+         fill(t, tv, count, [=](std::size_t i) { return std::ceil(a[i]); }, first);
+         break;
+      case Op::Round:
+         // round() converts its argument like QVariant::toLongLong(), which rounds halves up.
+         fill(t, tv, count, [=](std::size_t i) {
+            return std::abs(a[i]) < s_max_integer ? static_cast<double>(qRound64(a[i])) : a[i];
+         }, first);
+         break;
+      case Op::RoundPlaces:
+         fill(t, tv, count, [=](std::size_t i) { return std::round(a[i] * b[i]) / b[i]; }, first);
+         break;
+      case Op::Min:
+         fill(t, tv, count, [=](std::size_t i) { return av[i] && bv[i] ? std::min(a[i], b[i]) : (av[i] ? a[i] : b[i]); },
+              [=](std::size_t i) -> std::uint8_t { return av[i] | bv[i]; });
+         break;
+      case Op::Max:
+         fill(t, tv, count, [=](std::size_t i) { return av[i] && bv[i] ? std::max(a[i], b[i]) : (av[i] ? a[i] : b[i]); },
+              [=](std::size_t i) -> std::uint8_t { return av[i] | bv[i]; });
+         break;
+      case Op::Clamp:
+         fill(t, tv, count, [=](std::size_t i) { return b[i] <= a[i] ? a[i] : (b[i] >= c[i] ? c[i] : b[i]); },
+              [=](std::size_t i) -> std::uint8_t { return av[i] & bv[i] & cv[i]; });
+         break;
+      case Op::Coalesce:
+         fill(t, tv, count, [=](std::size_t i) { return av[i] ? a[i] : b[i]; },
+              [=](std::size_t i) -> std::uint8_t { return av[i] | bv[i]; });
+         break;
+      case Op::StringCoalesce:
+         fill_strings(ts, tv, count, [=](std::size_t i) { return av[i] ? as[i] : bs[i]; },
+                      [=](std::size_t i) -> std::uint8_t { return av[i] | bv[i]; });
+         break;
+      case Op::Upper:
+         fill_strings(ts, tv, count, [=](std::size_t i) { return av[i] ? as[i].toUpper() : QString(); }, first);
+         break;
+      case Op::Lower:
+         fill_strings(ts, tv, count, [=](std::size_t i) { return av[i] ? as[i].toLower() : QString(); }, first);
+         break;
+      case Op::Trim:
+         fill_strings(ts, tv, count, [=](std::size_t i) { return av[i] ? as[i].trimmed() : QString(); }, first);
+         break;
+      case Op::Length:
+         fill(t, tv, count, [=](std::size_t i) { return av[i] ? static_cast<double>(as[i].length()) : 0.0; }, first);
+         break;
+      case Op::Left:
+         fill_strings(ts, tv, count,
+                      [=](std::size_t i) {
+                         return av[i] && bv[i] && !fallback[i] ? as[i].left(static_cast<int>(b[i])) : QString();
+                      },
+                      both);
+         break;
+      case Op::Right:
+         fill_strings(ts, tv, count,
+                      [=](std::size_t i) {
+                         return av[i] && bv[i] && !fallback[i] ? as[i].right(static_cast<int>(b[i])) : QString();
+                      },
+                      both);
+         break;
+      case Op::Concat:
+         fill_strings(ts, tv, count, [=](std::size_t i) { return av[i] && bv[i] ? as[i] + bs[i] : QString(); }, both);
+         break;
+      case Op::ConcatSkipNull:
+         fill_strings(ts, tv, count,
+                      [=](std::size_t i) { return (av[i] ? as[i] : QString()) + (bv[i] ? bs[i] : QString()); }, always);
+         break;
+   }
+
+   // QGIS refuses infinite and NaN operands, and integers are exact up to 2^53 here but up to
+   // 2^63 in QGIS, so such results are left to QGIS.
+   if (needs_range_check(instruction.op)) {
+      const double limit = instruction.integral ? s_max_integer : std::numeric_limits<double>::infinity();
+      for (std::size_t i = 0; i < count; ++i) {
+         fallback[i] |= tv[i] & !(std::abs(t[i]) < limit);
+      }
+   }
+}
+
+QVariant ExpressionKernel::result_value(std::size_t i) const {
+   const Register& result = m_registers[m_result.reg];
+   if (!result.valid[i]) {
+      return m_null;
+   }
+   switch (m_result.type) {
+      case ValueType::Bool:
+         return QVariant(result.numbers[i] != 0.0);
+      case ValueType::Int:
+         return QVariant(static_cast<int>(result.numbers[i]));
+      case ValueType::LongLong:
+         return QVariant(static_cast<qlonglong>(result.numbers[i]));
+      case ValueType::Double:
+         return QVariant(result.numbers[i]);
+      case ValueType::String:
+         return QVariant(result.strings[i]);
+      default:
+         return QVariant();
+   }
+}
+
+QVariant ExpressionKernel::evaluate_exactly(const QgsFeature& feature) {
+   if (m_context) {
+      m_context->setFeature(feature);
+   }
+   return m_expression.evaluate(m_context);
+}
+
+void ExpressionKernel::evaluate(const QgsFeature* features, std::size_t count, QVariant* results) {
+   if (!m_compiled) {
+      for (std::size_t i = 0; i < count; ++i) {
+         results[i] = evaluate_exactly(features[i]);
+      }
+      return;
+   }
+   for (std::size_t offset = 0; offset < count; offset += s_batch_size) {
+      const std::size_t batch = std::min(s_batch_size, count - offset);
+      run_batch(features + offset, batch);
+      for (std::size_t i = 0; i < batch; ++i) {
+         results[offset + i] = m_fallback[i] ? evaluate_exactly(features[offset + i]) : result_value(i);
+      }
+   }
+}
+
+void ExpressionKernel::filter(const QgsFeature* features, std::size_t count, std::uint8_t* accepted) {
+   if (!m_compiled) {
+      for (std::size_t i = 0; i < count; ++i) {
+         accepted[i] = evaluate_exactly(features[i]).toBool();
+      }
+      return;
+   }
+   const Register& result = m_registers[m_result.reg];
+   const bool string = m_result.type == ValueType::String;
+   for (std::size_t offset = 0; offset < count; offset += s_batch_size) {
+      const std::size_t batch = std::min(s_batch_size, count - offset);
+      run_batch(features + offset, batch);
+      for (std::size_t i = 0; i < batch; ++i) {
+         if (m_fallback[i]) {
+            accepted[offset + i] = evaluate_exactly(features[offset + i]).toBool();
+         } else if (string) {
+            // Strings convert like QVariant::toBool(), e.g. "false" and "0" are false.
+            accepted[offset + i] = result.valid[i] && QVariant(result.strings[i]).toBool();
+         } else {
+            accepted[offset + i] = result.valid[i] && result.numbers[i] != 0.0;
+         }
+      }
+   }
+}
@@ -0,0 +1,244 @@
+#ifndef _EXPRESSION_KERNEL_H_
+#define _EXPRESSION_KERNEL_H_
+
+#include "qgsexpression.h"
+
+#include <QString>
+#include <QVariant>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class QgsExpressionContext;
+class QgsExpressionNode;
+class QgsFeature;
+
+/// @brief A QGIS expression compiled into typed kernels that run column at a time.
+///
+/// QgsExpression::evaluate() walks the node tree for every feature, every node returns a
+/// QVariant and every field is looked up through the context scopes. An ExpressionKernel
+/// compiles the prepared tree into register based bytecode like RasterProgram instead. Number
+/// registers hold doubles and string registers QStrings, each with a validity mask for null,
+/// for s_batch_size features. The attributes a batch references are decoded once into column
+/// registers, and every instruction then runs a typed loop over the whole batch.
+///
+/// The compiled subset is arithmetic, comparisons, AND, OR, NOT, IS, IN, CASE, ||, the
+/// functions abs, sqrt, sin, cos, tan, asin, acos, atan, atan2, exp, ln, log10, round, floor,
+/// ceil, min, max, clamp, coalesce, upper, lower, trim, length, left, right and concat, and
+/// Int, Int64, Double, Bool and String fields. Subexpressions QGIS evaluates once at prepare
+/// time, such as variables, are compiled as constants. Expressions with anything else are
+/// evaluated by QGIS, feature by feature.
+///
+/// The results are those of QgsExpression, including the type of the values and the three
+/// valued logic of comparisons, with two exceptions: computed nulls are invalid QVariants
+/// even where QGIS passes on the typed null of a field, and integer results of mixed width in
+/// CASE and coalesce are 64 bit. Rows the kernels cannot reproduce
+/// exactly, with an infinite or NaN operand, an integer beyond 2^53, a count of left() or
+/// right() beyond the int range or a null operand of the operators whose null handling
+/// differs between null QVariant types, are evaluated by QGIS.
+///
+/// An ExpressionKernel keeps its registers between calls, so every thread needs its own copy.
+class ExpressionKernel
+{
+public:
+   /// Number of features evaluated per instruction.
+   static constexpr std::size_t s_batch_size = 4096;
+
+   /// Static type of a compiled value.
+   enum class ValueType : std::uint8_t {
+      Null,
+      Bool,
+      Int,
+      LongLong,
+      Double,
+      String
+   };
+
+   /// Operations of the instructions.
+   enum class Op : std::uint8_t {
+      Add,
+      Subtract,
+      Multiply,
+      Divide,
+      IntDivide,
+      Modulo,
+      Power,
+      Negate,
+      Equal,
+      NotEqual,
+      Less,
+      Greater,
+      LessEqual,
+      GreaterEqual,
+      Is,
+      IsNot,
+      StringEqual,
+      StringNotEqual,
+      StringLess,
+      StringGreater,
+      StringLessEqual,
+      StringGreaterEqual,
+      StringIs,
+      StringIsNot,
+      IsNull,
+      IsNotNull,
+      StringIsNull,
+      StringIsNotNull,
+      And,
+      Or,
+      Not,
+      Select,
+      StringSelect,
+      Abs,
+      Sqrt,
+      Sin,
+      Cos,
+      Tan,
+      Asin,
+      Acos,
+      Atan,
+      Atan2,
+      Exp,
+      Log,
+      Log10,
+      Floor,
+      Ceil,
+      Round,
+      RoundPlaces,
+      Min,
+      Max,
+      Clamp,
+      Coalesce,
+      StringCoalesce,
+      Upper,
+      Lower,
+      Trim,
+      Length,
+      Left,
+      Right,
+      Concat,
+      ConcatSkipNull
+   };
+
+   /// One instruction: target = op(a, b, c), with unused operands ignored.
+   struct Instruction {
+      Op op;
+      /// The result is an integer, values beyond 2^53 are evaluated by QGIS.
+      bool integral;
+      std::uint16_t target;
+      std::uint16_t a;
+      std::uint16_t b;
+      std::uint16_t c;
+   };
+
+   /// @brief Constructor.
+   /// @param expression The QGIS expression text.
+   explicit ExpressionKernel(const QString& expression);
+
+   /// @brief Prepares the expression for a context and compiles it if possible.
+   /// @param context Context with the fields of the features to evaluate, kept for the
+   /// features evaluated by QGIS.
+   /// @return False if the expression has a parser error or cannot be prepared.
+   bool prepare(QgsExpressionContext* context);
+
+   /// The expression evaluated by QGIS for features the kernels do not handle.
+   const QgsExpression& expression() const {
+      return m_expression;
+   }
+
+   /// True if prepare() compiled the expression, false if it is evaluated by QGIS.
+   bool is_compiled() const {
+      return m_compiled;
+   }
+
+   /// Why the expression could not be compiled, empty if it was.
+   const QString& fallback_reason() const {
+      return m_fallback_reason;
+   }
+
+   /// Static type of the result of a compiled expression.
+   ValueType result_type() const {
+      return m_result.type;
+   }
+
+   const std::vector<Instruction>& instructions() const {
+      return m_instructions;
+   }
+
+   /// @brief Evaluates the expression for a run of features.
+   /// @param features The features, with the fields of the context passed to prepare().
+   /// @param count Number of features.
+   /// @param results Receives one value per feature.
+   void evaluate(const QgsFeature* features, std::size_t count, QVariant* results);
+
+   /// @brief Evaluates the expression as a filter, like QgsFeatureRequest::setFilterExpression().
+   /// @param accepted Receives 1 for every feature whose result converts to true, else 0.
+   void filter(const QgsFeature* features, std::size_t count, std::uint8_t* accepted);
+
+private:
+   /// Values of one register for a batch.
+   struct Register {
+      bool string = false;
+      /// Constant and column registers are never reused.
+      bool temporary = false;
+      std::vector<double> numbers;
+      std::vector<QString> strings;
+      std::vector<std::uint8_t> valid;
+   };
+
+   /// A field decoded into a register at the start of every batch.
+   struct Column {
+      int field;
+      ValueType type;
+      std::uint16_t target;
+   };
+
+   /// Register and static type of a compiled node. A null literal has no register.
+   struct Operand {
+      Operand() : ok(false), reg(-1), type(ValueType::Null) {
+      }
+      Operand(bool ok, int reg, ValueType type) : ok(ok), reg(reg), type(type) {
+      }
+      bool ok;
+      int reg;
+      ValueType type;
+   };
+
+   bool compile(const QgsExpressionNode* root, const QgsExpressionContext& context);
+   Operand compile_node(const QgsExpressionNode* node, const QgsExpressionContext& context);
+   Operand compile_literal(const QVariant& value);
+   Operand compile_binary(const QgsExpressionNode* node, const QgsExpressionContext& context);
+   Operand compile_function(const QgsExpressionNode* node, const QgsExpressionContext& context);
+   Operand compile_condition(const QgsExpressionNode* node, const QgsExpressionContext& context);
+   Operand compile_in(const QgsExpressionNode* node, const QgsExpressionContext& context);
+   Operand fail(const QString& reason);
+   Operand emit(Op op, ValueType type, Operand a, Operand b = Operand(), Operand c = Operand());
+   /// Register of a null operand, materialized for the register kind of type.
+   Operand materialize(Operand operand, ValueType type);
+   int allocate(bool string, bool temporary = true);
+   void release(const Operand& operand);
+
+   /// Decodes the columns and runs the instructions for at most s_batch_size features.
+   void run_batch(const QgsFeature* features, std::size_t count);
+   void execute(const Instruction& instruction, std::size_t count);
+   QVariant result_value(std::size_t i) const;
+   QVariant evaluate_exactly(const QgsFeature& feature);
+
+   QgsExpression m_expression;
+   QgsExpressionContext* m_context = nullptr;
+   bool m_compiled = false;
+   QString m_fallback_reason;
+   std::vector<Column> m_columns;
+   std::vector<Instruction> m_instructions;
+   std::vector<Register> m_registers;
+   std::vector<int> m_free_numbers;
+   std::vector<int> m_free_strings;
+   Operand m_result;
+   /// Value of null results.
+   QVariant m_null;
+   /// Rows of the current batch evaluated by QGIS.
+   std::vector<std::uint8_t> m_fallback;
+};
+
+#endif
@@ -0,0 +1,255 @@
+#include "feature_store.h"
+
+#include "qgsfeatureiterator.h"
+#include "qgsfeaturerequest.h"
+#include "qgsfeaturesource.h"
+#include "qgsfeedback.h"
+
+#include <algorithm>
+#include <limits>
+
+void FeatureStore::reset(const QgsFields& fields, const QgsAttributeList& attributes) {
+   m_fields = fields;
+   m_field_columns.assign(fields.count(), -1);
+   m_columns.clear();
+   m_ids.clear();
+   m_wkb.clear();
+   m_wkb_ends.clear();
+   m_index = HilbertRTree();
+   for (int field : attributes) {
+      if (field < 0 || field >= fields.count() || m_field_columns[field] >= 0) {
+         continue;
+      }
+      Column column;
+      column.field = field;
+      switch (fields.at(field).type()) {
+         case QVariant::Int:
+         case QVariant::UInt:
+         case QVariant::LongLong:
+         case QVariant::ULongLong:
+            column.type = ColumnType::Integer;
+            break;
+         case QVariant::Double:
+            column.type = ColumnType::Double;
+            break;
+         case QVariant::Bool:
+            column.type = ColumnType::Boolean;
+            break;
+         case QVariant::String:
+            column.type = ColumnType::String;
+            break;
+         default:
+            column.type = ColumnType::Other;
+            break;
+      }
+      m_field_columns[field] = static_cast<int>(m_columns.size());
+      m_columns.push_back(std::move(column));
+   }
+}
+
+void FeatureStore::append(const QgsFeature& feature, bool with_geometry) {
+   const std::size_t row = m_ids.size();
+   m_ids.push_back(feature.id());
+
+   const QgsGeometry geometry = with_geometry ? feature.geometry() : QgsGeometry();
+   if (!geometry.isNull()) {
+      const QByteArray wkb = geometry.asWkb();
+      m_wkb.insert(m_wkb.end(), wkb.constData(), wkb.constData() + wkb.size());
+      const QgsRectangle bounds = geometry.boundingBox();
+      m_index.add(bounds.xMinimum(), bounds.yMinimum(), bounds.xMaximum(), bounds.yMaximum());
+   } else {
+      const double infinity = std::numeric_limits<double>::infinity();
+      m_index.add(infinity, infinity, -infinity, -infinity);
+   }
+   m_wkb_ends.push_back(m_wkb.size());
+
+   const QgsAttributes attributes = feature.attributes();
+   for (Column& column : m_columns) {
+      append_value(column, row, column.field < attributes.size() ? attributes.at(column.field) : QVariant());
+   }
+}
+
+void FeatureStore::append_value(Column& column, std::size_t row, const QVariant& value) {
+   if (row % 64 == 0) {
+      column.valid.push_back(0);
+   }
+   bool ok = !value.isNull();
+   switch (column.type) {
+      case ColumnType::Integer: {
+         const qlonglong integer = ok ? value.toLongLong(&ok) : 0;
+         column.integers.push_back(ok ? integer : 0);
+         break;
+      }
+      case ColumnType::Double: {
+         const double number = ok ? value.toDouble(&ok) : 0.0;
+         column.doubles.push_back(ok ? number : 0.0);
+         break;
+      }
+      case ColumnType::Boolean:
+         column.integers.push_back(ok && value.toBool() ? 1 : 0);
+         break;
+      case ColumnType::String: {
+         std::uint32_t code = 0;
+         if (ok) {
+            const QString string = value.toString();
+            const auto found = column.lookup.constFind(string);
+            if (found != column.lookup.constEnd()) {
+               code = found.value();
+            } else {
+               code = static_cast<std::uint32_t>(column.dictionary_ends.size());
+               const QByteArray utf8 = string.toUtf8();
+               column.dictionary_chars.append(utf8.constData(), static_cast<std::size_t>(utf8.size()));
+               column.dictionary_ends.push_back(column.dictionary_chars.size());
+               column.lookup.insert(string, code);
+            }
+         }
+         column.codes.push_back(code);
+         break;
+      }
+      case ColumnType::Other:
+         column.others.push_back(value);
+         break;
+   }
+   if (ok) {
+      column.valid.back() |= std::uint64_t(1) << (row % 64);
+   }
+}
+
+void FeatureStore::finish() {
+   if (m_wkb.empty()) {
+      // Nothing to index without geometries.
+      m_index = HilbertRTree();
+   }
+   m_index.finish();
+   for (Column& column : m_columns) {
+      column.lookup = QHash<QString, std::uint32_t>();
+      column.valid.shrink_to_fit();
+      column.integers.shrink_to_fit();
+      column.doubles.shrink_to_fit();
+      column.codes.shrink_to_fit();
+      column.dictionary_ends.shrink_to_fit();
+      column.dictionary_chars.shrink_to_fit();
+      column.others.shrink_to_fit();
+   }
+   m_ids.shrink_to_fit();
+   m_wkb.shrink_to_fit();
+   m_wkb_ends.shrink_to_fit();
+}
+
+bool FeatureStore::load(const QgsFeatureSource& source, const QgsFeatureRequest& request, QgsFeedback* feedback) {
+   const QgsFields fields = source.fields();
+   reset(fields, request.flags() & QgsFeatureRequest::SubsetOfAttributes ? request.subsetOfAttributes()
+                                                                        : fields.allAttributesList());
+   const bool with_geometry = !(request.flags() & QgsFeatureRequest::NoGeometry);
+   const long long feature_count = std::max<long long>(1, source.featureCount());
+   QgsFeatureIterator iterator = source.getFeatures(request);
+   QgsFeature feature;
+   while (iterator.nextFeature(feature)) {
+      if (feedback && feedback->isCanceled()) {
+         return false;
+      }
+      append(feature, with_geometry);
+      if (feedback && m_ids.size() % 10000 == 0) {
+         feedback->setProgress(100.0 * static_cast<double>(m_ids.size()) / static_cast<double>(feature_count));
+      }
+   }
+   finish();
+   return true;
+}
+
+QgsGeometry FeatureStore::geometry(std::size_t row) const {
+   std::size_t size = 0;
+   const unsigned char* data = wkb(row, size);
+   QgsGeometry geometry;
+   if (size > 0) {
+      geometry.fromWkb(QByteArray::fromRawData(reinterpret_cast<const char*>(data), static_cast<int>(size)));
+   }
+   return geometry;
+}
+
+QVariant FeatureStore::value(const Column& column, std::size_t row) const {
+   const QVariant::Type type = m_fields.at(column.field).type();
+   if (column.type == ColumnType::Other) {
+      return column.others[row];
+   }
+   if (!is_valid(column, row)) {
+      return QVariant(type);
+   }
+   switch (column.type) {
+      case ColumnType::Integer: {
+         QVariant result(static_cast<qlonglong>(column.integers[row]));
+         result.convert(static_cast<int>(type));
+         return result;
+      }
+      case ColumnType::Double:
+         return column.doubles[row];
+      case ColumnType::Boolean:
+         return column.integers[row] != 0;
+      case ColumnType::String: {
+         const std::uint32_t code = column.codes[row];
+         const std::uint64_t begin = code == 0 ? 0 : column.dictionary_ends[code - 1];
+         return QString::fromUtf8(column.dictionary_chars.data() + begin, static_cast<int>(column.dictionary_ends[code] - begin));
+      }
+      case ColumnType::Other:
+         break;
+   }
+   return QVariant(type);
+}
+
+QVariant FeatureStore::attribute(std::size_t row, int field) const {
+   if (!has_attribute(field)) {
+      return field >= 0 && field < m_fields.count() ? QVariant(m_fields.at(field).type()) : QVariant();
+   }
+   return value(m_columns[m_field_columns[field]], row);
+}
+
+double FeatureStore::attribute_double(std::size_t row, int field, bool& ok) const {
+   ok = false;
+   if (!has_attribute(field)) {
+      return 0.0;
+   }
+   const Column& column = m_columns[m_field_columns[field]];
+   switch (column.type) {
+      case ColumnType::Integer:
+         ok = is_valid(column, row);
+         return static_cast<double>(column.integers[row]);
+      case ColumnType::Double:
+         ok = is_valid(column, row);
+         return column.doubles[row];
+      case ColumnType::Boolean:
+      case ColumnType::String:
+      case ColumnType::Other:
+         return value(column, row).toDouble(&ok);
+   }
+   return 0.0;
+}
+
+QgsAttributes FeatureStore::attributes(std::size_t row) const {
+   QgsAttributes result(m_fields.count());
+   for (int field = 0; field < m_fields.count(); ++field) {
+      result[field] = attribute(row, field);
+   }
+   return result;
+}
+
+QgsFeature FeatureStore::feature(std::size_t row) const {
+   QgsFeature result(m_fields, m_ids[row]);
+   result.setAttributes(attributes(row));
+   if (has_geometry(row)) {
+      result.setGeometry(geometry(row));
+   }
+   return result;
+}
+
+std::size_t FeatureStore::memory_usage() const {
+   std::size_t bytes = m_ids.capacity() * sizeof(QgsFeatureId) + m_wkb.capacity() + m_wkb_ends.capacity() * sizeof(std::uint64_t);
+   // The index holds about one box and one index per row.
+   bytes += m_index.size() * (4 * sizeof(float) + sizeof(std::uint32_t)) * 17 / 16;
+   for (const Column& column : m_columns) {
+      bytes += column.valid.capacity() * sizeof(std::uint64_t) + column.integers.capacity() * sizeof(std::int64_t) +
+               column.doubles.capacity() * sizeof(double) + column.codes.capacity() * sizeof(std::uint32_t) +
+               column.dictionary_ends.capacity() * sizeof(std::uint64_t) + column.dictionary_chars.capacity() +
+               column.others.capacity() * sizeof(QVariant);
+   }
+   return bytes;
+}
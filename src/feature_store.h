@@ -0,0 +1,153 @@
+#ifndef _FEATURE_STORE_H_
+#define _FEATURE_STORE_H_
+
+#include "hilbert_rtree.h"
+
+#include "qgsfeature.h"
+#include "qgsfields.h"
+#include "qgsgeometry.h"
+
+#include <QHash>
+#include <QVariant>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class QgsFeatureRequest;
+class QgsFeatureSource;
+class QgsFeedback;
+
+/// @brief Read-only, columnar copy of the features of a layer.
+///
+/// A QgsFeature holds its geometry as a tree of QgsAbstractGeometry objects and its attributes
+/// as a vector of QVariants, several heap blocks per feature. The store keeps the geometries as
+/// WKB in one buffer with an offset array, and every attribute in a typed column: integers,
+/// doubles and booleans in flat arrays, strings as codes into a per-column dictionary, with
+/// null values in a bit mask. Only fields of other types are kept as QVariants. The bounding
+/// boxes of the geometries are indexed by a HilbertRTree.
+///
+/// Features are appended once, then finish() builds the index. After that the store is only
+/// read, and any number of threads may query it at the same time.
+class FeatureStore
+{
+public:
+   /// @brief Clears the store and prepares a column for every stored field.
+   /// @param fields The fields of the features that will be appended.
+   /// @param attributes Indices of the fields to store, the others read as null.
+   void reset(const QgsFields& fields, const QgsAttributeList& attributes);
+
+   /// @brief Appends a feature.
+   /// @param with_geometry False to drop the geometry, e.g. if the caller keeps its own copy.
+   void append(const QgsFeature& feature, bool with_geometry = true);
+
+   /// @brief Builds the spatial index and releases the buffers needed only while appending.
+   void finish();
+
+   /// @brief Reads the features of a source into the store and finishes it.
+   ///
+   /// Only the attributes of the request are stored, and no geometries with the NoGeometry flag.
+   /// @return False if canceled.
+   bool load(const QgsFeatureSource& source, const QgsFeatureRequest& request, QgsFeedback* feedback = nullptr);
+
+   std::size_t size() const {
+      return m_ids.size();
+   }
+
+   const QgsFields& fields() const {
+      return m_fields;
+   }
+
+   QgsFeatureId id(std::size_t row) const {
+      return m_ids[row];
+   }
+
+   bool has_geometry(std::size_t row) const {
+      return m_wkb_ends[row] > first_wkb(row);
+   }
+
+   /// @brief Returns the WKB of a feature geometry, empty without geometry.
+   /// @param size Receives the size in bytes.
+   const unsigned char* wkb(std::size_t row, std::size_t& size) const {
+      size = m_wkb_ends[row] - first_wkb(row);
+      return m_wkb.data() + first_wkb(row);
+   }
+
+   /// Builds the geometry of a feature from its WKB.
+   QgsGeometry geometry(std::size_t row) const;
+
+   /// True if the field is stored.
+   bool has_attribute(int field) const {
+      return field >= 0 && field < static_cast<int>(m_field_columns.size()) && m_field_columns[field] >= 0;
+   }
+
+   /// Value of an attribute with the type of its field, null if not stored.
+   QVariant attribute(std::size_t row, int field) const;
+
+   /// @brief Numeric value of an attribute without building a QVariant.
+   /// @param ok Set to false for null, non-numeric or not stored attributes.
+   double attribute_double(std::size_t row, int field, bool& ok) const;
+
+   QgsAttributes attributes(std::size_t row) const;
+
+   /// Builds a feature with the id, fields, attributes and geometry of a row.
+   QgsFeature feature(std::size_t row) const;
+
+   /// Spatial index of the geometry bounding boxes, its items are the rows.
+   const HilbertRTree& index() const {
+      return m_index;
+   }
+
+   /// Approximate number of bytes held by the store.
+   std::size_t memory_usage() const;
+
+private:
+   enum class ColumnType {
+      Integer,
+      Double,
+      Boolean,
+      String,
+      Other
+   };
+
+   struct Column {
+      ColumnType type = ColumnType::Other;
+      int field = -1;
+      /// One bit per row, set for non-null values.
+      std::vector<std::uint64_t> valid;
+      /// Values of integer and boolean columns.
+      std::vector<std::int64_t> integers;
+      std::vector<double> doubles;
+      /// Dictionary codes of string columns.
+      std::vector<std::uint32_t> codes;
+      /// End of every dictionary entry in dictionary_chars, as UTF-8.
+      std::vector<std::uint64_t> dictionary_ends;
+      std::string dictionary_chars;
+      /// Dictionary lookup while appending.
+      QHash<QString, std::uint32_t> lookup;
+      std::vector<QVariant> others;
+   };
+
+   std::uint64_t first_wkb(std::size_t row) const {
+      return row == 0 ? 0 : m_wkb_ends[row - 1];
+   }
+
+   static bool is_valid(const Column& column, std::size_t row) {
+      return (column.valid[row / 64] >> (row % 64)) & 1;
+   }
+
+   void append_value(Column& column, std::size_t row, const QVariant& value);
+   QVariant value(const Column& column, std::size_t row) const;
+
+   QgsFields m_fields;
+   /// Column of every field, -1 if not stored.
+   std::vector<int> m_field_columns;
+   std::vector<Column> m_columns;
+   std::vector<QgsFeatureId> m_ids;
+   std::vector<unsigned char> m_wkb;
+   std::vector<std::uint64_t> m_wkb_ends;
+   HilbertRTree m_index;
+};
+
+#endif
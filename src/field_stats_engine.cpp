@@ -0,0 +1,206 @@
+#include "field_stats_engine.h"
+#include "parallel_for.h"
+
+#include "qgsfeatureiterator.h"
+#include "qgsfeaturerequest.h"
+#include "qgsfeaturesource.h"
+#include "qgsfeedback.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <string_view>
+#include <utility>
+
+namespace {
+
+/// Blocks summarized per worker and batch. A batch is merged before the next one is read,
+/// which bounds the number of blocks held at a time.
+constexpr std::size_t s_blocks_per_worker = 2;
+
+/// Values of one field in a block.
+struct Column {
+   /// Numeric values, NaN for null.
+   std::vector<double> values;
+   /// Hashes of the other values, nulls are only counted.
+   std::vector<quint64> hashes;
+   qint64 null_count = 0;
+};
+
+/// Consecutive features, decoded into one column per field.
+struct Block {
+   std::vector<Column> columns;
+   std::size_t size = 0;
+   std::vector<FieldStatistics> statistics;
+};
+
+quint64 string_hash(const QString& value) {
+   return std::hash<std::u16string_view>()(
+      std::u16string_view(reinterpret_cast<const char16_t*>(value.utf16()), static_cast<std::size_t>(value.size())));
+}
+
+/// Appends the attributes of a feature to the columns of a block.
+void decode(const QgsAttributes& attributes, const QgsAttributeList& indices, const std::vector<FieldStatistics>& fields,
+            Block& block) {
+   for (int i = 0; i < indices.size(); ++i) {
+      Column& column = block.columns[i];
+      const int index = indices[i];
+      const QVariant value = index < attributes.size() ? attributes.at(index) : QVariant();
+      if (fields[i].numeric) {
+         bool ok = false;
+         const double number = value.isNull() ? 0.0 : value.toDouble(&ok);
+         column.values.push_back(ok ? number : std::numeric_limits<double>::quiet_NaN());
+      } else if (value.isNull()) {
+         ++column.null_count;
+      } else {
+         column.hashes.push_back(string_hash(value.toString()));
+      }
+   }
+   ++block.size;
+}
+
+/// Summarizes the columns of a block.
+void summarize(const Block& block, std::vector<FieldStatistics>& statistics) {
+   for (std::size_t i = 0; i < statistics.size(); ++i) {
+      FieldStatistics& field = statistics[i];
+      const Column& column = block.columns[i];
+      if (field.numeric) {
+         for (double value : column.values) {
+            if (std::isnan(value)) {
+               ++field.null_count;
+               continue;
+            }
+            ++field.count;
+            field.sum.add(value);
+            field.sketch.add(value);
+         }
+      } else {
+         for (quint64 hash : column.hashes) {
+            field.sketch.distinct.add_hash(hash);
+         }
+         field.count += static_cast<qint64>(column.hashes.size());
+         field.null_count += column.null_count;
+      }
+   }
+}
+
+}
+
+void FieldStatistics::merge(const FieldStatistics& other) {
+   count += other.count;
+   null_count += other.null_count;
+   sum.merge(other.sum);
+   sketch.merge(other.sketch);
+}
+
+FieldStatsEngine::FieldStatsEngine(const QgsFeatureSource& source, const FieldStatsSettings& settings)
+   : m_source(source), m_settings(settings) {
+}
+
+int FieldStatsEngine::run(QgsFeedback* feedback) {
+   m_statistics.clear();
+   m_feature_count = 0;
+   if (m_settings.block_size < 1) {
+      return InvalidParameters;
+   }
+
+   const QgsFields fields = m_source.fields();
+   QgsAttributeList indices;
+   if (m_settings.fields.isEmpty()) {
+      for (int i = 0; i < fields.count(); ++i) {
+         if (fields.at(i).isNumeric()) {
+            indices << i;
+         }
+      }
+   } else {
+      for (const QString& name : m_settings.fields) {
+         const int index = fields.lookupField(name);
+         if (index < 0) {
+            return InvalidParameters;
+         }
+         indices << index;
+      }
+   }
+   if (indices.isEmpty()) {
+      return InvalidParameters;
+   }
+   std::vector<FieldStatistics> empty;
+   for (int index : std::as_const(indices)) {
+      empty.emplace_back(fields.at(index).name(), fields.at(index).isNumeric(), m_settings.hll_precision, m_settings.kll_k);
+   }
+   m_statistics = empty;
+
+   const int thread_count = resolve_thread_count(m_settings.thread_count);
+   const std::size_t block_size = static_cast<std::size_t>(m_settings.block_size);
+   std::vector<Block> blocks(s_blocks_per_worker * static_cast<std::size_t>(thread_count));
+   const double total = static_cast<double>(std::max<long long>(1, m_source.featureCount()));
+   std::atomic<bool> canceled(false);
+
+   QgsFeatureRequest request;
+   request.setFlags(QgsFeatureRequest::NoGeometry);
+   request.setSubsetOfAttributes(indices);
+   QgsFeatureIterator features = m_source.getFeatures(request);
+   QgsFeature feature;
+   bool more = true;
+   while (more) {
+      if (feedback && feedback->isCanceled()) {
+         canceled = true;
+         break;
+      }
+      std::size_t count = 0;
+      while (count < blocks.size() && more) {
+         Block& block = blocks[count];
+         // The columns keep their capacity from block to block.
+         block.columns.resize(indices.size());
+         for (Column& column : block.columns) {
+            column.values.clear();
+            column.hashes.clear();
+            column.null_count = 0;
+         }
+         block.size = 0;
+         while (block.size < block_size && (more = features.nextFeature(feature))) {
+            decode(feature.attributes(), indices, empty, block);
+         }
+         if (block.size == 0) {
+            break;
+         }
+         m_feature_count += static_cast<qint64>(block.size);
+         ++count;
+      }
+      if (count == 0) {
+         break;
+      }
+
+      parallel_for(count, thread_count, [&](std::size_t i, int) {
+         if (canceled) {
+            return;
+         }
+         if (feedback && feedback->isCanceled()) {
+            canceled = true;
+            return;
+         }
+         blocks[i].statistics = empty;
+         summarize(blocks[i], blocks[i].statistics);
+      });
+      if (canceled) {
+         break;
+      }
+
+      for (std::size_t i = 0; i < count; ++i) {
+         for (std::size_t field = 0; field < m_statistics.size(); ++field) {
+            m_statistics[field].merge(blocks[i].statistics[field]);
+         }
+      }
+      if (feedback) {
+         feedback->setProgress(std::min(100.0, 100.0 * static_cast<double>(m_feature_count) / total));
+      }
+   }
+
+   if (canceled) {
+      m_statistics.clear();
+      return Canceled;
+   }
+   return Success;
+}
@@ -0,0 +1,130 @@
+#ifndef _FIELD_STATS_ENGINE_H_
+#define _FIELD_STATS_ENGINE_H_
+
+#include "point_cloud_sketch.h"
+
+#include <QString>
+#include <QStringList>
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+class QgsFeatureSource;
+class QgsFeedback;
+
+/// @brief Settings of a field statistics engine run.
+struct FieldStatsSettings {
+   /// Fields to compute statistics of, empty for all numeric fields.
+   QStringList fields;
+   /// Features per block, the unit of work of a thread. Two blocks per thread are held at a time.
+   int block_size = 16384;
+   /// Precision of the distinct count sketches, 2^precision bytes per field and block.
+   int hll_precision = 11;
+   /// Accuracy parameter of the quantile sketches, about 3k values per field and block.
+   int kll_k = 128;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+};
+
+/// @brief Statistics of the values of one field, mergeable like the sketches it holds.
+///
+/// Numeric fields get all statistics. Other fields are counted and their distinct values
+/// estimated from their string representation, the moments and quantiles stay empty.
+struct FieldStatistics {
+   FieldStatistics(const QString& name, bool numeric, int hll_precision, int kll_k)
+      : name(name), numeric(numeric), sketch(hll_precision, kll_k) {
+   }
+
+   /// Both statistics must be of the same field and have the same parameters.
+   void merge(const FieldStatistics& other);
+
+   double mean() const {
+      return sketch.moments.count > 0 ? sum.value() / static_cast<double>(sketch.moments.count)
+                                      : std::numeric_limits<double>::quiet_NaN();
+   }
+
+   /// Sample standard deviation, like QgsStatisticalSummary::SampleStDev.
+   double sample_stddev() const {
+      const qint64 n = sketch.moments.count;
+      return n > 1 ? std::sqrt(sketch.moments.m2 / static_cast<double>(n - 1)) : std::numeric_limits<double>::quiet_NaN();
+   }
+
+   double median() const {
+      return sketch.quantiles.quantile(0.5);
+   }
+
+   double first_quartile() const {
+      return sketch.quantiles.quantile(0.25);
+   }
+
+   double third_quartile() const {
+      return sketch.quantiles.quantile(0.75);
+   }
+
+   double distinct_count() const {
+      return count > 0 ? sketch.distinct.estimate() : 0.0;
+   }
+
+   QString name;
+   bool numeric;
+   /// Number of values that are not null. NaN doubles count as null.
+   qint64 count = 0;
+   qint64 null_count = 0;
+   /// Compensated sum of the values.
+   CompensatedSum sum;
+   /// Moments, distinct values and quantiles. The population standard deviation, minimum and
+   /// maximum are those of sketch.moments.
+   AttributeSketch sketch;
+};
+
+/// @brief Streaming statistics of the fields of a large layer in constant memory.
+///
+/// QgsStatisticalSummary needs every value of a field in a list, or boxed one by one as a
+/// QVariant, and sorts them all for the median and quartiles. This engine reads the features
+/// once without geometries and only with the requested attributes. Consecutive blocks of
+/// block_size features are decoded into typed columns and summarized on all cores: Welford
+/// moments and a compensated sum, and the HyperLogLog and KLL sketches of PointCloudStatsEngine
+/// for the distinct count and the quantiles. The summaries of the blocks are merged in feature
+/// order, so the result does not depend on the number of threads, and only a few blocks per
+/// thread are held at a time, whatever the size of the layer.
+///
+/// The source is only read from the calling thread, as a provider iterator cannot be shared.
+class FieldStatsEngine
+{
+public:
+   /// Result codes of run().
+   enum Result {
+      Success = 0,
+      InvalidParameters = 1,
+      Canceled = 2
+   };
+
+   /// @brief Constructor.
+   /// @param source The features to summarize, must be valid for the whole run.
+   /// @param settings The fields and sketch parameters.
+   FieldStatsEngine(const QgsFeatureSource& source, const FieldStatsSettings& settings);
+
+   /// @brief Computes the statistics of all features of the source.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return One of the Result codes.
+   int run(QgsFeedback* feedback = nullptr);
+
+   /// Statistics of the last run, one per field in the order of the settings.
+   const std::vector<FieldStatistics>& statistics() const {
+      return m_statistics;
+   }
+
+   /// Number of features read by the last run.
+   qint64 feature_count() const {
+      return m_feature_count;
+   }
+
+private:
+   const QgsFeatureSource& m_source;
+   FieldStatsSettings m_settings;
+   std::vector<FieldStatistics> m_statistics;
+   qint64 m_feature_count = 0;
+};
+
+#endif
@@ -0,0 +1,329 @@
+#include "geometry_validation_engine.h"
+#include "feature_store.h"
+#include "parallel_for.h"
+
+#include "qgscoordinatetransform.h"
+#include "qgsexception.h"
+#include "qgsfeatureiterator.h"
+#include "qgsfeaturepool.h"
+#include "qgsfeedback.h"
+#include "qgsgeometrycheck.h"
+#include "qgsgeometrycheckcontext.h"
+#include "qgsgeometrycheckerror.h"
+#include "qgsvectorlayer.h"
+
+#include <QHash>
+#include <QMap>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <vector>
+
+namespace {
+
+/// Depth at which the quadtree stops splitting, e.g. for many features with the same centre.
+constexpr int s_max_depth = 24;
+
+/// The features of one layer, read once into a columnar store shared read-only by all workers.
+struct LayerSnapshot {
+   QgsVectorLayer* layer = nullptr;
+   FeatureStore features;
+   /// Bounding box of every feature in the map CRS.
+   std::vector<QgsRectangle> bounds;
+};
+
+/// A feature of the snapshot.
+struct FeatureRef {
+   std::uint16_t layer;
+   std::uint32_t index;
+};
+
+/// A leaf of the quadtree.
+struct Partition {
+   /// The rectangle the partition is responsible for.
+   QgsRectangle rect;
+   /// Features with the centre of their bounding box in rect.
+   std::vector<FeatureRef> own;
+   /// Features intersecting rect grown by the halo, own features included.
+   std::vector<FeatureRef> local;
+};
+
+/// A feature pool serving a fixed set of snapshot features, used by a single partition task.
+class SnapshotFeaturePool : public QgsFeaturePool
+{
+public:
+   explicit SnapshotFeaturePool(QgsVectorLayer* layer)
+      : QgsFeaturePool(layer) {
+   }
+
+   void load(const FeatureStore& features, const std::vector<std::uint32_t>& indices) {
+      QgsFeatureIds ids;
+      for (std::uint32_t index : indices) {
+         insertFeature(features.feature(index), true);
+         ids.insert(features.id(index));
+      }
+      setFeatureIds(ids);
+   }
+
+   bool addFeature(QgsFeature&, QgsFeatureSink::Flags = QgsFeatureSink::Flags()) override {
+      return false;
+   }
+
+   bool addFeatures(QgsFeatureList&, QgsFeatureSink::Flags = QgsFeatureSink::Flags()) override {
+      return false;
+   }
+
+   void updateFeature(QgsFeature&) override {
+   }
+
+   void deleteFeature(QgsFeatureId) override {
+   }
+};
+
+/// True if a point belongs to a quadtree cell. Cells include their maximum edges only on the
+/// border of the root, and points outside the root belong to the nearest cell.
+bool owns(const QgsRectangle& root, const QgsRectangle& cell, double x, double y) {
+   x = std::clamp(x, root.xMinimum(), root.xMaximum());
+   y = std::clamp(y, root.yMinimum(), root.yMaximum());
+   return x >= cell.xMinimum() && (x < cell.xMaximum() || cell.xMaximum() == root.xMaximum()) && y >= cell.yMinimum() &&
+          (y < cell.yMaximum() || cell.yMaximum() == root.yMaximum());
+}
+
+/// Builds the partitions of a quadtree cell and its descendants.
+class PartitionBuilder
+{
+public:
+   PartitionBuilder(const std::vector<LayerSnapshot>& snapshots, const QgsRectangle& root, const GeometryValidationSettings& settings,
+                    std::vector<Partition>& partitions)
+      : m_snapshots(snapshots), m_root(root), m_settings(settings), m_partitions(partitions) {
+   }
+
+   /// @param cell The quadtree cell.
+   /// @param candidates The features intersecting the cell grown by the halo.
+   void build(const QgsRectangle& cell, const std::vector<FeatureRef>& candidates, int depth) {
+      std::vector<FeatureRef> own;
+      for (const FeatureRef& feature : candidates) {
+         const QgsPointXY centre = m_snapshots[feature.layer].bounds[feature.index].center();
+         if (owns(m_root, cell, centre.x(), centre.y())) {
+            own.push_back(feature);
+         }
+      }
+      // The local set, halo included, is what the feature pools of the partition cache. Features
+      // overlapping the whole cell are in the halo of every child, so a cell owning at most one
+      // feature is not split any further.
+      if (candidates.size() <= static_cast<std::size_t>(std::max(1, m_settings.partition_features)) || own.size() <= 1
+          || depth == s_max_depth) {
+         m_partitions.push_back(Partition{cell, std::move(own), candidates});
+         return;
+      }
+
+      const double x_mid = 0.5 * (cell.xMinimum() + cell.xMaximum());
+      const double y_mid = 0.5 * (cell.yMinimum() + cell.yMaximum());
+      const double halo = std::max(0.0, m_settings.halo);
+      std::vector<FeatureRef> child_candidates;
+      for (int child = 0; child < 4; ++child) {
+         const QgsRectangle child_cell(child & 1 ? x_mid : cell.xMinimum(), child & 2 ? y_mid : cell.yMinimum(),
+                                       child & 1 ? cell.xMaximum() : x_mid, child & 2 ? cell.yMaximum() : y_mid);
+         child_candidates.clear();
+         for (const FeatureRef& feature : candidates) {
+            const QgsRectangle& bounds = m_snapshots[feature.layer].bounds[feature.index];
+            if (bounds.xMinimum() <= child_cell.xMaximum() + halo && bounds.xMaximum() >= child_cell.xMinimum() - halo &&
+                bounds.yMinimum() <= child_cell.yMaximum() + halo && bounds.yMaximum() >= child_cell.yMinimum() - halo) {
+               child_candidates.push_back(feature);
+            }
+         }
+         if (!child_candidates.empty()) {
+            build(child_cell, child_candidates, depth + 1);
+         }
+      }
+   }
+
+private:
+   const std::vector<LayerSnapshot>& m_snapshots;
+   QgsRectangle m_root;
+   const GeometryValidationSettings& m_settings;
+   std::vector<Partition>& m_partitions;
+};
+
+}
+
+GeometryValidationEngine::GeometryValidationEngine(const QList<QgsGeometryCheck*>& checks, const QList<QgsVectorLayer*>& layers,
+                                                   const GeometryValidationSettings& settings)
+   : m_checks(checks), m_layers(layers), m_settings(settings) {
+}
+
+int GeometryValidationEngine::run(QList<QgsGeometryCheckError*>& errors, QStringList& messages, QgsFeedback* feedback) {
+   m_partition_count = 0;
+   if (m_checks.isEmpty() || m_layers.isEmpty() || m_layers.size() > 0xffff || !m_checks.first()->context()) {
+      return InvalidParameters;
+   }
+   const QgsGeometryCheckContext* context = m_checks.first()->context();
+
+   // Read every layer once, with the bounding boxes in the map CRS for the partitioning.
+   std::vector<LayerSnapshot> snapshots(m_layers.size());
+   std::vector<FeatureRef> all_features;
+   QgsRectangle root;
+   root.setNull();
+   for (int layer_index = 0; layer_index < m_layers.size(); ++layer_index) {
+      LayerSnapshot& snapshot = snapshots[layer_index];
+      snapshot.layer = m_layers.at(layer_index);
+      if (!snapshot.layer) {
+         return InvalidParameters;
+      }
+      const QgsCoordinateTransform transform(snapshot.layer->crs(), context->mapCrs, context->transformContext);
+      const long long feature_count = snapshot.layer->featureCount();
+      snapshot.features.reset(snapshot.layer->fields(), snapshot.layer->fields().allAttributesList());
+      QgsFeatureIterator iterator = snapshot.layer->getFeatures();
+      QgsFeature feature;
+      while (iterator.nextFeature(feature)) {
+         if (feedback && feedback->isCanceled()) {
+            return Canceled;
+         }
+         if (!feature.hasGeometry()) {
+            continue;
+         }
+         QgsRectangle bounds;
+         try {
+            bounds = transform.transformBoundingBox(feature.geometry().boundingBox());
+         } catch (QgsCsException&) {
+            messages.append(QStringLiteral("Feature %1 of layer %2 could not be transformed to the map CRS")
+                               .arg(feature.id())
+                               .arg(snapshot.layer->name()));
+            continue;
+         }
+         all_features.push_back(FeatureRef{static_cast<std::uint16_t>(layer_index), static_cast<std::uint32_t>(snapshot.features.size())});
+         snapshot.features.append(feature);
+         snapshot.bounds.push_back(bounds);
+         root.combineExtentWith(bounds);
+         if (feedback && feature_count > 0 && snapshot.features.size() % 10000 == 0) {
+            feedback->setProgress(10.0 * (layer_index + static_cast<double>(snapshot.features.size()) / feature_count) / m_layers.size());
+         }
+      }
+      snapshot.features.finish();
+   }
+   if (all_features.empty()) {
+      return Success;
+   }
+
+   std::vector<Partition> partitions;
+   PartitionBuilder(snapshots, root, m_settings, partitions).build(root, all_features, 0);
+   all_features = std::vector<FeatureRef>();
+   m_partition_count = static_cast<int>(partitions.size());
+
+   // Start with the largest partitions, so no large one is left for the end.
+   std::vector<std::size_t> order(partitions.size());
+   std::iota(order.begin(), order.end(), 0);
+   std::stable_sort(order.begin(), order.end(),
+                    [&](std::size_t a, std::size_t b) { return partitions[a].local.size() > partitions[b].local.size(); });
+
+   std::vector<std::vector<QList<QgsGeometryCheckError*>>> results(partitions.size(),
+                                                                   std::vector<QList<QgsGeometryCheckError*>>(m_checks.size()));
+   std::atomic<bool> canceled(false);
+   std::atomic<std::size_t> partitions_done(0);
+   std::mutex messages_mutex;
+   std::mutex pools_mutex;
+
+   parallel_for(order.size(), m_settings.thread_count, [&](std::size_t index, int worker) {
+      const std::size_t partition_index = order[index];
+      const Partition& partition = partitions[partition_index];
+      if (canceled || (feedback && feedback->isCanceled())) {
+         canceled = true;
+         return;
+      }
+
+      // The pools exist only while their partition runs. Creating a pool copies the state of its
+      // layer, so the creations are serialized; the calling thread waits in parallel_for meanwhile.
+      std::vector<std::unique_ptr<SnapshotFeaturePool>> partition_pools;
+      {
+         std::lock_guard<std::mutex> lock(pools_mutex);
+         for (const LayerSnapshot& snapshot : snapshots) {
+            partition_pools.push_back(std::make_unique<SnapshotFeaturePool>(snapshot.layer));
+         }
+      }
+
+      std::vector<std::vector<std::uint32_t>> local_indices(snapshots.size());
+      QMap<QString, QgsFeatureIds> own_ids;
+      QMap<QString, QgsFeatureIds> local_ids;
+      for (const FeatureRef& feature : partition.local) {
+         local_indices[feature.layer].push_back(feature.index);
+         local_ids[snapshots[feature.layer].layer->id()].insert(snapshots[feature.layer].features.id(feature.index));
+      }
+      for (const FeatureRef& feature : partition.own) {
+         own_ids[snapshots[feature.layer].layer->id()].insert(snapshots[feature.layer].features.id(feature.index));
+      }
+      QMap<QString, QgsFeaturePool*> pool_map;
+      for (std::size_t layer = 0; layer < snapshots.size(); ++layer) {
+         partition_pools[layer]->load(snapshots[layer].features, local_indices[layer]);
+         pool_map.insert(snapshots[layer].layer->id(), partition_pools[layer].get());
+      }
+
+      QStringList check_messages;
+      for (int check_index = 0; check_index < m_checks.size(); ++check_index) {
+         if (feedback && feedback->isCanceled()) {
+            canceled = true;
+            break;
+         }
+         const QgsGeometryCheck* check = m_checks.at(check_index);
+         const bool layer_check = check->checkType() == QgsGeometryCheck::LayerCheck;
+         // Empty ids would select every feature of the pools.
+         const QMap<QString, QgsFeatureIds>& ids = layer_check ? local_ids : own_ids;
+         if (ids.isEmpty()) {
+            continue;
+         }
+         QList<QgsGeometryCheckError*> found;
+         check->collectErrors(pool_map, found, check_messages, nullptr, QgsGeometryCheck::LayerFeatureIds(ids));
+         QList<QgsGeometryCheckError*>& kept = results[partition_index][check_index];
+         for (QgsGeometryCheckError* error : found) {
+            // Layer errors are kept by the partition they are located in, the others see only part of the halo.
+            if (layer_check && !owns(root, partition.rect, error->location().x(), error->location().y())) {
+               delete error;
+            } else {
+               kept.append(error);
+            }
+         }
+      }
+      partition_pools.clear();
+
+      if (!check_messages.isEmpty()) {
+         std::lock_guard<std::mutex> lock(messages_mutex);
+         messages.append(check_messages);
+      }
+      const std::size_t done = ++partitions_done;
+      if (feedback && worker == 0) {
+         feedback->setProgress(10.0 + 90.0 * static_cast<double>(done) / static_cast<double>(partitions.size()));
+      }
+   });
+
+   if (canceled) {
+      for (std::vector<QList<QgsGeometryCheckError*>>& partition_results : results) {
+         for (QList<QgsGeometryCheckError*>& check_results : partition_results) {
+            qDeleteAll(check_results);
+         }
+      }
+      return Canceled;
+   }
+
+   // Merge by check in partition order, dropping errors reported by more than one partition.
+   for (int check_index = 0; check_index < m_checks.size(); ++check_index) {
+      QHash<QString, QList<QgsGeometryCheckError*>> reported;
+      for (std::vector<QList<QgsGeometryCheckError*>>& partition_results : results) {
+         for (QgsGeometryCheckError* error : partition_results[check_index]) {
+            QList<QgsGeometryCheckError*>& same_feature = reported[QStringLiteral("%1|%2").arg(error->layerId()).arg(error->featureId())];
+            const bool duplicate = std::any_of(same_feature.begin(), same_feature.end(),
+                                               [&](QgsGeometryCheckError* other) { return other->isEqual(error); });
+            if (duplicate) {
+               delete error;
+            } else {
+               same_feature.append(error);
+               errors.append(error);
+            }
+         }
+      }
+   }
+   messages.removeDuplicates();
+   return Success;
+}
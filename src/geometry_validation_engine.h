@@ -0,0 +1,80 @@
+#ifndef _GEOMETRY_VALIDATION_ENGINE_H_
+#define _GEOMETRY_VALIDATION_ENGINE_H_
+
+#include <QList>
+#include <QStringList>
+
+class QgsFeedback;
+class QgsGeometryCheck;
+class QgsGeometryCheckError;
+class QgsVectorLayer;
+
+/// @brief Settings of a geometry validation run.
+struct GeometryValidationSettings {
+   /// Maximum number of features a partition sees, its own and those in its halo, before it is
+   /// split. Keep it below the 1000 features a QgsFeaturePool caches. Only partitions owning a
+   /// single feature that overlaps many others can exceed it.
+   int partition_features = 400;
+   /// Width of the halo around every partition in map units. Layer checks see the features
+   /// intersecting the halo, so it should exceed the largest gap or overlap of interest.
+   double halo = 0.0;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+};
+
+/// @brief Runs geometry checks in parallel over spatial partitions of the features.
+///
+/// QgsGeometryChecker::execute() runs one task per check, so a single expensive check such as
+/// the overlap or gap check runs on one core, and all tasks share feature pools that serialize
+/// every QgsFeaturePool::getFeature() behind a lock. This engine reads the features of every
+/// layer once into a read-only FeatureStore and splits them with a quadtree, by the centre of
+/// their bounding box in the map CRS, until every partition sees at most partition_features
+/// features including its halo.
+///
+/// The task of every partition creates private feature pools filled from the snapshot with its
+/// own features and those intersecting its halo, runs every check on them and frees them.
+/// Feature checks only check the features of the partition. Layer checks see the halo features
+/// too, and a partition only keeps the layer errors located in its own rectangle, so errors
+/// across partition borders are found once. Remaining duplicates are merged with QgsGeometryCheckError::isEqual(). The
+/// largest partitions are started first, and idle workers pick up the next partition.
+///
+/// The checks must be prepared, their collectErrors() is called from several threads at once.
+/// Run the engine off the main thread like QgsGeometryChecker: a feature pool reads features
+/// missing from its cache through the main thread.
+class GeometryValidationEngine
+{
+public:
+   /// Result codes of run().
+   enum Result {
+      Success = 0,
+      InvalidParameters = 1,
+      Canceled = 2
+   };
+
+   /// @brief Constructor.
+   /// @param checks The checks to run, sharing one QgsGeometryCheckContext.
+   /// @param layers The layers to check.
+   /// @param settings The partitioning and processing options.
+   GeometryValidationEngine(const QList<QgsGeometryCheck*>& checks, const QList<QgsVectorLayer*>& layers,
+                            const GeometryValidationSettings& settings);
+
+   /// @brief Runs all checks on all layers.
+   /// @param errors Receives the errors ordered by check, the caller takes ownership.
+   /// @param messages Receives the messages of the checks and of features that could not be read.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return One of the Result codes.
+   int run(QList<QgsGeometryCheckError*>& errors, QStringList& messages, QgsFeedback* feedback = nullptr);
+
+   /// Number of partitions of the last run.
+   int partition_count() const {
+      return m_partition_count;
+   }
+
+private:
+   QList<QgsGeometryCheck*> m_checks;
+   QList<QgsVectorLayer*> m_layers;
+   GeometryValidationSettings m_settings;
+   int m_partition_count = 0;
+};
+
+#endif
@@ -0,0 +1,646 @@
+#include "group_by_engine.h"
+#include "expression_kernel.h"
+#include "parallel_for.h"
+#include "point_cloud_sketch.h"
+
+#include "qgsexpression.h"
+#include "qgsexpressioncontext.h"
+#include "qgsexpressioncontextutils.h"
+#include "qgsfeatureiterator.h"
+#include "qgsfeaturerequest.h"
+#include "qgsfeaturesource.h"
+#include "qgsfeedback.h"
+#include "qgsmemoryproviderutils.h"
+#include "qgsproject.h"
+#include "qgsvectordataprovider.h"
+#include "qgsvectorlayer.h"
+
+#include <QHash>
+#include <QSet>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace {
+
+/// Number of features in a run handed to one worker at a time.
+constexpr std::size_t s_run_size = 256;
+
+/// State of one aggregate of one group.
+struct AggregateState {
+   qint64 count = 0;
+   qint64 missing = 0;
+   MomentSketch moments;
+   CompensatedSum sum;
+   /// Values of the median and quartile aggregates.
+   std::vector<double> values;
+   /// String representations of the values of CountDistinct.
+   QSet<QString> distinct;
+   int min_length = std::numeric_limits<int>::max();
+   int max_length = -1;
+   /// Smallest and largest strings, dates or times of Min and Max, invalid if there were none.
+   QVariant minimum;
+   QVariant maximum;
+   /// A value of a type the aggregate cannot order or mix with the others.
+   bool invalid = false;
+
+   /// Orders a string, date or time into minimum and maximum.
+   void order(const QVariant& value) {
+      if (minimum.isValid() && value.userType() != minimum.userType()) {
+         invalid = true;
+         return;
+      }
+      if (!minimum.isValid() || qgsVariantLessThan(value, minimum)) {
+         minimum = value;
+      }
+      if (!maximum.isValid() || qgsVariantGreaterThan(value, maximum)) {
+         maximum = value;
+      }
+   }
+
+   void merge(const AggregateState& other) {
+      count += other.count;
+      missing += other.missing;
+      moments.merge(other.moments);
+      sum.merge(other.sum);
+      values.insert(values.end(), other.values.begin(), other.values.end());
+      distinct.unite(other.distinct);
+      min_length = std::min(min_length, other.min_length);
+      max_length = std::max(max_length, other.max_length);
+      if (other.minimum.isValid()) {
+         order(other.minimum);
+         order(other.maximum);
+      }
+      invalid = invalid || other.invalid;
+   }
+};
+
+/// Groups found by one worker, with the states of all aggregates of a group in a row.
+struct GroupTable {
+   QHash<QVariantList, int> index;
+   std::vector<QVariantList> keys;
+   std::vector<AggregateState> states;
+};
+
+/// Expressions of one worker, prepared for its own context.
+struct WorkerExpressions {
+   QgsExpressionContext context;
+   std::vector<ExpressionKernel> keys;
+   std::vector<ExpressionKernel> aggregates;
+   /// Results of the expressions for the features of a run, s_run_size per expression.
+   std::vector<QVariant> key_values;
+   std::vector<QVariant> aggregate_values;
+};
+
+bool is_supported(QgsAggregateCalculator::Aggregate aggregate) {
+   switch (aggregate) {
+   case QgsAggregateCalculator::Count:
+   case QgsAggregateCalculator::CountDistinct:
+   case QgsAggregateCalculator::CountMissing:
+   case QgsAggregateCalculator::Min:
+   case QgsAggregateCalculator::Max:
+   case QgsAggregateCalculator::Sum:
+   case QgsAggregateCalculator::Mean:
+   case QgsAggregateCalculator::Median:
+   case QgsAggregateCalculator::StDev:
+   case QgsAggregateCalculator::StDevSample:
+   case QgsAggregateCalculator::Range:
+   case QgsAggregateCalculator::FirstQuartile:
+   case QgsAggregateCalculator::ThirdQuartile:
+   case QgsAggregateCalculator::InterQuartileRange:
+   case QgsAggregateCalculator::StringMinimumLength:
+   case QgsAggregateCalculator::StringMaximumLength:
+      return true;
+   default:
+      return false;
+   }
+}
+
+/// Values Min, Max and Range compare as numbers. Min and Max order the others with
+/// qgsVariantLessThan, like the string and date statistics of QgsAggregateCalculator.
+bool is_number(const QVariant& value) {
+   switch (value.userType()) {
+   case QMetaType::Bool:
+   case QMetaType::Int:
+   case QMetaType::UInt:
+   case QMetaType::LongLong:
+   case QMetaType::ULongLong:
+   case QMetaType::Float:
+   case QMetaType::Double:
+      return true;
+   default:
+      return false;
+   }
+}
+
+bool needs_values(QgsAggregateCalculator::Aggregate aggregate) {
+   return aggregate == QgsAggregateCalculator::Median || aggregate == QgsAggregateCalculator::FirstQuartile
+      || aggregate == QgsAggregateCalculator::ThirdQuartile || aggregate == QgsAggregateCalculator::InterQuartileRange;
+}
+
+/// Short name of an aggregate for the default output field names.
+QString aggregate_name(QgsAggregateCalculator::Aggregate aggregate) {
+   switch (aggregate) {
+   case QgsAggregateCalculator::Count:
+      return QStringLiteral("count");
+   case QgsAggregateCalculator::CountDistinct:
+      return QStringLiteral("count_distinct");
+   case QgsAggregateCalculator::CountMissing:
+      return QStringLiteral("count_missing");
+   case QgsAggregateCalculator::Min:
+      return QStringLiteral("min");
+   case QgsAggregateCalculator::Max:
+      return QStringLiteral("max");
+   case QgsAggregateCalculator::Sum:
+      return QStringLiteral("sum");
+   case QgsAggregateCalculator::Mean:
+      return QStringLiteral("mean");
+   case QgsAggregateCalculator::Median:
+      return QStringLiteral("median");
+   case QgsAggregateCalculator::StDev:
+      return QStringLiteral("stdev");
+   case QgsAggregateCalculator::StDevSample:
+      return QStringLiteral("stdev_sample");
+   case QgsAggregateCalculator::Range:
+      return QStringLiteral("range");
+   case QgsAggregateCalculator::FirstQuartile:
+      return QStringLiteral("q1");
+   case QgsAggregateCalculator::ThirdQuartile:
+      return QStringLiteral("q3");
+   case QgsAggregateCalculator::InterQuartileRange:
+      return QStringLiteral("iqr");
+   case QgsAggregateCalculator::StringMinimumLength:
+      return QStringLiteral("min_length");
+   case QgsAggregateCalculator::StringMaximumLength:
+      return QStringLiteral("max_length");
+   default:
+      return QStringLiteral("aggregate");
+   }
+}
+
+QVariant::Type aggregate_type(QgsAggregateCalculator::Aggregate aggregate) {
+   switch (aggregate) {
+   case QgsAggregateCalculator::Count:
+   case QgsAggregateCalculator::CountDistinct:
+   case QgsAggregateCalculator::CountMissing:
+      return QVariant::LongLong;
+   case QgsAggregateCalculator::StringMinimumLength:
+   case QgsAggregateCalculator::StringMaximumLength:
+      return QVariant::Int;
+   default:
+      return QVariant::Double;
+   }
+}
+
+void add_value(QgsAggregateCalculator::Aggregate aggregate, const QVariant& value, AggregateState& state) {
+   if (value.isNull()) {
+      ++state.missing;
+      return;
+   }
+   switch (aggregate) {
+   case QgsAggregateCalculator::Count:
+   case QgsAggregateCalculator::CountMissing:
+      ++state.count;
+      return;
+   case QgsAggregateCalculator::CountDistinct:
+      ++state.count;
+      state.distinct.insert(value.toString());
+      return;
+   case QgsAggregateCalculator::StringMinimumLength:
+   case QgsAggregateCalculator::StringMaximumLength: {
+      const int length = value.toString().length();
+      ++state.count;
+      state.min_length = std::min(state.min_length, length);
+      state.max_length = std::max(state.max_length, length);
+      return;
+   }
+   case QgsAggregateCalculator::Min:
+   case QgsAggregateCalculator::Max:
+      if (!is_number(value)) {
+         state.order(value);
+         return;
+      }
+      break;
+   case QgsAggregateCalculator::Range:
+      if (!is_number(value)) {
+         state.invalid = true;
+         return;
+      }
+      break;
+   default:
+      break;
+   }
+   bool ok = false;
+   const double number = value.toDouble(&ok);
+   if (!ok || std::isnan(number)) {
+      ++state.missing;
+      return;
+   }
+   ++state.count;
+   state.moments.add(number);
+   state.sum.add(number);
+   if (needs_values(aggregate)) {
+      state.values.push_back(number);
+   }
+}
+
+/// Median of sorted values, NaN if empty.
+double median(const double* values, std::size_t count) {
+   if (count == 0) {
+      return std::numeric_limits<double>::quiet_NaN();
+   }
+   return count % 2 ? values[count / 2] : 0.5 * (values[count / 2 - 1] + values[count / 2]);
+}
+
+QVariant aggregate_value(QgsAggregateCalculator::Aggregate aggregate, AggregateState& state) {
+   switch (aggregate) {
+   case QgsAggregateCalculator::Count:
+      return state.count;
+   case QgsAggregateCalculator::CountMissing:
+      return state.missing;
+   case QgsAggregateCalculator::CountDistinct:
+      return static_cast<qint64>(state.distinct.size());
+   case QgsAggregateCalculator::Sum:
+      return state.sum.value();
+   case QgsAggregateCalculator::Min:
+      if (state.minimum.isValid()) {
+         return state.minimum;
+      }
+      break;
+   case QgsAggregateCalculator::Max:
+      if (state.maximum.isValid()) {
+         return state.maximum;
+      }
+      break;
+   default:
+      break;
+   }
+   if (state.count == 0) {
+      return QVariant();
+   }
+   switch (aggregate) {
+   case QgsAggregateCalculator::StringMinimumLength:
+      return state.min_length;
+   case QgsAggregateCalculator::StringMaximumLength:
+      return state.max_length;
+   case QgsAggregateCalculator::Min:
+      return state.moments.minimum;
+   case QgsAggregateCalculator::Max:
+      return state.moments.maximum;
+   case QgsAggregateCalculator::Range:
+      return state.moments.maximum - state.moments.minimum;
+   case QgsAggregateCalculator::Mean:
+      return state.sum.value() / static_cast<double>(state.count);
+   case QgsAggregateCalculator::StDev:
+      return state.moments.stddev();
+   case QgsAggregateCalculator::StDevSample:
+      return state.count > 1 ? QVariant(std::sqrt(state.moments.m2 / static_cast<double>(state.count - 1))) : QVariant();
+   default:
+      break;
+   }
+
+   // Quartiles are the medians of the lower and upper halves, both with the median if the
+   // count is odd, like QgsStatisticalSummary.
+   std::vector<double>& values = state.values;
+   std::sort(values.begin(), values.end());
+   const std::size_t count = values.size();
+   const std::size_t half = (count + 1) / 2;
+   const double first_quartile = median(values.data(), half);
+   const double third_quartile = median(values.data() + count - half, half);
+   switch (aggregate) {
+   case QgsAggregateCalculator::Median:
+      return median(values.data(), count);
+   case QgsAggregateCalculator::FirstQuartile:
+      return first_quartile;
+   case QgsAggregateCalculator::ThirdQuartile:
+      return third_quartile;
+   default:
+      return third_quartile - first_quartile;
+   }
+}
+
+/// Index of the field an expression consists of, -1 for other expressions.
+int plain_field(const QgsExpression& expression, const QgsFields& fields) {
+   if (!expression.isField()) {
+      return -1;
+   }
+   const QSet<QString> columns = expression.referencedColumns();
+   return columns.size() == 1 ? fields.lookupField(*columns.constBegin()) : -1;
+}
+
+/// @brief Key value with one type per kind of value.
+///
+/// QVariant compares an int and a qlonglong of the same value, or null values of different
+/// types, as equal, but they hash differently, so a key from an Int field and one from an
+/// Int64 field or expression would form two groups.
+QVariant normalized_key(const QVariant& value) {
+   if (value.isNull()) {
+      return QVariant();
+   }
+   switch (value.userType()) {
+   case QMetaType::Short:
+   case QMetaType::UShort:
+   case QMetaType::Int:
+   case QMetaType::UInt:
+   case QMetaType::Long:
+   case QMetaType::LongLong:
+      return value.toLongLong();
+   case QMetaType::ULongLong:
+   case QMetaType::ULong:
+      return value.toULongLong() <= static_cast<qulonglong>(std::numeric_limits<qlonglong>::max())
+         ? QVariant(value.toLongLong())
+         : QVariant(value.toULongLong());
+   case QMetaType::Float:
+      return value.toDouble();
+   default:
+      return value;
+   }
+}
+
+/// Lexicographic order of group keys.
+bool key_less(const QVariantList& a, const QVariantList& b) {
+   for (int i = 0; i < a.size() && i < b.size(); ++i) {
+      if (qgsVariantLessThan(a[i], b[i])) {
+         return true;
+      }
+      if (qgsVariantLessThan(b[i], a[i])) {
+         return false;
+      }
+   }
+   return a.size() < b.size();
+}
+
+}
+
+GroupByEngine::GroupByEngine(const QgsFeatureSource& source, const GroupBySettings& settings)
+   : m_source(source), m_settings(settings) {
+}
+
+int GroupByEngine::run(const QgsExpressionContext* context, QgsFeedback* feedback) {
+   m_fields = QgsFields();
+   m_rows.clear();
+   const int key_count = m_settings.group_by.size();
+   const int aggregate_count = m_settings.aggregates.size();
+   if (aggregate_count == 0 || m_settings.batch_size < 1) {
+      return InvalidParameters;
+   }
+
+   const QgsFields source_fields = m_source.fields();
+   QgsExpressionContext base_context;
+   if (context) {
+      base_context = *context;
+   } else {
+      base_context << QgsExpressionContextUtils::globalScope() << QgsExpressionContextUtils::projectScope(QgsProject::instance());
+   }
+   base_context.setFields(source_fields);
+
+   // Parse every expression once and collect what the request has to read.
+   std::vector<QgsExpression> keys;
+   std::vector<QgsExpression> aggregates;
+   for (const QString& key : m_settings.group_by) {
+      keys.emplace_back(key);
+   }
+   for (const GroupAggregate& aggregate : m_settings.aggregates) {
+      if (!is_supported(aggregate.aggregate)) {
+         return InvalidParameters;
+      }
+      aggregates.emplace_back(aggregate.expression);
+   }
+   QSet<QString> columns;
+   bool needs_geometry = false;
+   for (const std::vector<QgsExpression>* expressions : {&keys, &aggregates}) {
+      for (const QgsExpression& expression : *expressions) {
+         if (expression.hasParserError()) {
+            return InvalidParameters;
+         }
+         columns.unite(expression.referencedColumns());
+         needs_geometry = needs_geometry || expression.needsGeometry();
+      }
+   }
+
+   QgsFeatureRequest request;
+   if (!needs_geometry) {
+      request.setFlags(QgsFeatureRequest::NoGeometry);
+   }
+   if (!columns.contains(QgsFeatureRequest::ALL_ATTRIBUTES)) {
+      request.setSubsetOfAttributes(columns, source_fields);
+   }
+
+   // Expressions are prepared and compiled in the calling thread, the workers only evaluate them.
+   const int thread_count = resolve_thread_count(m_settings.thread_count);
+   std::vector<WorkerExpressions> workers(thread_count);
+   for (WorkerExpressions& worker : workers) {
+      worker.context = base_context;
+      for (const QString& key : m_settings.group_by) {
+         worker.keys.emplace_back(key);
+      }
+      for (const GroupAggregate& aggregate : m_settings.aggregates) {
+         worker.aggregates.emplace_back(aggregate.expression);
+      }
+      for (ExpressionKernel& expression : worker.keys) {
+         expression.prepare(&worker.context);
+      }
+      for (ExpressionKernel& expression : worker.aggregates) {
+         expression.prepare(&worker.context);
+      }
+      worker.key_values.resize(static_cast<std::size_t>(key_count) * s_run_size);
+      worker.aggregate_values.resize(static_cast<std::size_t>(aggregate_count) * s_run_size);
+   }
+   std::vector<GroupTable> tables(thread_count);
+
+   const std::size_t batch_size = static_cast<std::size_t>(m_settings.batch_size);
+   const double feature_count = static_cast<double>(std::max<long long>(1, m_source.featureCount()));
+   std::vector<QgsFeature> batch;
+   std::atomic<bool> canceled(false);
+   long long features_read = 0;
+   QgsFeatureIterator features = m_source.getFeatures(request);
+   bool more = true;
+   while (more) {
+      batch.clear();
+      QgsFeature feature;
+      while (batch.size() < batch_size && (more = features.nextFeature(feature))) {
+         batch.push_back(feature);
+      }
+      if (batch.empty()) {
+         break;
+      }
+      if (feedback && feedback->isCanceled()) {
+         return Canceled;
+      }
+      features_read += static_cast<long long>(batch.size());
+
+      const std::size_t run_count = (batch.size() + s_run_size - 1) / s_run_size;
+      parallel_for(run_count, thread_count, [&](std::size_t run, int worker) {
+         if (canceled) {
+            return;
+         }
+         if (feedback && feedback->isCanceled()) {
+            canceled = true;
+            return;
+         }
+         WorkerExpressions& expressions = workers[worker];
+         GroupTable& table = tables[worker];
+         // Every expression runs over the whole run before the features are grouped.
+         const std::size_t begin = run * s_run_size;
+         const std::size_t count = std::min(batch.size(), begin + s_run_size) - begin;
+         for (int k = 0; k < key_count; ++k) {
+            expressions.keys[k].evaluate(batch.data() + begin, count, expressions.key_values.data() + k * s_run_size);
+         }
+         for (int a = 0; a < aggregate_count; ++a) {
+            expressions.aggregates[a].evaluate(batch.data() + begin, count,
+                                               expressions.aggregate_values.data() + a * s_run_size);
+         }
+         QVariantList key;
+         for (std::size_t i = 0; i < count; ++i) {
+            key.clear();
+            for (int k = 0; k < key_count; ++k) {
+               key << normalized_key(expressions.key_values[k * s_run_size + i]);
+            }
+            auto group = table.index.constFind(key);
+            if (group == table.index.constEnd()) {
+               group = table.index.insert(key, static_cast<int>(table.keys.size()));
+               table.keys.push_back(key);
+               table.states.resize(table.states.size() + aggregate_count);
+            }
+            AggregateState* states = table.states.data() + static_cast<std::size_t>(group.value()) * aggregate_count;
+            for (int a = 0; a < aggregate_count; ++a) {
+               add_value(m_settings.aggregates[a].aggregate, expressions.aggregate_values[a * s_run_size + i], states[a]);
+            }
+         }
+      });
+      if (canceled) {
+         return Canceled;
+      }
+      if (feedback) {
+         feedback->setProgress(std::min(100.0, 100.0 * static_cast<double>(features_read) / feature_count));
+      }
+   }
+
+   // Merge the worker tables into the first one.
+   GroupTable& merged = tables[0];
+   for (int worker = 1; worker < thread_count; ++worker) {
+      GroupTable& table = tables[worker];
+      for (std::size_t group = 0; group < table.keys.size(); ++group) {
+         auto target = merged.index.constFind(table.keys[group]);
+         if (target == merged.index.constEnd()) {
+            target = merged.index.insert(table.keys[group], static_cast<int>(merged.keys.size()));
+            merged.keys.push_back(table.keys[group]);
+            merged.states.resize(merged.states.size() + aggregate_count);
+         }
+         AggregateState* states = merged.states.data() + static_cast<std::size_t>(target.value()) * aggregate_count;
+         for (int a = 0; a < aggregate_count; ++a) {
+            states[a].merge(table.states[group * aggregate_count + a]);
+         }
+      }
+      table = GroupTable();
+   }
+   // A run without keys has one group, even without features.
+   if (key_count == 0 && merged.keys.empty()) {
+      merged.keys.emplace_back();
+      merged.states.resize(aggregate_count);
+   }
+
+   std::vector<int> order(merged.keys.size());
+   for (std::size_t i = 0; i < order.size(); ++i) {
+      order[i] = static_cast<int>(i);
+   }
+   std::sort(order.begin(), order.end(), [&](int a, int b) { return key_less(merged.keys[a], merged.keys[b]); });
+
+   // Min and Max of strings, dates or times take the type of their values, which must not be
+   // mixed with numbers or other types in any group, and Range only takes numbers.
+   std::vector<QVariant::Type> aggregate_types(aggregate_count);
+   for (int a = 0; a < aggregate_count; ++a) {
+      aggregate_types[a] = aggregate_type(m_settings.aggregates[a].aggregate);
+      bool numbers = false;
+      int ordered_type = QMetaType::UnknownType;
+      for (std::size_t group = 0; group < merged.keys.size(); ++group) {
+         const AggregateState& state = merged.states[group * aggregate_count + a];
+         if (state.invalid) {
+            return InvalidParameters;
+         }
+         numbers = numbers || state.count > 0;
+         if (state.minimum.isValid()) {
+            if (ordered_type != QMetaType::UnknownType && state.minimum.userType() != ordered_type) {
+               return InvalidParameters;
+            }
+            ordered_type = state.minimum.userType();
+            aggregate_types[a] = state.minimum.type();
+         }
+      }
+      if (numbers && ordered_type != QMetaType::UnknownType) {
+         return InvalidParameters;
+      }
+   }
+
+   // Key fields take the type of the first non-null value, or the type of a plain field.
+   std::vector<bool> plain_keys(key_count);
+   for (int k = 0; k < key_count; ++k) {
+      const int field_index = plain_field(keys[k], source_fields);
+      QVariant::Type type = QVariant::String;
+      plain_keys[k] = field_index >= 0;
+      if (field_index >= 0) {
+         type = source_fields.at(field_index).type();
+      } else {
+         for (const QVariantList& key : merged.keys) {
+            if (!key[k].isNull()) {
+               type = key[k].type();
+               break;
+            }
+         }
+      }
+      const QString name = field_index >= 0 ? source_fields.at(field_index).name() : QStringLiteral("key_%1").arg(k + 1);
+      m_fields.append(QgsField(name, type));
+   }
+   for (int a = 0; a < aggregate_count; ++a) {
+      const GroupAggregate& aggregate = m_settings.aggregates[a];
+      QString name = aggregate.name;
+      if (name.isEmpty()) {
+         const int field_index = plain_field(aggregates[a], source_fields);
+         const QString column = field_index >= 0 ? source_fields.at(field_index).name() : QString::number(a + 1);
+         name = QStringLiteral("%1_%2").arg(aggregate_name(aggregate.aggregate), column);
+      }
+      m_fields.append(QgsField(name, aggregate_types[a]));
+   }
+
+   m_rows.reserve(order.size());
+   for (int group : order) {
+      QgsAttributes row;
+      row.reserve(key_count + aggregate_count);
+      for (int k = 0; k < key_count; ++k) {
+         // Keys of plain fields get the type of the field back.
+         QVariant value = merged.keys[group][k];
+         if (plain_keys[k] && !value.isNull()) {
+            value.convert(m_fields.at(k).type());
+         }
+         row << value;
+      }
+      AggregateState* states = merged.states.data() + static_cast<std::size_t>(group) * aggregate_count;
+      for (int a = 0; a < aggregate_count; ++a) {
+         row << aggregate_value(m_settings.aggregates[a].aggregate, states[a]);
+      }
+      m_rows.push_back(row);
+   }
+   return Success;
+}
+
+std::unique_ptr<QgsVectorLayer> GroupByEngine::create_layer(const QString& name) const {
+   std::unique_ptr<QgsVectorLayer> layer(QgsMemoryProviderUtils::createMemoryLayer(name, m_fields));
+   if (!layer || !layer->isValid()) {
+      return nullptr;
+   }
+   QgsFeatureList features;
+   features.reserve(static_cast<int>(m_rows.size()));
+   for (const QgsAttributes& row : m_rows) {
+      QgsFeature feature(m_fields);
+      feature.setAttributes(row);
+      features.append(feature);
+   }
+   if (!layer->dataProvider()->addFeatures(features, QgsFeatureSink::FastInsert)) {
+      return nullptr;
+   }
+   layer->updateExtents();
+   return layer;
+}
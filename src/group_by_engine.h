@@ -0,0 +1,112 @@
+#ifndef _GROUP_BY_ENGINE_H_
+#define _GROUP_BY_ENGINE_H_
+
+#include "qgsaggregatecalculator.h"
+#include "qgsattributes.h"
+#include "qgsfields.h"
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+
+#include <memory>
+#include <vector>
+
+class QgsExpressionContext;
+class QgsFeatureSource;
+class QgsFeedback;
+class QgsVectorLayer;
+
+/// @brief One aggregate of a group by run.
+struct GroupAggregate {
+   /// Expression or field name to aggregate.
+   QString expression;
+   /// Count, CountDistinct, CountMissing, Min, Max, Sum, Mean, Median, StDev, StDevSample,
+   /// Range, FirstQuartile, ThirdQuartile, InterQuartileRange, StringMinimumLength or
+   /// StringMaximumLength.
+   QgsAggregateCalculator::Aggregate aggregate = QgsAggregateCalculator::Count;
+   /// Name of the output field, empty for the aggregate and field name, e.g. "sum_population".
+   QString name;
+};
+
+/// @brief Settings of a group by run.
+struct GroupBySettings {
+   /// Expressions or field names whose values form the group key, empty for one group of all features.
+   QStringList group_by;
+   QList<GroupAggregate> aggregates;
+   /// Features read at a time.
+   int batch_size = 16384;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+};
+
+/// @brief Grouped aggregates of a vector layer in a single pass.
+///
+/// QgsAggregateCalculator computes one aggregate of one expression per call, so a report over
+/// many categories runs one filtered request per category and reads the layer again for every
+/// one. This engine reads the layer once, only with the attributes and geometries the
+/// expressions reference, and evaluates the key and aggregate expressions on all cores. Every
+/// worker compiles its own copies of the expressions into ExpressionKernel column kernels,
+/// evaluates them over the features of a run, and adds the features to a private hash table
+/// from group key to aggregate states. The tables are merged when the layer has been read.
+/// Groups are output sorted by their key. Key values are normalized before they are hashed:
+/// all nulls are one key, integers are 64 bit and floats are doubles, so equal keys from
+/// fields or expressions of different types form one group.
+///
+/// Numeric aggregates skip null and non-numeric values, which count as missing, like
+/// QgsAggregateCalculator. Min and Max also order strings, dates and times, and their field
+/// takes the type of those values. Values of different types in one Min or Max, or values
+/// other than numbers in a Range, fail the run with InvalidParameters. Sums are compensated,
+/// so the result does not depend on how the features were spread over the workers beyond the
+/// rounding of the total. The median and quartiles are exact and keep the values of every
+/// group in memory, the other aggregates use constant memory per group, apart from
+/// CountDistinct which keeps the distinct values.
+class GroupByEngine
+{
+public:
+   /// Result codes of run().
+   enum Result {
+      Success = 0,
+      InvalidParameters = 1,
+      Canceled = 2
+   };
+
+   /// @brief Constructor.
+   /// @param source The features to aggregate, must be valid for the whole run.
+   /// @param settings The key and aggregate expressions.
+   GroupByEngine(const QgsFeatureSource& source, const GroupBySettings& settings);
+
+   /// @brief Aggregates all features of the source.
+   /// @param context Expression context with the scopes of the layer, null for the global and
+   /// project scopes. Expressions must only use functions that are safe to run in threads.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return One of the Result codes.
+   int run(const QgsExpressionContext* context = nullptr, QgsFeedback* feedback = nullptr);
+
+   /// Key fields followed by one field per aggregate, valid after a successful run().
+   const QgsFields& output_fields() const {
+      return m_fields;
+   }
+
+   /// Number of groups of the last run.
+   int group_count() const {
+      return static_cast<int>(m_rows.size());
+   }
+
+   /// Keys and aggregates of every group of the last run, in the order of output_fields().
+   const std::vector<QgsAttributes>& rows() const {
+      return m_rows;
+   }
+
+   /// @brief Creates a memory layer without geometries holding the groups of the last run.
+   std::unique_ptr<QgsVectorLayer> create_layer(const QString& name) const;
+
+private:
+   const QgsFeatureSource& m_source;
+   GroupBySettings m_settings;
+   QgsFields m_fields;
+   std::vector<QgsAttributes> m_rows;
+};
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef _HILBERT_CURVE_H_
+#define _HILBERT_CURVE_H_
+
+#include <cstdint>
+#include <utility>
+
+/// Index of a cell along a Hilbert curve over a 2^16 × 2^16 grid.
+inline std::uint64_t hilbert_index(std::uint32_t x, std::uint32_t y) {
+   std::uint64_t index = 0;
+   for (std::uint32_t s = 1u << 15; s > 0; s >>= 1) {
+      const std::uint32_t rx = (x & s) ? 1 : 0;
+      const std::uint32_t ry = (y & s) ? 1 : 0;
+      index += static_cast<std::uint64_t>(s) * s * ((3 * rx) ^ ry);
+      if (ry == 0) {
+         if (rx == 1) {
+            x = s - 1 - x;
+            y = s - 1 - y;
+         }
+         std::swap(x, y);
+      }
+   }
+   return index;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#include "hilbert_rtree.h"
+#include "hilbert_curve.h"
+
+#include <cmath>
+#include <limits>
+
+namespace {
+
+/// Largest float not above the value.
+float round_down(double value) {
+   const float rounded = static_cast<float>(value);
+   return rounded > value ? std::nextafter(rounded, -std::numeric_limits<float>::infinity()) : rounded;
+}
+
+/// Smallest float not below the value.
+float round_up(double value) {
+   const float rounded = static_cast<float>(value);
+   return rounded < value ? std::nextafter(rounded, std::numeric_limits<float>::infinity()) : rounded;
+}
+
+}
+
+void HilbertRTree::add(double xmin, double ymin, double xmax, double ymax) {
+   m_boxes.push_back(round_down(xmin));
+   m_boxes.push_back(round_down(ymin));
+   m_boxes.push_back(round_up(xmax));
+   m_boxes.push_back(round_up(ymax));
+   ++m_item_count;
+}
+
+void HilbertRTree::finish() {
+   m_indices.clear();
+   m_level_ends.clear();
+   const std::size_t count = m_item_count;
+   if (count == 0) {
+      m_boxes.clear();
+      return;
+   }
+
+   float min_x = std::numeric_limits<float>::infinity();
+   float min_y = std::numeric_limits<float>::infinity();
+   float max_x = -std::numeric_limits<float>::infinity();
+   float max_y = -std::numeric_limits<float>::infinity();
+   for (std::size_t i = 0; i < count; ++i) {
+      if (m_boxes[4 * i] > m_boxes[4 * i + 2]) {
+         continue;
+      }
+      min_x = std::min(min_x, m_boxes[4 * i]);
+      min_y = std::min(min_y, m_boxes[4 * i + 1]);
+      max_x = std::max(max_x, m_boxes[4 * i + 2]);
+      max_y = std::max(max_y, m_boxes[4 * i + 3]);
+   }
+   const double scale_x = max_x > min_x ? 65535.0 / (static_cast<double>(max_x) - min_x) : 0.0;
+   const double scale_y = max_y > min_y ? 65535.0 / (static_cast<double>(max_y) - min_y) : 0.0;
+
+   // Sort the items by the Hilbert index of their centres, the index in the high bits. Empty
+   // items go last.
+   std::vector<std::uint64_t> keys(count);
+   for (std::size_t i = 0; i < count; ++i) {
+      if (m_boxes[4 * i] > m_boxes[4 * i + 2]) {
+         keys[i] = (std::uint64_t(0xffffffffu) << 32) | i;
+         continue;
+      }
+      const double x = 0.5 * (static_cast<double>(m_boxes[4 * i]) + m_boxes[4 * i + 2]);
+      const double y = 0.5 * (static_cast<double>(m_boxes[4 * i + 1]) + m_boxes[4 * i + 3]);
+      const std::uint64_t index = hilbert_index(static_cast<std::uint32_t>((x - min_x) * scale_x),
+                                                static_cast<std::uint32_t>((y - min_y) * scale_y));
+      keys[i] = (index << 32) | i;
+   }
+   std::sort(keys.begin(), keys.end());
+
+   // Count the nodes of all levels.
+   std::size_t node_count = count;
+   std::size_t level_count = count;
+   m_level_ends.push_back(count);
+   while (level_count > 1) {
+      level_count = (level_count + s_node_size - 1) / s_node_size;
+      node_count += level_count;
+      m_level_ends.push_back(node_count);
+   }
+
+   std::vector<float> boxes(4 * node_count);
+   m_indices.resize(node_count);
+   for (std::size_t i = 0; i < count; ++i) {
+      const std::uint32_t item = static_cast<std::uint32_t>(keys[i] & 0xffffffffu);
+      std::copy(m_boxes.begin() + 4 * item, m_boxes.begin() + 4 * item + 4, boxes.begin() + 4 * i);
+      m_indices[i] = item;
+   }
+   keys = std::vector<std::uint64_t>();
+
+   // Every node of the upper levels covers the boxes of up to s_node_size consecutive nodes below.
+   std::size_t node = count;
+   for (std::size_t level = 1; level < m_level_ends.size(); ++level) {
+      for (std::size_t child = level == 1 ? 0 : m_level_ends[level - 2]; child < m_level_ends[level - 1]; ++node) {
+         const std::size_t end = std::min(child + s_node_size, m_level_ends[level - 1]);
+         float* box = boxes.data() + 4 * node;
+         box[0] = box[1] = std::numeric_limits<float>::infinity();
+         box[2] = box[3] = -std::numeric_limits<float>::infinity();
+         m_indices[node] = static_cast<std::uint32_t>(child);
+         for (; child < end; ++child) {
+            box[0] = std::min(box[0], boxes[4 * child]);
+            box[1] = std::min(box[1], boxes[4 * child + 1]);
+            box[2] = std::max(box[2], boxes[4 * child + 2]);
+            box[3] = std::max(box[3], boxes[4 * child + 3]);
+         }
+      }
+   }
+   m_boxes.swap(boxes);
+}
+
+void HilbertRTree::query(double xmin, double ymin, double xmax, double ymax, std::vector<std::uint32_t>& result) const {
+   result.clear();
+   visit(xmin, ymin, xmax, ymax, [&result](std::uint32_t item) {
+      result.push_back(item);
+      return true;
+   });
+}
@@ -0,0 +1,88 @@
+#ifndef _HILBERT_RTREE_H_
+#define _HILBERT_RTREE_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/// @brief Static R-tree over rectangles, packed along a Hilbert curve.
+///
+/// Like the Flatbush index, the rectangles are sorted by the Hilbert index of their centres and
+/// grouped into nodes of s_node_size, level by level up to the root, all in flat arrays. The
+/// tree is built once and never modified, so any number of threads can query it at the same
+/// time without locks, unlike QgsSpatialIndex. Boxes are stored as floats rounded outwards, so
+/// queries may report items lying within float precision of the query rectangle.
+class HilbertRTree
+{
+public:
+   /// @brief Adds an item before finish(), the items are numbered in the order they are added.
+   ///
+   /// Items with xmin > xmax, e.g. features without geometry, are kept but never reported.
+   void add(double xmin, double ymin, double xmax, double ymax);
+
+   /// @brief Builds the tree from the added items.
+   void finish();
+
+   /// Number of items.
+   std::size_t size() const {
+      return m_item_count;
+   }
+
+   /// @brief Calls visit(item) for every item whose box intersects the rectangle.
+   ///
+   /// Stops early if visit returns false.
+   /// @return False if stopped early.
+   template <typename Visit>
+   bool visit(double xmin, double ymin, double xmax, double ymax, Visit&& visit) const;
+
+   /// @brief Collects the items whose box intersects the rectangle.
+   /// @param result Receives the items, in no particular order.
+   void query(double xmin, double ymin, double xmax, double ymax, std::vector<std::uint32_t>& result) const;
+
+private:
+   static constexpr std::size_t s_node_size = 16;
+
+   std::size_t m_item_count = 0;
+   /// Boxes of the items during add(), then of all nodes, leaves first and the root last, as
+   /// xmin, ymin, xmax, ymax.
+   std::vector<float> m_boxes;
+   /// Item of every leaf, first child of every inner node.
+   std::vector<std::uint32_t> m_indices;
+   /// End of every level in the node arrays, leaves first.
+   std::vector<std::size_t> m_level_ends;
+};
+
+template <typename Visit>
+bool HilbertRTree::visit(double xmin, double ymin, double xmax, double ymax, Visit&& visit) const {
+   if (m_level_ends.empty()) {
+      return true;
+   }
+   // Pending nodes with their level.
+   std::vector<std::pair<std::size_t, std::size_t>> stack;
+   stack.reserve(64);
+   stack.emplace_back(m_level_ends.back() - 1, m_level_ends.size() - 1);
+   while (!stack.empty()) {
+      const auto [node, level] = stack.back();
+      stack.pop_back();
+      const float* box = m_boxes.data() + 4 * node;
+      if (box[0] > xmax || box[1] > ymax || box[2] < xmin || box[3] < ymin) {
+         continue;
+      }
+      if (level == 0) {
+         if (!visit(m_indices[node])) {
+            return false;
+         }
+         continue;
+      }
+      const std::size_t first = m_indices[node];
+      const std::size_t end = std::min(first + s_node_size, m_level_ends[level - 1]);
+      for (std::size_t child = first; child < end; ++child) {
+         stack.emplace_back(child, level - 1);
+      }
+   }
+   return true;
+}
+
+#endif
@@ -0,0 +1,147 @@
+#include "idw_engine.h"
+#include "interpolator_points.h"
+#include "parallel_for.h"
+#include "point_kd_tree.h"
+
+#include "qgscoordinatereferencesystem.h"
+#include "qgsfeaturesource.h"
+#include "qgsfeedback.h"
+#include "qgsogrutils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+#include <gdal.h>
+
+IdwEngine::IdwEngine(const QList<QgsInterpolator::LayerData>& layer_data, const IdwSettings& settings)
+   : m_layer_data(layer_data), m_settings(settings) {
+}
+
+int IdwEngine::run(const QString& output_file, const QgsRectangle& extent, int columns, int rows, QgsFeedback* feedback) const {
+   if (m_layer_data.isEmpty() || columns <= 0 || rows <= 0 || extent.isEmpty()) {
+      return InvalidSource;
+   }
+
+   std::vector<double> x;
+   std::vector<double> y;
+   std::vector<double> values;
+   const QgsInterpolator::Result read_result = InterpolatorPoints(m_layer_data).read(x, y, values, feedback);
+   if (read_result == QgsInterpolator::Canceled) {
+      return Canceled;
+   }
+   if (read_result != QgsInterpolator::Success || x.empty()) {
+      return InvalidSource;
+   }
+   PointKdTree tree;
+   tree.build(x, y, values);
+   x = {};
+   y = {};
+   values = {};
+
+   GDALAllRegister();
+   GDALDriverH driver = GDALGetDriverByName(m_settings.output_format.toLocal8Bit().constData());
+   if (!driver || !GDALGetMetadataItem(driver, GDAL_DCAP_CREATE, nullptr)) {
+      return OutputDriverFailed;
+   }
+   char** options = nullptr;
+   options = CSLSetNameValue(options, "TILED", "YES");
+   options = CSLSetNameValue(options, "BIGTIFF", "IF_SAFER");
+   gdal::dataset_unique_ptr output(GDALCreate(driver, output_file.toUtf8().constData(), columns, rows, 1, GDT_Float32,
+                                              m_settings.output_format == QLatin1String("GTiff") ? options : nullptr));
+   CSLDestroy(options);
+   if (!output) {
+      return OutputCreateFailed;
+   }
+   const double cell_size_x = extent.width() / columns;
+   const double cell_size_y = extent.height() / rows;
+   double geo_transform[6] = {extent.xMinimum(), cell_size_x, 0.0, extent.yMaximum(), 0.0, -cell_size_y};
+   GDALSetGeoTransform(output.get(), geo_transform);
+   const QgsCoordinateReferenceSystem crs = m_layer_data.first().source ? m_layer_data.first().source->sourceCrs()
+                                                                        : QgsCoordinateReferenceSystem();
+   if (crs.isValid()) {
+      GDALSetProjection(output.get(), crs.toWkt(QgsCoordinateReferenceSystem::WKT_PREFERRED_GDAL).toUtf8().constData());
+   }
+   GDALRasterBandH output_band = GDALGetRasterBand(output.get(), 1);
+   GDALSetRasterNoDataValue(output_band, m_settings.output_nodata);
+
+   const int band_rows = std::max(1, m_settings.band_rows);
+   const std::size_t band_count = (static_cast<std::size_t>(rows) + band_rows - 1) / band_rows;
+   const int thread_count = resolve_thread_count(m_settings.thread_count);
+   const double max_distance = m_settings.search_radius > 0.0 ? m_settings.search_radius : std::numeric_limits<double>::infinity();
+   const double half_power = m_settings.distance_coefficient / 2.0;
+   // Same tolerance as the qgsDoubleNear() test in QgsIDWInterpolator, on squared distances.
+   const double coincident = 4.0 * std::numeric_limits<double>::epsilon();
+   const double coincident_squared = coincident * coincident;
+
+   std::vector<std::vector<PointKdTree::Neighbour>> worker_neighbours(thread_count);
+   std::vector<std::vector<float>> worker_buffers(thread_count);
+   std::mutex output_mutex;
+   std::size_t bands_done = 0;
+   std::atomic<bool> failed(false);
+   std::atomic<bool> canceled(false);
+
+   parallel_for(band_count, thread_count, [&](std::size_t band, int worker) {
+      if (canceled || failed) {
+         return;
+      }
+      if (feedback && feedback->isCanceled()) {
+         canceled = true;
+         return;
+      }
+      const int first_row = static_cast<int>(band) * band_rows;
+      const int row_count = std::min(band_rows, rows - first_row);
+      std::vector<PointKdTree::Neighbour>& neighbours = worker_neighbours[worker];
+      std::vector<float>& buffer = worker_buffers[worker];
+      buffer.resize(static_cast<std::size_t>(row_count) * columns);
+
+      for (int row = 0; row < row_count; ++row) {
+         const double cell_y = extent.yMaximum() - (first_row + row + 0.5) * cell_size_y;
+         float* output_row = buffer.data() + static_cast<std::size_t>(row) * columns;
+         for (int col = 0; col < columns; ++col) {
+            const double cell_x = extent.xMinimum() + (col + 0.5) * cell_size_x;
+            tree.nearest(cell_x, cell_y, m_settings.neighbours, max_distance, neighbours);
+
+            double sum_weighted = 0.0;
+            double sum_weights = 0.0;
+            bool exact = false;
+            for (const PointKdTree::Neighbour& neighbour : neighbours) {
+               if (neighbour.first <= coincident_squared) {
+                  output_row[col] = static_cast<float>(tree.value(neighbour.second));
+                  exact = true;
+                  break;
+               }
+               const double weight = half_power == 1.0 ? 1.0 / neighbour.first : std::pow(neighbour.first, -half_power);
+               sum_weighted += weight * tree.value(neighbour.second);
+               sum_weights += weight;
+            }
+            if (!exact) {
+               output_row[col] = sum_weights > 0.0 ? static_cast<float>(sum_weighted / sum_weights) : m_settings.output_nodata;
+            }
+         }
+      }
+
+      std::lock_guard<std::mutex> lock(output_mutex);
+      if (GDALRasterIO(output_band, GF_Write, 0, first_row, columns, row_count, buffer.data(), columns, row_count,
+                       GDT_Float32, 0, 0) != CE_None) {
+         failed = true;
+         return;
+      }
+      ++bands_done;
+      if (feedback) {
+         feedback->setProgress(100.0 * static_cast<double>(bands_done) / static_cast<double>(band_count));
+      }
+   });
+
+   if (canceled) {
+      gdal::fast_delete_and_close(output, driver, output_file);
+      return Canceled;
+   }
+   if (failed) {
+      return WriteFailed;
+   }
+   return Success;
+}
@@ -0,0 +1,71 @@
+#ifndef _IDW_ENGINE_H_
+#define _IDW_ENGINE_H_
+
+#include "qgsinterpolator.h"
+#include "qgsrectangle.h"
+
+#include <QList>
+#include <QString>
+
+class QgsFeedback;
+
+/// @brief Settings of an IDW interpolation engine run.
+struct IdwSettings {
+   /// Power of the inverse distance weights, like QgsIDWInterpolator::setDistanceCoefficient().
+   double distance_coefficient = 2.0;
+   /// Number of nearest points per cell, 0 uses all points within search_radius.
+   int neighbours = 12;
+   /// Only points this close contribute to a cell, 0 for no limit. Cells without any point get nodata.
+   double search_radius = 0.0;
+   /// Nodata value written to the output raster.
+   float output_nodata = -9999.0f;
+   /// Number of raster rows interpolated by one work item.
+   int band_rows = 64;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+   /// GDAL short name of the output format.
+   QString output_format = QStringLiteral("GTiff");
+};
+
+/// @brief Parallel replacement of QgsIDWInterpolator together with QgsGridFileWriter.
+///
+/// QgsIDWInterpolator::interpolatePoint() weighs every input point for every cell, and
+/// QgsGridFileWriter calls it one cell at a time and writes an ASCII grid. This engine
+/// caches the points the same way as QgsInterpolator, indexes them in a PointKdTree and
+/// weighs only the nearest points of each cell. Bands of rows are interpolated in parallel
+/// and written as binary blocks of a Float32 raster. With neighbours set to 0 and no search
+/// radius every point is weighed, which matches the QGIS interpolator up to summation order.
+class IdwEngine
+{
+public:
+   /// Result codes of run().
+   enum Result {
+      Success = 0,
+      InvalidSource = 1,
+      OutputDriverFailed = 2,
+      OutputCreateFailed = 3,
+      WriteFailed = 4,
+      Canceled = 5
+   };
+
+   /// @brief Constructor.
+   /// @param layer_data The input sources, as for QgsIDWInterpolator.
+   /// @param settings The interpolation and processing options.
+   IdwEngine(const QList<QgsInterpolator::LayerData>& layer_data, const IdwSettings& settings);
+
+   /// @brief Interpolates a grid into a raster file.
+   ///
+   /// Cells are sampled at their centres, like QgsGridFileWriter.
+   /// @param output_file Path of the Float32 raster to create.
+   /// @param extent Extent of the grid.
+   /// @param columns, rows Size of the grid in cells.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return One of the Result codes.
+   int run(const QString& output_file, const QgsRectangle& extent, int columns, int rows, QgsFeedback* feedback = nullptr) const;
+
+private:
+   QList<QgsInterpolator::LayerData> m_layer_data;
+   IdwSettings m_settings;
+};
+
+#endif
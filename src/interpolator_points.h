@@ -0,0 +1,38 @@
+#ifndef _INTERPOLATOR_POINTS_H_
+#define _INTERPOLATOR_POINTS_H_
+
+#include "qgsinterpolator.h"
+
+#include <vector>
+
+/// @brief Exposes the vertex cache of QgsInterpolator, so the points are read exactly like QGIS reads them.
+class InterpolatorPoints : public QgsInterpolator
+{
+public:
+   explicit InterpolatorPoints(const QList<QgsInterpolator::LayerData>& layer_data) : QgsInterpolator(layer_data) {
+   }
+
+   int interpolatePoint(double, double, double&, QgsFeedback*) override {
+      return 1;
+   }
+
+   /// @brief Reads the vertices of all sources into flat arrays.
+   Result read(std::vector<double>& x, std::vector<double>& y, std::vector<double>& values, QgsFeedback* feedback) {
+      const Result result = cacheBaseData(feedback);
+      if (result != Success) {
+         return result;
+      }
+      x.reserve(mCachedBaseData.size());
+      y.reserve(mCachedBaseData.size());
+      values.reserve(mCachedBaseData.size());
+      for (const QgsInterpolatorVertexData& vertex : std::as_const(mCachedBaseData)) {
+         x.push_back(vertex.x);
+         y.push_back(vertex.y);
+         values.push_back(vertex.z);
+      }
+      mCachedBaseData.clear();
+      return Success;
+   }
+};
+
+#endif
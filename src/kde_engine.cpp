@@ -0,0 +1,287 @@
+#include "kde_engine.h"
+#include "parallel_for.h"
+
+#include "qgsfeature.h"
+#include "qgsfeatureiterator.h"
+#include "qgsfeaturerequest.h"
+#include "qgsfeaturesource.h"
+#include "qgsfeedback.h"
+#include "qgsgeometry.h"
+#include "qgsogrutils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <gdal.h>
+
+namespace {
+
+/// Nodata value of the output, the same as QgsKernelDensityEstimation.
+constexpr float s_nodata = -9999.0f;
+
+/// Upper limit of the number of weights held by the prebuilt stencils.
+constexpr std::size_t s_max_stencil_weights = std::size_t(1) << 24;
+
+/// A point in the bucket of one tile, its pixel relative to the tile origin.
+struct TilePoint {
+   int col;
+   int row;
+   /// Position inside the pixel in [0, 1), x growing east and y growing south.
+   float offset_x;
+   float offset_y;
+   float weight;
+   std::uint32_t stencil;
+};
+
+}
+
+KdeEngine::KdeEngine(const KdeSettings& settings) : m_settings(settings) {
+}
+
+int KdeEngine::run(QgsFeatureSource* source, const QString& output_file, QgsFeedback* feedback) const {
+   if (!source || !(m_settings.pixel_size > 0.0)) {
+      return InvalidParameters;
+   }
+   const int radius_field = m_settings.radius_field.isEmpty() ? -1 : source->fields().lookupField(m_settings.radius_field);
+   const int weight_field = m_settings.weight_field.isEmpty() ? -1 : source->fields().lookupField(m_settings.weight_field);
+   if ((!m_settings.radius_field.isEmpty() && radius_field < 0) || (!m_settings.weight_field.isEmpty() && weight_field < 0)) {
+      return InvalidParameters;
+   }
+   if (radius_field < 0 && !(m_settings.radius > 0.0)) {
+      return InvalidParameters;
+   }
+
+   // Grow the source extent by the largest radius, like QgsKernelDensityEstimation::calculateBounds().
+   const double max_radius = radius_field >= 0 ? source->maximumValue(radius_field).toDouble() : m_settings.radius;
+   QgsRectangle bounds = source->sourceExtent();
+   if (bounds.isNull() || !(max_radius > 0.0)) {
+      return InvalidParameters;
+   }
+   bounds.grow(max_radius);
+
+   const double pixel_size = m_settings.pixel_size;
+   const int rows = std::max(static_cast<int>(std::ceil(bounds.height() / pixel_size)) + 1, 1);
+   const int cols = std::max(static_cast<int>(std::ceil(bounds.width() / pixel_size)) + 1, 1);
+
+   GDALAllRegister();
+   GDALDriverH driver = GDALGetDriverByName(m_settings.output_format.toLocal8Bit().constData());
+   if (!driver || !GDALGetMetadataItem(driver, GDAL_DCAP_CREATE, nullptr)) {
+      return DriverError;
+   }
+
+   const int tile_size = std::max(16, m_settings.tile_size);
+   const QByteArray block_size = QByteArray::number(tile_size);
+   char** options = nullptr;
+   options = CSLSetNameValue(options, "TILED", "YES");
+   options = CSLSetNameValue(options, "BIGTIFF", "IF_SAFER");
+   if (tile_size % 16 == 0) {
+      options = CSLSetNameValue(options, "BLOCKXSIZE", block_size.constData());
+      options = CSLSetNameValue(options, "BLOCKYSIZE", block_size.constData());
+   }
+   gdal::dataset_unique_ptr output(GDALCreate(driver, output_file.toUtf8().constData(), cols, rows, 1, GDT_Float32,
+                                              m_settings.output_format == QLatin1String("GTiff") ? options : nullptr));
+   CSLDestroy(options);
+   if (!output) {
+      return FileCreationError;
+   }
+   double geo_transform[6] = {bounds.xMinimum(), pixel_size, 0.0, bounds.yMaximum(), 0.0, -pixel_size};
+   GDALSetGeoTransform(output.get(), geo_transform);
+   GDALRasterBandH output_band = GDALGetRasterBand(output.get(), 1);
+   if (!output_band) {
+      return FileCreationError;
+   }
+   GDALSetRasterNoDataValue(output_band, s_nodata);
+
+   // Bucket the points by every tile their footprint overlaps.
+   const int tiles_x = (cols + tile_size - 1) / tile_size;
+   const int tiles_y = (rows + tile_size - 1) / tile_size;
+   const std::size_t tile_count = static_cast<std::size_t>(tiles_x) * tiles_y;
+   std::vector<std::vector<TilePoint>> tiles(tile_count);
+   std::map<double, std::uint32_t> radius_indices;
+   std::vector<double> radii;
+
+   QgsFeatureRequest request;
+   QgsAttributeList attributes;
+   for (int field : {radius_field, weight_field}) {
+      if (field >= 0) {
+         attributes << field;
+      }
+   }
+   request.setSubsetOfAttributes(attributes);
+   QgsFeatureIterator features = source->getFeatures(request);
+   const long long feature_count = std::max<long long>(1, source->featureCount());
+   long long features_read = 0;
+
+   QgsFeature feature;
+   while (features.nextFeature(feature)) {
+      if (feedback && feedback->isCanceled()) {
+         gdal::fast_delete_and_close(output, driver, output_file);
+         return Canceled;
+      }
+      if (feedback && ++features_read % 10000 == 0) {
+         feedback->setProgress(30.0 * static_cast<double>(features_read) / static_cast<double>(feature_count));
+      }
+      const QgsGeometry geometry = feature.geometry();
+      if (geometry.isNull()) {
+         continue;
+      }
+      const double radius = radius_field >= 0 ? feature.attribute(radius_field).toDouble() : m_settings.radius;
+      if (!(radius > 0.0)) {
+         continue;
+      }
+      const float weight = weight_field >= 0 ? static_cast<float>(feature.attribute(weight_field).toDouble()) : 1.0f;
+      auto inserted = radius_indices.emplace(radius, static_cast<std::uint32_t>(radii.size()));
+      if (inserted.second) {
+         radii.push_back(radius);
+      }
+      const std::uint32_t stencil = inserted.first->second;
+      const int buffer = KdeStencil::buffer_size(radius, pixel_size);
+
+      const QgsMultiPointXY points = geometry.isMultipart() ? geometry.asMultiPoint() : QgsMultiPointXY({geometry.asPoint()});
+      for (const QgsPointXY& point : points) {
+         if (!bounds.contains(point)) {
+            continue;
+         }
+         const double x = (point.x() - bounds.xMinimum()) / pixel_size;
+         const double y = (bounds.yMaximum() - point.y()) / pixel_size;
+         const int col = static_cast<int>(std::floor(x));
+         const int row = static_cast<int>(std::floor(y));
+         const TilePoint tile_point = {col, row, static_cast<float>(x - col), static_cast<float>(y - row), weight, stencil};
+
+         const int first_tile_x = std::max(0, col - buffer) / tile_size;
+         const int last_tile_x = std::min(cols - 1, col + buffer) / tile_size;
+         const int first_tile_y = std::max(0, row - buffer) / tile_size;
+         const int last_tile_y = std::min(rows - 1, row + buffer) / tile_size;
+         for (int tile_y = first_tile_y; tile_y <= last_tile_y; ++tile_y) {
+            for (int tile_x = first_tile_x; tile_x <= last_tile_x; ++tile_x) {
+               TilePoint relative = tile_point;
+               relative.col -= tile_x * tile_size;
+               relative.row -= tile_y * tile_size;
+               tiles[static_cast<std::size_t>(tile_y) * tiles_x + tile_x].push_back(relative);
+            }
+         }
+      }
+   }
+
+   // Prebuild the stencils of all radii that fit the weight budget, with as many sub-pixel
+   // phases as the budget share of each radius allows. Radii beyond the budget are built by
+   // the workers when needed, with one phase.
+   const int thread_count = resolve_thread_count(m_settings.thread_count);
+   std::vector<KdeStencil> stencils(radii.size());
+   std::vector<int> stencil_phases(radii.size(), 0);
+   std::size_t budget = s_max_stencil_weights;
+   for (std::size_t i = 0; i < radii.size(); ++i) {
+      const std::size_t share = budget / (radii.size() - i);
+      int phases = std::max(1, m_settings.stencil_phases);
+      while (phases > 1 && KdeStencil::weight_count(radii[i], pixel_size, phases) > share) {
+         --phases;
+      }
+      const std::size_t weights = KdeStencil::weight_count(radii[i], pixel_size, phases);
+      if (weights <= budget) {
+         stencil_phases[i] = phases;
+         budget -= weights;
+      }
+   }
+   parallel_for(radii.size(), thread_count, [&](std::size_t i, int) {
+      if (stencil_phases[i] > 0) {
+         stencils[i].build(m_settings.kernel, radii[i], pixel_size, stencil_phases[i]);
+      }
+   });
+
+   // Accumulate every tile in a worker buffer and write the finished tiles one at a time.
+   std::vector<std::vector<float>> worker_values(thread_count);
+   std::vector<std::vector<unsigned char>> worker_touched(thread_count);
+   std::vector<KdeStencil> worker_stencils(thread_count);
+   std::vector<double> worker_stencil_radii(thread_count, 0.0);
+   std::mutex output_mutex;
+   std::size_t tiles_done = 0;
+   std::atomic<bool> failed(false);
+   std::atomic<bool> canceled(false);
+
+   parallel_for(tile_count, thread_count, [&](std::size_t tile, int worker) {
+      if (canceled || failed) {
+         return;
+      }
+      if (feedback && feedback->isCanceled()) {
+         canceled = true;
+         return;
+      }
+
+      const int first_row = static_cast<int>(tile / tiles_x) * tile_size;
+      const int first_col = static_cast<int>(tile % tiles_x) * tile_size;
+      const int tile_rows = std::min(tile_size, rows - first_row);
+      const int tile_cols = std::min(tile_size, cols - first_col);
+      std::vector<float>& values = worker_values[worker];
+      std::vector<unsigned char>& touched = worker_touched[worker];
+      values.assign(static_cast<std::size_t>(tile_rows) * tile_cols, 0.0f);
+      touched.assign(values.size(), 0);
+
+      const std::vector<TilePoint> points = std::move(tiles[tile]);
+      for (const TilePoint& point : points) {
+         const KdeStencil* stencil = &stencils[point.stencil];
+         if (stencil_phases[point.stencil] == 0) {
+            if (worker_stencil_radii[worker] != radii[point.stencil]) {
+               worker_stencils[worker].build(m_settings.kernel, radii[point.stencil], pixel_size, 1);
+               worker_stencil_radii[worker] = radii[point.stencil];
+            }
+            stencil = &worker_stencils[worker];
+         }
+         const int buffer = stencil->buffer();
+         const int size = stencil->size();
+         const int phase_x = stencil->phase_of(point.offset_x);
+         const int phase_y = stencil->phase_of(point.offset_y);
+         const float* weights = stencil->weights(phase_x, phase_y);
+         const int* ranges = stencil->row_ranges(phase_x, phase_y);
+
+         const int stencil_col = point.col - buffer;
+         const int stencil_row = point.row - buffer;
+         const int first = std::max(0, -stencil_row);
+         const int last = std::min(size, tile_rows - stencil_row);
+         for (int i = first; i < last; ++i) {
+            const int begin = std::max(ranges[2 * i], -stencil_col);
+            const int end = std::min(ranges[2 * i + 1], tile_cols - stencil_col);
+            if (begin >= end) {
+               continue;
+            }
+            const float* row_weights = weights + static_cast<std::size_t>(i) * size;
+            const std::size_t offset = static_cast<std::size_t>(stencil_row + i) * tile_cols + stencil_col;
+            float* row_values = values.data() + offset;
+            for (int j = begin; j < end; ++j) {
+               row_values[j] += point.weight * row_weights[j];
+            }
+            std::memset(touched.data() + offset + begin, 1, end - begin);
+         }
+      }
+      for (std::size_t i = 0; i < values.size(); ++i) {
+         if (!touched[i]) {
+            values[i] = s_nodata;
+         }
+      }
+
+      std::lock_guard<std::mutex> lock(output_mutex);
+      if (GDALRasterIO(output_band, GF_Write, first_col, first_row, tile_cols, tile_rows, values.data(), tile_cols,
+                       tile_rows, GDT_Float32, 0, 0) != CE_None) {
+         failed = true;
+         return;
+      }
+      ++tiles_done;
+      if (feedback) {
+         feedback->setProgress(30.0 + 70.0 * static_cast<double>(tiles_done) / static_cast<double>(tile_count));
+      }
+   });
+
+   if (canceled) {
+      gdal::fast_delete_and_close(output, driver, output_file);
+      return Canceled;
+   }
+   if (failed) {
+      return RasterIoError;
+   }
+   return Success;
+}
@@ -0,0 +1,72 @@
+#ifndef _KDE_ENGINE_H_
+#define _KDE_ENGINE_H_
+
+#include "kde_stencil.h"
+
+#include <QString>
+
+class QgsFeatureSource;
+class QgsFeedback;
+
+/// @brief Settings of a kernel density estimation engine run.
+struct KdeSettings {
+   /// Fixed search radius in map units, used when radius_field is empty.
+   double radius = 0.0;
+   /// Field holding the search radius of every feature, or empty for the fixed radius.
+   QString radius_field;
+   /// Field holding the weight of every feature, or empty for weight 1.
+   QString weight_field;
+   /// Output pixel size in map units.
+   double pixel_size = 0.0;
+   /// Kernel shape, output scaling and decay ratio.
+   KdeKernel kernel;
+   /// Width and height of the output tiles in pixels.
+   int tile_size = 512;
+   /// Sub-pixel positions per axis of the kernel stencils, see KdeStencil.
+   int stencil_phases = 8;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+   /// GDAL short name of the output format.
+   QString output_format = QStringLiteral("GTiff");
+};
+
+/// @brief Parallel replacement of QgsKernelDensityEstimation.
+///
+/// QgsKernelDensityEstimation::addFeature() reads, updates and writes back the output
+/// raster block under every point and evaluates the kernel function for every cell. This
+/// engine buckets the points by the output tiles their footprint overlaps, and every
+/// worker accumulates a whole tile in its own float buffer from precomputed KdeStencil
+/// weights. Each finished tile is written once, so the output is never read back and never
+/// held in memory as a whole.
+class KdeEngine
+{
+public:
+   /// Result codes of run(), the first ones matching QgsKernelDensityEstimation::Result.
+   enum Result {
+      Success = 0,
+      DriverError = 1,
+      InvalidParameters = 2,
+      FileCreationError = 3,
+      RasterIoError = 4,
+      Canceled = 5
+   };
+
+   /// @brief Constructor.
+   /// @param settings The kernel and processing options.
+   explicit KdeEngine(const KdeSettings& settings);
+
+   /// @brief Computes the density surface of the points of source into output_file.
+   ///
+   /// The output covers the source extent grown by the largest radius, in the CRS of the
+   /// source, with the same size, geotransform and nodata value as QgsKernelDensityEstimation.
+   /// @param source Point or multipoint features.
+   /// @param output_file Path of the Float32 raster to create.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return One of the Result codes.
+   int run(QgsFeatureSource* source, const QString& output_file, QgsFeedback* feedback = nullptr) const;
+
+private:
+   KdeSettings m_settings;
+};
+
+#endif
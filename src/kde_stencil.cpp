@@ -0,0 +1,94 @@
+#include "kde_stencil.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+constexpr double s_pi = 3.14159265358979323846;
+
+}
+
+double KdeKernel::value(double distance, double bandwidth) const {
+   const double ratio = distance / bandwidth;
+   const bool scaled = output_values == QgsKernelDensityEstimation::OutputScaled;
+   switch (shape) {
+   case QgsKernelDensityEstimation::KernelUniform:
+      return scaled ? (2.0 / (s_pi * bandwidth)) * (0.5 / bandwidth) : 1.0;
+   case QgsKernelDensityEstimation::KernelQuartic: {
+      const double value = std::pow(1.0 - ratio * ratio, 2);
+      return scaled ? (116.0 / (5.0 * s_pi * bandwidth * bandwidth)) * (15.0 / 16.0) * value : value;
+   }
+   case QgsKernelDensityEstimation::KernelTriweight: {
+      const double value = std::pow(1.0 - ratio * ratio, 3);
+      return scaled ? (128.0 / (35.0 * s_pi * bandwidth * bandwidth)) * (35.0 / 32.0) * value : value;
+   }
+   case QgsKernelDensityEstimation::KernelEpanechnikov: {
+      const double value = 1.0 - ratio * ratio;
+      return scaled ? (8.0 / (3.0 * s_pi * bandwidth * bandwidth)) * (3.0 / 4.0) * value : value;
+   }
+   case QgsKernelDensityEstimation::KernelTriangular: {
+      const double value = 1.0 - (1.0 - decay_ratio) * ratio;
+      // Negative decays are not normalized, like in QgsKernelDensityEstimation.
+      if (scaled && decay_ratio >= 0.0) {
+         return 3.0 / ((1.0 + 2.0 * decay_ratio) * s_pi * bandwidth * bandwidth) * value;
+      }
+      return value;
+   }
+   }
+   return 0.0;
+}
+
+int KdeStencil::buffer_size(double radius, double pixel_size) {
+   int buffer = static_cast<int>(radius / pixel_size);
+   if (radius - pixel_size * buffer > 0.5) {
+      ++buffer;
+   }
+   return buffer;
+}
+
+std::size_t KdeStencil::weight_count(double radius, double pixel_size, int phases) {
+   const std::size_t size = 2 * static_cast<std::size_t>(buffer_size(radius, pixel_size)) + 1;
+   return size * size * phases * phases;
+}
+
+void KdeStencil::build(const KdeKernel& kernel, double radius, double pixel_size, int phases) {
+   m_buffer = buffer_size(radius, pixel_size);
+   m_phases = std::max(1, phases);
+   const int n = size();
+   m_weights.assign(static_cast<std::size_t>(n) * n * m_phases * m_phases, 0.0f);
+   m_row_ranges.assign(static_cast<std::size_t>(2) * n * m_phases * m_phases, 0);
+
+   const double radius_squared = radius * radius;
+   std::vector<double> dx_squared(n);
+   for (int phase_y = 0; phase_y < m_phases; ++phase_y) {
+      for (int phase_x = 0; phase_x < m_phases; ++phase_x) {
+         // Distances are measured from the centre of the sub-pixel position to the pixel centres.
+         const double offset_x = (phase_x + 0.5) / m_phases;
+         const double offset_y = (phase_y + 0.5) / m_phases;
+         for (int col = 0; col < n; ++col) {
+            const double dx = (col - m_buffer + 0.5 - offset_x) * pixel_size;
+            dx_squared[col] = dx * dx;
+         }
+
+         float* weights = m_weights.data() + static_cast<std::size_t>(phase_y * m_phases + phase_x) * n * n;
+         int* ranges = m_row_ranges.data() + static_cast<std::size_t>(phase_y * m_phases + phase_x) * 2 * n;
+         for (int row = 0; row < n; ++row) {
+            const double dy = (row - m_buffer + 0.5 - offset_y) * pixel_size;
+            int begin = n;
+            int end = 0;
+            for (int col = 0; col < n; ++col) {
+               const double distance_squared = dx_squared[col] + dy * dy;
+               if (distance_squared > radius_squared) {
+                  continue;
+               }
+               weights[static_cast<std::size_t>(row) * n + col] = static_cast<float>(kernel.value(std::sqrt(distance_squared), radius));
+               begin = std::min(begin, col);
+               end = col + 1;
+            }
+            ranges[2 * row] = begin < end ? begin : 0;
+            ranges[2 * row + 1] = begin < end ? end : 0;
+         }
+      }
+   }
+}
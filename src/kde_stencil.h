@@ -0,0 +1,86 @@
+#ifndef _KDE_STENCIL_H_
+#define _KDE_STENCIL_H_
+
+#include "qgskde.h"
+
+#include <cstddef>
+#include <vector>
+
+/// @brief Kernel shape and scaling of a kernel density estimation.
+struct KdeKernel {
+   QgsKernelDensityEstimation::KernelShape shape = QgsKernelDensityEstimation::KernelQuartic;
+   QgsKernelDensityEstimation::OutputValues output_values = QgsKernelDensityEstimation::OutputRaw;
+   /// Decay ratio, triangular kernels only.
+   double decay_ratio = 0.0;
+
+   /// @brief Returns the kernel value at a distance from the point.
+   ///
+   /// Uses the same formulas as QgsKernelDensityEstimation::calculateKernelValue().
+   /// @param distance Distance from the point, at most bandwidth.
+   /// @param bandwidth Search radius in map units.
+   double value(double distance, double bandwidth) const;
+};
+
+/// @brief Precomputed kernel weights of one search radius at one pixel size.
+///
+/// The weights of a point only depend on where the point lies inside its pixel. That
+/// offset is quantized into phases × phases sub-pixel positions, and for every position
+/// the stencil stores the (2 buffer + 1)² weights together with the columns of every
+/// stencil row that lie inside the radius. Accumulating a point is then a multiply-add
+/// over these rows, without evaluating the kernel per cell. The position error is at most
+/// half a pixel divided by phases, which is small relative to a radius of buffer pixels.
+class KdeStencil
+{
+public:
+   /// @brief Computes the weights of a radius.
+   /// @param kernel Kernel shape and scaling.
+   /// @param radius Search radius in map units.
+   /// @param pixel_size Output pixel size in map units.
+   /// @param phases Number of sub-pixel positions per axis, at least 1.
+   void build(const KdeKernel& kernel, double radius, double pixel_size, int phases);
+
+   /// Radius of the stencil in pixels, the same as QgsKernelDensityEstimation uses.
+   int buffer() const {
+      return m_buffer;
+   }
+
+   /// Width and height of the stencil in pixels.
+   int size() const {
+      return 2 * m_buffer + 1;
+   }
+
+   int phases() const {
+      return m_phases;
+   }
+
+   /// @brief Returns the sub-pixel position index of a pixel offset.
+   /// @param offset Offset of the point inside its pixel, in [0, 1).
+   int phase_of(double offset) const {
+      const int phase = static_cast<int>(offset * m_phases);
+      return phase < 0 ? 0 : (phase >= m_phases ? m_phases - 1 : phase);
+   }
+
+   /// Weights of one sub-pixel position, size() rows of size() values, north to south.
+   const float* weights(int phase_x, int phase_y) const {
+      return m_weights.data() + static_cast<std::size_t>(phase_y * m_phases + phase_x) * size() * size();
+   }
+
+   /// Columns [begin, end) of every row of weights() inside the radius, as size() pairs.
+   const int* row_ranges(int phase_x, int phase_y) const {
+      return m_row_ranges.data() + static_cast<std::size_t>(phase_y * m_phases + phase_x) * 2 * size();
+   }
+
+   /// Returns the number of weights a stencil of a radius and phase count holds.
+   static std::size_t weight_count(double radius, double pixel_size, int phases);
+
+   /// Returns the stencil radius in pixels, rounded like QgsKernelDensityEstimation::radiusSizeInPixels().
+   static int buffer_size(double radius, double pixel_size);
+
+private:
+   int m_buffer = 0;
+   int m_phases = 1;
+   std::vector<float> m_weights;
+   std::vector<int> m_row_ranges;
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "las_writer.h"
+
+#include <QDate>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+/// Size of a variable length record header.
+constexpr int s_vlr_header_size = 54;
+/// Record id of the OGC WKT coordinate system record of the LASF_Projection user.
+constexpr quint16 s_wkt_record_id = 2112;
+
+template <typename T>
+char* put(char* output, T value) {
+   qToLittleEndian<T>(value, output);
+   return output + sizeof(T);
+}
+
+char* put_double(char* output, double value) {
+   quint64 bits;
+   std::memcpy(&bits, &value, sizeof(bits));
+   return put<quint64>(output, bits);
+}
+
+/// Writes a zero padded text field of a fixed size.
+char* put_text(char* output, const char* text, int size) {
+   std::memset(output, 0, size);
+   std::memcpy(output, text, std::min<std::size_t>(std::strlen(text), size));
+   return output + size;
+}
+
+/// Stored integer of a coordinate, sets overflow instead of clamping values that do not fit.
+qint32 quantize(double value, double offset, double scale, bool& overflow) {
+   const double stored = std::round((value - offset) / scale);
+   if (!(stored >= static_cast<double>(std::numeric_limits<qint32>::lowest())
+         && stored <= static_cast<double>(std::numeric_limits<qint32>::max()))) {
+      overflow = true;
+      return 0;
+   }
+   return static_cast<qint32>(stored);
+}
+
+}
+
+bool LasWriter::open(const QString& path, const QgsCoordinateReferenceSystem& crs, const QgsVector3D& scale,
+                     const QgsVector3D& offset) {
+   m_scale = scale;
+   m_offset = offset;
+   m_point_count = 0;
+   m_minimum = QgsVector3D();
+   m_maximum = QgsVector3D();
+   m_wkt = crs.isValid() ? crs.toWkt(QgsCoordinateReferenceSystem::WKT_PREFERRED_GDAL).toUtf8() : QByteArray();
+   if (!m_wkt.isEmpty()) {
+      // Null terminated, and small enough for the 16-bit record length.
+      m_wkt = m_wkt.left(std::numeric_limits<quint16>::max() - 1);
+      m_wkt.append('\0');
+   }
+   m_file.setFileName(path);
+   if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+      return false;
+   }
+   const QByteArray bytes = header();
+   return m_file.write(bytes) == bytes.size();
+}
+
+QByteArray LasWriter::header() const {
+   const int vlr_size = m_wkt.isEmpty() ? 0 : s_vlr_header_size + m_wkt.size();
+   QByteArray bytes(s_header_size + vlr_size, '\0');
+   char* output = bytes.data();
+   const QDate today = QDate::currentDate();
+
+   output = put_text(output, "LASF", 4);
+   output = put<quint16>(output, 0);
+   // Global encoding: the CRS is stored as WKT.
+   output = put<quint16>(output, m_wkt.isEmpty() ? 0 : 16);
+   output += 16;
+   output = put<quint8>(output, 1);
+   output = put<quint8>(output, 4);
+   output = put_text(output, "OTHER", 32);
+   output = put_text(output, "QGIS plugin point cloud pipeline", 32);
+   output = put<quint16>(output, static_cast<quint16>(today.dayOfYear()));
+   output = put<quint16>(output, static_cast<quint16>(today.year()));
+   output = put<quint16>(output, s_header_size);
+   output = put<quint32>(output, static_cast<quint32>(s_header_size + vlr_size));
+   output = put<quint32>(output, m_wkt.isEmpty() ? 0 : 1);
+   output = put<quint8>(output, 6);
+   output = put<quint16>(output, s_record_size);
+   // Legacy point counts stay 0 for format 6.
+   output += 4 + 5 * 4;
+   output = put_double(output, m_scale.x());
+   output = put_double(output, m_scale.y());
+   output = put_double(output, m_scale.z());
+   output = put_double(output, m_offset.x());
+   output = put_double(output, m_offset.y());
+   output = put_double(output, m_offset.z());
+   output = put_double(output, m_maximum.x());
+   output = put_double(output, m_minimum.x());
+   output = put_double(output, m_maximum.y());
+   output = put_double(output, m_minimum.y());
+   output = put_double(output, m_maximum.z());
+   output = put_double(output, m_minimum.z());
+   // No waveform data and no extended records.
+   output += 8 + 8 + 4;
+   output = put<quint64>(output, m_point_count);
+   // All points are first returns.
+   output = put<quint64>(output, m_point_count);
+   output += 14 * 8;
+
+   if (!m_wkt.isEmpty()) {
+      output = put<quint16>(output, 0);
+      output = put_text(output, "LASF_Projection", 16);
+      output = put<quint16>(output, s_wkt_record_id);
+      output = put<quint16>(output, static_cast<quint16>(m_wkt.size()));
+      output = put_text(output, "OGC WKT", 32);
+      std::memcpy(output, m_wkt.constData(), m_wkt.size());
+   }
+   return bytes;
+}
+
+void LasWriter::encode(const PointCloudBuffer& points, Records& records) const {
+   const std::size_t count = points.size();
+   records.count = count;
+   records.overflow = false;
+   records.data.resize(count * s_record_size);
+   if (count == 0) {
+      return;
+   }
+   double minimum[3] = {points.x[0], points.y[0], points.z[0]};
+   double maximum[3] = {points.x[0], points.y[0], points.z[0]};
+   char* output = records.data.data();
+   for (std::size_t i = 0; i < count; ++i) {
+      minimum[0] = std::min(minimum[0], points.x[i]);
+      minimum[1] = std::min(minimum[1], points.y[i]);
+      minimum[2] = std::min(minimum[2], points.z[i]);
+      maximum[0] = std::max(maximum[0], points.x[i]);
+      maximum[1] = std::max(maximum[1], points.y[i]);
+      maximum[2] = std::max(maximum[2], points.z[i]);
+      output = put<qint32>(output, quantize(points.x[i], m_offset.x(), m_scale.x(), records.overflow));
+      output = put<qint32>(output, quantize(points.y[i], m_offset.y(), m_scale.y(), records.overflow));
+      output = put<qint32>(output, quantize(points.z[i], m_offset.z(), m_scale.z(), records.overflow));
+      output = put<quint16>(output, points.intensity[i]);
+      // Return 1 of 1, no flags.
+      output = put<quint8>(output, 0x11);
+      output = put<quint8>(output, 0);
+      output = put<quint8>(output, points.classification[i]);
+      // User data, scan angle, point source id and GPS time.
+      std::memset(output, 0, 1 + 2 + 2 + 8);
+      output += 1 + 2 + 2 + 8;
+   }
+   records.minimum = QgsVector3D(minimum[0], minimum[1], minimum[2]);
+   records.maximum = QgsVector3D(maximum[0], maximum[1], maximum[2]);
+}
+
+bool LasWriter::write(const Records& records) {
+   if (records.overflow) {
+      return false;
+   }
+   if (records.count == 0) {
+      return true;
+   }
+   if (m_point_count == 0) {
+      m_minimum = records.minimum;
+      m_maximum = records.maximum;
+   } else {
+      m_minimum = QgsVector3D(std::min(m_minimum.x(), records.minimum.x()), std::min(m_minimum.y(), records.minimum.y()),
+                              std::min(m_minimum.z(), records.minimum.z()));
+      m_maximum = QgsVector3D(std::max(m_maximum.x(), records.maximum.x()), std::max(m_maximum.y(), records.maximum.y()),
+                              std::max(m_maximum.z(), records.maximum.z()));
+   }
+   m_point_count += records.count;
+   const qint64 size = static_cast<qint64>(records.data.size());
+   return m_file.write(records.data.data(), size) == size;
+}
+
+bool LasWriter::close() {
+   const QByteArray bytes = header();
+   const bool written = m_file.seek(0) && m_file.write(bytes) == bytes.size() && m_file.flush();
+   m_file.close();
+   return written;
+}
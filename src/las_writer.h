@@ -0,0 +1,74 @@
+#ifndef _LAS_WRITER_H_
+#define _LAS_WRITER_H_
+
+#include "point_cloud_buffer.h"
+
+#include "qgscoordinatereferencesystem.h"
+#include "qgsvector3d.h"
+
+#include <QFile>
+#include <QString>
+
+#include <cstdint>
+#include <vector>
+
+/// @brief Streams points into an uncompressed LAS 1.4 file with point data record format 6.
+///
+/// The header is written with empty counts when the file is opened and rewritten by close()
+/// with the point count and bounds, so points can be appended in any number of calls while
+/// only the records of one call are held in memory. Format 6 has 64-bit point counts and the
+/// CRS is stored as a WKT record, as LAS 1.4 requires for it. Points are written as first of
+/// one return, with their intensity and classification. Coordinates that do not fit the 32-bit
+/// integers of the quantization fail the write instead of being clamped.
+class LasWriter
+{
+public:
+   /// Encoded point records and the bounds of their coordinates.
+   struct Records {
+      std::vector<char> data;
+      std::uint64_t count = 0;
+      QgsVector3D minimum;
+      QgsVector3D maximum;
+      /// A coordinate does not fit the 32-bit integers of the quantization.
+      bool overflow = false;
+   };
+
+   /// @brief Creates the file and writes a provisional header.
+   /// @param scale, offset Quantization of the coordinates, value = offset + scale * stored integer.
+   /// @return False if the file could not be created.
+   bool open(const QString& path, const QgsCoordinateReferenceSystem& crs, const QgsVector3D& scale,
+             const QgsVector3D& offset);
+
+   /// @brief Encodes points as point data records, may be called from any thread.
+   void encode(const PointCloudBuffer& points, Records& records) const;
+
+   /// @brief Appends encoded records.
+   /// @return False on a write error, or if a coordinate of the records overflows the
+   /// quantization, in which case nothing is written.
+   bool write(const Records& records);
+
+   /// @brief Writes the final header and closes the file.
+   /// @return False on a write error.
+   bool close();
+
+   /// Number of points written so far.
+   std::uint64_t point_count() const {
+      return m_point_count;
+   }
+
+private:
+   static constexpr int s_header_size = 375;
+   static constexpr int s_record_size = 30;
+
+   QByteArray header() const;
+
+   QFile m_file;
+   QByteArray m_wkt;
+   QgsVector3D m_scale;
+   QgsVector3D m_offset;
+   std::uint64_t m_point_count = 0;
+   QgsVector3D m_minimum;
+   QgsVector3D m_maximum;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include "mbtiles_writer.h"
+
+#include <utility>
+
+#include <sqlite3.h>
+
+MbTilesWriter::MbTilesWriter(std::size_t batch_size) : m_batch_size(batch_size > 0 ? batch_size : 1) {
+}
+
+MbTilesWriter::~MbTilesWriter() {
+   finish();
+}
+
+bool MbTilesWriter::create(const QString& path) {
+   if (m_database.open_v2(path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+      m_error = QStringLiteral("Could not create %1: %2").arg(path, m_database.errorMessage());
+      m_database.reset();
+      return false;
+   }
+   // The file is written once from scratch and discarded on failure, so durability does not matter.
+   QString message;
+   if (m_database.exec(QStringLiteral("PRAGMA synchronous = OFF;"
+                                      "PRAGMA journal_mode = OFF;"
+                                      "CREATE TABLE metadata (name text, value text);"
+                                      "CREATE TABLE tiles (zoom_level integer, tile_column integer, tile_row integer, tile_data blob);"
+                                      "CREATE UNIQUE INDEX tile_index on tiles (zoom_level, tile_column, tile_row);"),
+                       message)
+       != SQLITE_OK) {
+      m_error = message;
+      m_database.reset();
+      return false;
+   }
+   return true;
+}
+
+bool MbTilesWriter::set_metadata(const QString& name, const QString& value) {
+   std::lock_guard<std::mutex> lock(m_mutex);
+   if (!m_database || m_thread.joinable()) {
+      return false;
+   }
+   int result = SQLITE_OK;
+   sqlite3_statement_unique_ptr statement = m_database.prepare(QStringLiteral("INSERT INTO metadata VALUES (?, ?)"), result);
+   if (result != SQLITE_OK) {
+      m_error = m_database.errorMessage();
+      return false;
+   }
+   const QByteArray name_utf8 = name.toUtf8();
+   const QByteArray value_utf8 = value.toUtf8();
+   sqlite3_bind_text(statement.get(), 1, name_utf8.constData(), name_utf8.size(), SQLITE_STATIC);
+   sqlite3_bind_text(statement.get(), 2, value_utf8.constData(), value_utf8.size(), SQLITE_STATIC);
+   if (sqlite3_step(statement.get()) != SQLITE_DONE) {
+      m_error = m_database.errorMessage();
+      return false;
+   }
+   return true;
+}
+
+bool MbTilesWriter::add_tile(int zoom, int column, int row, QByteArray data) {
+   std::unique_lock<std::mutex> lock(m_mutex);
+   m_tiles_taken.wait(lock, [this] { return m_failed || m_queue.size() < 4 * m_batch_size; });
+   if (m_failed || !m_database) {
+      return false;
+   }
+   if (!m_thread.joinable()) {
+      m_thread = std::thread(&MbTilesWriter::run, this);
+   }
+   m_queue.push_back({zoom, column, row, std::move(data)});
+   if (m_queue.size() >= m_batch_size) {
+      m_tiles_added.notify_one();
+   }
+   return true;
+}
+
+bool MbTilesWriter::finish() {
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_finishing = true;
+   }
+   m_tiles_added.notify_one();
+   if (m_thread.joinable()) {
+      m_thread.join();
+   }
+   m_database.reset();
+   std::lock_guard<std::mutex> lock(m_mutex);
+   return !m_failed;
+}
+
+QString MbTilesWriter::error() const {
+   std::lock_guard<std::mutex> lock(m_mutex);
+   return m_error;
+}
+
+void MbTilesWriter::run() {
+   std::vector<PendingTile> batch;
+   for (;;) {
+      {
+         std::unique_lock<std::mutex> lock(m_mutex);
+         m_tiles_added.wait(lock, [this] { return m_finishing || m_queue.size() >= m_batch_size; });
+         if (m_queue.empty() && m_finishing) {
+            return;
+         }
+         batch.swap(m_queue);
+      }
+      m_tiles_taken.notify_all();
+      const bool written = write_batch(batch);
+      batch.clear();
+      if (!written) {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_failed = true;
+         m_queue.clear();
+         m_tiles_taken.notify_all();
+         return;
+      }
+   }
+}
+
+bool MbTilesWriter::write_batch(const std::vector<PendingTile>& batch) {
+   // Only this thread uses the connection once the tiles are being written.
+   QString message;
+   if (m_database.exec(QStringLiteral("BEGIN"), message) != SQLITE_OK) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_error = message;
+      return false;
+   }
+   int result = SQLITE_OK;
+   sqlite3_statement_unique_ptr statement = m_database.prepare(QStringLiteral("INSERT INTO tiles VALUES (?, ?, ?, ?)"), result);
+   bool written = result == SQLITE_OK;
+   for (std::size_t i = 0; i < batch.size() && written; ++i) {
+      const PendingTile& tile = batch[i];
+      // MBTiles rows follow the TMS scheme and count from the bottom.
+      sqlite3_bind_int(statement.get(), 1, tile.zoom);
+      sqlite3_bind_int(statement.get(), 2, tile.column);
+      sqlite3_bind_int(statement.get(), 3, (1 << tile.zoom) - 1 - tile.row);
+      sqlite3_bind_blob(statement.get(), 4, tile.data.constData(), tile.data.size(), SQLITE_STATIC);
+      written = sqlite3_step(statement.get()) == SQLITE_DONE;
+      sqlite3_reset(statement.get());
+   }
+   if (!written) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_error = m_database.errorMessage();
+   }
+   statement.reset();
+   if (m_database.exec(QString::fromLatin1(written ? "COMMIT" : "ROLLBACK"), message) != SQLITE_OK && written) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_error = message;
+      written = false;
+   }
+   return written;
+}
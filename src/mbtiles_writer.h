@@ -0,0 +1,75 @@
+#ifndef _MBTILES_WRITER_H_
+#define _MBTILES_WRITER_H_
+
+#include "qgssqliteutils.h"
+
+#include <QByteArray>
+#include <QString>
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// @brief Streams tiles into a new MBTiles file from any number of threads.
+///
+/// QgsMbTiles::setTileData() runs one INSERT statement per tile in its own implicit
+/// transaction. This writer owns the only connection to the file and inserts on a background
+/// thread, with one prepared statement and one transaction per batch of tiles. Producers only
+/// append to a bounded queue, and block while the writer is a full queue behind.
+class MbTilesWriter
+{
+public:
+   /// @brief Constructor.
+   /// @param batch_size Number of tiles per transaction.
+   explicit MbTilesWriter(std::size_t batch_size = 1000);
+   ~MbTilesWriter();
+
+   MbTilesWriter(const MbTilesWriter&) = delete;
+   MbTilesWriter& operator=(const MbTilesWriter&) = delete;
+
+   /// @brief Creates the file with the MBTiles schema.
+   /// @param path Path of the file, which must not exist yet.
+   /// @return False if the file could not be created, see error().
+   bool create(const QString& path);
+
+   /// @brief Adds a value to the metadata table, only before the first add_tile().
+   bool set_metadata(const QString& name, const QString& value);
+
+   /// @brief Queues a tile, may be called from any thread. The first call starts the writer thread.
+   /// @param zoom, column, row Tile position, with row 0 at the top as in XYZ tiles.
+   /// @param data Tile contents.
+   /// @return False if writing has failed, further tiles are discarded then.
+   bool add_tile(int zoom, int column, int row, QByteArray data);
+
+   /// @brief Writes the remaining tiles, stops the writer thread and closes the file.
+   /// @return False if any tile could not be written.
+   bool finish();
+
+   QString error() const;
+
+private:
+   struct PendingTile {
+      int zoom;
+      int column;
+      int row;
+      QByteArray data;
+   };
+
+   void run();
+   bool write_batch(const std::vector<PendingTile>& batch);
+
+   std::size_t m_batch_size;
+   sqlite3_database_unique_ptr m_database;
+   std::thread m_thread;
+   mutable std::mutex m_mutex;
+   std::condition_variable m_tiles_added;
+   std::condition_variable m_tiles_taken;
+   std::vector<PendingTile> m_queue;
+   bool m_finishing = false;
+   bool m_failed = false;
+   QString m_error;
+};
+
+#endif
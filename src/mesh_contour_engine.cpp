@@ -0,0 +1,199 @@
+#include "mesh_contour_engine.h"
+#include "mesh_contour_tracer.h"
+#include "parallel_for.h"
+
+#include "qgscoordinatetransform.h"
+#include "qgsfeaturesink.h"
+#include "qgsfeedback.h"
+#include "qgslinestring.h"
+#include "qgsmeshlayer.h"
+#include "qgsmeshlayerutils.h"
+#include "qgsmultilinestring.h"
+#include "qgstriangularmesh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+
+namespace {
+
+/// Datasets per worker and batch.
+constexpr int s_datasets_per_worker = 2;
+/// Upper bound of the levels generated from an interval.
+constexpr double s_max_levels = 100000.0;
+
+/// Dataset values read in the calling thread.
+struct DatasetBlock {
+   QgsMeshDataBlock values;
+   QgsMeshDataBlock active;
+   double time = 0.0;
+};
+
+}
+
+MeshContourEngine::MeshContourEngine(QgsMeshLayer* layer, const MeshContourSettings& settings)
+   : m_layer(layer), m_settings(settings) {
+}
+
+QgsFields MeshContourEngine::output_fields() {
+   QgsFields fields;
+   fields.append(QgsField(QStringLiteral("level"), QVariant::Double));
+   fields.append(QgsField(QStringLiteral("dataset"), QVariant::Int));
+   fields.append(QgsField(QStringLiteral("time"), QVariant::Double));
+   return fields;
+}
+
+int MeshContourEngine::run(QgsFeatureSink& sink, QgsFeedback* feedback) {
+   m_feature_count = 0;
+   if (!m_layer || !m_layer->isValid() || !m_layer->dataProvider()) {
+      return InvalidSource;
+   }
+   m_layer->updateTriangularMesh();
+   const QgsMesh* native_mesh = m_layer->nativeMesh();
+   const QgsMeshDatasetIndex group_index(m_settings.dataset_group, 0);
+   const QgsMeshDatasetGroupMetadata metadata = m_layer->datasetGroupMetadata(group_index);
+   if (!native_mesh || !metadata.isValid() || metadata.dataType() == QgsMeshDatasetGroupMetadata::DataOnEdges) {
+      return InvalidSource;
+   }
+   const int dataset_total = m_layer->datasetCount(group_index);
+   const int first_dataset = m_settings.first_dataset;
+   const int last_dataset = m_settings.dataset_count < 0 ? dataset_total
+                                                         : std::min(dataset_total, first_dataset + m_settings.dataset_count);
+   if (first_dataset < 0 || first_dataset >= last_dataset) {
+      return InvalidParameters;
+   }
+
+   std::vector<double> levels = m_settings.levels;
+   if (levels.empty()) {
+      const double interval = m_settings.interval;
+      if (!(interval > 0.0) || !std::isfinite(metadata.minimum()) || !std::isfinite(metadata.maximum())) {
+         return InvalidParameters;
+      }
+      const double first = std::ceil(metadata.minimum() / interval);
+      const double last = std::floor(metadata.maximum() / interval);
+      if (last - first + 1.0 > s_max_levels) {
+         return InvalidParameters;
+      }
+      for (double step = first; step <= last; ++step) {
+         levels.push_back(step * interval);
+      }
+   }
+
+   // The topology is triangulated and flattened once for all datasets.
+   QgsCoordinateTransform transform;
+   if (m_settings.destination_crs.isValid() && m_settings.destination_crs != m_layer->crs()) {
+      transform = QgsCoordinateTransform(m_layer->crs(), m_settings.destination_crs, m_settings.transform_context);
+   }
+   QgsMesh mesh_copy = *native_mesh;
+   QgsTriangularMesh triangular_mesh;
+   triangular_mesh.update(&mesh_copy, transform);
+   const QVector<QgsMeshVertex>& vertices = triangular_mesh.vertices();
+   const QVector<QgsMeshFace>& triangles = triangular_mesh.triangles();
+   const QVector<int>& triangle_faces = triangular_mesh.trianglesToNativeFaces();
+   const int vertex_count = vertices.size();
+   if (vertex_count < native_mesh->vertexCount()) {
+      return InvalidSource;
+   }
+   std::vector<double> x(vertices.size());
+   std::vector<double> y(vertices.size());
+   for (int i = 0; i < vertices.size(); ++i) {
+      x[i] = vertices[i].x();
+      y[i] = vertices[i].y();
+   }
+   std::vector<int> triangle_vertices;
+   triangle_vertices.reserve(3 * static_cast<std::size_t>(triangles.size()));
+   for (const QgsMeshFace& triangle : triangles) {
+      triangle_vertices.insert(triangle_vertices.end(), triangle.begin(), triangle.begin() + 3);
+   }
+   const MeshContourTracer tracer(std::move(x), std::move(y), std::move(triangle_vertices), std::move(levels));
+   if (tracer.levels().empty()) {
+      return InvalidParameters;
+   }
+
+   const int thread_count = resolve_thread_count(m_settings.thread_count);
+   const int batch_size = s_datasets_per_worker * thread_count;
+   const int value_count = QgsMeshLayerUtils::datasetValuesCount(native_mesh, QgsMeshLayerUtils::datasetValuesType(metadata.dataType()));
+   const int face_count = native_mesh->faceCount();
+   const std::size_t level_count = tracer.levels().size();
+   const QgsFields fields = output_fields();
+   std::vector<MeshContourTracer::Workspace> workspaces(thread_count);
+   std::vector<std::vector<std::uint8_t>> active_triangles(thread_count);
+   std::vector<DatasetBlock> blocks;
+   std::vector<QgsFeatureList> outputs;
+   std::atomic<bool> canceled(false);
+
+   for (int first = first_dataset; first < last_dataset; first += batch_size) {
+      if (feedback && feedback->isCanceled()) {
+         canceled = true;
+         break;
+      }
+      const int count = std::min(batch_size, last_dataset - first);
+      blocks.assign(count, DatasetBlock());
+      for (int i = 0; i < count; ++i) {
+         const QgsMeshDatasetIndex index(m_settings.dataset_group, first + i);
+         blocks[i].values = QgsMeshLayerUtils::datasetValues(m_layer, index, 0, value_count);
+         blocks[i].active = m_layer->areFacesActive(index, 0, face_count);
+         blocks[i].time = m_layer->datasetMetadata(index).time();
+      }
+
+      outputs.assign(count, QgsFeatureList());
+      parallel_for(count, thread_count, [&](std::size_t i, int worker) {
+         if (canceled) {
+            return;
+         }
+         if (feedback && feedback->isCanceled()) {
+            canceled = true;
+            return;
+         }
+         DatasetBlock& block = blocks[i];
+         if (!block.values.isValid()) {
+            return;
+         }
+         const QVector<double> values = QgsMeshLayerUtils::calculateMagnitudeOnVertices(*native_mesh, metadata, block.values,
+                                                                                     block.active, m_settings.resampling);
+         // The raw values are not needed anymore.
+         block.values = QgsMeshDataBlock();
+         if (values.size() < vertex_count) {
+            return;
+         }
+         std::vector<std::uint8_t>& active = active_triangles[worker];
+         active.resize(triangle_faces.size());
+         for (int triangle = 0; triangle < triangle_faces.size(); ++triangle) {
+            active[triangle] = !block.active.isValid() || block.active.active(triangle_faces[triangle]);
+         }
+
+         std::vector<std::vector<ContourLine>> lines;
+         tracer.trace(values.constData(), active.data(), workspaces[worker], lines);
+         for (std::size_t level = 0; level < level_count; ++level) {
+            if (lines[level].empty()) {
+               continue;
+            }
+            auto geometry = std::make_unique<QgsMultiLineString>();
+            for (const ContourLine& line : lines[level]) {
+               geometry->addGeometry(new QgsLineString(QVector<double>(line.x.begin(), line.x.end()),
+                                                       QVector<double>(line.y.begin(), line.y.end())));
+            }
+            QgsFeature feature(fields);
+            feature.setGeometry(QgsGeometry(std::move(geometry)));
+            feature.setAttributes(QgsAttributes{tracer.levels()[level], first + static_cast<int>(i), block.time});
+            outputs[i].append(feature);
+         }
+      });
+      if (canceled) {
+         break;
+      }
+
+      for (QgsFeatureList& output : outputs) {
+         if (!output.isEmpty() && !sink.addFeatures(output, QgsFeatureSink::FastInsert)) {
+            return WriteFailed;
+         }
+         m_feature_count += output.size();
+      }
+      if (feedback) {
+         feedback->setProgress(100.0 * static_cast<double>(first + count - first_dataset) /
+                               static_cast<double>(last_dataset - first_dataset));
+      }
+   }
+   return canceled ? Canceled : Success;
+}
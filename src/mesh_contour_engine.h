@@ -0,0 +1,82 @@
+#ifndef _MESH_CONTOUR_ENGINE_H_
+#define _MESH_CONTOUR_ENGINE_H_
+
+#include "qgscoordinatereferencesystem.h"
+#include "qgscoordinatetransformcontext.h"
+#include "qgsfields.h"
+#include "qgsmeshrenderersettings.h"
+
+#include <vector>
+
+class QgsFeatureSink;
+class QgsFeedback;
+class QgsMeshLayer;
+
+/// @brief Settings of a mesh contouring run.
+struct MeshContourSettings {
+   /// Index of the dataset group to contour.
+   int dataset_group = 0;
+   /// First dataset (timestep) of the group to contour.
+   int first_dataset = 0;
+   /// Number of datasets to contour, -1 for all datasets from first_dataset on.
+   int dataset_count = -1;
+   /// Contour levels. If empty, the multiples of interval within the value range of the group.
+   std::vector<double> levels;
+   /// Distance of the levels when levels is empty.
+   double interval = 0.0;
+   /// Interpolation of values defined on faces to the vertices, as in QgsMeshContours.
+   QgsMeshRendererScalarSettings::DataResamplingMethod resampling = QgsMeshRendererScalarSettings::NeighbourAverage;
+   /// CRS of the output, invalid to keep the CRS of the mesh.
+   QgsCoordinateReferenceSystem destination_crs;
+   QgsCoordinateTransformContext transform_context;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+};
+
+/// @brief Contour lines of every dataset of a mesh dataset group.
+///
+/// QgsMeshContours::exportLines() contours one dataset at one level per call and rebuilds its
+/// vertex value cache whenever the dataset changes. This engine triangulates the mesh once
+/// into a MeshContourTracer, which traces all levels in one pass over the triangles, and
+/// contours the datasets on all cores. The provider is only used from the calling thread: a
+/// batch of a few datasets per worker is read, interpolated to the vertices and traced in
+/// parallel, and its contours are written to the sink in dataset and level order, one multi
+/// line string per dataset and level, before the next batch is read.
+class MeshContourEngine
+{
+public:
+   /// Result codes of run().
+   enum Result {
+      Success = 0,
+      InvalidSource = 1,
+      InvalidParameters = 2,
+      WriteFailed = 3,
+      Canceled = 4
+   };
+
+   /// @brief Constructor.
+   /// @param layer The mesh layer, must outlive run().
+   /// @param settings The datasets, levels and processing options.
+   MeshContourEngine(QgsMeshLayer* layer, const MeshContourSettings& settings);
+
+   /// @brief Fields of the contour features: the level, the dataset index and its time in hours.
+   static QgsFields output_fields();
+
+   /// @brief Contours the datasets and writes the lines to the sink.
+   /// @param sink Receives MultiLineString features with output_fields(), e.g. a GeoPackage layer.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return One of the Result codes.
+   int run(QgsFeatureSink& sink, QgsFeedback* feedback = nullptr);
+
+   /// Number of features written by the last run.
+   long long feature_count() const {
+      return m_feature_count;
+   }
+
+private:
+   QgsMeshLayer* m_layer;
+   MeshContourSettings m_settings;
+   long long m_feature_count = 0;
+};
+
+#endif
@@ -0,0 +1,147 @@
+#include "mesh_contour_tracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace {
+
+std::uint64_t edge_id(int a, int b) {
+   return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(std::min(a, b))) << 32)
+          | static_cast<std::uint32_t>(std::max(a, b));
+}
+
+}
+
+MeshContourTracer::MeshContourTracer(std::vector<double> x, std::vector<double> y, std::vector<int> triangles,
+                                     std::vector<double> levels)
+   : m_x(std::move(x)), m_y(std::move(y)), m_triangles(std::move(triangles)), m_levels(std::move(levels)) {
+   m_levels.erase(std::remove_if(m_levels.begin(), m_levels.end(), [](double level) { return !std::isfinite(level); }),
+                  m_levels.end());
+   std::sort(m_levels.begin(), m_levels.end());
+   m_levels.erase(std::unique(m_levels.begin(), m_levels.end()), m_levels.end());
+}
+
+void MeshContourTracer::trace(const double* values, const std::uint8_t* active, Workspace& workspace,
+                              std::vector<std::vector<ContourLine>>& lines) const {
+   const std::size_t level_count = m_levels.size();
+   workspace.segments.resize(level_count);
+   for (std::vector<Workspace::Segment>& segments : workspace.segments) {
+      segments.clear();
+   }
+
+   const std::size_t triangle_count = m_triangles.size() / 3;
+   for (std::size_t triangle = 0; triangle < triangle_count; ++triangle) {
+      if (active && !active[triangle]) {
+         continue;
+      }
+      const int* vertices = m_triangles.data() + 3 * triangle;
+      const double triangle_values[3] = {values[vertices[0]], values[vertices[1]], values[vertices[2]]};
+      if (std::isnan(triangle_values[0]) || std::isnan(triangle_values[1]) || std::isnan(triangle_values[2])) {
+         continue;
+      }
+      const double low = std::min({triangle_values[0], triangle_values[1], triangle_values[2]});
+      const double high = std::max({triangle_values[0], triangle_values[1], triangle_values[2]});
+      // Levels with a vertex below and a vertex at or above them: low < level <= high.
+      const std::size_t first = std::upper_bound(m_levels.begin(), m_levels.end(), low) - m_levels.begin();
+      const std::size_t last = std::upper_bound(m_levels.begin(), m_levels.end(), high) - m_levels.begin();
+      for (std::size_t level = first; level < last; ++level) {
+         const double value = m_levels[level];
+         Workspace::Segment segment;
+         int end = 0;
+         for (int edge = 0; edge < 3 && end < 2; ++edge) {
+            int a = vertices[edge];
+            int b = vertices[(edge + 1) % 3];
+            double value_a = triangle_values[edge];
+            double value_b = triangle_values[(edge + 1) % 3];
+            if ((value_a < value) == (value_b < value)) {
+               continue;
+            }
+            // Interpolated from the lower vertex index, so both triangles of an edge get the same point.
+            if (b < a) {
+               std::swap(a, b);
+               std::swap(value_a, value_b);
+            }
+            const double t = (value - value_a) / (value_b - value_a);
+            segment.edges[end] = edge_id(a, b);
+            segment.x[end] = m_x[a] + t * (m_x[b] - m_x[a]);
+            segment.y[end] = m_y[a] + t * (m_y[b] - m_y[a]);
+            ++end;
+         }
+         if (end == 2) {
+            workspace.segments[level].push_back(segment);
+         }
+      }
+   }
+
+   lines.resize(level_count);
+   for (std::size_t level = 0; level < level_count; ++level) {
+      lines[level].clear();
+      chain(workspace.segments[level], workspace, lines[level]);
+   }
+}
+
+void MeshContourTracer::chain(std::vector<Workspace::Segment>& segments, Workspace& workspace,
+                              std::vector<ContourLine>& lines) {
+   const std::size_t count = segments.size();
+   if (count == 0) {
+      return;
+   }
+
+   // Link the segment ends on the same edge, at most two as an edge has at most two triangles.
+   std::vector<std::pair<std::uint64_t, std::uint32_t>>& ends = workspace.ends;
+   ends.resize(2 * count);
+   for (std::size_t i = 0; i < count; ++i) {
+      ends[2 * i] = {segments[i].edges[0], static_cast<std::uint32_t>(2 * i)};
+      ends[2 * i + 1] = {segments[i].edges[1], static_cast<std::uint32_t>(2 * i + 1)};
+   }
+   std::sort(ends.begin(), ends.end());
+   std::vector<std::int64_t>& links = workspace.links;
+   links.assign(2 * count, -1);
+   for (std::size_t i = 0; i + 1 < ends.size(); ++i) {
+      if (ends[i].first == ends[i + 1].first) {
+         links[ends[i].second] = ends[i + 1].second;
+         links[ends[i + 1].second] = ends[i].second;
+         ++i;
+      }
+   }
+
+   std::vector<std::uint8_t>& visited = workspace.visited;
+   visited.assign(count, 0);
+   const auto follow = [&](std::size_t segment, int start_end) {
+      ContourLine line;
+      line.x.push_back(segments[segment].x[start_end]);
+      line.y.push_back(segments[segment].y[start_end]);
+      std::int64_t end = static_cast<std::int64_t>(2 * segment + start_end);
+      while (true) {
+         const std::size_t current = static_cast<std::size_t>(end / 2);
+         const int exit = 1 - static_cast<int>(end % 2);
+         visited[current] = 1;
+         line.x.push_back(segments[current].x[exit]);
+         line.y.push_back(segments[current].y[exit]);
+         const std::int64_t next = links[2 * current + exit];
+         if (next < 0 || visited[next / 2]) {
+            break;
+         }
+         end = next;
+      }
+      lines.push_back(std::move(line));
+   };
+
+   // Open lines start at an unlinked end, the remaining segments form closed rings.
+   for (std::size_t i = 0; i < count; ++i) {
+      if (visited[i]) {
+         continue;
+      }
+      if (links[2 * i] < 0) {
+         follow(i, 0);
+      } else if (links[2 * i + 1] < 0) {
+         follow(i, 1);
+      }
+   }
+   for (std::size_t i = 0; i < count; ++i) {
+      if (!visited[i]) {
+         follow(i, 0);
+      }
+   }
+}
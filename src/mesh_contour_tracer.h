@@ -0,0 +1,73 @@
+#ifndef _MESH_CONTOUR_TRACER_H_
+#define _MESH_CONTOUR_TRACER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/// A contour polyline, closed if the first and last points are equal.
+struct ContourLine {
+   std::vector<double> x;
+   std::vector<double> y;
+};
+
+/// @brief Traces the contour lines of many levels over a fixed triangle mesh.
+///
+/// The mesh topology is copied once into flat arrays, and trace() is called for every set of
+/// vertex values, e.g. every timestep of a dataset group. Each call visits every triangle once
+/// and only the levels between its smallest and largest vertex value, so the cost grows with
+/// the number of contour segments and not with triangles times levels. Segments end on mesh
+/// edges, and segments of neighbouring triangles meeting on the same edge are chained into
+/// polylines through the edge ids.
+///
+/// A vertex belongs to the side at or above a level when its value equals the level.
+class MeshContourTracer
+{
+public:
+   /// Scratch memory of trace(), one per thread.
+   struct Workspace {
+      struct Segment {
+         std::uint64_t edges[2];
+         double x[2];
+         double y[2];
+      };
+      /// Segments of every level.
+      std::vector<std::vector<Segment>> segments;
+      std::vector<std::pair<std::uint64_t, std::uint32_t>> ends;
+      std::vector<std::int64_t> links;
+      std::vector<std::uint8_t> visited;
+   };
+
+   /// @brief Constructor.
+   /// @param x, y Vertex coordinates.
+   /// @param triangles Three vertex indices per triangle.
+   /// @param levels Contour levels, sorted and made unique.
+   MeshContourTracer(std::vector<double> x, std::vector<double> y, std::vector<int> triangles, std::vector<double> levels);
+
+   const std::vector<double>& levels() const {
+      return m_levels;
+   }
+
+   std::size_t triangle_count() const {
+      return m_triangles.size() / 3;
+   }
+
+   /// @brief Traces all levels.
+   /// @param values Value of every vertex, triangles with a NaN vertex are skipped.
+   /// @param active Flag of every triangle, null for all triangles.
+   /// @param lines Receives the polylines of every level.
+   void trace(const double* values, const std::uint8_t* active, Workspace& workspace,
+              std::vector<std::vector<ContourLine>>& lines) const;
+
+private:
+   /// Chains the segments of one level into polylines.
+   static void chain(std::vector<Workspace::Segment>& segments, Workspace& workspace, std::vector<ContourLine>& lines);
+
+   std::vector<double> m_x;
+   std::vector<double> m_y;
+   std::vector<int> m_triangles;
+   std::vector<double> m_levels;
+};
+
+#endif
@@ -0,0 +1,260 @@
+#include "mvt_encoder.h"
+
+#include <cstring>
+
+namespace {
+
+// Protobuf wire types.
+constexpr std::uint32_t s_varint = 0;
+constexpr std::uint32_t s_fixed64 = 1;
+constexpr std::uint32_t s_length_delimited = 2;
+
+// Vector tile geometry commands.
+constexpr std::uint32_t s_move_to = 1;
+constexpr std::uint32_t s_line_to = 2;
+constexpr std::uint32_t s_close_path = 7;
+
+void put_varint(std::string& out, std::uint64_t value) {
+   while (value >= 0x80) {
+      out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+      value >>= 7;
+   }
+   out.push_back(static_cast<char>(value));
+}
+
+void put_key(std::string& out, std::uint32_t field, std::uint32_t wire_type) {
+   put_varint(out, (static_cast<std::uint64_t>(field) << 3) | wire_type);
+}
+
+void put_bytes(std::string& out, std::uint32_t field, const char* data, std::size_t size) {
+   put_key(out, field, s_length_delimited);
+   put_varint(out, size);
+   out.append(data, size);
+}
+
+void put_string(std::string& out, std::uint32_t field, const QString& value) {
+   const QByteArray utf8 = value.toUtf8();
+   put_bytes(out, field, utf8.constData(), static_cast<std::size_t>(utf8.size()));
+}
+
+void put_packed(std::string& out, std::uint32_t field, const std::vector<std::uint32_t>& values) {
+   std::string packed;
+   for (std::uint32_t value : values) {
+      put_varint(packed, value);
+   }
+   put_bytes(out, field, packed.data(), packed.size());
+}
+
+inline std::uint32_t zigzag(std::int32_t value) {
+   return (static_cast<std::uint32_t>(value) << 1) ^ static_cast<std::uint32_t>(value >> 31);
+}
+
+}
+
+void MvtGeometry::clear() {
+   m_commands.clear();
+   m_x = 0;
+   m_y = 0;
+}
+
+void MvtGeometry::command(std::uint32_t id, std::uint32_t count) {
+   m_commands.push_back((id & 0x7) | (count << 3));
+}
+
+void MvtGeometry::vertex(std::int32_t x, std::int32_t y) {
+   m_commands.push_back(zigzag(x - m_x));
+   m_commands.push_back(zigzag(y - m_y));
+   m_x = x;
+   m_y = y;
+}
+
+void MvtGeometry::add_points(const std::int32_t* xy, std::size_t count) {
+   if (count == 0) {
+      return;
+   }
+   command(s_move_to, static_cast<std::uint32_t>(count));
+   for (std::size_t i = 0; i < count; ++i) {
+      vertex(xy[2 * i], xy[2 * i + 1]);
+   }
+}
+
+void MvtGeometry::compact(const std::int32_t* xy, std::size_t count, bool ring) {
+   m_ring.clear();
+   auto repeated = [&](std::int64_t x, std::int64_t y) {
+      return !m_ring.empty() && x == m_ring[m_ring.size() - 2] && y == m_ring.back();
+   };
+   for (std::size_t i = 0; i < count; ++i) {
+      const std::int64_t x = xy[2 * i];
+      const std::int64_t y = xy[2 * i + 1];
+      if (repeated(x, y)) {
+         continue;
+      }
+      // Drop previous vertices lying on the straight line to the new one. Lines keep vertices
+      // where they turn back, rings lose those spikes as they enclose no area.
+      while (m_ring.size() >= 4) {
+         const std::size_t size = m_ring.size();
+         const std::int64_t ax = m_ring[size - 4];
+         const std::int64_t ay = m_ring[size - 3];
+         const std::int64_t bx = m_ring[size - 2];
+         const std::int64_t by = m_ring[size - 1];
+         if ((bx - ax) * (y - ay) != (by - ay) * (x - ax) || (!ring && (bx - ax) * (x - bx) + (by - ay) * (y - by) <= 0)) {
+            break;
+         }
+         m_ring.resize(size - 2);
+      }
+      if (!repeated(x, y)) {
+         m_ring.push_back(xy[2 * i]);
+         m_ring.push_back(xy[2 * i + 1]);
+      }
+   }
+}
+
+bool MvtGeometry::add_line(const std::int32_t* xy, std::size_t count) {
+   compact(xy, count, false);
+   const std::size_t vertices = m_ring.size() / 2;
+   if (vertices < 2) {
+      return false;
+   }
+   command(s_move_to, 1);
+   vertex(m_ring[0], m_ring[1]);
+   command(s_line_to, static_cast<std::uint32_t>(vertices - 1));
+   for (std::size_t i = 1; i < vertices; ++i) {
+      vertex(m_ring[2 * i], m_ring[2 * i + 1]);
+   }
+   return true;
+}
+
+bool MvtGeometry::add_ring(const std::int32_t* xy, std::size_t count, bool exterior) {
+   compact(xy, count, true);
+   if (m_ring.size() >= 4 && m_ring[0] == m_ring[m_ring.size() - 2] && m_ring[1] == m_ring.back()) {
+      m_ring.resize(m_ring.size() - 2);
+   }
+   const std::size_t vertices = m_ring.size() / 2;
+   if (vertices < 3) {
+      return false;
+   }
+   std::int64_t area = 0;
+   for (std::size_t i = 0, j = vertices - 1; i < vertices; j = i++) {
+      area += static_cast<std::int64_t>(m_ring[2 * j]) * m_ring[2 * i + 1] - static_cast<std::int64_t>(m_ring[2 * i]) * m_ring[2 * j + 1];
+   }
+   if (area == 0) {
+      return false;
+   }
+   const bool reverse = (area > 0) != exterior;
+   auto at = [&](std::size_t i, int axis) { return m_ring[2 * (reverse ? vertices - 1 - i : i) + axis]; };
+   command(s_move_to, 1);
+   vertex(at(0, 0), at(0, 1));
+   command(s_line_to, static_cast<std::uint32_t>(vertices - 1));
+   for (std::size_t i = 1; i < vertices; ++i) {
+      vertex(at(i, 0), at(i, 1));
+   }
+   command(s_close_path, 1);
+   return true;
+}
+
+void MvtTileEncoder::begin_layer(const QString& name, int extent) {
+   m_name = name.toStdString();
+   m_extent = extent;
+   m_features.clear();
+   m_feature_count = 0;
+   m_keys.clear();
+   m_key_list.clear();
+   m_values.clear();
+   m_value_list.clear();
+}
+
+std::uint32_t MvtTileEncoder::key_index(const QString& key) {
+   const auto found = m_keys.constFind(key);
+   if (found != m_keys.constEnd()) {
+      return found.value();
+   }
+   const std::uint32_t index = static_cast<std::uint32_t>(m_key_list.size());
+   m_keys.insert(key, index);
+   m_key_list.push_back(key);
+   return index;
+}
+
+std::int64_t MvtTileEncoder::value_index(const QVariant& value) {
+   if (value.isNull()) {
+      return -1;
+   }
+   // The encoded Value message doubles as the lookup key.
+   std::string encoded;
+   switch (value.userType()) {
+      case QMetaType::QString:
+         put_string(encoded, 1, value.toString());
+         break;
+      case QMetaType::Bool:
+         put_key(encoded, 7, s_varint);
+         put_varint(encoded, value.toBool() ? 1 : 0);
+         break;
+      case QMetaType::Int:
+      case QMetaType::LongLong:
+         put_key(encoded, 4, s_varint);
+         put_varint(encoded, static_cast<std::uint64_t>(value.toLongLong()));
+         break;
+      case QMetaType::UInt:
+      case QMetaType::ULongLong:
+         put_key(encoded, 5, s_varint);
+         put_varint(encoded, value.toULongLong());
+         break;
+      default: {
+         bool ok = false;
+         const double number = value.toDouble(&ok);
+         if (!ok) {
+            put_string(encoded, 1, value.toString());
+            break;
+         }
+         put_key(encoded, 3, s_fixed64);
+         std::uint64_t bits = 0;
+         static_assert(sizeof(bits) == sizeof(number), "double must be 64 bits");
+         std::memcpy(&bits, &number, sizeof(bits));
+         for (int byte = 0; byte < 8; ++byte) {
+            encoded.push_back(static_cast<char>((bits >> (8 * byte)) & 0xff));
+         }
+         break;
+      }
+   }
+   const auto inserted = m_values.emplace(encoded, static_cast<std::uint32_t>(m_value_list.size()));
+   if (inserted.second) {
+      m_value_list.push_back(std::move(encoded));
+   }
+   return inserted.first->second;
+}
+
+void MvtTileEncoder::add_feature(std::uint64_t id, MvtGeometryType type, const std::vector<std::uint32_t>& tags,
+                                 const MvtGeometry& geometry) {
+   std::string feature;
+   put_key(feature, 1, s_varint);
+   put_varint(feature, id);
+   if (!tags.empty()) {
+      put_packed(feature, 2, tags);
+   }
+   put_key(feature, 3, s_varint);
+   put_varint(feature, static_cast<std::uint32_t>(type));
+   put_packed(feature, 4, geometry.commands());
+   put_bytes(m_features, 2, feature.data(), feature.size());
+   ++m_feature_count;
+}
+
+void MvtTileEncoder::end_layer() {
+   if (m_feature_count == 0) {
+      return;
+   }
+   std::string layer;
+   put_key(layer, 15, s_varint);
+   put_varint(layer, 2);
+   put_bytes(layer, 1, m_name.data(), m_name.size());
+   layer += m_features;
+   for (const QString& key : m_key_list) {
+      put_string(layer, 3, key);
+   }
+   for (const std::string& value : m_value_list) {
+      put_bytes(layer, 4, value.data(), value.size());
+   }
+   put_key(layer, 5, s_varint);
+   put_varint(layer, static_cast<std::uint32_t>(m_extent));
+   put_bytes(m_tile, 3, layer.data(), layer.size());
+   m_features.clear();
+   m_feature_count = 0;
+}
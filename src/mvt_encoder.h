@@ -0,0 +1,123 @@
+#ifndef _MVT_ENCODER_H_
+#define _MVT_ENCODER_H_
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QVariant>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Geometry types of Mapbox vector tile features.
+enum class MvtGeometryType {
+   Point = 1,
+   LineString = 2,
+   Polygon = 3
+};
+
+/// @brief Command stream of one vector tile feature geometry.
+///
+/// Coordinates are integer tile coordinates with y pointing down, written as zigzag encoded
+/// deltas behind MoveTo, LineTo and ClosePath commands as the vector tile specification requires.
+class MvtGeometry
+{
+public:
+   void clear();
+
+   bool empty() const {
+      return m_commands.empty();
+   }
+
+   const std::vector<std::uint32_t>& commands() const {
+      return m_commands;
+   }
+
+   /// @brief Adds points, written as one MoveTo command.
+   /// @param xy Interleaved tile coordinates.
+   /// @param count Number of points.
+   void add_points(const std::int32_t* xy, std::size_t count);
+
+   /// @brief Adds a line string, skipping repeated vertices and vertices on a straight segment.
+   /// @return False if fewer than two distinct vertices remain, the line is not added then.
+   bool add_line(const std::int32_t* xy, std::size_t count);
+
+   /// @brief Adds a polygon ring, skipping repeated and collinear vertices and orienting it as required.
+   ///
+   /// Exterior rings are written with positive area and interior rings with negative area, in
+   /// tile coordinates. The closing vertex may be present or not.
+   /// @return False if the ring has no area, the ring is not added then.
+   bool add_ring(const std::int32_t* xy, std::size_t count, bool exterior);
+
+private:
+   /// Copies the vertices into m_ring without the ones that add nothing after quantization.
+   void compact(const std::int32_t* xy, std::size_t count, bool ring);
+   void command(std::uint32_t id, std::uint32_t count);
+   void vertex(std::int32_t x, std::int32_t y);
+
+   std::vector<std::uint32_t> m_commands;
+   std::vector<std::int32_t> m_ring;
+   std::int32_t m_x = 0;
+   std::int32_t m_y = 0;
+};
+
+/// @brief Writes the protobuf encoding of one Mapbox vector tile.
+///
+/// Layers are written one after the other between begin_layer() and end_layer(). Keys and
+/// values of the feature attributes are collected per layer, every distinct key and value
+/// is stored once.
+class MvtTileEncoder
+{
+public:
+   /// @brief Starts a layer.
+   /// @param name Layer name.
+   /// @param extent Size of the tile in tile coordinates.
+   void begin_layer(const QString& name, int extent);
+
+   /// @brief Returns the index of a key in the current layer, adding it if needed.
+   std::uint32_t key_index(const QString& key);
+
+   /// @brief Returns the index of a value in the current layer, adding it if needed.
+   ///
+   /// Strings are written as string values, booleans as bool values, integers as int values
+   /// and everything else convertible to a number as double values, like QgsVectorTileMVTEncoder.
+   /// @return The index, or -1 for null values which are not written.
+   std::int64_t value_index(const QVariant& value);
+
+   /// @brief Adds a feature to the current layer.
+   /// @param id Feature id.
+   /// @param type Geometry type.
+   /// @param tags Pairs of key and value indices.
+   /// @param geometry Non-empty geometry of the feature.
+   void add_feature(std::uint64_t id, MvtGeometryType type, const std::vector<std::uint32_t>& tags, const MvtGeometry& geometry);
+
+   /// @brief Finishes the current layer. Layers without features are dropped.
+   void end_layer();
+
+   /// Returns true if no layer with features was written.
+   bool empty() const {
+      return m_tile.empty();
+   }
+
+   /// Returns the encoded tile, uncompressed.
+   QByteArray data() const {
+      return QByteArray(m_tile.data(), static_cast<int>(m_tile.size()));
+   }
+
+private:
+   std::string m_tile;
+   std::string m_name;
+   int m_extent = 4096;
+   std::string m_features;
+   std::size_t m_feature_count = 0;
+   QHash<QString, std::uint32_t> m_keys;
+   std::vector<QString> m_key_list;
+   /// Encoded value messages and their indices.
+   std::unordered_map<std::string, std::uint32_t> m_values;
+   std::vector<std::string> m_value_list;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "od_matrix.h"
+#include "parallel_for.h"
+#include "road_dijkstra.h"
+
+#include "qgsfeedback.h"
+#include "qgsgraph.h"
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QFile>
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+
+OdMatrix::OdMatrix(const RoadGraph& graph, const OdMatrixSettings& settings) : m_graph(graph), m_settings(settings) {
+}
+
+std::vector<int> OdMatrix::tied_vertices(const QgsGraph& graph, const QVector<QgsPointXY>& tied_points) {
+   std::vector<int> vertices;
+   vertices.reserve(tied_points.size());
+   for (const QgsPointXY& point : tied_points) {
+      vertices.push_back(graph.findVertex(point));
+   }
+   return vertices;
+}
+
+bool OdMatrix::compute(const std::vector<int>& origins, const std::vector<int>& destinations, QgsFeedback* feedback) {
+   m_origin_count = static_cast<int>(origins.size());
+   m_destination_count = static_cast<int>(destinations.size());
+   m_costs.assign(origins.size() * destinations.size(), std::numeric_limits<float>::infinity());
+
+   std::vector<int> targets;
+   for (int destination : destinations) {
+      if (destination >= 0) {
+         targets.push_back(destination);
+      }
+   }
+   if (targets.empty()) {
+      return true;
+   }
+
+   // Every worker owns a search with its heap and per-vertex state, created on first use.
+   const int thread_count = resolve_thread_count(m_settings.thread_count);
+   std::vector<std::unique_ptr<DijkstraSearch>> searches(thread_count);
+   std::atomic<bool> canceled(false);
+   std::atomic<std::size_t> origins_done(0);
+
+   parallel_for(origins.size(), thread_count, [&](std::size_t origin, int worker) {
+      if (canceled || origins[origin] < 0) {
+         return;
+      }
+      if (feedback && feedback->isCanceled()) {
+         canceled = true;
+         return;
+      }
+      std::unique_ptr<DijkstraSearch>& search = searches[worker];
+      if (!search) {
+         search = std::make_unique<DijkstraSearch>(m_graph);
+         search->set_targets(targets);
+      }
+      search->run({origins[origin]}, m_settings.strategy);
+
+      float* row = m_costs.data() + origin * destinations.size();
+      for (std::size_t destination = 0; destination < destinations.size(); ++destination) {
+         if (destinations[destination] >= 0) {
+            row[destination] = static_cast<float>(search->cost(destinations[destination]));
+         }
+      }
+
+      const std::size_t done = ++origins_done;
+      if (feedback && worker == 0) {
+         feedback->setProgress(100.0 * static_cast<double>(done) / static_cast<double>(origins.size()));
+      }
+   });
+   return !canceled;
+}
+
+bool OdMatrix::write_csv(const QString& path, const QStringList& origin_ids, const QStringList& destination_ids) const {
+   QFile file(path);
+   if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+      return false;
+   }
+
+   QByteArray line = "origin";
+   for (int destination = 0; destination < m_destination_count; ++destination) {
+      line += ',' + destination_ids.value(destination, QString::number(destination)).toUtf8();
+   }
+   line += '\n';
+   file.write(line);
+
+   for (int origin = 0; origin < m_origin_count; ++origin) {
+      line = origin_ids.value(origin, QString::number(origin)).toUtf8();
+      for (int destination = 0; destination < m_destination_count; ++destination) {
+         line += ',';
+         const float value = cost(origin, destination);
+         if (std::isfinite(value)) {
+            line += QByteArray::number(value, 'g', 9);
+         }
+      }
+      line += '\n';
+      if (file.write(line) != line.size()) {
+         return false;
+      }
+   }
+   return true;
+}
+
+bool OdMatrix::write_binary(const QString& path) const {
+   QFile file(path);
+   if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+      return false;
+   }
+   QDataStream stream(&file);
+   stream.setByteOrder(QDataStream::LittleEndian);
+   stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+   stream.writeRawData("ODM1", 4);
+   stream << static_cast<quint32>(m_origin_count) << static_cast<quint32>(m_destination_count);
+   for (float value : m_costs) {
+      stream << value;
+   }
+   return stream.status() == QDataStream::Ok;
+}
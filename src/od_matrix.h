@@ -0,0 +1,85 @@
+#ifndef _OD_MATRIX_H_
+#define _OD_MATRIX_H_
+
+#include "road_graph.h"
+
+#include "qgspointxy.h"
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <vector>
+
+class QgsFeedback;
+class QgsGraph;
+
+/// @brief Settings of an origin-destination matrix run.
+struct OdMatrixSettings {
+   /// Index of the edge cost to minimize.
+   int strategy = 0;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+};
+
+/// @brief Many-to-many travel costs on a RoadGraph.
+///
+/// Calling QgsGraphAnalyzer::dijkstra() once per origin explores the whole graph and copies
+/// result vectors of the whole graph every time. OdMatrix runs one DijkstraSearch per worker
+/// thread over the origins, and every search stops as soon as all destinations are settled.
+/// Only the matrix itself is kept, as float costs in row-major order.
+class OdMatrix
+{
+public:
+   /// @brief Constructor.
+   /// @param graph The network, must outlive the matrix.
+   /// @param settings The cost strategy and processing options.
+   OdMatrix(const RoadGraph& graph, const OdMatrixSettings& settings);
+
+   /// @brief Returns the graph vertices of the points tied to the graph by a QgsGraphDirector.
+   ///
+   /// Pass the tied points returned by QgsGraphDirector::makeGraph(). Points not in the graph get -1.
+   static std::vector<int> tied_vertices(const QgsGraph& graph, const QVector<QgsPointXY>& tied_points);
+
+   /// @brief Computes the costs from every origin to every destination.
+   /// @param origins Origin vertices, -1 gives a row of unreachable costs.
+   /// @param destinations Destination vertices, -1 gives a column of unreachable costs.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return False if canceled.
+   bool compute(const std::vector<int>& origins, const std::vector<int>& destinations, QgsFeedback* feedback = nullptr);
+
+   int origin_count() const {
+      return m_origin_count;
+   }
+
+   int destination_count() const {
+      return m_destination_count;
+   }
+
+   /// Cost from an origin to a destination, infinity if not reachable.
+   float cost(int origin, int destination) const {
+      return m_costs[static_cast<std::size_t>(origin) * m_destination_count + destination];
+   }
+
+   /// @brief Writes the matrix as CSV, a header row of destination ids and one row per origin.
+   ///
+   /// Unreachable destinations are written as empty cells.
+   /// @param origin_ids, destination_ids Labels of the rows and columns, e.g. feature ids.
+   bool write_csv(const QString& path, const QStringList& origin_ids, const QStringList& destination_ids) const;
+
+   /// @brief Writes the matrix in a compact binary format.
+   ///
+   /// The file holds the magic bytes "ODM1", the origin and destination counts as little
+   /// endian uint32 and the costs as little endian float32 in row-major order, with
+   /// unreachable destinations as infinity.
+   bool write_binary(const QString& path) const;
+
+private:
+   const RoadGraph& m_graph;
+   OdMatrixSettings m_settings;
+   int m_origin_count = 0;
+   int m_destination_count = 0;
+   std::vector<float> m_costs;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef _PARALLEL_FOR_H_
+#define _PARALLEL_FOR_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// @brief Returns the number of worker threads to use for a requested thread count.
+/// @param requested The requested thread count, 0 selects one thread per hardware core.
+inline int resolve_thread_count(int requested) {
+   if (requested > 0) {
+      return requested;
+   }
+   const unsigned int hardware = std::thread::hardware_concurrency();
+   return hardware > 0 ? static_cast<int>(hardware) : 1;
+}
+
+/// @brief Runs func(index, worker) for every index in [0, count) on a set of worker threads.
+///
+/// Indices are handed out dynamically, so uneven work items balance across the workers.
+/// The worker id lies in [0, thread_count) and can be used to address per-thread state.
+/// The first exception thrown by func stops the remaining work and is rethrown to the caller.
+/// @param count Number of work items.
+/// @param thread_count Number of threads, 0 selects one thread per hardware core.
+/// @param func Callable taking (std::size_t index, int worker).
+template <typename Func>
+void parallel_for(std::size_t count, int thread_count, Func&& func) {
+   if (count == 0) {
+      return;
+   }
+   const int workers = static_cast<int>(std::min<std::size_t>(resolve_thread_count(thread_count), count));
+   if (workers == 1) {
+      for (std::size_t i = 0; i < count; ++i) {
+         func(i, 0);
+      }
+      return;
+   }
+
+   std::atomic<std::size_t> next(0);
+   std::atomic<bool> failed(false);
+   std::exception_ptr error;
+   std::mutex error_mutex;
+
+   auto run = [&](int worker) {
+      try {
+         for (std::size_t i = next++; i < count && !failed; i = next++) {
+            func(i, worker);
+         }
+      } catch (...) {
+         std::lock_guard<std::mutex> lock(error_mutex);
+         if (!error) {
+            error = std::current_exception();
+         }
+         failed = true;
+      }
+   };
+
+   std::vector<std::thread> threads;
+   threads.reserve(workers - 1);
+   for (int worker = 1; worker < workers; ++worker) {
+      threads.emplace_back(run, worker);
+   }
+   run(0);
+   for (std::thread& thread : threads) {
+      thread.join();
+   }
+   if (error) {
+      std::rethrow_exception(error);
+   }
+}
+
+#endif
@@ -0,0 +1,195 @@
+#include "point_cloud_buffer.h"
+
+#include "qgscoordinatetransform.h"
+#include "qgscsexception.h"
+#include "qgspointcloudattribute.h"
+#include "qgspointcloudblock.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+/// Number of points transformed by one call. A failing call throws after writing all points, the
+/// failing ones as infinity, with a message listing every point of the call.
+constexpr std::size_t s_transform_batch = 4096;
+
+template <typename T>
+void read_scaled(const char* data, int record_size, int offset, std::size_t count, double scale, double add, double* output) {
+   for (std::size_t i = 0; i < count; ++i) {
+      T value;
+      std::memcpy(&value, data + i * record_size + offset, sizeof(T));
+      output[i] = add + scale * static_cast<double>(value);
+   }
+}
+
+/// Decodes one attribute of all points as scaled doubles, 0 if the block does not have it.
+void read_attribute(const QgsPointCloudBlock& block, const QString& name, double scale, double add, double* output) {
+   const std::size_t count = static_cast<std::size_t>(block.pointCount());
+   const QgsPointCloudAttributeCollection attributes = block.attributes();
+   int offset = 0;
+   const QgsPointCloudAttribute* attribute = attributes.find(name, offset);
+   if (!attribute) {
+      std::fill(output, output + count, 0.0);
+      return;
+   }
+   const char* data = block.data();
+   const int record_size = block.pointRecordSize();
+   switch (attribute->type()) {
+      case QgsPointCloudAttribute::Char:
+         read_scaled<qint8>(data, record_size, offset, count, scale, add, output);
+         break;
+      case QgsPointCloudAttribute::UChar:
+         read_scaled<quint8>(data, record_size, offset, count, scale, add, output);
+         break;
+      case QgsPointCloudAttribute::Short:
+         read_scaled<qint16>(data, record_size, offset, count, scale, add, output);
+         break;
+      case QgsPointCloudAttribute::UShort:
+         read_scaled<quint16>(data, record_size, offset, count, scale, add, output);
+         break;
+      case QgsPointCloudAttribute::Int32:
+         read_scaled<qint32>(data, record_size, offset, count, scale, add, output);
+         break;
+      case QgsPointCloudAttribute::UInt32:
+         read_scaled<quint32>(data, record_size, offset, count, scale, add, output);
+         break;
+      case QgsPointCloudAttribute::Int64:
+         read_scaled<qint64>(data, record_size, offset, count, scale, add, output);
+         break;
+      case QgsPointCloudAttribute::UInt64:
+         read_scaled<quint64>(data, record_size, offset, count, scale, add, output);
+         break;
+      case QgsPointCloudAttribute::Float:
+         read_scaled<float>(data, record_size, offset, count, scale, add, output);
+         break;
+      case QgsPointCloudAttribute::Double:
+         read_scaled<double>(data, record_size, offset, count, scale, add, output);
+         break;
+   }
+}
+
+/// Narrows decoded values to an integer attribute array, clamped to its range.
+template <typename T>
+void narrow(const std::vector<double>& values, std::vector<T>& output) {
+   const double lowest = static_cast<double>(std::numeric_limits<T>::lowest());
+   const double highest = static_cast<double>(std::numeric_limits<T>::max());
+   for (std::size_t i = 0; i < values.size(); ++i) {
+      output[i] = static_cast<T>(std::min(std::max(values[i], lowest), highest));
+   }
+}
+
+}
+
+void PointCloudBuffer::resize(std::size_t count) {
+   x.resize(count);
+   y.resize(count);
+   z.resize(count);
+   intensity.resize(count);
+   classification.resize(count);
+}
+
+void PointCloudBuffer::compact(const std::vector<std::uint8_t>& keep) {
+   // Branch free: every point is copied, and the output position only advances for kept points.
+   std::size_t kept = 0;
+   const std::size_t count = size();
+   for (std::size_t i = 0; i < count; ++i) {
+      x[kept] = x[i];
+      y[kept] = y[i];
+      z[kept] = z[i];
+      intensity[kept] = intensity[i];
+      classification[kept] = classification[i];
+      kept += keep[i];
+   }
+   resize(kept);
+}
+
+std::size_t PointCloudBuffer::memory_usage() const {
+   return x.capacity() * 3 * sizeof(double) + intensity.capacity() * sizeof(std::uint16_t) + classification.capacity();
+}
+
+namespace point_cloud_kernels {
+
+void decode(const QgsPointCloudBlock& block, PointCloudBuffer& buffer) {
+   const std::size_t count = static_cast<std::size_t>(std::max(0, block.pointCount()));
+   buffer.resize(count);
+   const QgsVector3D scale = block.scale();
+   const QgsVector3D offset = block.offset();
+   read_attribute(block, QStringLiteral("X"), scale.x(), offset.x(), buffer.x.data());
+   read_attribute(block, QStringLiteral("Y"), scale.y(), offset.y(), buffer.y.data());
+   read_attribute(block, QStringLiteral("Z"), scale.z(), offset.z(), buffer.z.data());
+   // The integer attributes go through a scratch array of doubles, which the next attribute reuses.
+   std::vector<double> values(count);
+   read_attribute(block, QStringLiteral("Intensity"), 1.0, 0.0, values.data());
+   narrow(values, buffer.intensity);
+   read_attribute(block, QStringLiteral("Classification"), 1.0, 0.0, values.data());
+   narrow(values, buffer.classification);
+}
+
+void decode_attribute(const QgsPointCloudBlock& block, const QString& name, std::vector<double>& values) {
+   values.resize(static_cast<std::size_t>(std::max(0, block.pointCount())));
+   const QgsVector3D scale = block.scale();
+   const QgsVector3D offset = block.offset();
+   if (name == QLatin1String("X")) {
+      read_attribute(block, name, scale.x(), offset.x(), values.data());
+   } else if (name == QLatin1String("Y")) {
+      read_attribute(block, name, scale.y(), offset.y(), values.data());
+   } else if (name == QLatin1String("Z")) {
+      read_attribute(block, name, scale.z(), offset.z(), values.data());
+   } else {
+      read_attribute(block, name, 1.0, 0.0, values.data());
+   }
+}
+
+void filter(const PointCloudFilter& filter, const PointCloudBuffer& buffer, std::vector<std::uint8_t>& keep) {
+   std::array<std::uint8_t, 256> class_kept;
+   class_kept.fill(filter.classes.empty() ? 1 : 0);
+   for (int code : filter.classes) {
+      if (code >= 0 && code < 256) {
+         class_kept[code] = 1;
+      }
+   }
+   const std::size_t count = buffer.size();
+   keep.resize(count);
+   const double min_z = filter.min_z;
+   const double max_z = filter.max_z;
+   const int min_intensity = filter.min_intensity;
+   const int max_intensity = filter.max_intensity;
+   for (std::size_t i = 0; i < count; ++i) {
+      const double z = buffer.z[i];
+      const int intensity = buffer.intensity[i];
+      keep[i] = static_cast<std::uint8_t>((z >= min_z) & (z <= max_z) & (intensity >= min_intensity)
+                                          & (intensity <= max_intensity) & class_kept[buffer.classification[i]]);
+   }
+}
+
+void transform(const QgsCoordinateTransform& transform, PointCloudBuffer& buffer, std::vector<std::uint8_t>& keep) {
+   const std::size_t count = buffer.size();
+   for (std::size_t first = 0; first < count; first += s_transform_batch) {
+      const int batch = static_cast<int>(std::min(s_transform_batch, count - first));
+      try {
+         transform.transformCoords(batch, buffer.x.data() + first, buffer.y.data() + first, buffer.z.data() + first);
+      } catch (QgsCsException&) {
+      }
+   }
+   for (std::size_t i = 0; i < count; ++i) {
+      keep[i] &= static_cast<std::uint8_t>(std::isfinite(buffer.x[i]) & std::isfinite(buffer.y[i]));
+   }
+}
+
+void cell_indices(const PointCloudBuffer& buffer, double left, double top, double cell_size, int columns, int rows,
+                  std::vector<std::int64_t>& cells) {
+   const std::size_t count = buffer.size();
+   cells.resize(count);
+   const double inverse = 1.0 / cell_size;
+   for (std::size_t i = 0; i < count; ++i) {
+      const double column = std::floor((buffer.x[i] - left) * inverse);
+      const double row = std::floor((top - buffer.y[i]) * inverse);
+      const bool inside = (column >= 0.0) & (column < columns) & (row >= 0.0) & (row < rows);
+      cells[i] = inside ? static_cast<std::int64_t>(row) * columns + static_cast<std::int64_t>(column) : -1;
+   }
+}
+
+}
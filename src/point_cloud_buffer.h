@@ -0,0 +1,81 @@
+#ifndef _POINT_CLOUD_BUFFER_H_
+#define _POINT_CLOUD_BUFFER_H_
+
+#include <QString>
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+class QgsCoordinateTransform;
+class QgsPointCloudBlock;
+
+/// @brief Points of a point cloud block with every attribute in its own array.
+///
+/// A QgsPointCloudBlock stores the points as records of packed attributes, so reading one
+/// attribute of all points strides through the whole block. The kernels below decode the
+/// attributes the pipeline needs once into contiguous arrays and then work on whole arrays.
+struct PointCloudBuffer {
+   std::vector<double> x;
+   std::vector<double> y;
+   std::vector<double> z;
+   std::vector<std::uint16_t> intensity;
+   std::vector<std::uint8_t> classification;
+
+   std::size_t size() const {
+      return x.size();
+   }
+
+   void resize(std::size_t count);
+
+   /// @brief Removes the points whose flag is zero, keeping the order of the others.
+   void compact(const std::vector<std::uint8_t>& keep);
+
+   /// Approximate number of bytes held by the buffer.
+   std::size_t memory_usage() const;
+};
+
+/// @brief Attribute conditions a point has to meet.
+struct PointCloudFilter {
+   /// Classification codes to keep, all if empty.
+   std::vector<int> classes;
+   double min_z = -std::numeric_limits<double>::infinity();
+   double max_z = std::numeric_limits<double>::infinity();
+   int min_intensity = 0;
+   int max_intensity = 65535;
+   /// QgsPointCloudExpression the points have to satisfy, such as "Classification = 2", empty
+   /// for none. Evaluated by PointCloudReader after the conditions above.
+   QString expression;
+};
+
+namespace point_cloud_kernels {
+
+/// @brief Decodes the coordinates, intensity and classification of a block.
+///
+/// Attributes missing from the block read as 0.
+void decode(const QgsPointCloudBlock& block, PointCloudBuffer& buffer);
+
+/// @brief Decodes one attribute of all points of a block as doubles.
+///
+/// X, Y and Z are scaled to map coordinates. An attribute missing from the block reads as 0.
+void decode_attribute(const QgsPointCloudBlock& block, const QString& name, std::vector<double>& values);
+
+/// @brief Flags the points that pass a filter.
+/// @param keep Receives 1 for the points to keep and 0 for the others.
+void filter(const PointCloudFilter& filter, const PointCloudBuffer& buffer, std::vector<std::uint8_t>& keep);
+
+/// @brief Transforms the coordinates in place, in batches of points.
+///
+/// Points that cannot be transformed get their keep flag cleared.
+void transform(const QgsCoordinateTransform& transform, PointCloudBuffer& buffer, std::vector<std::uint8_t>& keep);
+
+/// @brief Computes the raster cell of every point.
+/// @param left, top Upper left corner of the raster.
+/// @param cells Receives row * columns + column for every point, -1 outside the raster.
+void cell_indices(const PointCloudBuffer& buffer, double left, double top, double cell_size, int columns, int rows,
+                  std::vector<std::int64_t>& cells);
+
+}
+
+#endif
@@ -0,0 +1,162 @@
+#include "point_cloud_pipeline.h"
+#include "las_writer.h"
+#include "parallel_for.h"
+#include "point_cloud_reader.h"
+
+#include "qgscoordinatetransform.h"
+#include "qgsfeedback.h"
+#include "qgspointcloudindex.h"
+
+#include <QFile>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace {
+
+/// Estimated bytes per point in flight: the raw record, the decoded arrays, the flags and the
+/// encoded LAS record.
+constexpr std::size_t s_bytes_per_point = 96;
+
+}
+
+PointCloudPipeline::PointCloudPipeline(const QgsPointCloudIndex& index, const PointCloudPipelineSettings& settings)
+   : m_index(index), m_settings(settings) {
+}
+
+int PointCloudPipeline::run(const QString& output_file, QgsFeedback* feedback) {
+   m_point_count = 0;
+   if (!m_index.isValid()) {
+      return InvalidSource;
+   }
+   if (m_settings.output == PointCloudOutput::Raster && !(m_settings.cell_size > 0.0)) {
+      return InvalidParameters;
+   }
+
+   const QgsCoordinateReferenceSystem source_crs = m_index.crs();
+   QgsCoordinateTransform transform;
+   if (m_settings.destination_crs.isValid() && m_settings.destination_crs != source_crs) {
+      transform = QgsCoordinateTransform(source_crs, m_settings.destination_crs, m_settings.transform_context);
+   }
+   const QgsCoordinateReferenceSystem crs = transform.isValid() ? m_settings.destination_crs : source_crs;
+
+   const int thread_count = resolve_thread_count(m_settings.thread_count);
+   PointCloudReader reader(m_index, m_settings.extent, m_settings.filter, transform, thread_count);
+   if (!reader.is_valid()) {
+      return InvalidSource;
+   }
+   const std::vector<PointCloudNode> nodes = reader.nodes();
+   const QgsRectangle extent = reader.output_extent(m_settings.extent.isNull() ? m_index.extent() : m_settings.extent);
+   if (extent.isNull()) {
+      return InvalidParameters;
+   }
+
+   if (m_settings.output == PointCloudOutput::Raster) {
+      PointCloudRasterSettings raster_settings;
+      raster_settings.cell_size = m_settings.cell_size;
+      raster_settings.cell_value = m_settings.cell_value;
+      raster_settings.idw_power = m_settings.idw_power;
+      raster_settings.idw_radius = m_settings.idw_radius;
+      raster_settings.output_nodata = m_settings.output_nodata;
+      raster_settings.tile_size = m_settings.tile_size;
+      raster_settings.compression = m_settings.compression;
+      raster_settings.memory_limit = m_settings.memory_limit;
+      PointCloudRasterizer rasterizer(raster_settings);
+      switch (rasterizer.run(reader, nodes, extent, crs, output_file, feedback)) {
+         case PointCloudRasterizer::Success:
+            m_point_count = rasterizer.point_count();
+            return Success;
+         case PointCloudRasterizer::InvalidParameters:
+            return InvalidParameters;
+         case PointCloudRasterizer::OutputDriverFailed:
+            return OutputDriverFailed;
+         case PointCloudRasterizer::OutputCreateFailed:
+            return OutputCreateFailed;
+         case PointCloudRasterizer::Canceled:
+            return Canceled;
+         default:
+            return WriteFailed;
+      }
+   }
+
+   std::atomic<bool> canceled(false);
+   const auto check_canceled = [&]() {
+      if (feedback && feedback->isCanceled()) {
+         canceled = true;
+      }
+      return canceled.load();
+   };
+   std::vector<PointCloudBuffer> buffers(thread_count);
+
+   QgsVector3D scale = m_index.scale();
+   QgsVector3D offset = m_index.offset();
+   if (transform.isValid()) {
+      // Millimetres, or about a centimetre in degrees, coarsened by powers of ten until twice the
+      // output extent fits the 32-bit integers around its centre.
+      const double half_size = 0.5 * std::max(extent.width(), extent.height());
+      if (!std::isfinite(half_size)) {
+         return InvalidParameters;
+      }
+      double planar_scale = crs.isGeographic() ? 1e-7 : 0.001;
+      while (2.0 * half_size / planar_scale > static_cast<double>(std::numeric_limits<qint32>::max())) {
+         planar_scale *= 10.0;
+      }
+      scale = QgsVector3D(planar_scale, planar_scale, scale.z());
+      offset = QgsVector3D(std::floor(extent.center().x()), std::floor(extent.center().y()), offset.z());
+   }
+   LasWriter writer;
+   if (!writer.open(output_file, crs, scale, offset)) {
+      return OutputCreateFailed;
+   }
+
+   std::vector<std::size_t> selection(nodes.size());
+   qint64 total_points = 0;
+   for (std::size_t i = 0; i < nodes.size(); ++i) {
+      selection[i] = i;
+      total_points += nodes[i].point_count;
+   }
+   const qint64 max_points = static_cast<qint64>(std::max<std::size_t>(1, m_settings.memory_limit / s_bytes_per_point));
+   std::vector<LasWriter::Records> records;
+   qint64 points_done = 0;
+   std::size_t first = 0;
+   for (std::size_t end : PointCloudReader::chunk_ends(nodes, selection, max_points)) {
+      if (check_canceled()) {
+         break;
+      }
+      const std::size_t chunk_size = end - first;
+      records.resize(chunk_size);
+      parallel_for(chunk_size, thread_count, [&](std::size_t i, int worker) {
+         if (canceled) {
+            return;
+         }
+         reader.read(nodes[first + i].id, worker, buffers[worker]);
+         writer.encode(buffers[worker], records[i]);
+      });
+      if (canceled) {
+         break;
+      }
+      // Written in node order, so the output does not depend on the number of threads.
+      for (std::size_t i = 0; i < chunk_size; ++i) {
+         if (!writer.write(records[i])) {
+            writer.close();
+            return WriteFailed;
+         }
+         points_done += nodes[first + i].point_count;
+         records[i] = LasWriter::Records();
+      }
+      if (feedback) {
+         feedback->setProgress(100.0 * static_cast<double>(points_done) / static_cast<double>(std::max<qint64>(1, total_points)));
+      }
+      first = end;
+   }
+   if (canceled) {
+      writer.close();
+      QFile::remove(output_file);
+      return Canceled;
+   }
+   m_point_count = static_cast<long long>(writer.point_count());
+   return writer.close() ? Success : WriteFailed;
+}
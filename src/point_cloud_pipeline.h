@@ -0,0 +1,103 @@
+#ifndef _POINT_CLOUD_PIPELINE_H_
+#define _POINT_CLOUD_PIPELINE_H_
+
+#include "point_cloud_rasterizer.h"
+
+#include "qgscoordinatereferencesystem.h"
+#include "qgscoordinatetransformcontext.h"
+#include "qgsrectangle.h"
+
+#include <QString>
+
+#include <cstddef>
+
+class QgsFeedback;
+class QgsPointCloudIndex;
+
+/// Output of a point cloud pipeline.
+enum class PointCloudOutput {
+   /// The filtered points as an uncompressed LAS 1.4 file.
+   Las,
+   /// A tiled Float32 GeoTIFF of a value computed from the elevations of the points in every cell.
+   Raster
+};
+
+/// @brief Settings of a point cloud pipeline run.
+struct PointCloudPipelineSettings {
+   /// Only points within this extent, in the CRS of the point cloud, null for all points.
+   QgsRectangle extent;
+   /// Attribute conditions of the points to keep.
+   PointCloudFilter filter;
+   /// CRS of the output, invalid to keep the CRS of the point cloud.
+   QgsCoordinateReferenceSystem destination_crs;
+   QgsCoordinateTransformContext transform_context;
+   PointCloudOutput output = PointCloudOutput::Las;
+   /// Size of the raster cells in units of the output CRS.
+   double cell_size = 1.0;
+   PointCloudCellValue cell_value = PointCloudCellValue::Maximum;
+   /// Power of the inverse distance weights of PointCloudCellValue::Idw.
+   double idw_power = 2.0;
+   /// Search radius of PointCloudCellValue::Idw in units of the output CRS, 0 for the cell size.
+   double idw_radius = 0.0;
+   /// Nodata value of raster cells without points.
+   float output_nodata = -9999.0f;
+   /// Width and height of the raster tiles in cells.
+   int tile_size = 512;
+   /// GeoTIFF compression of the raster, empty or "NONE" for none.
+   QString compression = QStringLiteral("DEFLATE");
+   /// Approximate limit of the memory used for decoded points and raster tiles, in bytes.
+   std::size_t memory_limit = std::size_t(1) << 30;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+};
+
+/// @brief Filters, reprojects and writes the points of an indexed point cloud out of core.
+///
+/// Renderers and QgsPointCloudLayerExporter decode the packed records of every
+/// QgsPointCloudBlock one point at a time through attribute offsets. This pipeline walks the
+/// octree of a COPC or EPT index and reads the nodes on all cores through a PointCloudReader.
+/// Each node is decoded into a PointCloudBuffer of separate arrays, and the filter, the
+/// reprojection and the raster binning run as loops over whole arrays.
+///
+/// LAS output is read in chunks of nodes sized by memory_limit and written in node order, so
+/// any number of points can be processed with bounded memory. Reprojected coordinates are
+/// stored in millimetres, or 1e-7 degrees, coarsened by powers of ten for large extents, and a
+/// point that still does not fit fails the run with WriteFailed. Raster output is produced by
+/// a PointCloudRasterizer, tile by tile.
+class PointCloudPipeline
+{
+public:
+   /// Result codes of run().
+   enum Result {
+      Success = 0,
+      InvalidSource = 1,
+      InvalidParameters = 2,
+      OutputDriverFailed = 3,
+      OutputCreateFailed = 4,
+      WriteFailed = 5,
+      Canceled = 6
+   };
+
+   /// @brief Constructor.
+   /// @param index The point cloud to read, must be valid for the whole run.
+   /// @param settings The stages and processing options.
+   PointCloudPipeline(const QgsPointCloudIndex& index, const PointCloudPipelineSettings& settings);
+
+   /// @brief Runs the pipeline.
+   /// @param output_file Path of the LAS or GeoTIFF file to create.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return One of the Result codes.
+   int run(const QString& output_file, QgsFeedback* feedback = nullptr);
+
+   /// Number of points written or binned by the last run.
+   long long point_count() const {
+      return m_point_count;
+   }
+
+private:
+   const QgsPointCloudIndex& m_index;
+   PointCloudPipelineSettings m_settings;
+   long long m_point_count = 0;
+};
+
+#endif
@@ -0,0 +1,348 @@
+#include "point_cloud_rasterizer.h"
+#include "parallel_for.h"
+
+#include "qgsfeedback.h"
+#include "qgsogrutils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+#include <gdal.h>
+
+namespace {
+
+/// Bytes per cell of a worker grid: the accumulated value and the point count or weight sum.
+constexpr std::size_t s_bytes_per_cell = 2 * sizeof(double);
+/// Smallest squared distance of an inverse distance weight, in squared cell sizes.
+constexpr double s_min_idw_distance2 = 1e-12;
+
+double initial_value(PointCloudCellValue cell_value) {
+   switch (cell_value) {
+      case PointCloudCellValue::Minimum:
+         return std::numeric_limits<double>::infinity();
+      case PointCloudCellValue::Maximum:
+         return -std::numeric_limits<double>::infinity();
+      default:
+         return 0.0;
+   }
+}
+
+/// @brief Cells of the tiles processed together, and the grids of every worker.
+///
+/// A grid holds two doubles per cell of a full tile and is empty until a worker bins a point
+/// into the tile.
+struct Window {
+   double left = 0.0;
+   double top = 0.0;
+   int first_row = 0;
+   int first_column = 0;
+   int rows = 0;
+   int columns = 0;
+   int tile_columns = 0;
+   int tile_count = 0;
+
+   std::vector<std::vector<double>> grids;
+
+   /// Cell pair of a window cell in the grid of a worker, allocating the grid on first use.
+   double* cell(int worker, int row, int column, int tile_size, double initial) {
+      std::vector<double>& grid =
+         grids[static_cast<std::size_t>(worker) * tile_count + (row / tile_size) * tile_columns + column / tile_size];
+      if (grid.empty()) {
+         grid.resize(2 * static_cast<std::size_t>(tile_size) * tile_size);
+         for (std::size_t i = 0; i < grid.size(); i += 2) {
+            grid[i] = initial;
+            grid[i + 1] = 0.0;
+         }
+      }
+      return grid.data() + 2 * (static_cast<std::size_t>(row % tile_size) * tile_size + column % tile_size);
+   }
+};
+
+}
+
+PointCloudRasterizer::PointCloudRasterizer(const PointCloudRasterSettings& settings) : m_settings(settings) {
+}
+
+int PointCloudRasterizer::run(PointCloudReader& reader, const std::vector<PointCloudNode>& nodes,
+                              const QgsRectangle& extent, const QgsCoordinateReferenceSystem& crs,
+                              const QString& output_file, QgsFeedback* feedback) {
+   m_point_count = 0;
+   const double cell_size = m_settings.cell_size;
+   const PointCloudCellValue cell_value = m_settings.cell_value;
+   const bool idw = cell_value == PointCloudCellValue::Idw;
+   const double radius = m_settings.idw_radius > 0.0 ? m_settings.idw_radius : cell_size;
+   if (!(cell_size > 0.0) || extent.isNull() || (idw && !(m_settings.idw_power > 0.0))) {
+      return InvalidParameters;
+   }
+
+   // The grid is anchored at the upper left corner of the extent.
+   const double columns_double = std::floor(extent.width() / cell_size) + 1.0;
+   const double rows_double = std::floor(extent.height() / cell_size) + 1.0;
+   if (columns_double > std::numeric_limits<int>::max() || rows_double > std::numeric_limits<int>::max()) {
+      return InvalidParameters;
+   }
+   const int columns = static_cast<int>(columns_double);
+   const int rows = static_cast<int>(rows_double);
+   const double left = extent.xMinimum();
+   const double top = extent.yMaximum();
+
+   GDALAllRegister();
+   GDALDriverH driver = GDALGetDriverByName("GTiff");
+   if (!driver) {
+      return OutputDriverFailed;
+   }
+   // GeoTIFF tiles are multiples of 16 cells.
+   const int tile_size = std::max(16, m_settings.tile_size / 16 * 16);
+   const QByteArray block_size = QByteArray::number(tile_size);
+   const QByteArray compression = m_settings.compression.trimmed().toUpper().toUtf8();
+   char** options = nullptr;
+   options = CSLSetNameValue(options, "TILED", "YES");
+   options = CSLSetNameValue(options, "BLOCKXSIZE", block_size.constData());
+   options = CSLSetNameValue(options, "BLOCKYSIZE", block_size.constData());
+   options = CSLSetNameValue(options, "BIGTIFF", "IF_SAFER");
+   if (!compression.isEmpty() && compression != "NONE") {
+      options = CSLSetNameValue(options, "COMPRESS", compression.constData());
+      if (compression == "DEFLATE" || compression == "LZW" || compression == "ZSTD") {
+         // Floating point predictor.
+         options = CSLSetNameValue(options, "PREDICTOR", "3");
+      }
+   }
+   gdal::dataset_unique_ptr output(GDALCreate(driver, output_file.toUtf8().constData(), columns, rows, 1, GDT_Float32, options));
+   CSLDestroy(options);
+   if (!output) {
+      return OutputCreateFailed;
+   }
+   double geo_transform[6] = {left, cell_size, 0.0, top, 0.0, -cell_size};
+   GDALSetGeoTransform(output.get(), geo_transform);
+   if (crs.isValid()) {
+      GDALSetProjection(output.get(), crs.toWkt(QgsCoordinateReferenceSystem::WKT_PREFERRED_GDAL).toUtf8().constData());
+   }
+   GDALRasterBandH output_band = GDALGetRasterBand(output.get(), 1);
+   GDALSetRasterNoDataValue(output_band, m_settings.output_nodata);
+
+   // Windows of whole tile rows when one fits in memory, otherwise runs of tiles of a tile row.
+   const int thread_count = reader.thread_count();
+   const int tiles_x = (columns + tile_size - 1) / tile_size;
+   const int tiles_y = (rows + tile_size - 1) / tile_size;
+   const std::size_t tile_bytes = static_cast<std::size_t>(thread_count) * tile_size * tile_size * s_bytes_per_cell;
+   const std::size_t window_tiles = std::min(static_cast<std::size_t>(tiles_x) * tiles_y,
+                                             std::max<std::size_t>(1, m_settings.memory_limit / tile_bytes));
+   const int window_tile_columns = static_cast<int>(std::min<std::size_t>(tiles_x, window_tiles));
+   const int window_tile_rows = static_cast<int>(std::max<std::size_t>(1, window_tiles / tiles_x));
+   const int windows_x = (tiles_x + window_tile_columns - 1) / window_tile_columns;
+   const int windows_y = (tiles_y + window_tile_rows - 1) / window_tile_rows;
+   const int window_count = windows_x * windows_y;
+
+   const double initial = initial_value(cell_value);
+   const double power = m_settings.idw_power;
+   const double radius2 = radius * radius;
+   const double min_distance2 = s_min_idw_distance2 * cell_size * cell_size;
+   Window window;
+   window.grids.resize(static_cast<std::size_t>(thread_count) * window_tile_columns * window_tile_rows);
+   std::vector<PointCloudBuffer> buffers(thread_count);
+   std::vector<std::vector<std::int64_t>> cells(thread_count);
+   std::vector<std::vector<float>> tile_values(thread_count);
+   std::vector<long long> point_counts(thread_count, 0);
+   std::mutex output_mutex;
+   std::atomic<bool> canceled(false);
+   std::atomic<bool> failed(false);
+
+   for (int index = 0; index < window_count && !canceled && !failed; ++index) {
+      const int first_tile_row = (index / windows_x) * window_tile_rows;
+      const int first_tile_column = (index % windows_x) * window_tile_columns;
+      const int tile_rows = std::min(window_tile_rows, tiles_y - first_tile_row);
+      window.tile_columns = std::min(window_tile_columns, tiles_x - first_tile_column);
+      window.tile_count = tile_rows * window.tile_columns;
+      window.first_row = first_tile_row * tile_size;
+      window.first_column = first_tile_column * tile_size;
+      window.rows = std::min(tile_rows * tile_size, rows - window.first_row);
+      window.columns = std::min(window.tile_columns * tile_size, columns - window.first_column);
+      window.left = left + window.first_column * cell_size;
+      window.top = top - window.first_row * cell_size;
+
+      // Inverse distance weighting also reads the points within the radius around the window.
+      QgsRectangle window_extent(window.left, window.top - window.rows * cell_size,
+                                 window.left + window.columns * cell_size, window.top);
+      if (idw) {
+         window_extent.grow(radius);
+      }
+      std::vector<std::size_t> selection;
+      for (std::size_t i = 0; i < nodes.size(); ++i) {
+         if (nodes[i].extent.isNull() || nodes[i].extent.intersects(window_extent)) {
+            selection.push_back(i);
+         }
+      }
+
+      parallel_for(selection.size(), thread_count, [&](std::size_t i, int worker) {
+         if (canceled) {
+            return;
+         }
+         if (feedback && feedback->isCanceled()) {
+            canceled = true;
+            return;
+         }
+         PointCloudBuffer& buffer = buffers[worker];
+         reader.read(nodes[selection[i]].id, worker, buffer);
+         const std::size_t count = buffer.size();
+
+         if (idw) {
+            const double last_row = window.rows - 1;
+            const double last_column = window.columns - 1;
+            for (std::size_t point = 0; point < count; ++point) {
+               const double x = (buffer.x[point] - window.left) / cell_size;
+               const double y = (window.top - buffer.y[point]) / cell_size;
+               if (x >= 0.0 && y >= 0.0 && x < window.columns && y < window.rows) {
+                  ++point_counts[worker];
+               }
+               // Cells whose center lies within the radius.
+               const double reach = radius / cell_size;
+               const double row_begin = std::max(0.0, std::ceil(y - reach - 0.5));
+               const double row_end = std::min(last_row, std::floor(y + reach - 0.5));
+               const double column_begin = std::max(0.0, std::ceil(x - reach - 0.5));
+               const double column_end = std::min(last_column, std::floor(x + reach - 0.5));
+               if (row_begin > row_end || column_begin > column_end) {
+                  continue;
+               }
+               const double z = buffer.z[point];
+               for (int row = static_cast<int>(row_begin); row <= row_end; ++row) {
+                  const double dy = (row + 0.5 - y) * cell_size;
+                  for (int column = static_cast<int>(column_begin); column <= column_end; ++column) {
+                     const double dx = (column + 0.5 - x) * cell_size;
+                     const double distance2 = dx * dx + dy * dy;
+                     if (distance2 > radius2) {
+                        continue;
+                     }
+                     const double clamped = std::max(distance2, min_distance2);
+                     const double weight = power == 2.0 ? 1.0 / clamped : std::pow(clamped, -0.5 * power);
+                     double* value = window.cell(worker, row, column, tile_size, initial);
+                     value[0] += weight * z;
+                     value[1] += weight;
+                  }
+               }
+            }
+            return;
+         }
+
+         std::vector<std::int64_t>& point_cells = cells[worker];
+         point_cloud_kernels::cell_indices(buffer, window.left, window.top, cell_size, window.columns, window.rows,
+                                           point_cells);
+         for (std::size_t point = 0; point < count; ++point) {
+            const std::int64_t cell = point_cells[point];
+            if (cell < 0) {
+               continue;
+            }
+            double* value = window.cell(worker, static_cast<int>(cell / window.columns),
+                                        static_cast<int>(cell % window.columns), tile_size, initial);
+            switch (cell_value) {
+               case PointCloudCellValue::Minimum:
+                  value[0] = std::min(value[0], buffer.z[point]);
+                  break;
+               case PointCloudCellValue::Maximum:
+                  value[0] = std::max(value[0], buffer.z[point]);
+                  break;
+               case PointCloudCellValue::Mean:
+                  value[0] += buffer.z[point];
+                  break;
+               default:
+                  break;
+            }
+            value[1] += 1.0;
+            ++point_counts[worker];
+         }
+      });
+      if (canceled) {
+         break;
+      }
+
+      // Merge the grids of every tile into the first worker grid, in worker order, and write it.
+      parallel_for(window.tile_count, thread_count, [&](std::size_t tile, int worker) {
+         if (failed) {
+            return;
+         }
+         std::vector<double>* merged = nullptr;
+         for (int grid_worker = 0; grid_worker < thread_count; ++grid_worker) {
+            std::vector<double>& grid = window.grids[static_cast<std::size_t>(grid_worker) * window.tile_count + tile];
+            if (grid.empty()) {
+               continue;
+            }
+            if (!merged) {
+               merged = &grid;
+               continue;
+            }
+            double* target = merged->data();
+            for (std::size_t i = 0; i < grid.size(); i += 2) {
+               switch (cell_value) {
+                  case PointCloudCellValue::Minimum:
+                     target[i] = std::min(target[i], grid[i]);
+                     break;
+                  case PointCloudCellValue::Maximum:
+                     target[i] = std::max(target[i], grid[i]);
+                     break;
+                  default:
+                     target[i] += grid[i];
+                     break;
+               }
+               target[i + 1] += grid[i + 1];
+            }
+            // Empty again but keeps its memory for the next window.
+            grid.clear();
+         }
+
+         const int tile_row = static_cast<int>(tile) / window.tile_columns;
+         const int tile_column = static_cast<int>(tile) % window.tile_columns;
+         const int first_row = tile_row * tile_size;
+         const int first_column = tile_column * tile_size;
+         const int row_count = std::min(tile_size, window.rows - first_row);
+         const int column_count = std::min(tile_size, window.columns - first_column);
+         std::vector<float>& values = tile_values[worker];
+         values.resize(static_cast<std::size_t>(row_count) * column_count);
+         for (int row = 0; row < row_count; ++row) {
+            float* output_row = values.data() + static_cast<std::size_t>(row) * column_count;
+            if (!merged) {
+               std::fill(output_row, output_row + column_count, m_settings.output_nodata);
+               continue;
+            }
+            const double* cell = merged->data() + 2 * static_cast<std::size_t>(row) * tile_size;
+            for (int column = 0; column < column_count; ++column, cell += 2) {
+               if (cell[1] == 0.0) {
+                  output_row[column] = m_settings.output_nodata;
+               } else if (cell_value == PointCloudCellValue::Mean || cell_value == PointCloudCellValue::Idw) {
+                  output_row[column] = static_cast<float>(cell[0] / cell[1]);
+               } else if (cell_value == PointCloudCellValue::Count) {
+                  output_row[column] = static_cast<float>(cell[1]);
+               } else {
+                  output_row[column] = static_cast<float>(cell[0]);
+               }
+            }
+         }
+         if (merged) {
+            merged->clear();
+         }
+
+         std::lock_guard<std::mutex> lock(output_mutex);
+         if (GDALRasterIO(output_band, GF_Write, window.first_column + first_column, window.first_row + first_row,
+                          column_count, row_count, values.data(), column_count, row_count, GDT_Float32, 0, 0)
+             != CE_None) {
+            failed = true;
+         }
+      });
+      if (feedback) {
+         feedback->setProgress(100.0 * static_cast<double>(index + 1) / static_cast<double>(window_count));
+      }
+   }
+
+   if (canceled) {
+      gdal::fast_delete_and_close(output, driver, output_file);
+      return Canceled;
+   }
+   if (failed) {
+      return WriteFailed;
+   }
+   for (long long count : point_counts) {
+      m_point_count += count;
+   }
+   return Success;
+}
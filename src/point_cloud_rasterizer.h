@@ -0,0 +1,90 @@
+#ifndef _POINT_CLOUD_RASTERIZER_H_
+#define _POINT_CLOUD_RASTERIZER_H_
+
+#include "point_cloud_reader.h"
+
+#include "qgscoordinatereferencesystem.h"
+#include "qgsrectangle.h"
+
+#include <QString>
+
+#include <cstddef>
+#include <vector>
+
+class QgsFeedback;
+
+/// Cell value of raster output.
+enum class PointCloudCellValue {
+   Minimum,
+   Maximum,
+   Mean,
+   Count,
+   /// Inverse distance weighted elevation of the points within idw_radius of the cell center.
+   Idw
+};
+
+/// @brief Settings of a point cloud rasterizer run.
+struct PointCloudRasterSettings {
+   /// Size of the raster cells in units of the output CRS.
+   double cell_size = 1.0;
+   PointCloudCellValue cell_value = PointCloudCellValue::Maximum;
+   /// Power of the inverse distance weights.
+   double idw_power = 2.0;
+   /// Search radius of the inverse distance weighting in units of the output CRS, 0 for the cell size.
+   double idw_radius = 0.0;
+   /// Nodata value of raster cells without points.
+   float output_nodata = -9999.0f;
+   /// Width and height of the output tiles in cells.
+   int tile_size = 512;
+   /// GeoTIFF compression, empty or "NONE" for none.
+   QString compression = QStringLiteral("DEFLATE");
+   /// Approximate limit of the memory used for the worker grids, in bytes.
+   std::size_t memory_limit = std::size_t(1) << 30;
+};
+
+/// @brief Bins the points of a point cloud into a tiled Float32 GeoTIFF.
+///
+/// The raster is processed in windows of whole output tiles. For every window, the workers
+/// read the nodes overlapping it through a PointCloudReader and accumulate their points into
+/// tile grids of their own, allocated on the first point, without locks. The grids of all
+/// workers are then merged tile by tile, and every finished tile is compressed and written
+/// exactly once. Neither the points nor the full grid are ever held in memory.
+class PointCloudRasterizer
+{
+public:
+   /// Result codes of run().
+   enum Result {
+      Success = 0,
+      InvalidParameters = 1,
+      OutputDriverFailed = 2,
+      OutputCreateFailed = 3,
+      WriteFailed = 4,
+      Canceled = 5
+   };
+
+   /// @brief Constructor.
+   /// @param settings The cell value and output options.
+   explicit PointCloudRasterizer(const PointCloudRasterSettings& settings);
+
+   /// @brief Rasterizes the points of nodes.
+   /// @param reader Reader of the nodes, with one worker per thread of the run.
+   /// @param nodes The nodes to rasterize, from PointCloudReader::nodes().
+   /// @param extent Extent of the raster in the output CRS, anchored at its upper left corner.
+   /// @param crs CRS of the output.
+   /// @param output_file Path of the GeoTIFF to create.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return One of the Result codes.
+   int run(PointCloudReader& reader, const std::vector<PointCloudNode>& nodes, const QgsRectangle& extent,
+           const QgsCoordinateReferenceSystem& crs, const QString& output_file, QgsFeedback* feedback = nullptr);
+
+   /// Number of points binned by the last run.
+   long long point_count() const {
+      return m_point_count;
+   }
+
+private:
+   PointCloudRasterSettings m_settings;
+   long long m_point_count = 0;
+};
+
+#endif
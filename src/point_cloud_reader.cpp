@@ -0,0 +1,168 @@
+#include "point_cloud_reader.h"
+
+#include "qgscsexception.h"
+#include "qgspointcloudblock.h"
+
+#include <QSet>
+
+#include <algorithm>
+#include <array>
+
+PointCloudReader::PointCloudReader(const QgsPointCloudIndex& index, const QgsRectangle& extent,
+                                   const PointCloudFilter& filter, const QgsCoordinateTransform& transform,
+                                   int thread_count, const QStringList& extra_attributes)
+   : m_index(index), m_extent(extent), m_filter(filter), m_transform(transform), m_transforms(thread_count, transform),
+     m_keep(thread_count) {
+   if (!index.isValid()) {
+      return;
+   }
+
+   // Request only the attributes the kernels decode, the expression references and the caller asks for.
+   QgsPointCloudExpression expression(filter.expression);
+   const bool has_expression = !filter.expression.trimmed().isEmpty();
+   if (has_expression && !expression.isValid()) {
+      return;
+   }
+   QSet<QString> names{QStringLiteral("X"), QStringLiteral("Y"), QStringLiteral("Z"), QStringLiteral("Intensity"),
+                       QStringLiteral("Classification")};
+   for (const QString& name : extra_attributes) {
+      names.insert(name);
+   }
+   if (has_expression) {
+      const QSet<QString> referenced = expression.referencedAttributes();
+      m_expression_per_class = referenced == QSet<QString>{QStringLiteral("Classification")};
+      names.unite(referenced);
+   }
+   const QgsPointCloudAttributeCollection available = index.attributes();
+   QgsPointCloudAttributeCollection attributes;
+   for (const QgsPointCloudAttribute& attribute : available.attributes()) {
+      if (names.contains(attribute.name())) {
+         attributes.push_back(attribute);
+      }
+   }
+   if (attributes.indexOf(QStringLiteral("X")) < 0 || attributes.indexOf(QStringLiteral("Y")) < 0
+       || attributes.indexOf(QStringLiteral("Z")) < 0) {
+      return;
+   }
+   m_request.setAttributes(attributes);
+   if (!extent.isNull()) {
+      m_request.setFilterRect(extent);
+   }
+
+   for (int worker = 0; worker < thread_count; ++worker) {
+      m_indexes.push_back(index.clone());
+      if (!m_indexes.back() || !m_indexes.back()->isValid()) {
+         return;
+      }
+   }
+   if (has_expression) {
+      // Every worker prepares its own copy.
+      m_expressions.assign(thread_count, expression);
+   }
+   m_valid = true;
+}
+
+QgsRectangle PointCloudReader::output_extent(const QgsRectangle& extent) const {
+   if (!m_transform.isValid()) {
+      return extent;
+   }
+   try {
+      return m_transform.transformBoundingBox(extent);
+   } catch (QgsCsException&) {
+      return QgsRectangle();
+   }
+}
+
+std::vector<PointCloudNode> PointCloudReader::nodes() const {
+   std::vector<PointCloudNode> nodes;
+   std::vector<IndexedPointCloudNode> pending{IndexedPointCloudNode(0, 0, 0, 0)};
+   for (std::size_t next = 0; next < pending.size(); ++next) {
+      const IndexedPointCloudNode id = pending[next];
+      if (!m_index.hasNode(id)) {
+         continue;
+      }
+      const QgsRectangle node_extent = m_index.nodeMapExtent(id);
+      // Children lie within their parent.
+      if (!m_extent.isNull() && !m_extent.intersects(node_extent)) {
+         continue;
+      }
+      const qint64 point_count = m_index.nodePointCount(id);
+      if (point_count > 0) {
+         nodes.push_back({id, point_count, output_extent(node_extent)});
+      }
+      const QList<IndexedPointCloudNode> children = m_index.nodeChildren(id);
+      pending.insert(pending.end(), children.begin(), children.end());
+   }
+   return nodes;
+}
+
+std::unique_ptr<QgsPointCloudBlock> PointCloudReader::read_block(const IndexedPointCloudNode& node, int worker) {
+   return m_indexes[worker]->nodeData(node, m_request);
+}
+
+void PointCloudReader::read(const IndexedPointCloudNode& node, int worker, PointCloudBuffer& buffer) {
+   std::unique_ptr<QgsPointCloudBlock> block = read_block(node, worker);
+   if (!block) {
+      buffer.resize(0);
+      return;
+   }
+   point_cloud_kernels::decode(*block, buffer);
+   std::vector<std::uint8_t>& keep = m_keep[worker];
+   point_cloud_kernels::filter(m_filter, buffer, keep);
+   if (!m_expressions.empty()) {
+      evaluate_expression(worker, *block, buffer, keep);
+   }
+   block.reset();
+   buffer.compact(keep);
+   if (m_transforms[worker].isValid()) {
+      keep.assign(buffer.size(), 1);
+      point_cloud_kernels::transform(m_transforms[worker], buffer, keep);
+      buffer.compact(keep);
+   }
+}
+
+void PointCloudReader::evaluate_expression(int worker, const QgsPointCloudBlock& block, const PointCloudBuffer& buffer,
+                                           std::vector<std::uint8_t>& keep) {
+   QgsPointCloudExpression& expression = m_expressions[worker];
+   if (!expression.prepare(&block)) {
+      std::fill(keep.begin(), keep.end(), 0);
+      return;
+   }
+   const int count = static_cast<int>(buffer.size());
+   if (m_expression_per_class) {
+      // Result of every class code, -1 until the first point of the class is evaluated.
+      std::array<std::int8_t, 256> results;
+      results.fill(-1);
+      for (int i = 0; i < count; ++i) {
+         std::int8_t& result = results[buffer.classification[i]];
+         if (keep[i] && result < 0) {
+            result = expression.evaluate(i) != 0.0 ? 1 : 0;
+         }
+         keep[i] &= static_cast<std::uint8_t>(result > 0);
+      }
+      return;
+   }
+   for (int i = 0; i < count; ++i) {
+      if (keep[i]) {
+         keep[i] = expression.evaluate(i) != 0.0 ? 1 : 0;
+      }
+   }
+}
+
+std::vector<std::size_t> PointCloudReader::chunk_ends(const std::vector<PointCloudNode>& nodes,
+                                                      const std::vector<std::size_t>& selection, qint64 max_points) {
+   std::vector<std::size_t> ends;
+   qint64 points = 0;
+   for (std::size_t i = 0; i < selection.size(); ++i) {
+      const qint64 node_points = nodes[selection[i]].point_count;
+      if (i > 0 && points + node_points > max_points) {
+         ends.push_back(i);
+         points = 0;
+      }
+      points += node_points;
+   }
+   if (!selection.empty()) {
+      ends.push_back(selection.size());
+   }
+   return ends;
+}
@@ -0,0 +1,97 @@
+#ifndef _POINT_CLOUD_READER_H_
+#define _POINT_CLOUD_READER_H_
+
+#include "point_cloud_buffer.h"
+
+#include "qgscoordinatetransform.h"
+#include "qgspointcloudexpression.h"
+#include "qgspointcloudindex.h"
+#include "qgspointcloudrequest.h"
+#include "qgsrectangle.h"
+
+#include <QStringList>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/// A node of a point cloud index holding points.
+struct PointCloudNode {
+   IndexedPointCloudNode id;
+   qint64 point_count = 0;
+   /// Extent in the output CRS, null if it could not be transformed.
+   QgsRectangle extent;
+};
+
+/// @brief Reads the points of point cloud nodes on several worker threads.
+///
+/// Every worker reads through its own clone of the index and requests only the coordinates,
+/// intensity, classification and the attributes of the filter expression. The points of a
+/// node are decoded into a PointCloudBuffer, filtered and transformed to the output CRS.
+///
+/// A filter expression referencing only the classification is evaluated once per class
+/// code of a node instead of once per point.
+class PointCloudReader
+{
+public:
+   /// @brief Constructor.
+   /// @param index The point cloud to read, must stay valid while the reader is used.
+   /// @param extent Only points within this extent of the index CRS, null for all points.
+   /// @param filter Conditions of the points to keep.
+   /// @param transform Transform from the index CRS to the output CRS, invalid to keep the index CRS.
+   /// @param thread_count Number of workers that call read().
+   /// @param attributes Further attributes to request, for read_block().
+   PointCloudReader(const QgsPointCloudIndex& index, const QgsRectangle& extent, const PointCloudFilter& filter,
+                    const QgsCoordinateTransform& transform, int thread_count,
+                    const QStringList& attributes = QStringList());
+
+   /// False if the index has no coordinates, could not be cloned or the filter expression is invalid.
+   bool is_valid() const {
+      return m_valid;
+   }
+
+   /// Number of workers that may call read() at the same time.
+   int thread_count() const {
+      return static_cast<int>(m_transforms.size());
+   }
+
+   /// Collects the nodes with points within the extent, parents before children.
+   std::vector<PointCloudNode> nodes() const;
+
+   /// Transforms a rectangle of the index CRS to the output CRS, null if that fails.
+   QgsRectangle output_extent(const QgsRectangle& extent) const;
+
+   /// @brief Reads, filters and transforms the points of a node.
+   /// @param worker The calling worker, each worker may read one node at a time.
+   void read(const IndexedPointCloudNode& node, int worker, PointCloudBuffer& buffer);
+
+   /// @brief Reads the block of a node, clipped to the extent but neither filtered nor transformed.
+   /// @param worker The calling worker, each worker may read one node at a time.
+   std::unique_ptr<QgsPointCloudBlock> read_block(const IndexedPointCloudNode& node, int worker);
+
+   /// @brief Splits a selection of nodes into consecutive chunks of at most max_points points.
+   /// @return The end of every chunk in selection, a chunk has at least one node.
+   static std::vector<std::size_t> chunk_ends(const std::vector<PointCloudNode>& nodes,
+                                              const std::vector<std::size_t>& selection, qint64 max_points);
+
+private:
+   /// Clears keep for the kept points of the block failing the filter expression.
+   void evaluate_expression(int worker, const QgsPointCloudBlock& block, const PointCloudBuffer& buffer,
+                            std::vector<std::uint8_t>& keep);
+
+   const QgsPointCloudIndex& m_index;
+   QgsRectangle m_extent;
+   PointCloudFilter m_filter;
+   QgsCoordinateTransform m_transform;
+   QgsPointCloudRequest m_request;
+   bool m_valid = false;
+   /// True if the filter expression only references the classification.
+   bool m_expression_per_class = false;
+   std::vector<std::unique_ptr<QgsPointCloudIndex>> m_indexes;
+   std::vector<QgsCoordinateTransform> m_transforms;
+   std::vector<QgsPointCloudExpression> m_expressions;
+   std::vector<std::vector<std::uint8_t>> m_keep;
+};
+
+#endif
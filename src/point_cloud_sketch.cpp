@@ -0,0 +1,264 @@
+#include "point_cloud_sketch.h"
+
+#include <QtAlgorithms>
+
+#include <cstring>
+#include <utility>
+
+namespace {
+
+constexpr int s_min_precision = 4;
+constexpr int s_max_precision = 16;
+/// Smallest k of a KLL sketch.
+constexpr int s_min_k = 8;
+/// Capacity ratio of consecutive KLL levels.
+constexpr double s_level_ratio = 2.0 / 3.0;
+/// Upper bound of the levels and items read from a stream, against corrupted input.
+constexpr quint32 s_max_levels = 64;
+constexpr quint32 s_max_items = 1u << 24;
+
+/// SplitMix64 finalizer, spreading the bits of a value over the whole word.
+quint64 mix(quint64 value) {
+   value += 0x9e3779b97f4a7c15ULL;
+   value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+   value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+   return value ^ (value >> 31);
+}
+
+}
+
+HyperLogLog::HyperLogLog(int precision)
+   : m_precision(std::min(std::max(precision, s_min_precision), s_max_precision)),
+     m_registers(std::size_t(1) << m_precision, 0) {
+}
+
+void HyperLogLog::add(double value) {
+   // -0 and 0 are the same value.
+   const double canonical = value == 0.0 ? 0.0 : value;
+   quint64 bits;
+   std::memcpy(&bits, &canonical, sizeof(bits));
+   add_hash(bits);
+}
+
+void HyperLogLog::add_hash(quint64 hash) {
+   const quint64 mixed = mix(hash);
+   const std::size_t index = static_cast<std::size_t>(mixed >> (64 - m_precision));
+   // Position of the first set bit of the remaining bits, the guard bit bounds it.
+   const quint64 rest = (mixed << m_precision) | (quint64(1) << (m_precision - 1));
+   const std::uint8_t rank = static_cast<std::uint8_t>(qCountLeadingZeroBits(rest) + 1);
+   m_registers[index] = std::max(m_registers[index], rank);
+}
+
+void HyperLogLog::merge(const HyperLogLog& other) {
+   for (std::size_t i = 0; i < m_registers.size() && i < other.m_registers.size(); ++i) {
+      m_registers[i] = std::max(m_registers[i], other.m_registers[i]);
+   }
+}
+
+double HyperLogLog::estimate() const {
+   const double m = static_cast<double>(m_registers.size());
+   double sum = 0.0;
+   std::size_t zeros = 0;
+   for (std::uint8_t rank : m_registers) {
+      sum += std::ldexp(1.0, -static_cast<int>(rank));
+      zeros += rank == 0;
+   }
+   const double alpha = 0.7213 / (1.0 + 1.079 / m);
+   const double estimate = alpha * m * m / sum;
+   // Linear counting for small cardinalities.
+   if (estimate <= 2.5 * m && zeros > 0) {
+      return m * std::log(m / static_cast<double>(zeros));
+   }
+   return estimate;
+}
+
+void HyperLogLog::write(QDataStream& stream) const {
+   stream << static_cast<qint32>(m_precision);
+   stream.writeRawData(reinterpret_cast<const char*>(m_registers.data()), static_cast<int>(m_registers.size()));
+}
+
+bool HyperLogLog::read(QDataStream& stream) {
+   qint32 precision = 0;
+   stream >> precision;
+   if (stream.status() != QDataStream::Ok || precision != m_precision) {
+      return false;
+   }
+   const int size = static_cast<int>(m_registers.size());
+   return stream.readRawData(reinterpret_cast<char*>(m_registers.data()), size) == size;
+}
+
+KllSketch::KllSketch(int k) : m_k(std::max(k, s_min_k)), m_levels(1) {
+   update_capacities();
+}
+
+void KllSketch::update_capacities() {
+   const std::size_t level_count = m_levels.size();
+   m_capacities.resize(level_count);
+   m_max_size = 0;
+   for (std::size_t level = 0; level < level_count; ++level) {
+      const double depth = static_cast<double>(level_count - 1 - level);
+      m_capacities[level] = std::max<std::size_t>(2, static_cast<std::size_t>(std::ceil(m_k * std::pow(s_level_ratio, depth))));
+      m_max_size += m_capacities[level];
+   }
+}
+
+void KllSketch::add(double value) {
+   m_levels[0].push_back(value);
+   ++m_size;
+   ++m_count;
+   if (m_size > m_max_size) {
+      compress();
+   }
+}
+
+void KllSketch::merge(const KllSketch& other) {
+   if (other.m_levels.size() > m_levels.size()) {
+      m_levels.resize(other.m_levels.size());
+      update_capacities();
+   }
+   for (std::size_t level = 0; level < other.m_levels.size(); ++level) {
+      m_levels[level].insert(m_levels[level].end(), other.m_levels[level].begin(), other.m_levels[level].end());
+   }
+   m_size += other.m_size;
+   m_count += other.m_count;
+   while (m_size > m_max_size) {
+      compress();
+   }
+}
+
+void KllSketch::compress() {
+   for (std::size_t level = 0; level < m_levels.size(); ++level) {
+      if (m_levels[level].size() < m_capacities[level]) {
+         continue;
+      }
+      if (level + 1 == m_levels.size()) {
+         m_levels.emplace_back();
+         update_capacities();
+      }
+      std::vector<double>& items = m_levels[level];
+      std::sort(items.begin(), items.end());
+      // An odd item out stays on this level.
+      const std::size_t kept = items.size() % 2;
+      std::vector<double>& next = m_levels[level + 1];
+      for (std::size_t i = kept + m_offset; i < items.size(); i += 2) {
+         next.push_back(items[i]);
+      }
+      m_size -= (items.size() - kept) / 2;
+      items.resize(kept);
+      m_offset ^= 1;
+      return;
+   }
+}
+
+double KllSketch::quantile(double q) const {
+   std::vector<std::pair<double, quint64>> items;
+   items.reserve(m_size);
+   quint64 total = 0;
+   for (std::size_t level = 0; level < m_levels.size(); ++level) {
+      for (double value : m_levels[level]) {
+         items.emplace_back(value, quint64(1) << level);
+         total += quint64(1) << level;
+      }
+   }
+   if (items.empty()) {
+      return std::numeric_limits<double>::quiet_NaN();
+   }
+   std::sort(items.begin(), items.end());
+   const double target = std::min(std::max(q, 0.0), 1.0) * static_cast<double>(total);
+   quint64 cumulative = 0;
+   for (const std::pair<double, quint64>& item : items) {
+      cumulative += item.second;
+      if (static_cast<double>(cumulative) >= target) {
+         return item.first;
+      }
+   }
+   return items.back().first;
+}
+
+void KllSketch::write(QDataStream& stream) const {
+   stream << static_cast<qint32>(m_k) << m_count << m_offset << static_cast<quint32>(m_levels.size());
+   for (const std::vector<double>& items : m_levels) {
+      stream << static_cast<quint32>(items.size());
+      for (double value : items) {
+         stream << value;
+      }
+   }
+}
+
+bool KllSketch::read(QDataStream& stream) {
+   qint32 k = 0;
+   quint32 level_count = 0;
+   stream >> k >> m_count >> m_offset >> level_count;
+   if (stream.status() != QDataStream::Ok || k != m_k || level_count == 0 || level_count > s_max_levels) {
+      return false;
+   }
+   m_levels.assign(level_count, std::vector<double>());
+   m_size = 0;
+   for (std::vector<double>& items : m_levels) {
+      quint32 size = 0;
+      stream >> size;
+      if (stream.status() != QDataStream::Ok || size > s_max_items) {
+         return false;
+      }
+      items.resize(size);
+      for (double& value : items) {
+         stream >> value;
+      }
+      m_size += size;
+   }
+   m_offset &= 1;
+   update_capacities();
+   return stream.status() == QDataStream::Ok;
+}
+
+void PointCloudSketch::merge(const PointCloudSketch& other) {
+   point_count += other.point_count;
+   for (std::size_t i = 0; i < attributes.size() && i < other.attributes.size(); ++i) {
+      attributes[i].merge(other.attributes[i]);
+   }
+   for (const std::pair<const int, qint64>& entry : other.class_counts) {
+      class_counts[entry.first] += entry.second;
+   }
+}
+
+void PointCloudSketch::write(QDataStream& stream) const {
+   stream << point_count << static_cast<quint32>(attributes.size());
+   for (const AttributeSketch& attribute : attributes) {
+      const MomentSketch& moments = attribute.moments;
+      stream << moments.count << moments.minimum << moments.maximum << moments.mean << moments.m2;
+      attribute.distinct.write(stream);
+      attribute.quantiles.write(stream);
+   }
+   stream << static_cast<quint32>(class_counts.size());
+   for (const std::pair<const int, qint64>& entry : class_counts) {
+      stream << static_cast<qint32>(entry.first) << entry.second;
+   }
+}
+
+bool PointCloudSketch::read(QDataStream& stream) {
+   quint32 attribute_count = 0;
+   stream >> point_count >> attribute_count;
+   if (stream.status() != QDataStream::Ok || attribute_count != attributes.size()) {
+      return false;
+   }
+   for (AttributeSketch& attribute : attributes) {
+      MomentSketch& moments = attribute.moments;
+      stream >> moments.count >> moments.minimum >> moments.maximum >> moments.mean >> moments.m2;
+      if (!attribute.distinct.read(stream) || !attribute.quantiles.read(stream)) {
+         return false;
+      }
+   }
+   quint32 class_count = 0;
+   stream >> class_count;
+   if (stream.status() != QDataStream::Ok || class_count > s_max_items) {
+      return false;
+   }
+   class_counts.clear();
+   for (quint32 i = 0; i < class_count; ++i) {
+      qint32 code = 0;
+      qint64 count = 0;
+      stream >> code >> count;
+      class_counts[code] = count;
+   }
+   return stream.status() == QDataStream::Ok;
+}
@@ -0,0 +1,200 @@
+#ifndef _POINT_CLOUD_SKETCH_H_
+#define _POINT_CLOUD_SKETCH_H_
+
+#include <QDataStream>
+#include <QtGlobal>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <vector>
+
+/// @brief Count, extremes, mean and variance of a stream of values.
+///
+/// Values are added with Welford's algorithm and sketches merged with Chan's formula, so the
+/// sketches of any partition of the values combine to the moments of all of them.
+struct MomentSketch {
+   qint64 count = 0;
+   double minimum = std::numeric_limits<double>::infinity();
+   double maximum = -std::numeric_limits<double>::infinity();
+   double mean = 0.0;
+   /// Sum of squared differences from the mean.
+   double m2 = 0.0;
+
+   void add(double value) {
+      ++count;
+      minimum = std::min(minimum, value);
+      maximum = std::max(maximum, value);
+      const double delta = value - mean;
+      mean += delta / static_cast<double>(count);
+      m2 += delta * (value - mean);
+   }
+
+   void merge(const MomentSketch& other) {
+      if (other.count == 0) {
+         return;
+      }
+      const double total = static_cast<double>(count + other.count);
+      const double delta = other.mean - mean;
+      m2 += other.m2 + delta * delta * static_cast<double>(count) * static_cast<double>(other.count) / total;
+      mean += delta * static_cast<double>(other.count) / total;
+      count += other.count;
+      minimum = std::min(minimum, other.minimum);
+      maximum = std::max(maximum, other.maximum);
+   }
+
+   /// Population standard deviation, like QgsPointCloudStatistics.
+   double stddev() const {
+      return count > 0 ? std::sqrt(m2 / static_cast<double>(count)) : std::numeric_limits<double>::quiet_NaN();
+   }
+};
+
+/// @brief Sum of a stream of values with Neumaier's compensation of the rounding errors.
+///
+/// The error stays in the order of one rounding of the total, where a plain running sum of
+/// many values of mixed magnitude loses digits with every addition.
+struct CompensatedSum {
+   double sum = 0.0;
+   double compensation = 0.0;
+
+   void add(double value) {
+      const double total = sum + value;
+      if (std::abs(sum) >= std::abs(value)) {
+         compensation += (sum - total) + value;
+      } else {
+         compensation += (value - total) + sum;
+      }
+      sum = total;
+   }
+
+   void merge(const CompensatedSum& other) {
+      add(other.sum);
+      compensation += other.compensation;
+   }
+
+   double value() const {
+      return sum + compensation;
+   }
+};
+
+/// @brief HyperLogLog estimate of the number of distinct values.
+///
+/// Keeps one byte per register, 2^precision bytes in total, for a relative error of
+/// about 1.04 / sqrt(2^precision). Merging takes the maximum of every register, so the
+/// estimate of merged sketches equals the estimate of all values.
+class HyperLogLog
+{
+public:
+   explicit HyperLogLog(int precision = 11);
+
+   void add(double value);
+
+   /// Adds a value by a 64 bit hash of it, e.g. of a string.
+   void add_hash(quint64 hash);
+
+   /// Both sketches must have the same precision.
+   void merge(const HyperLogLog& other);
+
+   double estimate() const;
+
+   void write(QDataStream& stream) const;
+   bool read(QDataStream& stream);
+
+private:
+   int m_precision;
+   std::vector<std::uint8_t> m_registers;
+};
+
+/// @brief KLL sketch of the distribution of a stream of values.
+///
+/// Values are kept in levels of compactors, an item of level h standing for 2^h values. A full
+/// level is sorted and every other item promoted to the next one, so the sketch holds about
+/// 3k items and the rank error of quantile() is about 1.7 / k. The promoted half alternates
+/// between compactions instead of being drawn at random, so equal inputs always give equal
+/// sketches and cached sketches can be compared.
+class KllSketch
+{
+public:
+   explicit KllSketch(int k = 128);
+
+   void add(double value);
+
+   /// Both sketches must have the same k.
+   void merge(const KllSketch& other);
+
+   /// Approximate q-quantile, q in [0, 1], NaN if the sketch is empty.
+   double quantile(double q) const;
+
+   qint64 count() const {
+      return m_count;
+   }
+
+   void write(QDataStream& stream) const;
+   bool read(QDataStream& stream);
+
+private:
+   void update_capacities();
+   /// Compacts the lowest full level.
+   void compress();
+
+   int m_k;
+   qint64 m_count = 0;
+   /// Which half of the next compaction is promoted.
+   std::uint8_t m_offset = 0;
+   std::vector<std::vector<double>> m_levels;
+   std::vector<std::size_t> m_capacities;
+   std::size_t m_size = 0;
+   std::size_t m_max_size = 0;
+};
+
+/// Sketches of the values of one attribute. NaN values are skipped.
+struct AttributeSketch {
+   AttributeSketch(int hll_precision, int kll_k) : distinct(hll_precision), quantiles(kll_k) {
+   }
+
+   void add(double value) {
+      if (std::isnan(value)) {
+         return;
+      }
+      moments.add(value);
+      distinct.add(value);
+      quantiles.add(value);
+   }
+
+   void merge(const AttributeSketch& other) {
+      moments.merge(other.moments);
+      distinct.merge(other.distinct);
+      quantiles.merge(other.quantiles);
+   }
+
+   MomentSketch moments;
+   HyperLogLog distinct;
+   KllSketch quantiles;
+};
+
+/// @brief Mergeable statistics of the points of a point cloud node or of a set of nodes.
+struct PointCloudSketch {
+   /// @brief Constructor.
+   /// @param attribute_count Number of attribute sketches.
+   /// @param hll_precision, kll_k Parameters of the attribute sketches.
+   PointCloudSketch(std::size_t attribute_count = 0, int hll_precision = 11, int kll_k = 128)
+      : attributes(attribute_count, AttributeSketch(hll_precision, kll_k)) {
+   }
+
+   /// Both sketches must have the same attributes and parameters.
+   void merge(const PointCloudSketch& other);
+
+   void write(QDataStream& stream) const;
+   /// Reads a sketch with the attribute count and parameters of this one, false if it differs.
+   bool read(QDataStream& stream);
+
+   qint64 point_count = 0;
+   std::vector<AttributeSketch> attributes;
+   /// Exact number of points of every classification code.
+   std::map<int, qint64> class_counts;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include "point_cloud_sketch_cache.h"
+
+#include <QDataStream>
+
+namespace {
+
+constexpr char s_magic[] = "QPCSKCH1";
+constexpr int s_magic_size = 8;
+constexpr QDataStream::Version s_stream_version = QDataStream::Qt_5_12;
+/// The directory offset and the magic closing a complete file.
+constexpr qint64 s_footer_size = sizeof(qint64) + s_magic_size;
+
+void prepare(QDataStream& stream) {
+   stream.setVersion(s_stream_version);
+   stream.setByteOrder(QDataStream::LittleEndian);
+}
+
+}
+
+PointCloudSketchCache::~PointCloudSketchCache() {
+   close();
+}
+
+bool PointCloudSketchCache::open(const QString& path, const QByteArray& fingerprint) {
+   close();
+   m_directory.clear();
+   m_modified = false;
+   m_file.setFileName(path);
+   if (!m_file.open(QIODevice::ReadWrite)) {
+      return false;
+   }
+
+   // Load the directory of a complete file with the same fingerprint.
+   QDataStream stream(&m_file);
+   prepare(stream);
+   bool valid = false;
+   const qint64 size = m_file.size();
+   if (size >= s_magic_size + s_footer_size) {
+      QByteArray magic(s_magic_size, '\0');
+      QByteArray stored_fingerprint;
+      qint64 directory_offset = 0;
+      QByteArray end_magic(s_magic_size, '\0');
+      stream.readRawData(magic.data(), s_magic_size);
+      stream >> stored_fingerprint;
+      const qint64 header_end = m_file.pos();
+      m_file.seek(size - s_footer_size);
+      stream >> directory_offset;
+      stream.readRawData(end_magic.data(), s_magic_size);
+      if (stream.status() == QDataStream::Ok && magic == s_magic && end_magic == s_magic
+          && stored_fingerprint == fingerprint && directory_offset >= header_end
+          && directory_offset <= size - s_footer_size && m_file.seek(directory_offset)) {
+         quint32 count = 0;
+         stream >> count;
+         for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+            QString node;
+            qint64 offset = 0;
+            stream >> node >> offset;
+            m_directory.insert(node, offset);
+         }
+         valid = stream.status() == QDataStream::Ok;
+         m_records_end = directory_offset;
+      }
+   }
+   if (valid) {
+      return true;
+   }
+
+   // Start over with an empty cache.
+   m_directory.clear();
+   stream.resetStatus();
+   if (!m_file.resize(0) || !m_file.seek(0)) {
+      m_file.close();
+      return false;
+   }
+   stream.writeRawData(s_magic, s_magic_size);
+   stream << fingerprint;
+   m_records_end = m_file.pos();
+   m_modified = true;
+   return stream.status() == QDataStream::Ok;
+}
+
+bool PointCloudSketchCache::read(const QString& node, PointCloudSketch& sketch) {
+   const auto entry = m_directory.constFind(node);
+   if (entry == m_directory.constEnd() || !m_file.isOpen() || !m_file.seek(entry.value())) {
+      return false;
+   }
+   QDataStream stream(&m_file);
+   prepare(stream);
+   QByteArray record;
+   stream >> record;
+   if (stream.status() != QDataStream::Ok) {
+      return false;
+   }
+   const QByteArray data = qUncompress(record);
+   QDataStream record_stream(data);
+   prepare(record_stream);
+   return !data.isEmpty() && sketch.read(record_stream);
+}
+
+bool PointCloudSketchCache::write(const QString& node, const PointCloudSketch& sketch) {
+   if (!m_file.isOpen()) {
+      return false;
+   }
+   // Drop the old directory first, so an interrupted update leaves an invalid file.
+   if (!m_modified && !m_file.resize(m_records_end)) {
+      return false;
+   }
+   m_modified = true;
+   if (!m_file.seek(m_records_end)) {
+      return false;
+   }
+   QByteArray data;
+   {
+      QDataStream record_stream(&data, QIODevice::WriteOnly);
+      prepare(record_stream);
+      sketch.write(record_stream);
+   }
+   QDataStream stream(&m_file);
+   prepare(stream);
+   stream << qCompress(data);
+   if (stream.status() != QDataStream::Ok) {
+      return false;
+   }
+   m_directory.insert(node, m_records_end);
+   m_records_end = m_file.pos();
+   return true;
+}
+
+bool PointCloudSketchCache::close() {
+   if (!m_file.isOpen()) {
+      return true;
+   }
+   bool written = true;
+   if (m_modified && m_file.seek(m_records_end)) {
+      QDataStream stream(&m_file);
+      prepare(stream);
+      stream << static_cast<quint32>(m_directory.size());
+      for (auto entry = m_directory.constBegin(); entry != m_directory.constEnd(); ++entry) {
+         stream << entry.key() << entry.value();
+      }
+      stream << m_records_end;
+      stream.writeRawData(s_magic, s_magic_size);
+      written = stream.status() == QDataStream::Ok && m_file.resize(m_file.pos()) && m_file.flush();
+   } else if (m_modified) {
+      written = false;
+   }
+   m_file.close();
+   m_modified = false;
+   return written;
+}
@@ -0,0 +1,60 @@
+#ifndef _POINT_CLOUD_SKETCH_CACHE_H_
+#define _POINT_CLOUD_SKETCH_CACHE_H_
+
+#include "point_cloud_sketch.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QString>
+
+/// @brief Sidecar file of the sketches of point cloud nodes, keyed by node id.
+///
+/// The file holds a header with a fingerprint of the point cloud and the sketch parameters,
+/// the compressed sketch records, and a directory of the records at the end. Opening reads
+/// only the directory, and sketches are read on demand. New sketches are appended over the
+/// old directory, and close() writes the new directory. A cache with another fingerprint or
+/// without a complete directory, for example after a crash while writing, starts empty.
+class PointCloudSketchCache
+{
+public:
+   PointCloudSketchCache() = default;
+   ~PointCloudSketchCache();
+
+   PointCloudSketchCache(const PointCloudSketchCache&) = delete;
+   PointCloudSketchCache& operator=(const PointCloudSketchCache&) = delete;
+
+   /// @brief Opens or creates a cache file.
+   /// @param fingerprint Identifies the point cloud and the sketch parameters.
+   /// @return False if the file cannot be opened for writing.
+   bool open(const QString& path, const QByteArray& fingerprint);
+
+   bool contains(const QString& node) const {
+      return m_directory.contains(node);
+   }
+
+   /// Number of cached node sketches.
+   int size() const {
+      return m_directory.size();
+   }
+
+   /// @brief Reads the sketch of a node into a sketch with the parameters of the cache.
+   /// @return False if the node is not cached or its record is damaged.
+   bool read(const QString& node, PointCloudSketch& sketch);
+
+   /// Appends the sketch of a node, replacing an earlier one.
+   bool write(const QString& node, const PointCloudSketch& sketch);
+
+   /// Writes the directory and closes the file.
+   bool close();
+
+private:
+   QFile m_file;
+   /// File offset of every record.
+   QHash<QString, qint64> m_directory;
+   /// End of the records, where the directory starts.
+   qint64 m_records_end = 0;
+   bool m_modified = false;
+};
+
+#endif
@@ -0,0 +1,203 @@
+#include "point_cloud_stats_engine.h"
+#include "parallel_for.h"
+#include "point_cloud_reader.h"
+#include "point_cloud_sketch_cache.h"
+
+#include "qgsfeedback.h"
+#include "qgspointcloudblock.h"
+#include "qgspointcloudindex.h"
+
+#include <QDataStream>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace {
+
+/// Nodes sketched per worker and batch. A batch is cached and merged before the next one is
+/// read, which bounds the number of node sketches held at a time.
+constexpr std::size_t s_nodes_per_worker = 4;
+
+/// Identifies the points of an index and the layout of its sketches.
+QByteArray fingerprint(const QgsPointCloudIndex& index, const QStringList& names,
+                       const PointCloudStatsSettings& settings) {
+   QByteArray data;
+   QDataStream stream(&data, QIODevice::WriteOnly);
+   const QgsRectangle extent = index.extent();
+   stream << static_cast<qint64>(index.pointCount()) << extent.xMinimum() << extent.yMinimum() << extent.xMaximum()
+          << extent.yMaximum() << index.zMin() << index.zMax() << index.crs().toWkt() << index.subsetString() << names
+          << static_cast<qint32>(settings.hll_precision) << static_cast<qint32>(settings.kll_k);
+   return data;
+}
+
+/// Adds the points of a block to a sketch.
+void sketch_block(const QgsPointCloudBlock& block, const QStringList& names, std::vector<double>& values,
+                  PointCloudSketch& sketch) {
+   sketch.point_count += block.pointCount();
+   for (int i = 0; i < names.size(); ++i) {
+      point_cloud_kernels::decode_attribute(block, names[i], values);
+      AttributeSketch& attribute = sketch.attributes[i];
+      for (double value : values) {
+         attribute.add(value);
+      }
+   }
+
+   if (block.attributes().indexOf(QStringLiteral("Classification")) < 0) {
+      return;
+   }
+   point_cloud_kernels::decode_attribute(block, QStringLiteral("Classification"), values);
+   std::array<qint64, 256> counts;
+   counts.fill(0);
+   for (double value : values) {
+      const int code = static_cast<int>(value);
+      if (code >= 0 && code < 256) {
+         ++counts[code];
+      } else {
+         ++sketch.class_counts[code];
+      }
+   }
+   for (int code = 0; code < 256; ++code) {
+      if (counts[code] > 0) {
+         sketch.class_counts[code] += counts[code];
+      }
+   }
+}
+
+}
+
+PointCloudStatsEngine::PointCloudStatsEngine(const QgsPointCloudIndex& index, const PointCloudStatsSettings& settings)
+   : m_index(index), m_settings(settings) {
+}
+
+int PointCloudStatsEngine::run(const QgsRectangle& extent, QgsFeedback* feedback) {
+   m_attribute_names.clear();
+   m_statistics = PointCloudSketch();
+   m_cached_node_count = 0;
+   if (!m_index.isValid()) {
+      return InvalidSource;
+   }
+
+   const QgsPointCloudAttributeCollection attributes = m_index.attributes();
+   if (m_settings.attributes.isEmpty()) {
+      for (const QgsPointCloudAttribute& attribute : attributes.attributes()) {
+         if (QgsPointCloudAttribute::isNumeric(attribute.type())) {
+            m_attribute_names << attribute.name();
+         }
+      }
+   } else {
+      for (const QString& name : m_settings.attributes) {
+         if (attributes.indexOf(name) < 0) {
+            return InvalidParameters;
+         }
+      }
+      m_attribute_names = m_settings.attributes;
+   }
+
+   const int thread_count = resolve_thread_count(m_settings.thread_count);
+   PointCloudReader reader(m_index, QgsRectangle(), PointCloudFilter(), QgsCoordinateTransform(), thread_count,
+                           m_attribute_names);
+   if (!reader.is_valid()) {
+      return InvalidSource;
+   }
+
+   // Nodes within the extent come from the cache, nodes crossing its border are clipped.
+   const std::vector<PointCloudNode> all_nodes = reader.nodes();
+   std::vector<PointCloudNode> nodes;
+   std::vector<std::uint8_t> clipped;
+   for (const PointCloudNode& node : all_nodes) {
+      if (extent.isNull() || extent.contains(node.extent)) {
+         nodes.push_back(node);
+         clipped.push_back(0);
+      } else if (extent.intersects(node.extent)) {
+         nodes.push_back(node);
+         clipped.push_back(1);
+      }
+   }
+   std::unique_ptr<PointCloudReader> clip_reader;
+   if (std::find(clipped.begin(), clipped.end(), 1) != clipped.end()) {
+      clip_reader = std::make_unique<PointCloudReader>(m_index, extent, PointCloudFilter(), QgsCoordinateTransform(),
+                                                       thread_count, m_attribute_names);
+      if (!clip_reader->is_valid()) {
+         return InvalidSource;
+      }
+   }
+
+   const PointCloudSketch empty(m_attribute_names.size(), m_settings.hll_precision, m_settings.kll_k);
+   m_statistics = empty;
+   PointCloudSketchCache cache;
+   bool cache_open = false;
+   bool cache_failed = false;
+   if (!m_settings.cache_file.isEmpty()) {
+      cache_open = cache.open(m_settings.cache_file, fingerprint(m_index, m_attribute_names, m_settings));
+      cache_failed = !cache_open;
+   }
+
+   std::vector<PointCloudSketch> sketches;
+   std::vector<std::uint8_t> from_cache;
+   std::vector<std::vector<double>> values(thread_count);
+   std::atomic<bool> canceled(false);
+   const std::size_t batch_size = s_nodes_per_worker * static_cast<std::size_t>(thread_count);
+
+   for (std::size_t first = 0; first < nodes.size() && !canceled; first += batch_size) {
+      if (feedback && feedback->isCanceled()) {
+         canceled = true;
+         break;
+      }
+      const std::size_t count = std::min(batch_size, nodes.size() - first);
+      sketches.assign(count, empty);
+      from_cache.assign(count, 0);
+      for (std::size_t i = 0; i < count; ++i) {
+         const std::size_t node = first + i;
+         if (cache_open && !clipped[node] && cache.read(nodes[node].id.toString(), sketches[i])) {
+            from_cache[i] = 1;
+         } else {
+            // A damaged record may have been read partly.
+            sketches[i] = empty;
+         }
+      }
+
+      parallel_for(count, thread_count, [&](std::size_t i, int worker) {
+         if (from_cache[i] || canceled) {
+            return;
+         }
+         if (feedback && feedback->isCanceled()) {
+            canceled = true;
+            return;
+         }
+         const std::size_t node = first + i;
+         PointCloudReader& node_reader = clipped[node] ? *clip_reader : reader;
+         if (std::unique_ptr<QgsPointCloudBlock> block = node_reader.read_block(nodes[node].id, worker)) {
+            sketch_block(*block, m_attribute_names, values[worker], sketches[i]);
+         }
+      });
+      if (canceled) {
+         break;
+      }
+
+      for (std::size_t i = 0; i < count; ++i) {
+         const std::size_t node = first + i;
+         if (from_cache[i]) {
+            ++m_cached_node_count;
+         } else if (cache_open && !clipped[node] && !cache.write(nodes[node].id.toString(), sketches[i])) {
+            cache_failed = true;
+         }
+         m_statistics.merge(sketches[i]);
+      }
+      if (feedback) {
+         feedback->setProgress(100.0 * static_cast<double>(first + count) / static_cast<double>(nodes.size()));
+      }
+   }
+
+   // The sketches computed so far are kept even when canceled.
+   if (cache_open && !cache.close()) {
+      cache_failed = true;
+   }
+   if (canceled) {
+      m_statistics = PointCloudSketch();
+      return Canceled;
+   }
+   return cache_failed ? CacheFailed : Success;
+}
@@ -0,0 +1,85 @@
+#ifndef _POINT_CLOUD_STATS_ENGINE_H_
+#define _POINT_CLOUD_STATS_ENGINE_H_
+
+#include "point_cloud_sketch.h"
+
+#include "qgsrectangle.h"
+
+#include <QString>
+#include <QStringList>
+
+class QgsFeedback;
+class QgsPointCloudIndex;
+
+/// @brief Settings of a point cloud statistics engine run.
+struct PointCloudStatsSettings {
+   /// Attributes to compute statistics of, empty for all numeric attributes.
+   QStringList attributes;
+   /// Sidecar file of the node sketches, empty to compute every node on every run.
+   QString cache_file;
+   /// Precision of the distinct count sketches, 2^precision bytes per attribute and node.
+   int hll_precision = 11;
+   /// Accuracy parameter of the quantile sketches, about 3k values per attribute and node.
+   int kll_k = 128;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+};
+
+/// @brief Incremental statistics of an indexed point cloud from mergeable node sketches.
+///
+/// QgsPointCloudStatsCalculator scans every point of the layer again whenever the layer is
+/// loaded. This engine computes a PointCloudSketch of every node of a COPC or EPT index on
+/// all cores, through a PointCloudReader, and stores it in a PointCloudSketchCache keyed by
+/// the node id. Later runs only read the cached sketches of the nodes within the extent and
+/// merge them, so reopening a large survey or querying another extent reads no points.
+///
+/// Nodes crossing the border of the extent are read again and sketched from their points
+/// within the extent only, and are not cached. Merging is done in node order, so the result
+/// does not depend on the number of threads.
+class PointCloudStatsEngine
+{
+public:
+   /// Result codes of run().
+   enum Result {
+      Success = 0,
+      InvalidSource = 1,
+      InvalidParameters = 2,
+      CacheFailed = 3,
+      Canceled = 4
+   };
+
+   /// @brief Constructor.
+   /// @param index The point cloud, must be valid for the whole run.
+   /// @param settings The attributes, cache and sketch parameters.
+   PointCloudStatsEngine(const QgsPointCloudIndex& index, const PointCloudStatsSettings& settings);
+
+   /// @brief Computes the statistics of the points within an extent.
+   /// @param extent Extent in the CRS of the point cloud, null for all points.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return One of the Result codes. CacheFailed still computes the statistics.
+   int run(const QgsRectangle& extent = QgsRectangle(), QgsFeedback* feedback = nullptr);
+
+   /// Attributes of the sketches of statistics(), in order.
+   const QStringList& attribute_names() const {
+      return m_attribute_names;
+   }
+
+   /// Statistics of the last run.
+   const PointCloudSketch& statistics() const {
+      return m_statistics;
+   }
+
+   /// Number of nodes of the last run whose sketch came from the cache.
+   int cached_node_count() const {
+      return m_cached_node_count;
+   }
+
+private:
+   const QgsPointCloudIndex& m_index;
+   PointCloudStatsSettings m_settings;
+   QStringList m_attribute_names;
+   PointCloudSketch m_statistics;
+   int m_cached_node_count = 0;
+};
+
+#endif
@@ -0,0 +1,92 @@
+#include "point_kd_tree.h"
+
+#include <algorithm>
+#include <numeric>
+
+void PointKdTree::build(const std::vector<double>& x, const std::vector<double>& y, const std::vector<double>& values) {
+   // Arrange a permutation of the points into tree order, then apply it to the arrays once.
+   std::vector<int> order(x.size());
+   std::iota(order.begin(), order.end(), 0);
+   if (order.size() > 1) {
+      sort(order, x, y, 0, static_cast<int>(order.size()) - 1, 0);
+   }
+   m_x.resize(order.size());
+   m_y.resize(order.size());
+   m_values.resize(order.size());
+   for (std::size_t i = 0; i < order.size(); ++i) {
+      m_x[i] = x[order[i]];
+      m_y[i] = y[order[i]];
+      m_values[i] = values[order[i]];
+   }
+}
+
+void PointKdTree::sort(std::vector<int>& order, const std::vector<double>& x, const std::vector<double>& y, int left,
+                       int right, int axis) {
+   if (right - left <= s_leaf_size) {
+      return;
+   }
+   const int middle = left + (right - left) / 2;
+   const std::vector<double>& keys = axis == 0 ? x : y;
+   std::nth_element(order.begin() + left, order.begin() + middle, order.begin() + right + 1,
+                    [&keys](int a, int b) { return keys[a] < keys[b]; });
+   sort(order, x, y, left, middle - 1, 1 - axis);
+   sort(order, x, y, middle + 1, right, 1 - axis);
+}
+
+void PointKdTree::nearest(double x, double y, int count, double max_distance, std::vector<Neighbour>& result) const {
+   result.clear();
+   if (m_x.empty()) {
+      return;
+   }
+   double max_squared = max_distance == std::numeric_limits<double>::infinity() ? max_distance : max_distance * max_distance;
+   search(0, static_cast<int>(m_x.size()) - 1, 0, x, y, count > 0 ? static_cast<std::size_t>(count) : 0, max_squared, result);
+}
+
+void PointKdTree::visit(int index, double x, double y, std::size_t count, double& max_squared,
+                        std::vector<Neighbour>& result) const {
+   const double dx = m_x[index] - x;
+   const double dy = m_y[index] - y;
+   const double squared = dx * dx + dy * dy;
+   if (squared > max_squared) {
+      return;
+   }
+   if (count == 0) {
+      result.emplace_back(squared, index);
+      return;
+   }
+   // result is a max-heap on the distance holding the best count points found so far.
+   if (result.size() == count) {
+      std::pop_heap(result.begin(), result.end());
+      result.pop_back();
+   }
+   result.emplace_back(squared, index);
+   std::push_heap(result.begin(), result.end());
+   if (result.size() == count) {
+      max_squared = result.front().first;
+   }
+}
+
+void PointKdTree::search(int left, int right, int axis, double x, double y, std::size_t count, double& max_squared,
+                         std::vector<Neighbour>& result) const {
+   if (right - left <= s_leaf_size) {
+      for (int index = left; index <= right; ++index) {
+         visit(index, x, y, count, max_squared, result);
+      }
+      return;
+   }
+   const int middle = left + (right - left) / 2;
+   visit(middle, x, y, count, max_squared, result);
+
+   const double offset = axis == 0 ? x - m_x[middle] : y - m_y[middle];
+   if (offset <= 0.0) {
+      search(left, middle - 1, 1 - axis, x, y, count, max_squared, result);
+      if (offset * offset <= max_squared) {
+         search(middle + 1, right, 1 - axis, x, y, count, max_squared, result);
+      }
+   } else {
+      search(middle + 1, right, 1 - axis, x, y, count, max_squared, result);
+      if (offset * offset <= max_squared) {
+         search(left, middle - 1, 1 - axis, x, y, count, max_squared, result);
+      }
+   }
+}
@@ -0,0 +1,63 @@
+#ifndef _POINT_KD_TREE_H_
+#define _POINT_KD_TREE_H_
+
+#include <cstddef>
+#include <limits>
+#include <utility>
+#include <vector>
+
+/// @brief Static 2D KD-tree over points with a value each.
+///
+/// The tree is implicit, like the KDBush index behind QgsSpatialIndexKDBush: the points are
+/// sorted in place so that the median of every range splits it alternately by x and y, with
+/// small ranges left unsorted as leaves. Coordinates and values are stored in tree order in
+/// flat arrays, so a query walks contiguous memory. QgsSpatialIndexKDBush only answers radius
+/// queries over feature ids, while interpolation needs the k nearest values.
+class PointKdTree
+{
+public:
+   /// A neighbour found by a query, its squared distance and its index in tree order.
+   using Neighbour = std::pair<double, int>;
+
+   /// @brief Builds the tree.
+   /// @param x, y, values Coordinates and value of every point.
+   void build(const std::vector<double>& x, const std::vector<double>& y, const std::vector<double>& values);
+
+   std::size_t size() const {
+      return m_x.size();
+   }
+
+   double x(int index) const {
+      return m_x[index];
+   }
+
+   double y(int index) const {
+      return m_y[index];
+   }
+
+   double value(int index) const {
+      return m_values[index];
+   }
+
+   /// @brief Finds the nearest points of a location.
+   /// @param count Maximum number of points, 0 for all points within max_distance.
+   /// @param max_distance Only points at most this far away are returned.
+   /// @param result Receives the points, in no particular order.
+   void nearest(double x, double y, int count, double max_distance, std::vector<Neighbour>& result) const;
+
+private:
+   static void sort(std::vector<int>& order, const std::vector<double>& x, const std::vector<double>& y, int left,
+                    int right, int axis);
+   void search(int left, int right, int axis, double x, double y, std::size_t count, double& max_squared,
+               std::vector<Neighbour>& result) const;
+   void visit(int index, double x, double y, std::size_t count, double& max_squared, std::vector<Neighbour>& result) const;
+
+   /// Ranges of at most this many points are not split further.
+   static constexpr int s_leaf_size = 16;
+
+   std::vector<double> m_x;
+   std::vector<double> m_y;
+   std::vector<double> m_values;
+};
+
+#endif
@@ -0,0 +1,252 @@
+#include "polygon_rasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+struct Edge {
+   double x0;
+   double y0;
+   double slope;
+   int first_row;
+   int last_row;
+};
+
+}
+
+void rasterize_polygon(const PolygonRings& polygon, const RasterGrid& grid, std::vector<ScanlineSpan>& spans) {
+   if (grid.width <= 0 || grid.height <= 0) {
+      return;
+   }
+
+   // Row r samples the polygon at y = origin_y - (r + 0.5) * cell_size_y.
+   auto row_of = [&](double y) {
+      return (grid.origin_y - y) / grid.cell_size_y - 0.5;
+   };
+
+   std::vector<Edge> edges;
+   for (std::size_t ring = 0; ring < polygon.ring_count(); ++ring) {
+      const std::size_t begin = polygon.ring_offsets[ring];
+      const std::size_t end = polygon.ring_offsets[ring + 1];
+      if (end - begin < 3) {
+         continue;
+      }
+      for (std::size_t i = begin; i < end; ++i) {
+         const std::size_t j = (i + 1 < end) ? i + 1 : begin;
+         double x0 = polygon.coords[2 * i];
+         double y0 = polygon.coords[2 * i + 1];
+         double x1 = polygon.coords[2 * j];
+         double y1 = polygon.coords[2 * j + 1];
+         if (y0 == y1) {
+            continue;
+         }
+         if (y0 < y1) {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+         }
+         // y0 is the northern end. The edge crosses the rows whose sample lies in [y1, y0).
+         const int first_row = std::max(0, static_cast<int>(std::floor(row_of(y0))) + 1);
+         const int last_row = std::min(grid.height - 1, static_cast<int>(std::floor(row_of(y1))));
+         if (first_row > last_row) {
+            continue;
+         }
+         edges.push_back({x0, y0, (x1 - x0) / (y1 - y0), first_row, last_row});
+      }
+   }
+   if (edges.empty()) {
+      return;
+   }
+
+   std::sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b) { return a.first_row < b.first_row; });
+
+   std::vector<const Edge*> active;
+   std::vector<double> crossings;
+   std::size_t next_edge = 0;
+   int row = edges.front().first_row;
+   while (row < grid.height && (next_edge < edges.size() || !active.empty())) {
+      if (active.empty() && edges[next_edge].first_row > row) {
+         row = edges[next_edge].first_row;
+      }
+      while (next_edge < edges.size() && edges[next_edge].first_row == row) {
+         active.push_back(&edges[next_edge++]);
+      }
+
+      const double y = grid.origin_y - (row + 0.5) * grid.cell_size_y;
+      crossings.clear();
+      for (const Edge* edge : active) {
+         crossings.push_back(edge->x0 + (y - edge->y0) * edge->slope);
+      }
+      std::sort(crossings.begin(), crossings.end());
+
+      for (std::size_t i = 0; i + 1 < crossings.size(); i += 2) {
+         // Cell col samples at x = origin_x + (col + 0.5) * cell_size_x, keep the samples in [x_in, x_out).
+         const int col_begin = std::max(0, static_cast<int>(std::ceil((crossings[i] - grid.origin_x) / grid.cell_size_x - 0.5)));
+         const int col_end = std::min(grid.width, static_cast<int>(std::ceil((crossings[i + 1] - grid.origin_x) / grid.cell_size_x - 0.5)));
+         if (col_begin < col_end) {
+            if (!spans.empty() && spans.back().row == row && spans.back().col_end >= col_begin) {
+               spans.back().col_end = std::max(spans.back().col_end, col_end);
+            } else {
+               spans.push_back({row, col_begin, col_end});
+            }
+         }
+      }
+
+      active.erase(std::remove_if(active.begin(), active.end(), [row](const Edge* edge) { return edge->last_row <= row; }),
+                   active.end());
+      ++row;
+   }
+}
+
+namespace {
+
+/// An edge in grid units, u growing east and v growing south.
+struct CoverageEdge {
+   double u0;
+   double v0;
+   double u1;
+   double v1;
+   int first_row;
+   int last_row;
+};
+
+/// @brief Adds the signed area east of the segment (ua, va) - (ub, vb) inside one row.
+///
+/// Coordinates are relative to the first column of the accumulation window of n columns.
+/// area receives the part inside the cells the segment crosses, cover the height that is
+/// carried to every cell further east.
+void accumulate_segment(double ua, double va, double ub, double vb, double sign, int n, std::vector<double>& area,
+                        std::vector<double>& cover) {
+   const double height = sign * (vb - va);
+   if (ua == ub) {
+      const double u = std::max(0.0, ua);
+      const int col = static_cast<int>(u);
+      if (col < n) {
+         area[col] += height * (col + 1 - u);
+         cover[col + 1] += height;
+      }
+      return;
+   }
+
+   double u_min = std::min(ua, ub);
+   const double u_max = std::min(std::max(ua, ub), static_cast<double>(n));
+   const double height_per_u = height / std::abs(ub - ua);
+   if (u_min < 0.0) {
+      // West of the window the segment acts like a vertical one on its west edge.
+      const double west = height_per_u * (std::min(u_max, 0.0) - u_min);
+      area[0] += west;
+      cover[1] += west;
+      u_min = 0.0;
+   }
+   for (double u = u_min; u < u_max;) {
+      const int col = static_cast<int>(u);
+      const double u_next = std::min(u_max, static_cast<double>(col + 1));
+      const double part = height_per_u * (u_next - u);
+      area[col] += part * (col + 1 - (u + u_next) / 2.0);
+      cover[col + 1] += part;
+      u = u_next;
+   }
+}
+
+}
+
+void rasterize_polygon_coverage(const PolygonRings& polygon, const RasterGrid& grid, std::vector<CoverageRun>& runs) {
+   if (grid.width <= 0 || grid.height <= 0 || polygon.coords.empty()) {
+      return;
+   }
+
+   double u_min = std::numeric_limits<double>::max();
+   double u_max = std::numeric_limits<double>::lowest();
+   std::vector<CoverageEdge> edges;
+   for (std::size_t ring = 0; ring < polygon.ring_count(); ++ring) {
+      const std::size_t begin = polygon.ring_offsets[ring];
+      const std::size_t end = polygon.ring_offsets[ring + 1];
+      if (end - begin < 3) {
+         continue;
+      }
+      for (std::size_t i = begin; i < end; ++i) {
+         const std::size_t j = (i + 1 < end) ? i + 1 : begin;
+         const double u0 = (polygon.coords[2 * i] - grid.origin_x) / grid.cell_size_x;
+         const double v0 = (grid.origin_y - polygon.coords[2 * i + 1]) / grid.cell_size_y;
+         const double u1 = (polygon.coords[2 * j] - grid.origin_x) / grid.cell_size_x;
+         const double v1 = (grid.origin_y - polygon.coords[2 * j + 1]) / grid.cell_size_y;
+         u_min = std::min(u_min, u0);
+         u_max = std::max(u_max, u0);
+         if (v0 == v1) {
+            continue;
+         }
+         const int first_row = std::max(0, static_cast<int>(std::floor(std::min(v0, v1))));
+         const int last_row = std::min(grid.height - 1, static_cast<int>(std::ceil(std::max(v0, v1))) - 1);
+         if (first_row > last_row) {
+            continue;
+         }
+         edges.push_back({u0, v0, u1, v1, first_row, last_row});
+      }
+   }
+   if (edges.empty()) {
+      return;
+   }
+
+   const int first_col = std::clamp(static_cast<int>(std::floor(u_min)), 0, grid.width);
+   const int end_col = std::clamp(static_cast<int>(std::ceil(u_max)), 0, grid.width);
+   const int n = end_col - first_col;
+   if (n <= 0) {
+      return;
+   }
+
+   std::sort(edges.begin(), edges.end(),
+             [](const CoverageEdge& a, const CoverageEdge& b) { return a.first_row < b.first_row; });
+
+   std::vector<double> area(n);
+   std::vector<double> cover(n + 1);
+   std::vector<const CoverageEdge*> active;
+   std::size_t next_edge = 0;
+   int row = edges.front().first_row;
+   while (row < grid.height && (next_edge < edges.size() || !active.empty())) {
+      if (active.empty() && edges[next_edge].first_row > row) {
+         row = edges[next_edge].first_row;
+      }
+      while (next_edge < edges.size() && edges[next_edge].first_row == row) {
+         active.push_back(&edges[next_edge++]);
+      }
+
+      std::fill(area.begin(), area.end(), 0.0);
+      std::fill(cover.begin(), cover.end(), 0.0);
+      for (const CoverageEdge* edge : active) {
+         // Clip the edge to the row and keep its direction as the sign of the area.
+         const double sign = edge->v1 > edge->v0 ? 1.0 : -1.0;
+         const double va = std::max(std::min(edge->v0, edge->v1), static_cast<double>(row));
+         const double vb = std::min(std::max(edge->v0, edge->v1), static_cast<double>(row + 1));
+         if (va >= vb) {
+            continue;
+         }
+         const double du_dv = (edge->u1 - edge->u0) / (edge->v1 - edge->v0);
+         const double ua = edge->u0 + (va - edge->v0) * du_dv - first_col;
+         const double ub = edge->u0 + (vb - edge->v0) * du_dv - first_col;
+         accumulate_segment(ua, va, ub, vb, sign, n, area, cover);
+      }
+
+      double carried = 0.0;
+      for (int col = 0; col < n; ++col) {
+         carried += cover[col];
+         double fraction = area[col] + carried;
+         if (fraction < 1e-9) {
+            continue;
+         }
+         fraction = fraction > 1.0 - 1e-9 ? 1.0 : fraction;
+         const int grid_col = first_col + col;
+         CoverageRun* last = runs.empty() ? nullptr : &runs.back();
+         if (fraction == 1.0 && last && last->row == row && last->col_end == grid_col && last->fraction == 1.0f) {
+            last->col_end = grid_col + 1;
+         } else {
+            runs.push_back({row, grid_col, grid_col + 1, static_cast<float>(fraction)});
+         }
+      }
+
+      active.erase(std::remove_if(active.begin(), active.end(),
+                                  [row](const CoverageEdge* edge) { return edge->last_row <= row; }),
+                   active.end());
+      ++row;
+   }
+}
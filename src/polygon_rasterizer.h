@@ -0,0 +1,102 @@
+#ifndef _POLYGON_RASTERIZER_H_
+#define _POLYGON_RASTERIZER_H_
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/// @brief A north-up raster grid.
+struct RasterGrid {
+   /// X coordinate of the west edge.
+   double origin_x = 0.0;
+   /// Y coordinate of the north edge.
+   double origin_y = 0.0;
+   double cell_size_x = 1.0;
+   double cell_size_y = 1.0;
+   int width = 0;
+   int height = 0;
+};
+
+/// @brief The cells [col_begin, col_end) of one raster row.
+struct ScanlineSpan {
+   int row = 0;
+   int col_begin = 0;
+   int col_end = 0;
+};
+
+/// @brief The cells [col_begin, col_end) of one raster row, each covered by fraction of its area.
+struct CoverageRun {
+   int row = 0;
+   int col_begin = 0;
+   int col_end = 0;
+   float fraction = 1.0f;
+};
+
+/// @brief The rings of a (multi)polygon in flat arrays.
+///
+/// Ring i consists of the points [ring_offsets[i], ring_offsets[i + 1]) of coords,
+/// which stores x and y interleaved. Exterior rings, holes and the parts of a
+/// multipolygon are not distinguished: rasterize_polygon() applies the even-odd rule,
+/// rasterize_polygon_coverage() requires counter-clockwise exterior rings and clockwise
+/// holes, see close_ring_oriented().
+struct PolygonRings {
+   std::vector<double> coords;
+   std::vector<std::size_t> ring_offsets = {0};
+
+   void clear() {
+      coords.clear();
+      ring_offsets.assign(1, 0);
+   }
+
+   /// Appends a point to the ring that is currently being built.
+   void add_point(double x, double y) {
+      coords.push_back(x);
+      coords.push_back(y);
+   }
+
+   /// Closes the ring that is currently being built.
+   void close_ring() {
+      ring_offsets.push_back(coords.size() / 2);
+   }
+
+   /// @brief Closes the ring that is currently being built, reversing it if needed.
+   /// @param counter_clockwise True for exterior rings, false for holes.
+   void close_ring_oriented(bool counter_clockwise) {
+      const std::size_t begin = ring_offsets.back();
+      const std::size_t end = coords.size() / 2;
+      double twice_area = 0.0;
+      for (std::size_t i = begin; i < end; ++i) {
+         const std::size_t j = (i + 1 < end) ? i + 1 : begin;
+         twice_area += coords[2 * i] * coords[2 * j + 1] - coords[2 * j] * coords[2 * i + 1];
+      }
+      if ((twice_area > 0.0) != counter_clockwise) {
+         for (std::size_t i = begin, j = end - 1; i < j; ++i, --j) {
+            std::swap(coords[2 * i], coords[2 * j]);
+            std::swap(coords[2 * i + 1], coords[2 * j + 1]);
+         }
+      }
+      close_ring();
+   }
+
+   std::size_t ring_count() const {
+      return ring_offsets.size() - 1;
+   }
+};
+
+/// @brief Rasterizes a polygon into the spans of cells whose centre lies inside it.
+///
+/// Uses an active edge table, so the cost is proportional to the number of edges plus the
+/// number of edge/row crossings instead of edges times rows. Spans are appended to spans
+/// in row order, clipped to the grid.
+void rasterize_polygon(const PolygonRings& polygon, const RasterGrid& grid, std::vector<ScanlineSpan>& spans);
+
+/// @brief Computes the exact fraction of every cell covered by a polygon.
+///
+/// Every edge adds the signed area between itself and the east edge of the grid to the
+/// cells it crosses, the way font rasterizers accumulate coverage. Cells without an edge
+/// get the running sum of the rows' crossing heights. Fully covered cells are merged into
+/// runs with fraction 1, partially covered cells are emitted as runs of one cell. Runs are
+/// appended in row order, clipped to the grid.
+void rasterize_polygon_coverage(const PolygonRings& polygon, const RasterGrid& grid, std::vector<CoverageRun>& runs);
+
+#endif
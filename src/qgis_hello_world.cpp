@@ -1,4 +1,65 @@
 #include "qgis_hello_world.h"
+#include "terrain_engine.h"
+
+#include "qgsapplication.h"
+#include "qgsfeedback.h"
+#include "qgsmessagebar.h"
+#include "qgsrasterlayer.h"
+
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QInputDialog>
+
+#include <memory>
+
+namespace {
+
+/// Computes a terrain derivative in the background and adds it to the project when done.
+class TerrainTask : public QgsTask
+{
+public:
+   TerrainTask(QgisInterface* qgis_if, const TerrainSettings& settings, const QString& input_file, const QString& output_file)
+      : QgsTask(QStringLiteral("Terrain derivative"), QgsTask::CanCancel), m_qgis_if(qgis_if), m_settings(settings),
+        m_input_file(input_file), m_output_file(output_file), m_feedback(std::make_unique<QgsFeedback>()) {
+      // The engine reports progress from the task thread, like QgsTask::setProgress() expects.
+      QObject::connect(m_feedback.get(), &QgsFeedback::progressChanged, this, [this](double progress) { setProgress(progress); },
+                       Qt::DirectConnection);
+   }
+
+   void cancel() override {
+      m_feedback->cancel();
+      QgsTask::cancel();
+   }
+
+protected:
+   bool run() override {
+      TerrainEngine engine(m_settings);
+      m_result = engine.process_raster(m_input_file, m_output_file, m_feedback.get());
+      return m_result == TerrainEngine::Success;
+   }
+
+   void finished(bool result) override {
+      const QString title = TerrainEngine::derivative_name(m_settings.derivative);
+      if (result) {
+         m_qgis_if->addRasterLayer(m_output_file, QFileInfo(m_output_file).completeBaseName());
+         m_qgis_if->messageBar()->pushSuccess(title, QString("Written to %1.").arg(m_output_file));
+      } else if (m_result == TerrainEngine::Canceled) {
+         m_qgis_if->messageBar()->pushInfo(title, QString("Canceled."));
+      } else {
+         m_qgis_if->messageBar()->pushCritical(title, QString("Failed with error %1.").arg(m_result));
+      }
+   }
+
+private:
+   QgisInterface* m_qgis_if;
+   TerrainSettings m_settings;
+   QString m_input_file;
+   QString m_output_file;
+   std::unique_ptr<QgsFeedback> m_feedback;
+   int m_result = TerrainEngine::Canceled;
+};
+
+}
 
 QGISEXTERN QgisPlugin* classFactory(QgisInterface* qgis_if)
 {
@@ -41,7 +102,19 @@ HelloWorldPlugin::HelloWorldPlugin(QgisInterface* iface) : QgisPlugin(s_name, s_
 
 
 void HelloWorldPlugin::unload() {
-   // TODO - need to remove the actions from the menu again.
+   for (const QPointer<QgsTask>& task : std::as_const(m_terrain_tasks)) {
+      if (task) {
+         task->cancel();
+         task->waitForFinished();
+      }
+   }
+   m_terrain_tasks.clear();
+   m_qgis_if->removePluginMenu(QString("&Hello World"), m_menu_action);
+   m_qgis_if->removePluginMenu(QString("&Hello World"), m_terrain_action);
+   delete m_menu_action;
+   m_menu_action = nullptr;
+   delete m_terrain_action;
+   m_terrain_action = nullptr;
 }
 
 void HelloWorldPlugin::initGui() {
@@ -51,9 +124,52 @@ void HelloWorldPlugin::initGui() {
    m_menu_action = new QAction(QIcon(""), QString("Hello World"), this);
    connect(m_menu_action, SIGNAL(triggered()), this, SLOT(menu_button_action()));
    m_qgis_if->addPluginToMenu(QString("&Hello World"), m_menu_action);
+
+   m_terrain_action = new QAction(QIcon(""), QString("Terrain Derivative..."), this);
+   connect(m_terrain_action, SIGNAL(triggered()), this, SLOT(terrain_button_action()));
+   m_qgis_if->addPluginToMenu(QString("&Hello World"), m_terrain_action);
 }
 
 void HelloWorldPlugin::menu_button_action() {
    QgsMessageLog::logMessage(QString("Menu clicked!"), QString("Hello World Plugin"), Qgis::MessageLevel::Info);
 }
 
+
+void HelloWorldPlugin::terrain_button_action() {
+   QgsRasterLayer* layer = qobject_cast<QgsRasterLayer*>(m_qgis_if->activeLayer());
+   if (!layer) {
+      QgsMessageLog::logMessage(QString("Select a DEM raster layer first."), QString("Hello World Plugin"), Qgis::MessageLevel::Warning);
+      return;
+   }
+
+   const QList<TerrainDerivative> derivatives = {
+      TerrainDerivative::Slope,
+      TerrainDerivative::Aspect,
+      TerrainDerivative::Hillshade,
+      TerrainDerivative::MultidirectionalHillshade,
+      TerrainDerivative::Ruggedness,
+      TerrainDerivative::TotalCurvature
+   };
+   QStringList names;
+   for (TerrainDerivative derivative : derivatives) {
+      names << TerrainEngine::derivative_name(derivative);
+   }
+
+   bool ok = false;
+   const QString name = QInputDialog::getItem(m_qgis_if->mainWindow(), QString("Terrain Derivative"), QString("Derivative"), names, 0, false, &ok);
+   if (!ok) {
+      return;
+   }
+   const QString output_file = QFileDialog::getSaveFileName(m_qgis_if->mainWindow(), QString("Output Raster"), QString(), QString("GeoTIFF (*.tif)"));
+   if (output_file.isEmpty()) {
+      return;
+   }
+
+   TerrainSettings settings;
+   settings.derivative = derivatives.at(names.indexOf(name));
+   // The task manager takes ownership and runs the engine off the GUI thread.
+   TerrainTask* task = new TerrainTask(m_qgis_if, settings, layer->source(), output_file);
+   m_terrain_tasks.removeAll(nullptr);
+   m_terrain_tasks.append(task);
+   QgsApplication::taskManager()->addTask(task);
+}
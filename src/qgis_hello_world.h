@@ -15,9 +15,12 @@
 #include "qgisinterface.h"
 #include "qgsvectorlayer.h"
 #include "qgsmessagelog.h"
+#include "qgstaskmanager.h"
 #include <iostream>
 #include <QAction>
 #include <QApplication>
+#include <QList>
+#include <QPointer>
 
 static const QString s_name = QStringLiteral("Hello World Plugin");
 static const QString s_description = QStringLiteral("Sample Plugin");
@@ -45,11 +48,20 @@ public slots:
    /// An example of an action, triggered when a menu is clicked.
    void menu_button_action();
 
+   /// Computes a terrain derivative of the active raster layer.
+   void terrain_button_action();
+
 private:
    QgisInterface* m_qgis_if;
 
    /// The action in the QGIS menu bar.
-   QAction* m_menu_action;
+   QAction* m_menu_action = nullptr;
+
+   /// The terrain derivative action in the QGIS menu bar.
+   QAction* m_terrain_action = nullptr;
+
+   /// Terrain derivative tasks, canceled on unload. The task manager deletes finished tasks.
+   QList<QPointer<QgsTask>> m_terrain_tasks;
 };
 
 #endif
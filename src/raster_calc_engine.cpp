@@ -0,0 +1,221 @@
+#include "raster_calc_engine.h"
+#include "parallel_for.h"
+#include "raster_program.h"
+
+#include "qgsfeedback.h"
+#include "qgsogrutils.h"
+#include "qgsrasterblock.h"
+#include "qgsrastercalcnode.h"
+#include "qgsrasterdataprovider.h"
+#include "qgsrasterlayer.h"
+#include "qgsrasterprojector.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <gdal.h>
+
+namespace {
+
+/// A raster reference of the formula, resolved to a layer and band.
+struct CalcInput {
+   /// Index into the distinct layers of the run.
+   int layer;
+   int band;
+};
+
+/// The readers of one worker: a clone of every layer provider, behind a projector if needed.
+struct CalcReaders {
+   std::vector<std::unique_ptr<QgsRasterDataProvider>> providers;
+   std::vector<std::unique_ptr<QgsRasterProjector>> projectors;
+
+   QgsRasterInterface* reader(int layer) const {
+      return projectors[layer] ? static_cast<QgsRasterInterface*>(projectors[layer].get()) : providers[layer].get();
+   }
+};
+
+}
+
+RasterCalcEngine::RasterCalcEngine(const QString& formula, const QVector<QgsRasterCalculatorEntry>& entries,
+                                   const RasterCalcSettings& settings)
+   : m_formula(formula), m_entries(entries), m_settings(settings) {
+}
+
+int RasterCalcEngine::run(const QString& output_file, const QgsRectangle& extent, const QgsCoordinateReferenceSystem& crs,
+                          int columns, int rows, const QgsCoordinateTransformContext& transform_context, QgsFeedback* feedback) {
+   m_last_error.clear();
+   QString parser_error;
+   std::unique_ptr<QgsRasterCalcNode> calc_node(QgsRasterCalcNode::parseRasterCalcString(m_formula, parser_error));
+   if (!calc_node) {
+      m_last_error = parser_error;
+      return ParserError;
+   }
+   RasterProgram program;
+   std::string compile_error;
+   if (!program.compile(m_formula.toStdString(), compile_error)) {
+      m_last_error = QString::fromStdString(compile_error);
+      return ParserError;
+   }
+   if (columns <= 0 || rows <= 0 || extent.isEmpty()) {
+      m_last_error = QStringLiteral("Invalid output size");
+      return CreateOutputError;
+   }
+
+   // Resolve the references, sharing the readers of references to different bands of a layer.
+   std::vector<QgsRasterLayer*> layers;
+   std::vector<CalcInput> inputs;
+   for (const std::string& reference : program.references()) {
+      const QString name = QString::fromStdString(reference);
+      const auto entry = std::find_if(m_entries.cbegin(), m_entries.cend(),
+                                      [&name](const QgsRasterCalculatorEntry& candidate) { return candidate.ref == name; });
+      if (entry == m_entries.cend() || !entry->raster || !entry->raster->dataProvider()) {
+         m_last_error = QStringLiteral("No raster layer for reference %1").arg(name);
+         return InputLayerError;
+      }
+      if (entry->bandNumber < 1 || entry->bandNumber > entry->raster->bandCount()) {
+         m_last_error = QStringLiteral("Band number %1 is not valid for entry %2").arg(entry->bandNumber).arg(name);
+         return BandError;
+      }
+      const auto layer = std::find(layers.begin(), layers.end(), entry->raster);
+      inputs.push_back({static_cast<int>(layer - layers.begin()), entry->bandNumber});
+      if (layer == layers.end()) {
+         layers.push_back(entry->raster);
+      }
+   }
+
+   GDALAllRegister();
+   GDALDriverH driver = GDALGetDriverByName(m_settings.output_format.toLocal8Bit().constData());
+   if (!driver || !GDALGetMetadataItem(driver, GDAL_DCAP_CREATE, nullptr)) {
+      m_last_error = QStringLiteral("Could not obtain driver for %1").arg(m_settings.output_format);
+      return CreateOutputError;
+   }
+   char** options = nullptr;
+   options = CSLSetNameValue(options, "TILED", "YES");
+   options = CSLSetNameValue(options, "BIGTIFF", "IF_SAFER");
+   gdal::dataset_unique_ptr output(GDALCreate(driver, output_file.toUtf8().constData(), columns, rows, 1, GDT_Float32,
+                                              m_settings.output_format == QLatin1String("GTiff") ? options : nullptr));
+   CSLDestroy(options);
+   if (!output) {
+      m_last_error = QStringLiteral("Could not create output %1").arg(output_file);
+      return CreateOutputError;
+   }
+   const double cell_size_x = extent.width() / columns;
+   const double cell_size_y = extent.height() / rows;
+   double geo_transform[6] = {extent.xMinimum(), cell_size_x, 0.0, extent.yMaximum(), 0.0, -cell_size_y};
+   GDALSetGeoTransform(output.get(), geo_transform);
+   if (crs.isValid()) {
+      GDALSetProjection(output.get(), crs.toWkt(QgsCoordinateReferenceSystem::WKT_PREFERRED_GDAL).toUtf8().constData());
+   }
+   GDALRasterBandH output_band = GDALGetRasterBand(output.get(), 1);
+   GDALSetRasterNoDataValue(output_band, m_settings.output_nodata);
+
+   const int tile_size = std::max(16, m_settings.tile_size);
+   const std::size_t tiles_x = (static_cast<std::size_t>(columns) + tile_size - 1) / tile_size;
+   const std::size_t tiles_y = (static_cast<std::size_t>(rows) + tile_size - 1) / tile_size;
+   const std::size_t tile_count = tiles_x * tiles_y;
+   const std::size_t tile_cells = static_cast<std::size_t>(tile_size) * tile_size;
+   const int thread_count = resolve_thread_count(m_settings.thread_count);
+
+   // Raster providers are not thread safe, so every worker reads through its own clones.
+   std::vector<CalcReaders> worker_readers(thread_count);
+   for (CalcReaders& readers : worker_readers) {
+      for (QgsRasterLayer* layer : layers) {
+         readers.providers.emplace_back(layer->dataProvider()->clone());
+         std::unique_ptr<QgsRasterProjector> projector;
+         if (layer->crs() != crs) {
+            projector.reset(new QgsRasterProjector());
+            projector->setCrs(layer->crs(), crs, transform_context);
+            projector->setInput(readers.providers.back().get());
+            projector->setPrecision(QgsRasterProjector::Exact);
+         }
+         readers.projectors.push_back(std::move(projector));
+      }
+   }
+   std::vector<std::vector<double>> worker_inputs(thread_count);
+   std::vector<std::vector<double>> worker_results(thread_count);
+   std::vector<std::vector<float>> worker_outputs(thread_count);
+   std::vector<std::vector<double>> worker_registers(thread_count);
+   std::mutex output_mutex;
+   std::size_t tiles_done = 0;
+   std::atomic<bool> read_failed(false);
+   std::atomic<bool> write_failed(false);
+   std::atomic<bool> canceled(false);
+
+   parallel_for(tile_count, thread_count, [&](std::size_t tile, int worker) {
+      if (canceled || read_failed || write_failed) {
+         return;
+      }
+      if (feedback && feedback->isCanceled()) {
+         canceled = true;
+         return;
+      }
+      const int first_row = static_cast<int>(tile / tiles_x) * tile_size;
+      const int first_col = static_cast<int>(tile % tiles_x) * tile_size;
+      const int tile_rows = std::min(tile_size, rows - first_row);
+      const int tile_cols = std::min(tile_size, columns - first_col);
+      const std::size_t cells = static_cast<std::size_t>(tile_rows) * tile_cols;
+      const QgsRectangle tile_extent(extent.xMinimum() + first_col * cell_size_x,
+                                     extent.yMaximum() - (first_row + tile_rows) * cell_size_y,
+                                     extent.xMinimum() + (first_col + tile_cols) * cell_size_x,
+                                     extent.yMaximum() - first_row * cell_size_y);
+
+      // Read every input once, with nodata as NaN as RasterProgram expects.
+      std::vector<double>& input_values = worker_inputs[worker];
+      input_values.resize(inputs.size() * tile_cells);
+      std::vector<const double*> input_pointers(inputs.size());
+      for (std::size_t input = 0; input < inputs.size(); ++input) {
+         std::unique_ptr<QgsRasterBlock> block(
+            worker_readers[worker].reader(inputs[input].layer)->block(inputs[input].band, tile_extent, tile_cols, tile_rows));
+         if (!block || !block->isValid()) {
+            read_failed = true;
+            return;
+         }
+         double* values = input_values.data() + input * tile_cells;
+         for (std::size_t cell = 0; cell < cells; ++cell) {
+            bool is_nodata = false;
+            const double value = block->valueAndNoData(cell, is_nodata);
+            values[cell] = is_nodata ? std::numeric_limits<double>::quiet_NaN() : value;
+         }
+         input_pointers[input] = values;
+      }
+
+      std::vector<double>& results = worker_results[worker];
+      std::vector<float>& output_values = worker_outputs[worker];
+      results.resize(cells);
+      output_values.resize(cells);
+      program.evaluate(input_pointers.data(), cells, results.data(), worker_registers[worker]);
+      for (std::size_t cell = 0; cell < cells; ++cell) {
+         output_values[cell] = std::isnan(results[cell]) ? m_settings.output_nodata : static_cast<float>(results[cell]);
+      }
+
+      std::lock_guard<std::mutex> lock(output_mutex);
+      if (GDALRasterIO(output_band, GF_Write, first_col, first_row, tile_cols, tile_rows, output_values.data(), tile_cols,
+                       tile_rows, GDT_Float32, 0, 0) != CE_None) {
+         write_failed = true;
+         return;
+      }
+      ++tiles_done;
+      if (feedback) {
+         feedback->setProgress(100.0 * static_cast<double>(tiles_done) / static_cast<double>(tile_count));
+      }
+   });
+
+   if (canceled) {
+      gdal::fast_delete_and_close(output, driver, output_file);
+      return Canceled;
+   }
+   if (read_failed) {
+      m_last_error = QStringLiteral("Could not read input raster data");
+      return InputLayerError;
+   }
+   if (write_failed) {
+      m_last_error = QStringLiteral("Could not write output raster data");
+      return CreateOutputError;
+   }
+   return Success;
+}
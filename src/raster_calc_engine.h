@@ -0,0 +1,84 @@
+#ifndef _RASTER_CALC_ENGINE_H_
+#define _RASTER_CALC_ENGINE_H_
+
+#include "qgscoordinatereferencesystem.h"
+#include "qgscoordinatetransformcontext.h"
+#include "qgsrastercalculator.h"
+#include "qgsrectangle.h"
+
+#include <QString>
+#include <QVector>
+
+#include <limits>
+
+class QgsFeedback;
+
+/// @brief Settings of a raster calculator engine run.
+struct RasterCalcSettings {
+   /// Nodata value written to the output raster, the same as QgsRasterCalculator uses.
+   float output_nodata = -std::numeric_limits<float>::max();
+   /// Width and height of the output tiles in cells.
+   int tile_size = 512;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+   /// GDAL short name of the output format.
+   QString output_format = QStringLiteral("GTiff");
+};
+
+/// @brief Tiled, multithreaded replacement of QgsRasterCalculator.
+///
+/// QgsRasterCalculator::processCalculation() reads one row of every input and evaluates the
+/// QgsRasterCalcNode tree on it, with every operator allocating and filling a full row matrix.
+/// This engine compiles the formula once into a RasterProgram and evaluates output tiles in
+/// parallel. The inputs of a tile are read into one buffer per raster reference, and the
+/// program runs over them in small chunks without any intermediate matrix, so a formula over
+/// dozens of inputs costs one read per input and one write per tile.
+///
+/// The formula is validated with QgsRasterCalcNode::parseRasterCalcString() first, so the
+/// engine accepts the same formulas as QGIS. Inputs in another CRS are reprojected like
+/// QgsRasterCalculator does, with an exact QgsRasterProjector.
+class RasterCalcEngine
+{
+public:
+   /// Result codes of run(), matching QgsRasterCalculator::Result.
+   enum Result {
+      Success = QgsRasterCalculator::Success,
+      CreateOutputError = QgsRasterCalculator::CreateOutputError,
+      InputLayerError = QgsRasterCalculator::InputLayerError,
+      Canceled = QgsRasterCalculator::Canceled,
+      ParserError = QgsRasterCalculator::ParserError,
+      MemoryError = QgsRasterCalculator::MemoryError,
+      BandError = QgsRasterCalculator::BandError,
+      CalculationError = QgsRasterCalculator::CalculationError
+   };
+
+   /// @brief Constructor.
+   /// @param formula The raster calculator expression.
+   /// @param entries The raster layers and bands referenced by the formula.
+   /// @param settings The processing options.
+   RasterCalcEngine(const QString& formula, const QVector<QgsRasterCalculatorEntry>& entries, const RasterCalcSettings& settings);
+
+   /// @brief Evaluates the formula into a Float32 raster.
+   /// @param output_file Path of the raster to create.
+   /// @param extent Extent of the output raster.
+   /// @param crs CRS of the output raster, inputs in other CRS are reprojected.
+   /// @param columns, rows Size of the output raster in cells.
+   /// @param transform_context Transform context for the reprojection of inputs.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return One of the Result codes, last_error() describes failures.
+   int run(const QString& output_file, const QgsRectangle& extent, const QgsCoordinateReferenceSystem& crs, int columns,
+           int rows, const QgsCoordinateTransformContext& transform_context, QgsFeedback* feedback = nullptr);
+
+   /// Returns a description of the last error encountered by run().
+   QString last_error() const {
+      return m_last_error;
+   }
+
+private:
+   QString m_formula;
+   QVector<QgsRasterCalculatorEntry> m_entries;
+   RasterCalcSettings m_settings;
+   QString m_last_error;
+};
+
+#endif
@@ -0,0 +1,650 @@
+#include "raster_program.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+namespace {
+
+constexpr double s_nan = std::numeric_limits<double>::quiet_NaN();
+
+inline double divide(double a, double b) {
+   return b == 0.0 ? s_nan : a / b;
+}
+
+inline double power(double a, double b) {
+   // Negative bases with fractional exponents already give NaN.
+   return a == 0.0 && b < 0.0 ? s_nan : std::pow(a, b);
+}
+
+/// Comparisons and logical operators give 1 or 0, or nodata if an operand is nodata.
+inline double truth(bool value, double a, double b) {
+   return std::isnan(a) || std::isnan(b) ? s_nan : (value ? 1.0 : 0.0);
+}
+
+inline double minimum(double a, double b) {
+   return std::isnan(a) || std::isnan(b) ? s_nan : std::min(a, b);
+}
+
+inline double maximum(double a, double b) {
+   return std::isnan(a) || std::isnan(b) ? s_nan : std::max(a, b);
+}
+
+inline double logarithm(double a) {
+   return a > 0.0 ? std::log(a) : s_nan;
+}
+
+inline double logarithm10(double a) {
+   return a > 0.0 ? std::log10(a) : s_nan;
+}
+
+inline double select(double condition, double a, double b) {
+   return std::isnan(condition) ? s_nan : (condition != 0.0 ? a : b);
+}
+
+/// Sets target[i] = value(i) for a chunk, one simple loop the compiler can vectorize.
+template <typename Value>
+inline void fill(double* target, std::size_t count, Value value) {
+   for (std::size_t i = 0; i < count; ++i) {
+      target[i] = value(i);
+   }
+}
+
+/// Scalar evaluation of one operation, used for constant folding.
+double apply(RasterProgram::Op op, double a, double b, double c) {
+   using Op = RasterProgram::Op;
+   switch (op) {
+      case Op::Add:
+         return a + b;
+      case Op::Subtract:
+         return a - b;
+      case Op::Multiply:
+         return a * b;
+      case Op::Divide:
+         return divide(a, b);
+      case Op::Power:
+         return power(a, b);
+      case Op::Equal:
+         return truth(a == b, a, b);
+      case Op::NotEqual:
+         return truth(a != b, a, b);
+      case Op::Greater:
+         return truth(a > b, a, b);
+      case Op::Less:
+         return truth(a < b, a, b);
+      case Op::GreaterEqual:
+         return truth(a >= b, a, b);
+      case Op::LessEqual:
+         return truth(a <= b, a, b);
+      case Op::And:
+         return truth(a != 0.0 && b != 0.0, a, b);
+      case Op::Or:
+         return truth(a != 0.0 || b != 0.0, a, b);
+      case Op::Min:
+         return minimum(a, b);
+      case Op::Max:
+         return maximum(a, b);
+      case Op::Negate:
+         return -a;
+      case Op::Sqrt:
+         return std::sqrt(a);
+      case Op::Sin:
+         return std::sin(a);
+      case Op::Cos:
+         return std::cos(a);
+      case Op::Tan:
+         return std::tan(a);
+      case Op::Asin:
+         return std::asin(a);
+      case Op::Acos:
+         return std::acos(a);
+      case Op::Atan:
+         return std::atan(a);
+      case Op::Log:
+         return logarithm(a);
+      case Op::Log10:
+         return logarithm10(a);
+      case Op::Abs:
+         return std::abs(a);
+      case Op::Select:
+         return select(a, b, c);
+   }
+   return s_nan;
+}
+
+/// Expression tree node produced by the parser.
+struct Node {
+   enum Kind { Number, Reference, Operation };
+   Kind kind = Number;
+   RasterProgram::Op op = RasterProgram::Op::Add;
+   double value = 0.0;
+   /// Index into the references for Reference nodes, the constant register offset for Number nodes.
+   int index = 0;
+   int args[3] = {-1, -1, -1};
+   int arg_count = 0;
+};
+
+struct Function {
+   const char* name;
+   RasterProgram::Op op;
+   int arg_count;
+};
+
+const Function s_functions[] = {
+   {"sqrt", RasterProgram::Op::Sqrt, 1},  {"sin", RasterProgram::Op::Sin, 1},     {"cos", RasterProgram::Op::Cos, 1},
+   {"tan", RasterProgram::Op::Tan, 1},    {"asin", RasterProgram::Op::Asin, 1},   {"acos", RasterProgram::Op::Acos, 1},
+   {"atan", RasterProgram::Op::Atan, 1},  {"ln", RasterProgram::Op::Log, 1},      {"log10", RasterProgram::Op::Log10, 1},
+   {"abs", RasterProgram::Op::Abs, 1},    {"min", RasterProgram::Op::Min, 2},     {"max", RasterProgram::Op::Max, 2},
+   {"if", RasterProgram::Op::Select, 3},
+};
+
+bool equals_ignore_case(const std::string& a, const char* b) {
+   std::size_t i = 0;
+   for (; i < a.size() && b[i]; ++i) {
+      if (std::tolower(static_cast<unsigned char>(a[i])) != b[i]) {
+         return false;
+      }
+   }
+   return i == a.size() && !b[i];
+}
+
+/// Characters of unquoted raster references, including non-ASCII bytes of UTF-8 names.
+bool is_reference_char(char c) {
+   return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.' || c == ':' || c == '/'
+          || static_cast<unsigned char>(c) >= 0x80;
+}
+
+/// Recursive descent parser with the operator precedence of the QGIS raster calculator grammar,
+/// from lowest to highest: AND, OR, comparisons, + -, * /, ^, unary minus.
+class Parser
+{
+public:
+   Parser(const std::string& text, std::vector<Node>& nodes, std::vector<std::string>& references)
+      : m_text(text), m_nodes(nodes), m_references(references) {
+   }
+
+   int parse(std::string& error) {
+      int root = parse_and();
+      skip_space();
+      if (root >= 0 && m_pos < m_text.size()) {
+         fail("unexpected '" + m_text.substr(m_pos, 1) + "'");
+         root = -1;
+      }
+      if (root < 0) {
+         error = m_error + " at position " + std::to_string(m_pos + 1);
+      }
+      return root;
+   }
+
+private:
+   void skip_space() {
+      while (m_pos < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_pos]))) {
+         ++m_pos;
+      }
+   }
+
+   bool accept(const char* token) {
+      skip_space();
+      const std::size_t length = std::char_traits<char>::length(token);
+      if (m_text.compare(m_pos, length, token) != 0) {
+         return false;
+      }
+      m_pos += length;
+      return true;
+   }
+
+   /// Accepts a keyword such as AND, case insensitive and not followed by a name character.
+   bool accept_keyword(const char* keyword) {
+      skip_space();
+      const std::size_t length = std::char_traits<char>::length(keyword);
+      if (m_pos + length > m_text.size() || !equals_ignore_case(m_text.substr(m_pos, length), keyword)
+          || (m_pos + length < m_text.size() && (is_reference_char(m_text[m_pos + length]) || m_text[m_pos + length] == '@'))) {
+         return false;
+      }
+      m_pos += length;
+      return true;
+   }
+
+   int fail(const std::string& message) {
+      if (m_error.empty()) {
+         m_error = message;
+      }
+      return -1;
+   }
+
+   int number(double value) {
+      Node node;
+      node.value = value;
+      m_nodes.push_back(node);
+      return static_cast<int>(m_nodes.size()) - 1;
+   }
+
+   /// Adds an operation node, folding it into a number if all arguments are numbers.
+   int operation(RasterProgram::Op op, int a, int b = -1, int c = -1) {
+      if (a < 0 || (op < RasterProgram::Op::Negate && b < 0) || (op == RasterProgram::Op::Select && c < 0)) {
+         return -1;
+      }
+      Node node;
+      node.kind = Node::Operation;
+      node.op = op;
+      node.args[0] = a;
+      node.args[1] = b;
+      node.args[2] = c;
+      node.arg_count = b < 0 ? 1 : (c < 0 ? 2 : 3);
+      bool constant = true;
+      double values[3] = {0.0, 0.0, 0.0};
+      for (int i = 0; i < node.arg_count; ++i) {
+         constant = constant && m_nodes[node.args[i]].kind == Node::Number;
+         values[i] = m_nodes[node.args[i]].value;
+      }
+      if (constant) {
+         return number(apply(op, values[0], values[1], values[2]));
+      }
+      m_nodes.push_back(node);
+      return static_cast<int>(m_nodes.size()) - 1;
+   }
+
+   int parse_and() {
+      int left = parse_or();
+      while (left >= 0 && accept_keyword("and")) {
+         left = operation(RasterProgram::Op::And, left, parse_or());
+      }
+      return left;
+   }
+
+   int parse_or() {
+      int left = parse_comparison();
+      while (left >= 0 && accept_keyword("or")) {
+         left = operation(RasterProgram::Op::Or, left, parse_comparison());
+      }
+      return left;
+   }
+
+   int parse_comparison() {
+      int left = parse_additive();
+      while (left >= 0) {
+         RasterProgram::Op op;
+         if (accept("!=")) {
+            op = RasterProgram::Op::NotEqual;
+         } else if (accept("<=")) {
+            op = RasterProgram::Op::LessEqual;
+         } else if (accept(">=")) {
+            op = RasterProgram::Op::GreaterEqual;
+         } else if (accept("=")) {
+            op = RasterProgram::Op::Equal;
+         } else if (accept("<")) {
+            op = RasterProgram::Op::Less;
+         } else if (accept(">")) {
+            op = RasterProgram::Op::Greater;
+         } else {
+            break;
+         }
+         left = operation(op, left, parse_additive());
+      }
+      return left;
+   }
+
+   int parse_additive() {
+      int left = parse_multiplicative();
+      while (left >= 0) {
+         if (accept("+")) {
+            left = operation(RasterProgram::Op::Add, left, parse_multiplicative());
+         } else if (accept("-")) {
+            left = operation(RasterProgram::Op::Subtract, left, parse_multiplicative());
+         } else {
+            break;
+         }
+      }
+      return left;
+   }
+
+   int parse_multiplicative() {
+      int left = parse_power();
+      while (left >= 0) {
+         if (accept("*")) {
+            left = operation(RasterProgram::Op::Multiply, left, parse_power());
+         } else if (accept("/")) {
+            left = operation(RasterProgram::Op::Divide, left, parse_power());
+         } else {
+            break;
+         }
+      }
+      return left;
+   }
+
+   int parse_power() {
+      int left = parse_unary();
+      while (left >= 0 && accept("^")) {
+         left = operation(RasterProgram::Op::Power, left, parse_unary());
+      }
+      return left;
+   }
+
+   int parse_unary() {
+      if (accept("-")) {
+         return operation(RasterProgram::Op::Negate, parse_unary());
+      }
+      if (accept("+")) {
+         return parse_unary();
+      }
+      return parse_primary();
+   }
+
+   int parse_primary() {
+      skip_space();
+      if (m_pos >= m_text.size()) {
+         return fail("unexpected end of expression");
+      }
+      if (accept("(")) {
+         const int inner = parse_and();
+         return inner >= 0 && !accept(")") ? fail("expected ')'") : inner;
+      }
+      if (m_text[m_pos] == '"') {
+         std::string name;
+         std::size_t pos = m_pos + 1;
+         for (; pos < m_text.size() && m_text[pos] != '"'; ++pos) {
+            if (m_text[pos] == '\\' && pos + 1 < m_text.size()) {
+               ++pos;
+            }
+            name += m_text[pos];
+         }
+         if (pos >= m_text.size()) {
+            return fail("unterminated raster reference");
+         }
+         m_pos = pos + 1;
+         return reference(name);
+      }
+      const char first = m_text[m_pos];
+      if (std::isdigit(static_cast<unsigned char>(first)) || first == '.') {
+         // A name may start with a digit too, only a complete number is a number.
+         const char* begin = m_text.c_str() + m_pos;
+         char* end = nullptr;
+         const double value = std::strtod(begin, &end);
+         const std::size_t length = static_cast<std::size_t>(end - begin);
+         const char next = m_pos + length < m_text.size() ? m_text[m_pos + length] : '\0';
+         if (length > 0 && !is_reference_char(next) && next != '@') {
+            m_pos += length;
+            return number(value);
+         }
+      }
+
+      std::size_t pos = m_pos;
+      while (pos < m_text.size() && is_reference_char(m_text[pos])) {
+         ++pos;
+      }
+      if (pos == m_pos) {
+         return fail("unexpected '" + m_text.substr(m_pos, 1) + "'");
+      }
+      const std::string name = m_text.substr(m_pos, pos - m_pos);
+      if (pos < m_text.size() && m_text[pos] == '@') {
+         std::size_t band_end = pos + 1;
+         while (band_end < m_text.size() && std::isdigit(static_cast<unsigned char>(m_text[band_end]))) {
+            ++band_end;
+         }
+         if (band_end == pos + 1) {
+            return fail("expected a band number");
+         }
+         const std::string full_name = m_text.substr(m_pos, band_end - m_pos);
+         m_pos = band_end;
+         return reference(full_name);
+      }
+      for (const Function& function : s_functions) {
+         if (!equals_ignore_case(name, function.name)) {
+            continue;
+         }
+         m_pos = pos;
+         if (!accept("(")) {
+            return fail("expected '('");
+         }
+         int args[3] = {-1, -1, -1};
+         for (int i = 0; i < function.arg_count; ++i) {
+            if (i > 0 && !accept(",")) {
+               return fail("expected ','");
+            }
+            args[i] = parse_and();
+            if (args[i] < 0) {
+               return -1;
+            }
+         }
+         if (!accept(")")) {
+            return fail("expected ')'");
+         }
+         return operation(function.op, args[0], args[1], args[2]);
+      }
+      return fail("unknown name '" + name + "'");
+   }
+
+   int reference(const std::string& name) {
+      Node node;
+      node.kind = Node::Reference;
+      const auto found = std::find(m_references.begin(), m_references.end(), name);
+      node.index = static_cast<int>(found - m_references.begin());
+      if (found == m_references.end()) {
+         m_references.push_back(name);
+      }
+      m_nodes.push_back(node);
+      return static_cast<int>(m_nodes.size()) - 1;
+   }
+
+   const std::string& m_text;
+   std::vector<Node>& m_nodes;
+   std::vector<std::string>& m_references;
+   std::size_t m_pos = 0;
+   std::string m_error;
+};
+
+/// Emits the instructions of a tree in post order, reusing temporary registers once consumed.
+class CodeGenerator
+{
+public:
+   CodeGenerator(const std::vector<Node>& nodes, std::size_t reference_count, std::size_t constant_count,
+                 std::vector<RasterProgram::Instruction>& instructions)
+      : m_nodes(nodes), m_first_constant(reference_count), m_first_temporary(reference_count + constant_count),
+        m_instructions(instructions) {
+   }
+
+   std::uint16_t emit(int index) {
+      const Node& node = m_nodes[index];
+      if (node.kind == Node::Reference) {
+         return static_cast<std::uint16_t>(node.index);
+      }
+      if (node.kind == Node::Number) {
+         return static_cast<std::uint16_t>(m_first_constant + node.index);
+      }
+      std::uint16_t args[3] = {0, 0, 0};
+      for (int i = 0; i < node.arg_count; ++i) {
+         args[i] = emit(node.args[i]);
+      }
+      // Instructions work element by element, so the target may be one of the arguments.
+      for (int i = 0; i < node.arg_count; ++i) {
+         release(args[i]);
+      }
+      const std::uint16_t target = allocate();
+      m_instructions.push_back({node.op, target, args[0], args[1], args[2]});
+      return target;
+   }
+
+   std::size_t temporary_count() const {
+      return m_temporary_count;
+   }
+
+private:
+   std::uint16_t allocate() {
+      if (!m_free.empty()) {
+         const std::uint16_t target = m_free.back();
+         m_free.pop_back();
+         return target;
+      }
+      return static_cast<std::uint16_t>(m_first_temporary + m_temporary_count++);
+   }
+
+   void release(std::uint16_t target) {
+      if (target >= m_first_temporary && std::find(m_free.begin(), m_free.end(), target) == m_free.end()) {
+         m_free.push_back(target);
+      }
+   }
+
+   const std::vector<Node>& m_nodes;
+   std::size_t m_first_constant;
+   std::size_t m_first_temporary;
+   std::vector<RasterProgram::Instruction>& m_instructions;
+   std::vector<std::uint16_t> m_free;
+   std::size_t m_temporary_count = 0;
+};
+
+}
+
+bool RasterProgram::compile(const std::string& formula, std::string& error) {
+   m_references.clear();
+   m_constants.clear();
+   m_instructions.clear();
+   m_temporary_count = 0;
+   m_result = 0;
+
+   std::vector<Node> nodes;
+   const int root = Parser(formula, nodes, m_references).parse(error);
+   if (root < 0) {
+      return false;
+   }
+
+   // Number constants that survived folding get their own registers, after the inputs.
+   std::vector<int> reachable = {root};
+   for (std::size_t i = 0; i < reachable.size(); ++i) {
+      Node& node = nodes[reachable[i]];
+      if (node.kind == Node::Number) {
+         node.index = static_cast<int>(m_constants.size());
+         m_constants.push_back(node.value);
+      }
+      for (int arg = 0; arg < node.arg_count; ++arg) {
+         reachable.push_back(node.args[arg]);
+      }
+   }
+   if (m_references.size() + m_constants.size() + nodes.size() > std::numeric_limits<std::uint16_t>::max()) {
+      error = "expression too large";
+      return false;
+   }
+
+   CodeGenerator generator(nodes, m_references.size(), m_constants.size(), m_instructions);
+   m_result = generator.emit(root);
+   m_temporary_count = generator.temporary_count();
+   return true;
+}
+
+void RasterProgram::evaluate(const double* const* inputs, std::size_t count, double* output,
+                             std::vector<double>& registers) const {
+   const std::size_t reference_count = m_references.size();
+   const std::size_t register_count = reference_count + m_constants.size() + m_temporary_count;
+   registers.resize((m_constants.size() + m_temporary_count) * s_chunk);
+   std::vector<const double*> sources(register_count, nullptr);
+   std::vector<double*> targets(register_count, nullptr);
+   for (std::size_t reg = reference_count; reg < register_count; ++reg) {
+      targets[reg] = registers.data() + (reg - reference_count) * s_chunk;
+      sources[reg] = targets[reg];
+   }
+   for (std::size_t constant = 0; constant < m_constants.size(); ++constant) {
+      std::fill_n(targets[reference_count + constant], s_chunk, m_constants[constant]);
+   }
+
+   for (std::size_t offset = 0; offset < count; offset += s_chunk) {
+      const std::size_t chunk = std::min(s_chunk, count - offset);
+      for (std::size_t reference = 0; reference < reference_count; ++reference) {
+         sources[reference] = inputs[reference] + offset;
+      }
+      evaluate_chunk(sources.data(), targets.data(), chunk);
+      std::copy_n(sources[m_result], chunk, output + offset);
+   }
+}
+
+void RasterProgram::evaluate_chunk(const double** sources, double* const* targets, std::size_t count) const {
+   for (const Instruction& instruction : m_instructions) {
+      double* target = targets[instruction.target];
+      const double* a = sources[instruction.a];
+      const double* b = sources[instruction.b];
+      const double* c = sources[instruction.c];
+      switch (instruction.op) {
+         case Op::Add:
+            fill(target, count, [=](std::size_t i) { return a[i] + b[i]; });
+            break;
+         case Op::Subtract:
+            fill(target, count, [=](std::size_t i) { return a[i] - b[i]; });
+            break;
+         case Op::Multiply:
+            fill(target, count, [=](std::size_t i) { return a[i] * b[i]; });
+            break;
+         case Op::Divide:
+            fill(target, count, [=](std::size_t i) { return divide(a[i], b[i]); });
+            break;
+         case Op::Power:
+            fill(target, count, [=](std::size_t i) { return power(a[i], b[i]); });
+            break;
+         case Op::Equal:
+            fill(target, count, [=](std::size_t i) { return truth(a[i] == b[i], a[i], b[i]); });
+            break;
+         case Op::NotEqual:
+            fill(target, count, [=](std::size_t i) { return truth(a[i] != b[i], a[i], b[i]); });
+            break;
+         case Op::Greater:
+            fill(target, count, [=](std::size_t i) { return truth(a[i] > b[i], a[i], b[i]); });
+            break;
+         case Op::Less:
+            fill(target, count, [=](std::size_t i) { return truth(a[i] < b[i], a[i], b[i]); });
+            break;
+         case Op::GreaterEqual:
+            fill(target, count, [=](std::size_t i) { return truth(a[i] >= b[i], a[i], b[i]); });
+            break;
+         case Op::LessEqual:
+            fill(target, count, [=](std::size_t i) { return truth(a[i] <= b[i], a[i], b[i]); });
+            break;
+         case Op::And:
+            fill(target, count, [=](std::size_t i) { return truth(a[i] != 0.0 && b[i] != 0.0, a[i], b[i]); });
+            break;
+         case Op::Or:
+            fill(target, count, [=](std::size_t i) { return truth(a[i] != 0.0 || b[i] != 0.0, a[i], b[i]); });
+            break;
+         case Op::Min:
+            fill(target, count, [=](std::size_t i) { return minimum(a[i], b[i]); });
+            break;
+         case Op::Max:
+            fill(target, count, [=](std::size_t i) { return maximum(a[i], b[i]); });
+            break;
+         case Op::Negate:
+            fill(target, count, [=](std::size_t i) { return -a[i]; });
+            break;
+         case Op::Sqrt:
+            fill(target, count, [=](std::size_t i) { return std::sqrt(a[i]); });
+            break;
+         case Op::Sin:
+            fill(target, count, [=](std::size_t i) { return std::sin(a[i]); });
+            break;
+         case Op::Cos:
+            fill(target, count, [=](std::size_t i) { return std::cos(a[i]); });
+            break;
+         case Op::Tan:
+            fill(target, count, [=](std::size_t i) { return std::tan(a[i]); });
+            break;
+         case Op::Asin:
+            fill(target, count, [=](std::size_t i) { return std::asin(a[i]); });
+            break;
+         case Op::Acos:
+            fill(target, count, [=](std::size_t i) { return std::acos(a[i]); });
+            break;
+         case Op::Atan:
+            fill(target, count, [=](std::size_t i) { return std::atan(a[i]); });
+            break;
+         case Op::Log:
+            fill(target, count, [=](std::size_t i) { return logarithm(a[i]); });
+            break;
+         case Op::Log10:
+            fill(target, count, [=](std::size_t i) { return logarithm10(a[i]); });
+            break;
+         case Op::Abs:
+            fill(target, count, [=](std::size_t i) { return std::abs(a[i]); });
+            break;
+         case Op::Select:
+            fill(target, count, [=](std::size_t i) { return select(a[i], b[i], c[i]); });
+            break;
+      }
+   }
+}
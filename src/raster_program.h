@@ -0,0 +1,106 @@
+#ifndef _RASTER_PROGRAM_H_
+#define _RASTER_PROGRAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// @brief A raster calculator formula compiled into register based bytecode.
+///
+/// QgsRasterCalcNode::calculate() evaluates the operator tree recursively and every operator
+/// fills a complete intermediate QgsRasterMatrix. A RasterProgram flattens the tree into a list
+/// of instructions on a small set of registers instead. Each register holds s_chunk values, so
+/// a pixel chunk runs through the whole formula while it stays in the L1 cache, and registers
+/// are reused as soon as their value has been consumed. Subexpressions without raster
+/// references are folded into constants at compile time.
+///
+/// The formula syntax is the one of the QGIS raster calculator: raster references such as
+/// dem@1 or "my layer@2", numbers, + - * / ^, comparisons = != < > <= >=, AND, OR, the
+/// functions sqrt, sin, cos, tan, asin, acos, atan, ln, log10, abs, min, max and
+/// if(condition, then, else). Nodata is represented by NaN: it propagates through every
+/// operation, and invalid operations such as a division by zero or the logarithm of a
+/// non-positive number yield NaN, matching the nodata results of QgsRasterMatrix.
+class RasterProgram
+{
+public:
+   /// Number of pixels evaluated per instruction.
+   static constexpr std::size_t s_chunk = 256;
+
+   /// Operations of the instructions.
+   enum class Op : std::uint8_t {
+      Add,
+      Subtract,
+      Multiply,
+      Divide,
+      Power,
+      Equal,
+      NotEqual,
+      Greater,
+      Less,
+      GreaterEqual,
+      LessEqual,
+      And,
+      Or,
+      Min,
+      Max,
+      Negate,
+      Sqrt,
+      Sin,
+      Cos,
+      Tan,
+      Asin,
+      Acos,
+      Atan,
+      Log,
+      Log10,
+      Abs,
+      Select
+   };
+
+   /// One instruction: target = op(a, b, c), with unused operands ignored.
+   struct Instruction {
+      Op op;
+      std::uint16_t target;
+      std::uint16_t a;
+      std::uint16_t b;
+      std::uint16_t c;
+   };
+
+   /// @brief Parses and compiles a formula.
+   /// @param formula The raster calculator expression.
+   /// @param error Receives a description of the syntax error, if any.
+   /// @return False if the formula is invalid.
+   bool compile(const std::string& formula, std::string& error);
+
+   /// Raster references of the formula without quotes, in the order of the inputs of evaluate().
+   const std::vector<std::string>& references() const {
+      return m_references;
+   }
+
+   const std::vector<Instruction>& instructions() const {
+      return m_instructions;
+   }
+
+   /// @brief Evaluates the formula for a run of pixels.
+   /// @param inputs One array of count values per reference, NaN for nodata.
+   /// @param count Number of pixels.
+   /// @param output Receives the results, NaN for nodata.
+   /// @param registers Scratch space, reused between calls of the same thread.
+   void evaluate(const double* const* inputs, std::size_t count, double* output, std::vector<double>& registers) const;
+
+private:
+   /// Evaluates one chunk of at most s_chunk pixels, with the registers located by sources.
+   void evaluate_chunk(const double** sources, double* const* targets, std::size_t count) const;
+
+   std::vector<std::string> m_references;
+   /// Values of the constant registers, which follow the input registers.
+   std::vector<double> m_constants;
+   /// Number of temporary registers, which follow the constant registers.
+   std::size_t m_temporary_count = 0;
+   std::vector<Instruction> m_instructions;
+   /// Register holding the result.
+   std::uint16_t m_result = 0;
+};
+
+#endif
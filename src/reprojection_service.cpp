@@ -0,0 +1,253 @@
+#include "reprojection_service.h"
+#include "parallel_for.h"
+
+#include "qgsabstractgeometry.h"
+#include "qgsexception.h"
+#include "qgsfeedback.h"
+#include "qgsgeometrytransformer.h"
+
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace {
+
+/// Tasks per worker when transforming geometries, so uneven geometries balance.
+constexpr std::size_t s_tasks_per_worker = 8;
+/// Smallest chunk worth building an approximation grid for.
+constexpr std::size_t s_min_approximated_points = 1024;
+/// Exact samples of an approximation grid are limited to this fraction of the chunk's points.
+constexpr std::size_t s_max_sample_fraction = 4;
+
+/// Appends the vertices of a geometry to the buffers of a worker.
+class GatherTransformer : public QgsAbstractGeometryTransformer
+{
+public:
+   GatherTransformer(std::vector<double>& x, std::vector<double>& y, std::vector<double>& z, bool transform_z)
+      : m_x(x), m_y(y), m_z(z), m_transform_z(transform_z) {
+   }
+
+   bool transformPoint(double& x, double& y, double& z, double&) override {
+      m_x.push_back(x);
+      m_y.push_back(y);
+      // Points without z are transformed at z 0, as QgsCoordinateTransform does.
+      m_z.push_back(m_transform_z && !std::isnan(z) ? z : 0.0);
+      return true;
+   }
+
+private:
+   std::vector<double>& m_x;
+   std::vector<double>& m_y;
+   std::vector<double>& m_z;
+   bool m_transform_z;
+};
+
+/// Writes the transformed vertices back, in the order they were gathered.
+class ScatterTransformer : public QgsAbstractGeometryTransformer
+{
+public:
+   ScatterTransformer(const double* x, const double* y, const double* z, bool transform_z)
+      : m_x(x), m_y(y), m_z(z), m_transform_z(transform_z) {
+   }
+
+   bool transformPoint(double& x, double& y, double& z, double&) override {
+      x = m_x[m_next];
+      y = m_y[m_next];
+      if (m_transform_z && !std::isnan(z)) {
+         z = m_z[m_next];
+      }
+      ++m_next;
+      return true;
+   }
+
+private:
+   const double* m_x;
+   const double* m_y;
+   const double* m_z;
+   bool m_transform_z;
+   std::size_t m_next = 0;
+};
+
+/// Gathered vertices of a task, reused by every task of a worker.
+struct Workspace {
+   std::vector<double> x;
+   std::vector<double> y;
+   std::vector<double> z;
+   std::vector<std::uint8_t> failed;
+   /// Offset of the first vertex of every geometry of the task, plus the end.
+   std::vector<std::size_t> offsets;
+   long long point_count = 0;
+   long long failed_point_count = 0;
+   long long failed_geometry_count = 0;
+};
+
+}
+
+ReprojectionService::ReprojectionService(const QgsCoordinateTransform& transform, const ReprojectionSettings& settings)
+   : m_settings(settings), m_thread_count(resolve_thread_count(settings.thread_count)),
+     m_pool(m_thread_count), m_transforms(m_thread_count, transform),
+     m_approximations(m_thread_count, ApproximateTransform(settings.approximation)) {
+   m_settings.chunk_size = std::max(1, m_settings.chunk_size);
+}
+
+std::size_t ReprojectionService::transform_chunk(int worker, double* x, double* y, double* z, std::size_t count,
+                                                 std::uint8_t* failed, bool exact_z) {
+   if (!exact_z && m_settings.approximation.max_error > 0.0) {
+      double x_min = std::numeric_limits<double>::max();
+      double y_min = std::numeric_limits<double>::max();
+      double x_max = std::numeric_limits<double>::lowest();
+      double y_max = std::numeric_limits<double>::lowest();
+      for (std::size_t i = 0; i < count; ++i) {
+         if (std::isfinite(x[i]) && std::isfinite(y[i])) {
+            x_min = std::min(x_min, x[i]);
+            y_min = std::min(y_min, y[i]);
+            x_max = std::max(x_max, x[i]);
+            y_max = std::max(y_max, y[i]);
+         }
+      }
+      const QgsRectangle extent(x_min, y_min, x_max, y_max, false);
+      // Chunks too small or degenerate for a grid are transformed exactly, and so are the parts
+      // of a chunk the sample budget cannot resolve.
+      ApproximateTransform& approximation = m_approximations[worker];
+      if (count >= s_min_approximated_points
+          && approximation.build(m_transforms[worker], extent, count / s_max_sample_fraction)) {
+         return approximation.transform(x, y, count, failed);
+      }
+   }
+   try {
+      m_transforms[worker].transformCoords(static_cast<int>(count), x, y, z);
+   } catch (QgsCsException&) {
+      // All points were transformed, the failed ones hold infinite coordinates.
+   }
+   std::size_t failed_count = 0;
+   for (std::size_t i = 0; i < count; ++i) {
+      const bool point_failed = !std::isfinite(x[i]) || !std::isfinite(y[i]);
+      failed_count += point_failed;
+      if (failed) {
+         failed[i] = point_failed;
+      }
+   }
+   return failed_count;
+}
+
+long long ReprojectionService::transform_coords(double* x, double* y, double* z, std::size_t count, std::uint8_t* failed) {
+   QElapsedTimer timer;
+   timer.start();
+   const std::size_t chunk_size = static_cast<std::size_t>(m_settings.chunk_size);
+   const std::size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+   std::vector<std::vector<double>> scratch_z(m_thread_count);
+   std::atomic<long long> failed_count(0);
+   m_pool.run(chunk_count, [&](std::size_t chunk, int worker) {
+      const std::size_t first = chunk * chunk_size;
+      const std::size_t size = std::min(chunk_size, count - first);
+      double* chunk_z = z ? z + first : nullptr;
+      if (!chunk_z) {
+         scratch_z[worker].assign(size, 0.0);
+         chunk_z = scratch_z[worker].data();
+      }
+      failed_count += static_cast<long long>(transform_chunk(worker, x + first, y + first, chunk_z, size,
+                                                             failed ? failed + first : nullptr, z != nullptr));
+   });
+   m_stats.point_count += static_cast<long long>(count);
+   m_stats.failed_point_count += failed_count;
+   m_stats.seconds += static_cast<double>(timer.nsecsElapsed()) * 1e-9;
+   return failed_count;
+}
+
+template <typename GeometryAt>
+long long ReprojectionService::transform_geometries(std::size_t count, GeometryAt geometry_at, QgsFeedback* feedback) {
+   QElapsedTimer timer;
+   timer.start();
+   const std::size_t chunk_size = static_cast<std::size_t>(m_settings.chunk_size);
+   const std::size_t task_count = std::min(count, static_cast<std::size_t>(m_thread_count) * s_tasks_per_worker);
+   std::vector<Workspace> workspaces(m_thread_count);
+   std::atomic<bool> canceled(false);
+
+   m_pool.run(task_count, [&](std::size_t task, int worker) {
+      if (canceled) {
+         return;
+      }
+      if (feedback && feedback->isCanceled()) {
+         canceled = true;
+         return;
+      }
+      const std::size_t first = task * count / task_count;
+      const std::size_t last = (task + 1) * count / task_count;
+      Workspace& workspace = workspaces[worker];
+      workspace.x.clear();
+      workspace.y.clear();
+      workspace.z.clear();
+      workspace.offsets.clear();
+
+      GatherTransformer gather(workspace.x, workspace.y, workspace.z, m_settings.transform_z);
+      for (std::size_t i = first; i < last; ++i) {
+         workspace.offsets.push_back(workspace.x.size());
+         QgsGeometry& geometry = geometry_at(i);
+         if (!geometry.isNull()) {
+            geometry.get()->transform(&gather);
+         }
+      }
+      workspace.offsets.push_back(workspace.x.size());
+
+      const std::size_t point_count = workspace.x.size();
+      workspace.failed.resize(point_count);
+      for (std::size_t offset = 0; offset < point_count; offset += chunk_size) {
+         const std::size_t size = std::min(chunk_size, point_count - offset);
+         workspace.failed_point_count += static_cast<long long>(
+            transform_chunk(worker, workspace.x.data() + offset, workspace.y.data() + offset, workspace.z.data() + offset,
+                            size, workspace.failed.data() + offset, m_settings.transform_z));
+      }
+      workspace.point_count += static_cast<long long>(point_count);
+
+      for (std::size_t i = first; i < last; ++i) {
+         const std::size_t begin = workspace.offsets[i - first];
+         const std::size_t end = workspace.offsets[i - first + 1];
+         if (begin == end) {
+            continue;
+         }
+         QgsGeometry& geometry = geometry_at(i);
+         if (std::any_of(workspace.failed.begin() + begin, workspace.failed.begin() + end, [](std::uint8_t f) { return f; })) {
+            geometry = QgsGeometry();
+            ++workspace.failed_geometry_count;
+            continue;
+         }
+         ScatterTransformer scatter(workspace.x.data() + begin, workspace.y.data() + begin, workspace.z.data() + begin,
+                                    m_settings.transform_z);
+         geometry.get()->transform(&scatter);
+      }
+   });
+
+   long long failed_geometry_count = 0;
+   for (const Workspace& workspace : workspaces) {
+      m_stats.point_count += workspace.point_count;
+      m_stats.failed_point_count += workspace.failed_point_count;
+      failed_geometry_count += workspace.failed_geometry_count;
+   }
+   m_stats.seconds += static_cast<double>(timer.nsecsElapsed()) * 1e-9;
+   return failed_geometry_count;
+}
+
+long long ReprojectionService::transform(QVector<QgsGeometry>& geometries, QgsFeedback* feedback) {
+   // Detach once in the calling thread, the workers only touch their own elements.
+   QgsGeometry* data = geometries.data();
+   return transform_geometries(static_cast<std::size_t>(geometries.size()),
+                               [data](std::size_t i) -> QgsGeometry& { return data[i]; }, feedback);
+}
+
+long long ReprojectionService::transform(QgsFeatureList& features, QgsFeedback* feedback) {
+   // QgsFeature::geometry() returns a copy, so the geometries are moved out and set again.
+   QVector<QgsGeometry> geometries;
+   geometries.reserve(features.size());
+   for (const QgsFeature& feature : std::as_const(features)) {
+      geometries.append(feature.geometry());
+   }
+   const long long failed_count = transform(geometries, feedback);
+   for (int i = 0; i < features.size(); ++i) {
+      features[i].setGeometry(geometries[i]);
+   }
+   return failed_count;
+}
@@ -0,0 +1,110 @@
+#ifndef _REPROJECTION_SERVICE_H_
+#define _REPROJECTION_SERVICE_H_
+
+#include "approximate_transform.h"
+#include "worker_pool.h"
+
+#include "qgscoordinatetransform.h"
+#include "qgsfeature.h"
+#include "qgsgeometry.h"
+#include "qgsrectangle.h"
+
+#include <QVector>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class QgsFeedback;
+
+/// @brief Settings of a reprojection service.
+struct ReprojectionSettings {
+   /// Points per QgsCoordinateTransform::transformCoords() call.
+   int chunk_size = 65536;
+   /// Also transform the z values of geometries with z, like QgsGeometry::transform() with transformZ.
+   bool transform_z = false;
+   /// Interpolates the x and y of every chunk from an ApproximateTransform over the chunk's
+   /// bounding box when max_error is positive. Z values are always transformed exactly.
+   ApproximationSettings approximation;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+};
+
+/// Counters of the points transformed by a reprojection service.
+struct ReprojectionStats {
+   long long point_count = 0;
+   long long failed_point_count = 0;
+   /// Wall time of the transform calls, including gathering and scattering.
+   double seconds = 0.0;
+
+   double points_per_second() const {
+      return seconds > 0.0 ? static_cast<double>(point_count) / seconds : 0.0;
+   }
+};
+
+/// @brief Reprojects many geometries or points with few, large PROJ calls.
+///
+/// QgsGeometry::transform() and QgsCoordinateTransform::transformInPlace() enter PROJ once per
+/// vertex or ring, each time with the per-call setup and error handling. The service gathers
+/// the vertices of a range of geometries into contiguous x, y and z buffers, transforms them
+/// with one transformCoords() call per chunk, and scatters the results back, on all cores.
+/// Gathering and scattering use a QgsAbstractGeometryTransformer, so every geometry type
+/// including curves is visited in the same vertex order both times.
+///
+/// Every worker has its own copy of the transform, whose error state QGIS updates on every
+/// call. The workers are the threads of a WorkerPool that lives as long as the service, so the
+/// PROJ objects QGIS creates for a transform in every thread, with the grid shift files they
+/// have opened, are set up once and reused by all later calls.
+///
+/// With a positive approximation.max_error, the x and y of every chunk without exact z are
+/// interpolated from an ApproximateTransform built over the chunk's bounding box.
+class ReprojectionService
+{
+public:
+   /// @brief Constructor.
+   /// @param transform The transform to apply, forward.
+   /// @param settings The chunk size and processing options.
+   ReprojectionService(const QgsCoordinateTransform& transform, const ReprojectionSettings& settings = ReprojectionSettings());
+
+   /// @brief Transforms geometries in place.
+   ///
+   /// Geometries with a vertex that cannot be transformed are set to null, like features of a
+   /// QgsFeatureRequest with a destination CRS.
+   /// @return The number of geometries set to null.
+   long long transform(QVector<QgsGeometry>& geometries, QgsFeedback* feedback = nullptr);
+
+   /// @brief Transforms the geometries of features in place, see transform().
+   long long transform(QgsFeatureList& features, QgsFeedback* feedback = nullptr);
+
+   /// @brief Transforms coordinate arrays in place.
+   /// @param z Z values to transform, or null to keep the points at z 0.
+   /// @param failed Receives 1 for every point that could not be transformed, or null.
+   /// @return The number of points that could not be transformed; they hold infinite coordinates.
+   long long transform_coords(double* x, double* y, double* z, std::size_t count, std::uint8_t* failed = nullptr);
+
+   /// Counters of all calls since construction or reset_stats().
+   const ReprojectionStats& stats() const {
+      return m_stats;
+   }
+
+   void reset_stats() {
+      m_stats = ReprojectionStats();
+   }
+
+private:
+   /// Transforms one chunk with the transform of a worker, approximated unless exact_z is set.
+   std::size_t transform_chunk(int worker, double* x, double* y, double* z, std::size_t count, std::uint8_t* failed,
+                               bool exact_z);
+
+   template <typename GeometryAt>
+   long long transform_geometries(std::size_t count, GeometryAt geometry_at, QgsFeedback* feedback);
+
+   ReprojectionSettings m_settings;
+   int m_thread_count;
+   WorkerPool m_pool;
+   std::vector<QgsCoordinateTransform> m_transforms;
+   std::vector<ApproximateTransform> m_approximations;
+   ReprojectionStats m_stats;
+};
+
+#endif
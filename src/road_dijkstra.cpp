@@ -0,0 +1,104 @@
+#include "road_dijkstra.h"
+
+#include <algorithm>
+#include <functional>
+
+DijkstraSearch::DijkstraSearch(const RoadGraph& graph)
+   : m_graph(graph),
+     m_costs(graph.vertex_count()),
+     m_parent_edges(graph.vertex_count()),
+     m_run_of(graph.vertex_count(), 0),
+     m_done(graph.vertex_count(), 0),
+     m_is_target(graph.vertex_count(), 0) {
+}
+
+void DijkstraSearch::run(const std::vector<int>& sources, int strategy, double max_cost) {
+   if (++m_run == 0) {
+      // The counter wrapped around, so old stamps could match again.
+      std::fill(m_run_of.begin(), m_run_of.end(), 0);
+      m_run = 1;
+   }
+   m_settled.clear();
+   m_heap.clear();
+   std::size_t targets_left = m_targets.size();
+
+   // m_heap is a binary min-heap with lazy deletion: a vertex is pushed again whenever its cost
+   // drops, and stale entries are skipped when popped.
+   const auto heap_order = std::greater<std::pair<double, int>>();
+   const double* edge_costs = m_graph.costs(strategy);
+   for (int source : sources) {
+      if (m_run_of[source] == m_run) {
+         continue;
+      }
+      m_run_of[source] = m_run;
+      m_costs[source] = 0.0;
+      m_parent_edges[source] = -1;
+      m_done[source] = 0;
+      m_heap.emplace_back(0.0, source);
+   }
+   std::make_heap(m_heap.begin(), m_heap.end(), heap_order);
+
+   while (!m_heap.empty()) {
+      std::pop_heap(m_heap.begin(), m_heap.end(), heap_order);
+      const auto [cost, vertex] = m_heap.back();
+      m_heap.pop_back();
+      if (m_done[vertex] || cost > m_costs[vertex]) {
+         continue;
+      }
+      if (cost > max_cost) {
+         break;
+      }
+      m_done[vertex] = 1;
+      m_settled.push_back(vertex);
+      if (m_is_target[vertex] && --targets_left == 0) {
+         break;
+      }
+
+      const int end = m_graph.first_edge(vertex + 1);
+      for (int edge = m_graph.first_edge(vertex); edge < end; ++edge) {
+         const int target = m_graph.target(edge);
+         const double target_cost = cost + edge_costs[edge];
+         if (m_run_of[target] != m_run) {
+            m_run_of[target] = m_run;
+            m_done[target] = 0;
+         } else if (m_done[target] || target_cost >= m_costs[target]) {
+            continue;
+         }
+         m_costs[target] = target_cost;
+         m_parent_edges[target] = edge;
+         m_heap.emplace_back(target_cost, target);
+         std::push_heap(m_heap.begin(), m_heap.end(), heap_order);
+      }
+   }
+}
+
+void DijkstraSearch::set_targets(const std::vector<int>& targets) {
+   for (int target : m_targets) {
+      m_is_target[target] = 0;
+   }
+   m_targets.clear();
+   for (int target : targets) {
+      if (!m_is_target[target]) {
+         m_is_target[target] = 1;
+         m_targets.push_back(target);
+      }
+   }
+}
+
+void DijkstraSearch::result_tree(std::vector<int>* tree, std::vector<double>* costs) const {
+   const int vertex_count = m_graph.vertex_count();
+   if (tree) {
+      tree->assign(vertex_count, -1);
+   }
+   if (costs) {
+      costs->assign(vertex_count, std::numeric_limits<double>::infinity());
+   }
+   for (int vertex : m_settled) {
+      if (tree && m_parent_edges[vertex] >= 0) {
+         (*tree)[vertex] = m_graph.source_edge(m_parent_edges[vertex]);
+      }
+      if (costs) {
+         (*costs)[vertex] = m_costs[vertex];
+      }
+   }
+}
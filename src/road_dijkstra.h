@@ -0,0 +1,75 @@
+#ifndef _ROAD_DIJKSTRA_H_
+#define _ROAD_DIJKSTRA_H_
+
+#include "road_graph.h"
+
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+/// @brief Reusable multi-source Dijkstra search on a RoadGraph.
+///
+/// Unlike QgsGraphAnalyzer::dijkstra(), the search reads the costs from a flat array, accepts
+/// any number of sources and can stop at a cost limit, which is what service areas need. The
+/// per-vertex state is allocated once and reset lazily through a run counter, so thousands of
+/// small queries do not pay for clearing arrays of the whole graph. One instance must not be
+/// used by several threads at once; create one per worker.
+class DijkstraSearch
+{
+public:
+   /// @brief Constructor.
+   /// @param graph The graph to search, must outlive the search.
+   explicit DijkstraSearch(const RoadGraph& graph);
+
+   /// @brief Computes the cheapest paths from the nearest of several sources.
+   /// @param sources Start vertices, each with cost 0.
+   /// @param strategy Index of the edge cost to minimize.
+   /// @param max_cost Vertices farther than this are not settled.
+   void run(const std::vector<int>& sources, int strategy, double max_cost = std::numeric_limits<double>::infinity());
+
+   /// @brief Sets the vertices whose costs the following runs have to find.
+   ///
+   /// A run stops as soon as all targets are settled, instead of exploring the whole graph.
+   /// @param targets The target vertices, empty to search without stopping early.
+   void set_targets(const std::vector<int>& targets);
+
+   /// Cost of a vertex in the last run, infinity if it was not settled.
+   double cost(int vertex) const {
+      return settled(vertex) ? m_costs[vertex] : std::numeric_limits<double>::infinity();
+   }
+
+   /// Edge of the graph the vertex was reached through in the last run, -1 for sources and unsettled vertices.
+   int parent_edge(int vertex) const {
+      return settled(vertex) ? m_parent_edges[vertex] : -1;
+   }
+
+   /// Whether the last run settled a vertex, i.e. found its final cost within the cost limit.
+   bool settled(int vertex) const {
+      return m_run_of[vertex] == m_run && m_done[vertex];
+   }
+
+   /// Vertices settled by the last run, in order of increasing cost.
+   const std::vector<int>& settled_vertices() const {
+      return m_settled;
+   }
+
+   /// @brief Returns the last run as QgsGraphAnalyzer::dijkstra() does.
+   /// @param tree Receives the QgsGraph index of the incoming edge of every vertex, or -1.
+   /// @param costs Receives the cost of every vertex, infinity if not settled.
+   void result_tree(std::vector<int>* tree, std::vector<double>* costs) const;
+
+private:
+   const RoadGraph& m_graph;
+   std::vector<double> m_costs;
+   std::vector<int> m_parent_edges;
+   std::vector<std::uint32_t> m_run_of;
+   std::vector<char> m_done;
+   std::vector<char> m_is_target;
+   std::vector<int> m_targets;
+   std::vector<int> m_settled;
+   std::vector<std::pair<double, int>> m_heap;
+   std::uint32_t m_run = 0;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include "road_graph.h"
+
+#include "qgsgraph.h"
+
+RoadGraph RoadGraph::from_qgs_graph(const QgsGraph& graph) {
+   // Indices of removed vertices and edges are skipped, so scan until all live ones are found.
+   int vertex_count = 0;
+   for (int found = 0; found < graph.vertexCount(); ++vertex_count) {
+      found += graph.hasVertex(vertex_count) ? 1 : 0;
+   }
+
+   std::vector<int> from;
+   std::vector<int> to;
+   std::vector<int> edge_ids;
+   std::vector<double> costs;
+   from.reserve(graph.edgeCount());
+   to.reserve(graph.edgeCount());
+   edge_ids.reserve(graph.edgeCount());
+
+   int strategy_count = 0;
+   for (int index = 0, found = 0; found < graph.edgeCount(); ++index) {
+      if (!graph.hasEdge(index)) {
+         continue;
+      }
+      ++found;
+      const QgsGraphEdge& edge = graph.edge(index);
+      const QVector<QVariant> strategies = edge.strategies();
+      if (edge_ids.empty()) {
+         strategy_count = strategies.size();
+         costs.reserve(static_cast<std::size_t>(graph.edgeCount()) * strategy_count);
+      }
+      from.push_back(edge.fromVertex());
+      to.push_back(edge.toVertex());
+      edge_ids.push_back(index);
+      for (int strategy = 0; strategy < strategy_count; ++strategy) {
+         costs.push_back(strategy < strategies.size() ? strategies.at(strategy).toDouble() : 0.0);
+      }
+   }
+
+   RoadGraph result = from_edges(vertex_count, from, to, costs, strategy_count, edge_ids);
+   result.m_coordinates.assign(2 * static_cast<std::size_t>(vertex_count), 0.0);
+   for (int vertex = 0; vertex < vertex_count; ++vertex) {
+      if (graph.hasVertex(vertex)) {
+         const QgsPointXY point = graph.vertex(vertex).point();
+         result.m_coordinates[2 * vertex] = point.x();
+         result.m_coordinates[2 * vertex + 1] = point.y();
+      }
+   }
+   return result;
+}
+
+RoadGraph RoadGraph::from_edges(int vertex_count, const std::vector<int>& from, const std::vector<int>& to,
+                                const std::vector<double>& costs, int strategy_count, const std::vector<int>& edge_ids) {
+   RoadGraph result;
+   const std::size_t edge_count = from.size();
+   result.m_strategy_count = strategy_count;
+   result.m_offsets.assign(static_cast<std::size_t>(vertex_count) + 1, 0);
+   for (int vertex : from) {
+      ++result.m_offsets[vertex + 1];
+   }
+   for (int vertex = 0; vertex < vertex_count; ++vertex) {
+      result.m_offsets[vertex + 1] += result.m_offsets[vertex];
+   }
+
+   // Counting sort of the edges by start vertex, keeping their input order per vertex.
+   std::vector<int> next(result.m_offsets.begin(), result.m_offsets.end() - 1);
+   result.m_targets.resize(edge_count);
+   result.m_source_edges.resize(edge_count);
+   result.m_costs.resize(edge_count * strategy_count);
+   for (std::size_t edge = 0; edge < edge_count; ++edge) {
+      const int slot = next[from[edge]]++;
+      result.m_targets[slot] = to[edge];
+      result.m_source_edges[slot] = edge_ids.empty() ? static_cast<int>(edge) : edge_ids[edge];
+      for (int strategy = 0; strategy < strategy_count; ++strategy) {
+         result.m_costs[strategy * edge_count + slot] = costs[edge * strategy_count + strategy];
+      }
+   }
+   return result;
+}
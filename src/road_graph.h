@@ -0,0 +1,82 @@
+#ifndef _ROAD_GRAPH_H_
+#define _ROAD_GRAPH_H_
+
+#include <cstddef>
+#include <vector>
+
+class QgsGraph;
+
+/// @brief A directed graph in compressed sparse row layout.
+///
+/// QgsGraph keeps its vertices and edges in hash maps, and every edge stores its costs as
+/// QVariants. RoadGraph holds the outgoing edges of vertex v at [first_edge(v),
+/// first_edge(v + 1)) of flat target and cost arrays, with one contiguous double array per
+/// strategy, so searches touch neither hash maps nor QVariants.
+class RoadGraph
+{
+public:
+   RoadGraph() = default;
+
+   /// @brief Converts a graph built by QgsGraphBuilder.
+   ///
+   /// Vertex indices are the QgsGraph vertex indices. Indices of removed vertices stay
+   /// unused, without edges. Null and non numeric costs become 0, like QVariant::toDouble().
+   static RoadGraph from_qgs_graph(const QgsGraph& graph);
+
+   /// @brief Builds a graph from an edge list.
+   /// @param vertex_count Number of vertices, edges refer to [0, vertex_count).
+   /// @param from, to Start and end vertex of every edge.
+   /// @param costs Costs of every edge, strategy_count values per edge.
+   /// @param strategy_count Number of costs per edge.
+   /// @param edge_ids Identifier of every edge reported by source_edge(), empty for the edge list index.
+   static RoadGraph from_edges(int vertex_count, const std::vector<int>& from, const std::vector<int>& to,
+                               const std::vector<double>& costs, int strategy_count,
+                               const std::vector<int>& edge_ids = std::vector<int>());
+
+   int vertex_count() const {
+      return static_cast<int>(m_offsets.size()) - 1;
+   }
+
+   int edge_count() const {
+      return static_cast<int>(m_targets.size());
+   }
+
+   int strategy_count() const {
+      return m_strategy_count;
+   }
+
+   /// Index of the first outgoing edge of a vertex, first_edge(vertex_count()) is edge_count().
+   int first_edge(int vertex) const {
+      return m_offsets[vertex];
+   }
+
+   /// End vertex of an edge.
+   int target(int edge) const {
+      return m_targets[edge];
+   }
+
+   /// Costs of all edges for one strategy, indexed by edge.
+   const double* costs(int strategy) const {
+      return m_costs.data() + static_cast<std::size_t>(strategy) * m_targets.size();
+   }
+
+   /// Index of the edge in the QgsGraph or edge list the graph was built from.
+   int source_edge(int edge) const {
+      return m_source_edges[edge];
+   }
+
+   /// Vertex coordinates, x and y interleaved, empty if the graph was built from an edge list.
+   const std::vector<double>& coordinates() const {
+      return m_coordinates;
+   }
+
+private:
+   std::vector<int> m_offsets = {0};
+   std::vector<int> m_targets;
+   std::vector<double> m_costs;
+   std::vector<int> m_source_edges;
+   std::vector<double> m_coordinates;
+   int m_strategy_count = 0;
+};
+
+#endif
@@ -0,0 +1,390 @@
+#include "road_hierarchy.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
+
+namespace {
+
+constexpr double s_infinity = std::numeric_limits<double>::infinity();
+
+/// An edge of the graph during contraction, middle is the bypassed vertex of a shortcut or -1.
+struct Arc {
+   int node;
+   double cost;
+   int middle;
+};
+
+using HeapEntry = std::pair<double, int>;
+const auto s_heap_order = std::greater<HeapEntry>();
+
+/// The remaining graph while the vertices are contracted.
+class Contractor
+{
+public:
+   Contractor(const RoadGraph& graph, int strategy, const HierarchySettings& settings)
+      : m_settings(settings),
+        m_out(graph.vertex_count()),
+        m_in(graph.vertex_count()),
+        m_deleted_neighbours(graph.vertex_count(), 0),
+        m_witness_costs(graph.vertex_count()),
+        m_witness_run_of(graph.vertex_count(), 0) {
+      const double* costs = graph.costs(strategy);
+      for (int vertex = 0; vertex < graph.vertex_count(); ++vertex) {
+         for (int edge = graph.first_edge(vertex); edge < graph.first_edge(vertex + 1); ++edge) {
+            if (graph.target(edge) != vertex) {
+               add_arc(vertex, graph.target(edge), costs[edge], -1);
+            }
+         }
+      }
+   }
+
+   /// Edge difference of contracting a vertex plus its contracted neighbours, lower is contracted first.
+   int priority(int vertex) {
+      const int shortcuts = contract(vertex, true);
+      return shortcuts - static_cast<int>(m_in[vertex].size() + m_out[vertex].size()) + m_deleted_neighbours[vertex];
+   }
+
+   /// @brief Contracts a vertex and removes it from the remaining graph.
+   /// @param up Receives the edges from the vertex to its remaining neighbours.
+   /// @param down Receives the edges from the remaining neighbours to the vertex.
+   void contract(int vertex, std::vector<Arc>& up, std::vector<Arc>& down) {
+      contract(vertex, false);
+      up = std::move(m_out[vertex]);
+      down = std::move(m_in[vertex]);
+      for (const Arc& arc : up) {
+         erase_arc(m_in[arc.node], vertex);
+         ++m_deleted_neighbours[arc.node];
+      }
+      for (const Arc& arc : down) {
+         erase_arc(m_out[arc.node], vertex);
+         ++m_deleted_neighbours[arc.node];
+      }
+      m_out[vertex] = {};
+      m_in[vertex] = {};
+   }
+
+private:
+   /// Adds the needed shortcuts around a vertex, or only counts them when simulating.
+   int contract(int vertex, bool simulate) {
+      int shortcut_count = 0;
+      m_shortcuts.clear();
+      for (const Arc& in_arc : m_in[vertex]) {
+         double max_out_cost = -1.0;
+         for (const Arc& out_arc : m_out[vertex]) {
+            if (out_arc.node != in_arc.node) {
+               max_out_cost = std::max(max_out_cost, out_arc.cost);
+            }
+         }
+         if (max_out_cost < 0.0) {
+            continue;
+         }
+         witness_search(in_arc.node, vertex, in_arc.cost + max_out_cost);
+         for (const Arc& out_arc : m_out[vertex]) {
+            const double via_cost = in_arc.cost + out_arc.cost;
+            if (out_arc.node == in_arc.node || witness_cost(out_arc.node) <= via_cost) {
+               continue;
+            }
+            ++shortcut_count;
+            if (!simulate) {
+               m_shortcuts.push_back({in_arc.node, out_arc.node, via_cost});
+            }
+         }
+      }
+      for (const Shortcut& shortcut : m_shortcuts) {
+         add_arc(shortcut.from, shortcut.to, shortcut.cost, vertex);
+      }
+      return shortcut_count;
+   }
+
+   /// Dijkstra search from source avoiding excluded, bounded by a cost and a settle limit.
+   void witness_search(int source, int excluded, double max_cost) {
+      if (++m_witness_run == 0) {
+         std::fill(m_witness_run_of.begin(), m_witness_run_of.end(), 0);
+         m_witness_run = 1;
+      }
+      m_heap.clear();
+      m_witness_run_of[source] = m_witness_run;
+      m_witness_costs[source] = 0.0;
+      m_heap.emplace_back(0.0, source);
+      int settled = 0;
+      while (!m_heap.empty()) {
+         std::pop_heap(m_heap.begin(), m_heap.end(), s_heap_order);
+         const auto [cost, vertex] = m_heap.back();
+         m_heap.pop_back();
+         if (cost > m_witness_costs[vertex]) {
+            continue;
+         }
+         if (cost > max_cost || ++settled > m_settings.witness_settle_limit) {
+            break;
+         }
+         for (const Arc& arc : m_out[vertex]) {
+            if (arc.node == excluded) {
+               continue;
+            }
+            const double target_cost = cost + arc.cost;
+            if (m_witness_run_of[arc.node] == m_witness_run && m_witness_costs[arc.node] <= target_cost) {
+               continue;
+            }
+            m_witness_run_of[arc.node] = m_witness_run;
+            m_witness_costs[arc.node] = target_cost;
+            m_heap.emplace_back(target_cost, arc.node);
+            std::push_heap(m_heap.begin(), m_heap.end(), s_heap_order);
+         }
+      }
+   }
+
+   double witness_cost(int vertex) const {
+      return m_witness_run_of[vertex] == m_witness_run ? m_witness_costs[vertex] : s_infinity;
+   }
+
+   /// Adds an edge, or lowers the cost of an existing edge between the same vertices.
+   void add_arc(int from, int to, double cost, int middle) {
+      for (Arc& arc : m_out[from]) {
+         if (arc.node != to) {
+            continue;
+         }
+         if (cost < arc.cost) {
+            arc.cost = cost;
+            arc.middle = middle;
+            for (Arc& reverse : m_in[to]) {
+               if (reverse.node == from) {
+                  reverse.cost = cost;
+                  reverse.middle = middle;
+               }
+            }
+         }
+         return;
+      }
+      m_out[from].push_back({to, cost, middle});
+      m_in[to].push_back({from, cost, middle});
+   }
+
+   static void erase_arc(std::vector<Arc>& arcs, int node) {
+      arcs.erase(std::remove_if(arcs.begin(), arcs.end(), [node](const Arc& arc) { return arc.node == node; }), arcs.end());
+   }
+
+   struct Shortcut {
+      int from;
+      int to;
+      double cost;
+   };
+
+   const HierarchySettings& m_settings;
+   std::vector<std::vector<Arc>> m_out;
+   std::vector<std::vector<Arc>> m_in;
+   std::vector<int> m_deleted_neighbours;
+   std::vector<Shortcut> m_shortcuts;
+   std::vector<double> m_witness_costs;
+   std::vector<std::uint32_t> m_witness_run_of;
+   std::uint32_t m_witness_run = 0;
+   std::vector<HeapEntry> m_heap;
+};
+
+}
+
+ContractionHierarchy ContractionHierarchy::build(const RoadGraph& graph, int strategy, const HierarchySettings& settings) {
+   const int vertex_count = graph.vertex_count();
+   Contractor contractor(graph, strategy, settings);
+
+   // Contract in the order of the priorities, updated lazily: a popped vertex whose priority
+   // grew beyond the next one is put back instead of being contracted.
+   std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> queue;
+   for (int vertex = 0; vertex < vertex_count; ++vertex) {
+      queue.emplace(contractor.priority(vertex), vertex);
+   }
+
+   ContractionHierarchy result;
+   result.m_ranks.assign(vertex_count, -1);
+   result.m_vertices.reserve(vertex_count);
+   std::vector<std::vector<Arc>> up(vertex_count);
+   std::vector<std::vector<Arc>> down(vertex_count);
+   while (!queue.empty()) {
+      const int vertex = queue.top().second;
+      queue.pop();
+      if (result.m_ranks[vertex] >= 0) {
+         continue;
+      }
+      const int priority = contractor.priority(vertex);
+      if (!queue.empty() && priority > queue.top().first) {
+         queue.emplace(priority, vertex);
+         continue;
+      }
+      contractor.contract(vertex, up[vertex], down[vertex]);
+      result.m_ranks[vertex] = static_cast<int>(result.m_vertices.size());
+      result.m_vertices.push_back(vertex);
+   }
+
+   // Store the edges in rank order, with ranks instead of vertices.
+   for (int rank = 0; rank < vertex_count; ++rank) {
+      const int vertex = result.m_vertices[rank];
+      for (const Arc& arc : up[vertex]) {
+         result.m_up_targets.push_back(result.m_ranks[arc.node]);
+         result.m_up_costs.push_back(arc.cost);
+         result.m_up_middles.push_back(arc.middle >= 0 ? result.m_ranks[arc.middle] : -1);
+      }
+      for (const Arc& arc : down[vertex]) {
+         result.m_down_sources.push_back(result.m_ranks[arc.node]);
+         result.m_down_costs.push_back(arc.cost);
+         result.m_down_middles.push_back(arc.middle >= 0 ? result.m_ranks[arc.middle] : -1);
+      }
+      result.m_up_offsets.push_back(static_cast<int>(result.m_up_targets.size()));
+      result.m_down_offsets.push_back(static_cast<int>(result.m_down_sources.size()));
+      up[vertex] = {};
+      down[vertex] = {};
+   }
+   return result;
+}
+
+HierarchyQuery::HierarchyQuery(const ContractionHierarchy& hierarchy) : m_hierarchy(hierarchy) {
+   const int vertex_count = hierarchy.vertex_count();
+   for (Direction* direction : {&m_forward, &m_backward}) {
+      direction->costs.resize(vertex_count);
+      direction->parents.resize(vertex_count);
+      direction->middles.resize(vertex_count);
+      direction->run_of.assign(vertex_count, 0);
+   }
+}
+
+void HierarchyQuery::start_run() {
+   if (++m_run == 0) {
+      std::fill(m_forward.run_of.begin(), m_forward.run_of.end(), 0);
+      std::fill(m_backward.run_of.begin(), m_backward.run_of.end(), 0);
+      m_run = 1;
+   }
+   m_forward.heap.clear();
+   m_backward.heap.clear();
+}
+
+void HierarchyQuery::relax(Direction& direction, int rank, double cost, int parent, int middle) {
+   if (direction.run_of[rank] == m_run && direction.costs[rank] <= cost) {
+      return;
+   }
+   direction.run_of[rank] = m_run;
+   direction.costs[rank] = cost;
+   direction.parents[rank] = parent;
+   direction.middles[rank] = middle;
+   direction.heap.emplace_back(cost, rank);
+   std::push_heap(direction.heap.begin(), direction.heap.end(), s_heap_order);
+}
+
+double HierarchyQuery::cost(const Direction& direction, int rank) const {
+   return direction.run_of[rank] == m_run ? direction.costs[rank] : s_infinity;
+}
+
+double HierarchyQuery::shortest_path(int source, int target, std::vector<int>* path) {
+   if (path) {
+      path->clear();
+   }
+   const ContractionHierarchy& h = m_hierarchy;
+   start_run();
+   relax(m_forward, h.m_ranks[source], 0.0, -1, -1);
+   relax(m_backward, h.m_ranks[target], 0.0, -1, -1);
+
+   double best = s_infinity;
+   int meeting = -1;
+   while (!m_forward.heap.empty() || !m_backward.heap.empty()) {
+      const bool forward = m_backward.heap.empty()
+                           || (!m_forward.heap.empty() && m_forward.heap.front().first <= m_backward.heap.front().first);
+      Direction& direction = forward ? m_forward : m_backward;
+      std::pop_heap(direction.heap.begin(), direction.heap.end(), s_heap_order);
+      const auto [rank_cost, rank] = direction.heap.back();
+      direction.heap.pop_back();
+      if (rank_cost > direction.costs[rank]) {
+         continue;
+      }
+      if (rank_cost >= best) {
+         // Nothing this direction still has to settle can improve the path.
+         direction.heap.clear();
+         continue;
+      }
+      const double total = rank_cost + cost(forward ? m_backward : m_forward, rank);
+      if (total < best) {
+         best = total;
+         meeting = rank;
+      }
+      if (forward) {
+         for (int edge = h.m_up_offsets[rank]; edge < h.m_up_offsets[rank + 1]; ++edge) {
+            relax(m_forward, h.m_up_targets[edge], rank_cost + h.m_up_costs[edge], rank, h.m_up_middles[edge]);
+         }
+      } else {
+         for (int edge = h.m_down_offsets[rank]; edge < h.m_down_offsets[rank + 1]; ++edge) {
+            relax(m_backward, h.m_down_sources[edge], rank_cost + h.m_down_costs[edge], rank, h.m_down_middles[edge]);
+         }
+      }
+   }
+
+   if (path && meeting >= 0) {
+      // Walk the forward tree from the meeting vertex back to the source, then unpack both halves.
+      std::vector<int> ranks;
+      for (int rank = meeting; rank >= 0; rank = m_forward.parents[rank]) {
+         ranks.push_back(rank);
+      }
+      std::reverse(ranks.begin(), ranks.end());
+      path->push_back(h.m_vertices[ranks.front()]);
+      for (std::size_t i = 1; i < ranks.size(); ++i) {
+         unpack(ranks[i - 1], ranks[i], m_forward.middles[ranks[i]], *path);
+      }
+      for (int rank = meeting; m_backward.parents[rank] >= 0; rank = m_backward.parents[rank]) {
+         unpack(rank, m_backward.parents[rank], m_backward.middles[rank], *path);
+      }
+   }
+   return best;
+}
+
+void HierarchyQuery::unpack(int from, int to, int middle, std::vector<int>& path) const {
+   const ContractionHierarchy& h = m_hierarchy;
+   if (middle < 0) {
+      path.push_back(h.m_vertices[to]);
+      return;
+   }
+   // The shortcut from -> to bypasses middle, which is ranked below both: from -> middle is a
+   // downward edge into middle and middle -> to an upward edge out of it.
+   for (int edge = h.m_down_offsets[middle]; edge < h.m_down_offsets[middle + 1]; ++edge) {
+      if (h.m_down_sources[edge] == from) {
+         unpack(from, middle, h.m_down_middles[edge], path);
+         break;
+      }
+   }
+   for (int edge = h.m_up_offsets[middle]; edge < h.m_up_offsets[middle + 1]; ++edge) {
+      if (h.m_up_targets[edge] == to) {
+         unpack(middle, to, h.m_up_middles[edge], path);
+         break;
+      }
+   }
+}
+
+void HierarchyQuery::all_costs(const std::vector<int>& sources, std::vector<double>& costs) {
+   const ContractionHierarchy& h = m_hierarchy;
+   const int vertex_count = h.vertex_count();
+   start_run();
+   for (int source : sources) {
+      relax(m_forward, h.m_ranks[source], 0.0, -1, -1);
+   }
+   while (!m_forward.heap.empty()) {
+      std::pop_heap(m_forward.heap.begin(), m_forward.heap.end(), s_heap_order);
+      const auto [rank_cost, rank] = m_forward.heap.back();
+      m_forward.heap.pop_back();
+      if (rank_cost > m_forward.costs[rank]) {
+         continue;
+      }
+      for (int edge = h.m_up_offsets[rank]; edge < h.m_up_offsets[rank + 1]; ++edge) {
+         relax(m_forward, h.m_up_targets[edge], rank_cost + h.m_up_costs[edge], rank, h.m_up_middles[edge]);
+      }
+   }
+
+   // Downward edges into a rank come from higher ranks, which the sweep has already finished.
+   m_sweep.resize(vertex_count);
+   for (int rank = vertex_count - 1; rank >= 0; --rank) {
+      double best = cost(m_forward, rank);
+      for (int edge = h.m_down_offsets[rank]; edge < h.m_down_offsets[rank + 1]; ++edge) {
+         best = std::min(best, m_sweep[h.m_down_sources[edge]] + h.m_down_costs[edge]);
+      }
+      m_sweep[rank] = best;
+   }
+   costs.resize(vertex_count);
+   for (int rank = 0; rank < vertex_count; ++rank) {
+      costs[h.m_vertices[rank]] = m_sweep[rank];
+   }
+}
@@ -0,0 +1,115 @@
+#ifndef _ROAD_HIERARCHY_H_
+#define _ROAD_HIERARCHY_H_
+
+#include "road_graph.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/// @brief Settings of the contraction hierarchy preprocessing.
+struct HierarchySettings {
+   /// Vertices a witness search may settle before a shortcut is added anyway.
+   int witness_settle_limit = 500;
+};
+
+/// @brief Contraction hierarchy of a RoadGraph for one cost strategy.
+///
+/// Vertices are contracted one by one in the order of their edge difference. Contracting a
+/// vertex adds a shortcut between two of its neighbours whenever no witness path avoiding it
+/// is as cheap. Every edge of the result then leads from a lower to a higher ranked vertex or
+/// the other way round, and a cheapest path climbs up to a top vertex and descends from there.
+/// Queries only search the upward edges from both ends, which settles a tiny part of the
+/// graph. The hierarchy is stored in rank order, so the edges of neighbouring ranks are
+/// adjacent in memory. It is immutable and can be shared by threads, each running its own
+/// HierarchyQuery.
+class ContractionHierarchy
+{
+public:
+   /// @brief Preprocesses a graph.
+   /// @param graph The graph to contract.
+   /// @param strategy Index of the edge cost the hierarchy minimizes.
+   /// @param settings The preprocessing options.
+   static ContractionHierarchy build(const RoadGraph& graph, int strategy, const HierarchySettings& settings = HierarchySettings());
+
+   int vertex_count() const {
+      return static_cast<int>(m_vertices.size());
+   }
+
+   /// Number of upward and downward edges, including the shortcuts.
+   int edge_count() const {
+      return static_cast<int>(m_up_targets.size() + m_down_sources.size());
+   }
+
+   /// Position of a vertex in the contraction order.
+   int rank(int vertex) const {
+      return m_ranks[vertex];
+   }
+
+private:
+   friend class HierarchyQuery;
+
+   /// Vertex of every rank.
+   std::vector<int> m_vertices;
+   /// Rank of every vertex.
+   std::vector<int> m_ranks;
+   /// Edges from rank r to higher ranks at [m_up_offsets[r], m_up_offsets[r + 1]).
+   std::vector<int> m_up_offsets = {0};
+   std::vector<int> m_up_targets;
+   std::vector<double> m_up_costs;
+   /// Rank of the contracted vertex a shortcut bypasses, -1 for graph edges.
+   std::vector<int> m_up_middles;
+   /// Edges into rank r from higher ranks at [m_down_offsets[r], m_down_offsets[r + 1]).
+   std::vector<int> m_down_offsets = {0};
+   std::vector<int> m_down_sources;
+   std::vector<double> m_down_costs;
+   std::vector<int> m_down_middles;
+};
+
+/// @brief Query state for a ContractionHierarchy, one per thread.
+class HierarchyQuery
+{
+public:
+   /// @brief Constructor.
+   /// @param hierarchy The hierarchy to query, must outlive the query.
+   explicit HierarchyQuery(const ContractionHierarchy& hierarchy);
+
+   /// @brief Computes the cheapest path between two vertices.
+   ///
+   /// Runs a bidirectional search on the upward edges and unpacks the shortcuts of the result.
+   /// @param path If set, receives the graph vertices of the path from source to target.
+   /// @return The path cost, infinity if target cannot be reached.
+   double shortest_path(int source, int target, std::vector<int>* path = nullptr);
+
+   /// @brief Computes the cost from the nearest source to every vertex.
+   ///
+   /// Searches the upward edges from the sources and then relaxes the downward edges of all
+   /// ranks from the top down, in one linear sweep over the hierarchy (PHAST). Service areas
+   /// are the vertices whose cost lies within the limit.
+   /// @param costs Receives the cost of every graph vertex, infinity if not reachable.
+   void all_costs(const std::vector<int>& sources, std::vector<double>& costs);
+
+private:
+   /// Search state of one direction, indexed by rank.
+   struct Direction {
+      std::vector<double> costs;
+      std::vector<int> parents;
+      std::vector<int> middles;
+      std::vector<std::uint32_t> run_of;
+      std::vector<std::pair<double, int>> heap;
+   };
+
+   void start_run();
+   void relax(Direction& direction, int rank, double cost, int parent, int middle);
+   double cost(const Direction& direction, int rank) const;
+   /// Appends the vertices of the edge from rank from to rank to after from, unpacking shortcuts.
+   void unpack(int from, int to, int middle, std::vector<int>& path) const;
+
+   const ContractionHierarchy& m_hierarchy;
+   Direction m_forward;
+   Direction m_backward;
+   std::vector<double> m_sweep;
+   std::uint32_t m_run = 0;
+};
+
+#endif
@@ -0,0 +1,488 @@
+#include "snap_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SNAP_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#ifdef SNAP_SIMD_X86
+/* MSVC emits any intrinsic without compiler flags, GCC and Clang need the target per function. */
+#if defined(__GNUC__) || defined(__clang__)
+#define SNAP_TARGET_SSE42 __attribute__((target("sse4.2")))
+#define SNAP_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SNAP_TARGET_SSE42
+#define SNAP_TARGET_AVX2
+#endif
+#endif
+
+namespace {
+
+/// Coordinate arrays of the segments of a scan.
+struct Segments {
+   const double* ax;
+   const double* ay;
+   const double* bx;
+   const double* by;
+};
+
+/// @brief Squared distance of a point to a segment.
+/// @param position Receives the position of the nearest point along the segment, from 0 to 1.
+inline double segment_distance(double ax, double ay, double bx, double by, double x, double y, double& position) {
+   const double ex = bx - ax;
+   const double ey = by - ay;
+   const double length = ex * ex + ey * ey;
+   double t = length > 0.0 ? ((x - ax) * ex + (y - ay) * ey) / length : 0.0;
+   t = std::min(std::max(t, 0.0), 1.0);
+   position = t;
+   const double dx = ax + t * ex - x;
+   const double dy = ay + t * ey - y;
+   return dx * dx + dy * dy;
+}
+
+// The scans keep the smallest squared distance below best and its index. Of equal distances
+// the lowest index wins, in the vector kernels too.
+
+void nearest_vertex_scalar(const double* xs, const double* ys, std::size_t first, std::size_t end, double x, double y,
+                           double& best, std::ptrdiff_t& best_index) {
+   for (std::size_t i = first; i < end; ++i) {
+      const double dx = xs[i] - x;
+      const double dy = ys[i] - y;
+      const double distance = dx * dx + dy * dy;
+      if (distance < best) {
+         best = distance;
+         best_index = static_cast<std::ptrdiff_t>(i);
+      }
+   }
+}
+
+void nearest_segment_scalar(const Segments& s, std::size_t first, std::size_t end, double x, double y, double& best,
+                            std::ptrdiff_t& best_index) {
+   for (std::size_t i = first; i < end; ++i) {
+      double position;
+      const double distance = segment_distance(s.ax[i], s.ay[i], s.bx[i], s.by[i], x, y, position);
+      if (distance < best) {
+         best = distance;
+         best_index = static_cast<std::ptrdiff_t>(i);
+      }
+   }
+}
+
+/// Merges the per lane minima of a vector kernel into best.
+void reduce_lanes(const double* distances, const double* indices, int lanes, double& best, std::ptrdiff_t& best_index) {
+   for (int lane = 0; lane < lanes; ++lane) {
+      if (indices[lane] < 0.0) {
+         continue;
+      }
+      const std::ptrdiff_t index = static_cast<std::ptrdiff_t>(indices[lane]);
+      if (distances[lane] < best || (distances[lane] == best && index < best_index)) {
+         best = distances[lane];
+         best_index = index;
+      }
+   }
+}
+
+#ifdef SNAP_SIMD_X86
+
+// SSE4.2: two candidates per iteration, every lane keeps its own minimum and index.
+
+SNAP_TARGET_SSE42 void nearest_vertex_sse(const double* xs, const double* ys, std::size_t first, std::size_t end,
+                                          double x, double y, double& best, std::ptrdiff_t& best_index) {
+   const __m128d px = _mm_set1_pd(x);
+   const __m128d py = _mm_set1_pd(y);
+   __m128d lane_best = _mm_set1_pd(best);
+   __m128d lane_index = _mm_set1_pd(-1.0);
+   __m128d index = _mm_setr_pd(static_cast<double>(first), static_cast<double>(first + 1));
+   const __m128d step = _mm_set1_pd(2.0);
+   std::size_t i = first;
+   for (; i + 2 <= end; i += 2) {
+      const __m128d dx = _mm_sub_pd(_mm_loadu_pd(xs + i), px);
+      const __m128d dy = _mm_sub_pd(_mm_loadu_pd(ys + i), py);
+      const __m128d distance = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+      const __m128d closer = _mm_cmplt_pd(distance, lane_best);
+      lane_best = _mm_blendv_pd(lane_best, distance, closer);
+      lane_index = _mm_blendv_pd(lane_index, index, closer);
+      index = _mm_add_pd(index, step);
+   }
+   double distances[2];
+   double indices[2];
+   _mm_storeu_pd(distances, lane_best);
+   _mm_storeu_pd(indices, lane_index);
+   reduce_lanes(distances, indices, 2, best, best_index);
+   nearest_vertex_scalar(xs, ys, i, end, x, y, best, best_index);
+}
+
+SNAP_TARGET_SSE42 void nearest_segment_sse(const Segments& s, std::size_t first, std::size_t end, double x, double y,
+                                           double& best, std::ptrdiff_t& best_index) {
+   const __m128d px = _mm_set1_pd(x);
+   const __m128d py = _mm_set1_pd(y);
+   const __m128d zero = _mm_setzero_pd();
+   const __m128d one = _mm_set1_pd(1.0);
+   __m128d lane_best = _mm_set1_pd(best);
+   __m128d lane_index = _mm_set1_pd(-1.0);
+   __m128d index = _mm_setr_pd(static_cast<double>(first), static_cast<double>(first + 1));
+   const __m128d step = _mm_set1_pd(2.0);
+   std::size_t i = first;
+   for (; i + 2 <= end; i += 2) {
+      const __m128d ax = _mm_loadu_pd(s.ax + i);
+      const __m128d ay = _mm_loadu_pd(s.ay + i);
+      const __m128d ex = _mm_sub_pd(_mm_loadu_pd(s.bx + i), ax);
+      const __m128d ey = _mm_sub_pd(_mm_loadu_pd(s.by + i), ay);
+      const __m128d length = _mm_add_pd(_mm_mul_pd(ex, ex), _mm_mul_pd(ey, ey));
+      const __m128d dot = _mm_add_pd(_mm_mul_pd(_mm_sub_pd(px, ax), ex), _mm_mul_pd(_mm_sub_pd(py, ay), ey));
+      __m128d t = _mm_blendv_pd(_mm_div_pd(dot, length), zero, _mm_cmple_pd(length, zero));
+      t = _mm_min_pd(_mm_max_pd(t, zero), one);
+      const __m128d dx = _mm_sub_pd(_mm_add_pd(ax, _mm_mul_pd(t, ex)), px);
+      const __m128d dy = _mm_sub_pd(_mm_add_pd(ay, _mm_mul_pd(t, ey)), py);
+      const __m128d distance = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+      const __m128d closer = _mm_cmplt_pd(distance, lane_best);
+      lane_best = _mm_blendv_pd(lane_best, distance, closer);
+      lane_index = _mm_blendv_pd(lane_index, index, closer);
+      index = _mm_add_pd(index, step);
+   }
+   double distances[2];
+   double indices[2];
+   _mm_storeu_pd(distances, lane_best);
+   _mm_storeu_pd(indices, lane_index);
+   reduce_lanes(distances, indices, 2, best, best_index);
+   nearest_segment_scalar(s, i, end, x, y, best, best_index);
+}
+
+// AVX2: four candidates per iteration.
+
+SNAP_TARGET_AVX2 void nearest_vertex_avx2(const double* xs, const double* ys, std::size_t first, std::size_t end,
+                                          double x, double y, double& best, std::ptrdiff_t& best_index) {
+   const __m256d px = _mm256_set1_pd(x);
+   const __m256d py = _mm256_set1_pd(y);
+   __m256d lane_best = _mm256_set1_pd(best);
+   __m256d lane_index = _mm256_set1_pd(-1.0);
+   __m256d index = _mm256_setr_pd(static_cast<double>(first), static_cast<double>(first + 1),
+                                  static_cast<double>(first + 2), static_cast<double>(first + 3));
+   const __m256d step = _mm256_set1_pd(4.0);
+   std::size_t i = first;
+   for (; i + 4 <= end; i += 4) {
+      const __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(xs + i), px);
+      const __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(ys + i), py);
+      const __m256d distance = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+      const __m256d closer = _mm256_cmp_pd(distance, lane_best, _CMP_LT_OQ);
+      lane_best = _mm256_blendv_pd(lane_best, distance, closer);
+      lane_index = _mm256_blendv_pd(lane_index, index, closer);
+      index = _mm256_add_pd(index, step);
+   }
+   double distances[4];
+   double indices[4];
+   _mm256_storeu_pd(distances, lane_best);
+   _mm256_storeu_pd(indices, lane_index);
+   reduce_lanes(distances, indices, 4, best, best_index);
+   nearest_vertex_scalar(xs, ys, i, end, x, y, best, best_index);
+}
+
+SNAP_TARGET_AVX2 void nearest_segment_avx2(const Segments& s, std::size_t first, std::size_t end, double x, double y,
+                                           double& best, std::ptrdiff_t& best_index) {
+   const __m256d px = _mm256_set1_pd(x);
+   const __m256d py = _mm256_set1_pd(y);
+   const __m256d zero = _mm256_setzero_pd();
+   const __m256d one = _mm256_set1_pd(1.0);
+   __m256d lane_best = _mm256_set1_pd(best);
+   __m256d lane_index = _mm256_set1_pd(-1.0);
+   __m256d index = _mm256_setr_pd(static_cast<double>(first), static_cast<double>(first + 1),
+                                  static_cast<double>(first + 2), static_cast<double>(first + 3));
+   const __m256d step = _mm256_set1_pd(4.0);
+   std::size_t i = first;
+   for (; i + 4 <= end; i += 4) {
+      const __m256d ax = _mm256_loadu_pd(s.ax + i);
+      const __m256d ay = _mm256_loadu_pd(s.ay + i);
+      const __m256d ex = _mm256_sub_pd(_mm256_loadu_pd(s.bx + i), ax);
+      const __m256d ey = _mm256_sub_pd(_mm256_loadu_pd(s.by + i), ay);
+      const __m256d length = _mm256_add_pd(_mm256_mul_pd(ex, ex), _mm256_mul_pd(ey, ey));
+      const __m256d dot = _mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(px, ax), ex), _mm256_mul_pd(_mm256_sub_pd(py, ay), ey));
+      __m256d t = _mm256_blendv_pd(_mm256_div_pd(dot, length), zero, _mm256_cmp_pd(length, zero, _CMP_LE_OQ));
+      t = _mm256_min_pd(_mm256_max_pd(t, zero), one);
+      const __m256d dx = _mm256_sub_pd(_mm256_add_pd(ax, _mm256_mul_pd(t, ex)), px);
+      const __m256d dy = _mm256_sub_pd(_mm256_add_pd(ay, _mm256_mul_pd(t, ey)), py);
+      const __m256d distance = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+      const __m256d closer = _mm256_cmp_pd(distance, lane_best, _CMP_LT_OQ);
+      lane_best = _mm256_blendv_pd(lane_best, distance, closer);
+      lane_index = _mm256_blendv_pd(lane_index, index, closer);
+      index = _mm256_add_pd(index, step);
+   }
+   double distances[4];
+   double indices[4];
+   _mm256_storeu_pd(distances, lane_best);
+   _mm256_storeu_pd(indices, lane_index);
+   reduce_lanes(distances, indices, 4, best, best_index);
+   nearest_segment_scalar(s, i, end, x, y, best, best_index);
+}
+
+#endif
+
+void nearest_vertex_range(SimdLevel level, const double* xs, const double* ys, std::size_t first, std::size_t end,
+                          double x, double y, double& best, std::ptrdiff_t& best_index) {
+   switch (level) {
+#ifdef SNAP_SIMD_X86
+   case SimdLevel::Avx2:
+      nearest_vertex_avx2(xs, ys, first, end, x, y, best, best_index);
+      return;
+   case SimdLevel::Sse42:
+      nearest_vertex_sse(xs, ys, first, end, x, y, best, best_index);
+      return;
+#endif
+   default:
+      nearest_vertex_scalar(xs, ys, first, end, x, y, best, best_index);
+      return;
+   }
+}
+
+void nearest_segment_range(SimdLevel level, const Segments& s, std::size_t first, std::size_t end, double x, double y,
+                           double& best, std::ptrdiff_t& best_index) {
+   switch (level) {
+#ifdef SNAP_SIMD_X86
+   case SimdLevel::Avx2:
+      nearest_segment_avx2(s, first, end, x, y, best, best_index);
+      return;
+   case SimdLevel::Sse42:
+      nearest_segment_sse(s, first, end, x, y, best, best_index);
+      return;
+#endif
+   default:
+      nearest_segment_scalar(s, first, end, x, y, best, best_index);
+      return;
+   }
+}
+
+}
+
+void SnapIndex::add_vertex(double x, double y) {
+   m_vertex_x.push_back(x);
+   m_vertex_y.push_back(y);
+}
+
+void SnapIndex::add_segment(double ax, double ay, double bx, double by) {
+   m_segment_ax.push_back(ax);
+   m_segment_ay.push_back(ay);
+   m_segment_bx.push_back(bx);
+   m_segment_by.push_back(by);
+}
+
+void SnapIndex::finish(double tolerance) {
+   m_tolerance = std::max(0.0, tolerance);
+   m_vertex_count = m_vertex_x.size();
+   m_segment_count = m_segment_ax.size();
+   m_columns = 0;
+   m_rows = 0;
+   m_vertex_starts.clear();
+   m_segment_starts.clear();
+
+   double min_x = std::numeric_limits<double>::infinity();
+   double min_y = min_x;
+   double max_x = -min_x;
+   double max_y = -min_x;
+   for (std::size_t i = 0; i < m_vertex_count; ++i) {
+      min_x = std::min(min_x, m_vertex_x[i]);
+      min_y = std::min(min_y, m_vertex_y[i]);
+      max_x = std::max(max_x, m_vertex_x[i]);
+      max_y = std::max(max_y, m_vertex_y[i]);
+   }
+   double segment_extent = 0.0;
+   for (std::size_t i = 0; i < m_segment_count; ++i) {
+      min_x = std::min({min_x, m_segment_ax[i], m_segment_bx[i]});
+      min_y = std::min({min_y, m_segment_ay[i], m_segment_by[i]});
+      max_x = std::max({max_x, m_segment_ax[i], m_segment_bx[i]});
+      max_y = std::max({max_y, m_segment_ay[i], m_segment_by[i]});
+      segment_extent += std::max(std::abs(m_segment_bx[i] - m_segment_ax[i]), std::abs(m_segment_by[i] - m_segment_ay[i]));
+   }
+   const std::size_t item_count = m_vertex_count + m_segment_count;
+   if (item_count == 0) {
+      return;
+   }
+
+   // Cells at least a tolerance wide, so a point query covers at most three rows of three cells,
+   // and about as wide as the average segment, so a segment overlaps few cells. The grid has at
+   // most a few cells per item.
+   const double width = max_x - min_x;
+   const double height = max_y - min_y;
+   double cell_size = std::max(m_tolerance, m_segment_count > 0 ? segment_extent / static_cast<double>(m_segment_count) : 0.0);
+   if (!(cell_size > 0.0)) {
+      cell_size = std::max(width, height) / std::sqrt(static_cast<double>(item_count));
+   }
+   if (!(cell_size > 0.0)) {
+      cell_size = 1.0;
+   }
+   const double max_cells = 4.0 * static_cast<double>(item_count) + 16.0;
+   while ((std::floor(width / cell_size) + 1.0) * (std::floor(height / cell_size) + 1.0) > max_cells) {
+      cell_size *= 2.0;
+   }
+   m_cell_size = cell_size;
+   m_origin_x = min_x;
+   m_origin_y = min_y;
+   m_columns = static_cast<int>(std::floor(width / cell_size)) + 1;
+   m_rows = static_cast<int>(std::floor(height / cell_size)) + 1;
+   const std::size_t cell_count = static_cast<std::size_t>(m_columns) * m_rows;
+
+   // Counting sort of the vertices by cell.
+   std::vector<std::size_t> vertex_cells(m_vertex_count);
+   m_vertex_starts.assign(cell_count + 1, 0);
+   for (std::size_t i = 0; i < m_vertex_count; ++i) {
+      vertex_cells[i] = static_cast<std::size_t>(row(m_vertex_y[i])) * m_columns + column(m_vertex_x[i]);
+      ++m_vertex_starts[vertex_cells[i] + 1];
+   }
+   for (std::size_t cell = 0; cell < cell_count; ++cell) {
+      m_vertex_starts[cell + 1] += m_vertex_starts[cell];
+   }
+   std::vector<std::size_t> next(m_vertex_starts.begin(), m_vertex_starts.end() - 1);
+   std::vector<double> sorted_x(m_vertex_count);
+   std::vector<double> sorted_y(m_vertex_count);
+   for (std::size_t i = 0; i < m_vertex_count; ++i) {
+      const std::size_t target = next[vertex_cells[i]]++;
+      sorted_x[target] = m_vertex_x[i];
+      sorted_y[target] = m_vertex_y[i];
+   }
+   m_vertex_x.swap(sorted_x);
+   m_vertex_y.swap(sorted_y);
+
+   // Segments are copied into every cell of their bounding box.
+   m_segment_starts.assign(cell_count + 1, 0);
+   std::vector<CellRange> segment_cells(m_segment_count);
+   for (std::size_t i = 0; i < m_segment_count; ++i) {
+      CellRange& range = segment_cells[i];
+      cells(std::min(m_segment_ax[i], m_segment_bx[i]), std::min(m_segment_ay[i], m_segment_by[i]),
+            std::max(m_segment_ax[i], m_segment_bx[i]), std::max(m_segment_ay[i], m_segment_by[i]), range);
+      for (int r = range.first_row; r <= range.last_row; ++r) {
+         for (int c = range.first_column; c <= range.last_column; ++c) {
+            ++m_segment_starts[static_cast<std::size_t>(r) * m_columns + c + 1];
+         }
+      }
+   }
+   for (std::size_t cell = 0; cell < cell_count; ++cell) {
+      m_segment_starts[cell + 1] += m_segment_starts[cell];
+   }
+   next.assign(m_segment_starts.begin(), m_segment_starts.end() - 1);
+   const std::size_t copies = m_segment_starts.back();
+   std::vector<double> ax(copies);
+   std::vector<double> ay(copies);
+   std::vector<double> bx(copies);
+   std::vector<double> by(copies);
+   for (std::size_t i = 0; i < m_segment_count; ++i) {
+      const CellRange& range = segment_cells[i];
+      for (int r = range.first_row; r <= range.last_row; ++r) {
+         for (int c = range.first_column; c <= range.last_column; ++c) {
+            const std::size_t target = next[static_cast<std::size_t>(r) * m_columns + c]++;
+            ax[target] = m_segment_ax[i];
+            ay[target] = m_segment_ay[i];
+            bx[target] = m_segment_bx[i];
+            by[target] = m_segment_by[i];
+         }
+      }
+   }
+   m_segment_ax.swap(ax);
+   m_segment_ay.swap(ay);
+   m_segment_bx.swap(bx);
+   m_segment_by.swap(by);
+}
+
+int SnapIndex::column(double x) const {
+   const double cell = std::floor((x - m_origin_x) / m_cell_size);
+   return static_cast<int>(std::min(std::max(cell, 0.0), static_cast<double>(m_columns - 1)));
+}
+
+int SnapIndex::row(double y) const {
+   const double cell = std::floor((y - m_origin_y) / m_cell_size);
+   return static_cast<int>(std::min(std::max(cell, 0.0), static_cast<double>(m_rows - 1)));
+}
+
+bool SnapIndex::cells(double xmin, double ymin, double xmax, double ymax, CellRange& range) const {
+   if (m_columns == 0 || xmax < m_origin_x || ymax < m_origin_y || xmin > m_origin_x + m_columns * m_cell_size
+       || ymin > m_origin_y + m_rows * m_cell_size) {
+      return false;
+   }
+   range.first_column = column(xmin);
+   range.last_column = column(xmax);
+   range.first_row = row(ymin);
+   range.last_row = row(ymax);
+   return true;
+}
+
+bool SnapIndex::nearest_vertex(SimdLevel level, double x, double y, double& snapped_x, double& snapped_y) const {
+   CellRange range;
+   if (m_vertex_count == 0 || !cells(x - m_tolerance, y - m_tolerance, x + m_tolerance, y + m_tolerance, range)) {
+      return false;
+   }
+   // Distances equal to the tolerance are accepted.
+   double best = std::nextafter(m_tolerance * m_tolerance, std::numeric_limits<double>::infinity());
+   std::ptrdiff_t best_index = -1;
+   for (int r = range.first_row; r <= range.last_row; ++r) {
+      const std::size_t row_start = static_cast<std::size_t>(r) * m_columns;
+      nearest_vertex_range(level, m_vertex_x.data(), m_vertex_y.data(), m_vertex_starts[row_start + range.first_column],
+                           m_vertex_starts[row_start + range.last_column + 1], x, y, best, best_index);
+   }
+   if (best_index < 0) {
+      return false;
+   }
+   snapped_x = m_vertex_x[best_index];
+   snapped_y = m_vertex_y[best_index];
+   return true;
+}
+
+bool SnapIndex::nearest_segment(SimdLevel level, double x, double y, double& snapped_x, double& snapped_y) const {
+   CellRange range;
+   if (m_segment_count == 0 || !cells(x - m_tolerance, y - m_tolerance, x + m_tolerance, y + m_tolerance, range)) {
+      return false;
+   }
+   const Segments segments{m_segment_ax.data(), m_segment_ay.data(), m_segment_bx.data(), m_segment_by.data()};
+   double best = std::nextafter(m_tolerance * m_tolerance, std::numeric_limits<double>::infinity());
+   std::ptrdiff_t best_index = -1;
+   for (int r = range.first_row; r <= range.last_row; ++r) {
+      const std::size_t row_start = static_cast<std::size_t>(r) * m_columns;
+      nearest_segment_range(level, segments, m_segment_starts[row_start + range.first_column],
+                            m_segment_starts[row_start + range.last_column + 1], x, y, best, best_index);
+   }
+   if (best_index < 0) {
+      return false;
+   }
+   const double ax = m_segment_ax[best_index];
+   const double ay = m_segment_ay[best_index];
+   const double bx = m_segment_bx[best_index];
+   const double by = m_segment_by[best_index];
+   double position;
+   segment_distance(ax, ay, bx, by, x, y, position);
+   snapped_x = ax + position * (bx - ax);
+   snapped_y = ay + position * (by - ay);
+   return true;
+}
+
+void SnapIndex::vertices_near_segment(double ax, double ay, double bx, double by, std::vector<SegmentVertex>& result) const {
+   result.clear();
+   CellRange range;
+   if (m_vertex_count == 0
+       || !cells(std::min(ax, bx) - m_tolerance, std::min(ay, by) - m_tolerance, std::max(ax, bx) + m_tolerance,
+                 std::max(ay, by) + m_tolerance, range)) {
+      return;
+   }
+   const double max_distance = m_tolerance * m_tolerance;
+   for (int r = range.first_row; r <= range.last_row; ++r) {
+      const std::size_t row_start = static_cast<std::size_t>(r) * m_columns;
+      const std::size_t end = m_vertex_starts[row_start + range.last_column + 1];
+      for (std::size_t i = m_vertex_starts[row_start + range.first_column]; i < end; ++i) {
+         const double x = m_vertex_x[i];
+         const double y = m_vertex_y[i];
+         double position;
+         if (segment_distance(ax, ay, bx, by, x, y, position) > max_distance || position <= 0.0 || position >= 1.0
+             || (x == ax && y == ay) || (x == bx && y == by)) {
+            continue;
+         }
+         result.push_back({position, x, y});
+      }
+   }
+   // Vertices shared by several reference features are inserted once.
+   std::sort(result.begin(), result.end(), [](const SegmentVertex& a, const SegmentVertex& b) {
+      return a.position != b.position ? a.position < b.position : a.x != b.x ? a.x < b.x : a.y < b.y;
+   });
+   result.erase(std::unique(result.begin(), result.end(),
+                            [](const SegmentVertex& a, const SegmentVertex& b) { return a.x == b.x && a.y == b.y; }),
+                result.end());
+}
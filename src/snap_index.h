@@ -0,0 +1,99 @@
+#ifndef _SNAP_INDEX_H_
+#define _SNAP_INDEX_H_
+
+#include "terrain_simd.h"
+
+#include <cstddef>
+#include <vector>
+
+/// @brief Static grid of the reference vertices and segments geometries are snapped to.
+///
+/// QgsGeometrySnapper looks up reference features in a QgsSpatialIndex and a feature cache
+/// behind mutexes, then builds a snap index per geometry. This index is built once: the
+/// vertices and segments are bucketed into a uniform grid of cells at least one tolerance
+/// wide and stored cell by cell, row-major, as separate coordinate arrays. The cells of a row
+/// are contiguous, so a query scans one contiguous range per grid row, at most three rows for
+/// a point, with AVX2 or SSE4.2 kernels. The index is immutable after finish(), so any number
+/// of threads can query it at the same time.
+class SnapIndex
+{
+public:
+   /// A reference vertex near a segment, with its position along the segment from 0 to 1.
+   struct SegmentVertex {
+      double position;
+      double x;
+      double y;
+   };
+
+   void add_vertex(double x, double y);
+
+   /// Adds a segment, which is indexed in every cell its bounding box overlaps.
+   void add_segment(double ax, double ay, double bx, double by);
+
+   /// @brief Builds the grid from the added vertices and segments.
+   /// @param tolerance The snapping distance, queries look this far around a location.
+   void finish(double tolerance);
+
+   std::size_t vertex_count() const {
+      return m_vertex_count;
+   }
+
+   std::size_t segment_count() const {
+      return m_segment_count;
+   }
+
+   /// @brief Finds the nearest vertex within the tolerance.
+   ///
+   /// Of vertices at the same distance the first one in grid order is returned, whatever the level.
+   /// @param snapped_x, snapped_y Receive the vertex.
+   /// @return False if there is no vertex within the tolerance.
+   bool nearest_vertex(SimdLevel level, double x, double y, double& snapped_x, double& snapped_y) const;
+
+   /// @brief Finds the nearest point on a segment within the tolerance.
+   /// @param snapped_x, snapped_y Receive the point on the segment.
+   /// @return False if there is no segment within the tolerance.
+   bool nearest_segment(SimdLevel level, double x, double y, double& snapped_x, double& snapped_y) const;
+
+   /// @brief Collects the vertices within the tolerance of a segment, strictly between its ends.
+   /// @param result Receives the vertices sorted by position along the segment.
+   void vertices_near_segment(double ax, double ay, double bx, double by, std::vector<SegmentVertex>& result) const;
+
+private:
+   /// Inclusive range of grid cells.
+   struct CellRange {
+      int first_column;
+      int last_column;
+      int first_row;
+      int last_row;
+   };
+
+   bool cells(double xmin, double ymin, double xmax, double ymax, CellRange& range) const;
+   int column(double x) const;
+   int row(double y) const;
+
+   double m_tolerance = 0.0;
+   double m_origin_x = 0.0;
+   double m_origin_y = 0.0;
+   double m_cell_size = 1.0;
+   int m_columns = 0;
+   int m_rows = 0;
+   std::size_t m_vertex_count = 0;
+   std::size_t m_segment_count = 0;
+
+   /// Vertex coordinates, in the order added until finish(), then sorted by cell.
+   std::vector<double> m_vertex_x;
+   std::vector<double> m_vertex_y;
+   /// First vertex of every cell and the end of the last one.
+   std::vector<std::size_t> m_vertex_starts;
+
+   /// Segment coordinates, in the order added until finish(), then copied into every cell the
+   /// segment overlaps.
+   std::vector<double> m_segment_ax;
+   std::vector<double> m_segment_ay;
+   std::vector<double> m_segment_bx;
+   std::vector<double> m_segment_by;
+   /// First segment of every cell and the end of the last one.
+   std::vector<std::size_t> m_segment_starts;
+};
+
+#endif
@@ -0,0 +1,277 @@
+#include "snapping_engine.h"
+#include "parallel_for.h"
+#include "reprojection_service.h"
+
+#include "qgsfeatureiterator.h"
+#include "qgsfeaturerequest.h"
+#include "qgsfeaturesink.h"
+#include "qgsfeaturesource.h"
+#include "qgsfeedback.h"
+#include "qgswkbtypes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+namespace {
+
+/// Number of features in a run handed to one worker at a time.
+constexpr std::size_t s_run_size = 64;
+
+enum class SnapState {
+   Unsnapped,
+   SnappedToVertex,
+   SnappedToSegment
+};
+
+bool is_end_point_mode(QgsGeometrySnapper::SnapMode mode) {
+   return mode == QgsGeometrySnapper::EndPointPreferNodes || mode == QgsGeometrySnapper::EndPointPreferClosest
+      || mode == QgsGeometrySnapper::EndPointToEndPoint;
+}
+
+bool prefers_vertices(QgsGeometrySnapper::SnapMode mode) {
+   return mode == QgsGeometrySnapper::PreferNodes || mode == QgsGeometrySnapper::PreferNodesNoExtraVertices
+      || mode == QgsGeometrySnapper::EndPointPreferNodes;
+}
+
+bool inserts_vertices(QgsGeometrySnapper::SnapMode mode) {
+   return mode == QgsGeometrySnapper::PreferNodes || mode == QgsGeometrySnapper::PreferClosest;
+}
+
+/// Number of vertices of a ring, without the closing vertex of polygon rings.
+int ring_size(const QgsPointSequence& points, bool polygon) {
+   const int count = points.size();
+   return polygon && count > 1 && points.front() == points.back() ? count - 1 : count;
+}
+
+void add_reference(const QgsGeometry& geometry, QgsGeometrySnapper::SnapMode mode, SnapIndex& index) {
+   const Qgis::GeometryType type = geometry.type();
+   const QgsCoordinateSequence sequence = geometry.constGet()->coordinateSequence();
+   for (const QgsRingSequence& part : sequence) {
+      for (const QgsPointSequence& points : part) {
+         if (points.isEmpty()) {
+            continue;
+         }
+         // Only the ends of lines are snapped to.
+         if (mode == QgsGeometrySnapper::EndPointToEndPoint) {
+            if (type == Qgis::GeometryType::Line) {
+               index.add_vertex(points.front().x(), points.front().y());
+               index.add_vertex(points.back().x(), points.back().y());
+            }
+            continue;
+         }
+         const int count = ring_size(points, type == Qgis::GeometryType::Polygon);
+         for (int i = 0; i < count; ++i) {
+            index.add_vertex(points[i].x(), points[i].y());
+         }
+         for (int i = 0; i + 1 < points.size(); ++i) {
+            index.add_segment(points[i].x(), points[i].y(), points[i + 1].x(), points[i + 1].y());
+         }
+      }
+   }
+}
+
+/// Moves a location to its snapping target, if any.
+SnapState snap_point(const SnapIndex& index, SimdLevel level, QgsGeometrySnapper::SnapMode mode, double& x, double& y) {
+   double vertex_x, vertex_y;
+   const bool vertex = index.nearest_vertex(level, x, y, vertex_x, vertex_y);
+   if (!vertex && mode == QgsGeometrySnapper::EndPointToEndPoint) {
+      return SnapState::Unsnapped;
+   }
+   double segment_x, segment_y;
+   const bool segment = !(vertex && prefers_vertices(mode)) && index.nearest_segment(level, x, y, segment_x, segment_y);
+   if (vertex
+       && (!segment
+           || (vertex_x - x) * (vertex_x - x) + (vertex_y - y) * (vertex_y - y)
+                 <= (segment_x - x) * (segment_x - x) + (segment_y - y) * (segment_y - y))) {
+      x = vertex_x;
+      y = vertex_y;
+      return SnapState::SnappedToVertex;
+   }
+   if (segment) {
+      x = segment_x;
+      y = segment_y;
+      return SnapState::SnappedToSegment;
+   }
+   return SnapState::Unsnapped;
+}
+
+/// @brief Snaps the vertices of a geometry.
+/// @param inserted Scratch buffer for the vertices inserted into a segment.
+/// @param changed Set to true if the geometry was modified.
+QgsGeometry snap_geometry(const QgsGeometry& geometry, const SnapIndex& index, QgsGeometrySnapper::SnapMode mode,
+                          SimdLevel level, std::vector<SnapIndex::SegmentVertex>& inserted, bool& changed) {
+   changed = false;
+   const Qgis::GeometryType type = geometry.type();
+   const bool end_points_only = is_end_point_mode(mode);
+   if (end_points_only && type == Qgis::GeometryType::Polygon) {
+      return geometry;
+   }
+
+   QgsGeometry result = geometry;
+   const QgsCoordinateSequence sequence = geometry.constGet()->coordinateSequence();
+   std::vector<SnapState> states;
+   for (int part = 0; part < sequence.size(); ++part) {
+      for (int ring = 0; ring < sequence[part].size(); ++ring) {
+         const QgsPointSequence& points = sequence[part][ring];
+         const int count = ring_size(points, type == Qgis::GeometryType::Polygon);
+         QgsPointSequence snapped = points;
+         states.assign(count, SnapState::Unsnapped);
+         for (int i = 0; i < count; ++i) {
+            if (end_points_only && type == Qgis::GeometryType::Line && i != 0 && i != count - 1) {
+               continue;
+            }
+            double x = points[i].x();
+            double y = points[i].y();
+            states[i] = snap_point(index, level, mode, x, y);
+            if (states[i] == SnapState::Unsnapped || (x == points[i].x() && y == points[i].y())) {
+               continue;
+            }
+            snapped[i].setX(x);
+            snapped[i].setY(y);
+            result.get()->moveVertex(QgsVertexId(part, ring, i), snapped[i]);
+            changed = true;
+         }
+         if (!inserts_vertices(mode) || type == Qgis::GeometryType::Point) {
+            continue;
+         }
+
+         // Segments from the last to the first, so the vertex numbers of earlier segments stay valid.
+         const int segment_count = count < points.size() ? count : count - 1;
+         for (int segment = segment_count - 1; segment >= 0; --segment) {
+            const int a = segment;
+            const int b = (segment + 1) % count;
+            if (states[a] == SnapState::Unsnapped || states[b] == SnapState::Unsnapped) {
+               continue;
+            }
+            const QgsPoint& start = snapped[a];
+            const QgsPoint& end = snapped[b];
+            index.vertices_near_segment(start.x(), start.y(), end.x(), end.y(), inserted);
+            for (auto vertex = inserted.rbegin(); vertex != inserted.rend(); ++vertex) {
+               QgsPoint point = start;
+               point.setX(vertex->x);
+               point.setY(vertex->y);
+               if (point.is3D()) {
+                  point.setZ(start.z() + vertex->position * (end.z() - start.z()));
+               }
+               if (point.isMeasure()) {
+                  point.setM(start.m() + vertex->position * (end.m() - start.m()));
+               }
+               result.get()->insertVertex(QgsVertexId(part, ring, segment + 1), point);
+               changed = true;
+            }
+         }
+      }
+   }
+   return result;
+}
+
+}
+
+SnappingEngine::SnappingEngine(const QgsFeatureSource& reference_source, const SnappingSettings& settings)
+   : m_reference_source(reference_source), m_settings(settings) {
+}
+
+int SnappingEngine::run(const QgsFeatureSource& source, QgsFeatureSink& sink,
+                        const QgsCoordinateTransformContext& transform_context, QgsFeedback* feedback) {
+   m_snapped_count = 0;
+   if (!(m_settings.tolerance >= 0.0) || QgsWkbTypes::geometryType(m_reference_source.wkbType()) == Qgis::GeometryType::Null
+       || QgsWkbTypes::geometryType(source.wkbType()) == Qgis::GeometryType::Null) {
+      return InvalidParameters;
+   }
+
+   // Read the reference geometries once, in the CRS of the snapped features.
+   m_index = SnapIndex();
+   QgsFeatureRequest reference_request;
+   reference_request.setNoAttributes();
+   QgsFeatureIterator references = m_reference_source.getFeatures(reference_request);
+   QgsFeature reference;
+   QVector<QgsGeometry> reference_geometries;
+   while (references.nextFeature(reference)) {
+      if (feedback && feedback->isCanceled()) {
+         return Canceled;
+      }
+      if (reference.hasGeometry()) {
+         reference_geometries.append(reference.geometry());
+      }
+   }
+   // Reprojected in large batches instead of vertex by vertex in the feature iterator.
+   if (m_reference_source.sourceCrs() != source.sourceCrs()) {
+      ReprojectionSettings reprojection_settings;
+      reprojection_settings.thread_count = m_settings.thread_count;
+      ReprojectionService reprojection(QgsCoordinateTransform(m_reference_source.sourceCrs(), source.sourceCrs(), transform_context),
+                                       reprojection_settings);
+      reprojection.transform(reference_geometries, feedback);
+      if (feedback && feedback->isCanceled()) {
+         return Canceled;
+      }
+   }
+   for (const QgsGeometry& geometry : std::as_const(reference_geometries)) {
+      if (!geometry.isNull()) {
+         add_reference(geometry, m_settings.mode, m_index);
+      }
+   }
+   m_index.finish(m_settings.tolerance);
+   if (feedback) {
+      feedback->setProgress(10.0);
+   }
+
+   const SimdLevel simd_level = m_settings.use_simd ? terrain_simd::detect_simd_level() : SimdLevel::Scalar;
+   const int thread_count = resolve_thread_count(m_settings.thread_count);
+   std::vector<std::vector<SnapIndex::SegmentVertex>> worker_inserted(thread_count);
+   const std::size_t batch_size = static_cast<std::size_t>(std::max(1, m_settings.batch_size));
+   const long long feature_count = std::max<long long>(1, source.featureCount());
+
+   std::vector<QgsFeature> batch;
+   std::atomic<long long> snapped(0);
+   long long features_read = 0;
+   QgsFeatureIterator features = source.getFeatures();
+   bool more = true;
+   while (more) {
+      batch.clear();
+      QgsFeature feature;
+      while (batch.size() < batch_size && (more = features.nextFeature(feature))) {
+         batch.push_back(feature);
+      }
+      if (batch.empty()) {
+         break;
+      }
+      if (feedback && feedback->isCanceled()) {
+         return Canceled;
+      }
+      features_read += static_cast<long long>(batch.size());
+
+      const std::size_t run_count = (batch.size() + s_run_size - 1) / s_run_size;
+      parallel_for(run_count, thread_count, [&](std::size_t run, int worker) {
+         const std::size_t end = std::min(batch.size(), (run + 1) * s_run_size);
+         for (std::size_t i = run * s_run_size; i < end; ++i) {
+            if (!batch[i].hasGeometry()) {
+               continue;
+            }
+            bool changed;
+            const QgsGeometry geometry =
+               snap_geometry(batch[i].geometry(), m_index, m_settings.mode, simd_level, worker_inserted[worker], changed);
+            if (changed) {
+               batch[i].setGeometry(geometry);
+               ++snapped;
+            }
+         }
+      });
+
+      // Write in input order.
+      QgsFeatureList output;
+      output.reserve(static_cast<int>(batch.size()));
+      for (const QgsFeature& snapped_feature : batch) {
+         output.append(snapped_feature);
+      }
+      if (!sink.addFeatures(output, QgsFeatureSink::FastInsert)) {
+         return WriteFailed;
+      }
+      if (feedback) {
+         feedback->setProgress(10.0 + 90.0 * std::min(1.0, static_cast<double>(features_read) / static_cast<double>(feature_count)));
+      }
+   }
+   m_snapped_count = snapped;
+   return Success;
+}
@@ -0,0 +1,77 @@
+#ifndef _SNAPPING_ENGINE_H_
+#define _SNAPPING_ENGINE_H_
+
+#include "snap_index.h"
+
+#include "qgscoordinatetransformcontext.h"
+#include "qgsgeometrysnapper.h"
+
+class QgsFeatureSink;
+class QgsFeatureSource;
+class QgsFeedback;
+
+/// @brief Settings of a snapping run.
+struct SnappingSettings {
+   /// How vertices are snapped, with the meaning of QgsGeometrySnapper.
+   QgsGeometrySnapper::SnapMode mode = QgsGeometrySnapper::PreferNodes;
+   /// Snapping distance in units of the snapped features' CRS.
+   double tolerance = 0.0;
+   /// Number of features read and snapped at a time.
+   int batch_size = 16384;
+   /// Use the AVX2 or SSE4.2 kernels when the CPU supports them.
+   bool use_simd = true;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+};
+
+/// @brief Snaps the geometries of features to the vertices and segments of a reference source.
+///
+/// QgsGeometrySnapper::snapFeatures() runs features in parallel, but every feature queries a
+/// shared QgsSpatialIndex and reference feature cache behind mutexes, and builds its own snap
+/// index from the reference geometries near it. This engine reads the reference geometries
+/// once into a SnapIndex, after which the workers share it without locks. Features are read in
+/// batches, snapped on all cores in runs of consecutive features and written to the sink in
+/// input order, so the output does not depend on the number of threads.
+///
+/// Every vertex is moved to the nearest reference vertex or point on a reference segment
+/// within the tolerance, as selected by the mode. Except in the NoExtraVertices and end point
+/// modes, reference vertices within the tolerance of a segment whose ends were both snapped
+/// are then inserted into it, so shared borders follow each other exactly.
+class SnappingEngine
+{
+public:
+   /// Result codes of run().
+   enum Result {
+      Success = 0,
+      InvalidParameters = 1,
+      WriteFailed = 2,
+      Canceled = 3
+   };
+
+   /// @brief Constructor.
+   /// @param reference_source The features to snap to, must outlive run().
+   /// @param settings The snapping and processing options.
+   SnappingEngine(const QgsFeatureSource& reference_source, const SnappingSettings& settings);
+
+   /// @brief Snaps the features of a source and writes them to the sink.
+   /// @param source The features to snap, written with their fields.
+   /// @param sink Receives the snapped features.
+   /// @param transform_context Transform context for the transformation of the reference features to the CRS of source.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return One of the Result codes.
+   int run(const QgsFeatureSource& source, QgsFeatureSink& sink, const QgsCoordinateTransformContext& transform_context,
+           QgsFeedback* feedback = nullptr);
+
+   /// Number of features with a modified geometry in the last run.
+   long long snapped_count() const {
+      return m_snapped_count;
+   }
+
+private:
+   const QgsFeatureSource& m_reference_source;
+   SnappingSettings m_settings;
+   SnapIndex m_index;
+   long long m_snapped_count = 0;
+};
+
+#endif
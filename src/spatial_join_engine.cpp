@@ -0,0 +1,262 @@
+#include "spatial_join_engine.h"
+#include "hilbert_curve.h"
+#include "parallel_for.h"
+
+#include "qgsfeatureiterator.h"
+#include "qgsfeaturerequest.h"
+#include "qgsfeaturesink.h"
+#include "qgsfeaturesource.h"
+#include "qgsfeedback.h"
+#include "qgsgeometryengine.h"
+#include "qgsprocessingutils.h"
+#include "qgswkbtypes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+/// Number of probe features in a run handed to one worker at a time.
+constexpr std::size_t s_run_size = 256;
+
+/// @brief Prepared join geometries of one worker, evicting the least recently used ones.
+class PreparedGeometryCache
+{
+public:
+   explicit PreparedGeometryCache(std::size_t max_vertices)
+      : m_max_vertices(max_vertices) {
+   }
+
+   /// Returns the prepared geometry of a join feature, nullptr if it has no geometry.
+   const QgsGeometryEngine* get(const FeatureStore& features, std::uint32_t row) {
+      const auto found = m_entries.find(row);
+      if (found != m_entries.end()) {
+         m_order.splice(m_order.begin(), m_order, found->second.position);
+         return found->second.engine.get();
+      }
+
+      Entry entry;
+      entry.geometry = features.geometry(row);
+      if (entry.geometry.isNull()) {
+         return nullptr;
+      }
+      entry.engine.reset(QgsGeometry::createGeometryEngine(entry.geometry.constGet()));
+      entry.engine->prepareGeometry();
+      entry.vertices = static_cast<std::size_t>(std::max(1, entry.geometry.constGet()->nCoordinates()));
+      // The new geometry is kept even if it alone exceeds the budget.
+      while (!m_order.empty() && m_vertices + entry.vertices > m_max_vertices) {
+         const auto evicted = m_entries.find(m_order.back());
+         m_vertices -= evicted->second.vertices;
+         m_entries.erase(evicted);
+         m_order.pop_back();
+      }
+      m_order.push_front(row);
+      entry.position = m_order.begin();
+      m_vertices += entry.vertices;
+      return m_entries.emplace(row, std::move(entry)).first->second.engine.get();
+   }
+
+private:
+   struct Entry {
+      /// The geometry the engine was created from, kept alive with it.
+      QgsGeometry geometry;
+      std::unique_ptr<QgsGeometryEngine> engine;
+      std::size_t vertices = 0;
+      std::list<std::uint32_t>::iterator position;
+   };
+
+   std::size_t m_max_vertices;
+   std::size_t m_vertices = 0;
+   /// Rows of the cached geometries, most recently used first.
+   std::list<std::uint32_t> m_order;
+   std::unordered_map<std::uint32_t, Entry> m_entries;
+};
+
+bool matches(const QgsGeometryEngine& join_geometry, const QgsAbstractGeometry* probe_geometry, SpatialJoinPredicate predicate) {
+   switch (predicate) {
+      case SpatialJoinPredicate::Intersects:
+         return join_geometry.intersects(probe_geometry);
+      case SpatialJoinPredicate::Contains:
+         return join_geometry.contains(probe_geometry);
+      case SpatialJoinPredicate::Within:
+         return join_geometry.within(probe_geometry);
+   }
+   return false;
+}
+
+}
+
+SpatialJoinEngine::SpatialJoinEngine(const QgsFeatureSource& join_source, const SpatialJoinSettings& settings)
+   : m_join_source(join_source), m_settings(settings) {
+}
+
+QgsAttributeList SpatialJoinEngine::join_attributes() const {
+   QgsAttributeList attributes;
+   for (int field : m_settings.join_fields) {
+      if (field >= 0 && field < m_join_source.fields().count()) {
+         attributes << field;
+      }
+   }
+   return attributes.isEmpty() ? m_join_source.fields().allAttributesList() : attributes;
+}
+
+QgsFields SpatialJoinEngine::output_fields(const QgsFields& probe_fields) const {
+   QgsFields join_fields;
+   for (int field : join_attributes()) {
+      join_fields.append(m_join_source.fields().at(field));
+   }
+   return QgsProcessingUtils::combineFields(probe_fields, join_fields, m_settings.prefix);
+}
+
+int SpatialJoinEngine::run(const QgsFeatureSource& probe_source, QgsFeatureSink& sink,
+                           const QgsCoordinateTransformContext& transform_context, QgsFeedback* feedback) {
+   m_matched_count = 0;
+   if (QgsWkbTypes::geometryType(m_join_source.wkbType()) == Qgis::GeometryType::Null
+       || QgsWkbTypes::geometryType(probe_source.wkbType()) == Qgis::GeometryType::Null) {
+      return InvalidSource;
+   }
+
+   // Load the join features once, in the CRS of the probes.
+   const QgsAttributeList attributes = join_attributes();
+   QgsFeatureRequest join_request;
+   join_request.setSubsetOfAttributes(attributes);
+   join_request.setDestinationCrs(probe_source.sourceCrs(), transform_context);
+   if (!m_join_features.load(m_join_source, join_request, nullptr)) {
+      return Canceled;
+   }
+   if (feedback && feedback->isCanceled()) {
+      return Canceled;
+   }
+   if (feedback) {
+      feedback->setProgress(10.0);
+   }
+
+   const QgsFields fields = output_fields(probe_source.fields());
+   const int probe_field_count = probe_source.fields().count();
+   const int thread_count = resolve_thread_count(m_settings.thread_count);
+   std::vector<PreparedGeometryCache> caches(thread_count, PreparedGeometryCache(std::max<std::size_t>(1, m_settings.cache_vertices)));
+   std::vector<std::vector<std::uint32_t>> worker_candidates(thread_count);
+   const std::size_t batch_size = static_cast<std::size_t>(std::max(1, m_settings.batch_size));
+   const long long feature_count = std::max<long long>(1, probe_source.featureCount());
+
+   std::vector<QgsFeature> batch;
+   std::vector<QgsFeatureList> outputs;
+   std::vector<std::uint32_t> order;
+   std::vector<std::uint64_t> keys;
+   std::atomic<long long> matched(0);
+   long long features_read = 0;
+   QgsFeatureIterator probes = probe_source.getFeatures();
+   bool more = true;
+   while (more) {
+      batch.clear();
+      QgsFeature feature;
+      while (batch.size() < batch_size && (more = probes.nextFeature(feature))) {
+         batch.push_back(feature);
+      }
+      if (batch.empty()) {
+         break;
+      }
+      if (feedback && feedback->isCanceled()) {
+         return Canceled;
+      }
+      features_read += static_cast<long long>(batch.size());
+
+      // Sort the batch along a Hilbert curve over its extent, so every run covers few join features.
+      double min_x = std::numeric_limits<double>::infinity();
+      double min_y = min_x;
+      double max_x = -min_x;
+      double max_y = -min_x;
+      std::vector<QgsPointXY> centres(batch.size());
+      for (std::size_t i = 0; i < batch.size(); ++i) {
+         if (!batch[i].hasGeometry()) {
+            continue;
+         }
+         centres[i] = batch[i].geometry().boundingBox().center();
+         min_x = std::min(min_x, centres[i].x());
+         min_y = std::min(min_y, centres[i].y());
+         max_x = std::max(max_x, centres[i].x());
+         max_y = std::max(max_y, centres[i].y());
+      }
+      const double scale_x = max_x > min_x ? 65535.0 / (max_x - min_x) : 0.0;
+      const double scale_y = max_y > min_y ? 65535.0 / (max_y - min_y) : 0.0;
+      keys.resize(batch.size());
+      for (std::size_t i = 0; i < batch.size(); ++i) {
+         const std::uint64_t index = batch[i].hasGeometry()
+                                        ? hilbert_index(static_cast<std::uint32_t>((centres[i].x() - min_x) * scale_x),
+                                                        static_cast<std::uint32_t>((centres[i].y() - min_y) * scale_y))
+                                        : 0;
+         keys[i] = (index << 32) | i;
+      }
+      std::sort(keys.begin(), keys.end());
+      order.resize(batch.size());
+      for (std::size_t i = 0; i < batch.size(); ++i) {
+         order[i] = static_cast<std::uint32_t>(keys[i] & 0xffffffffu);
+      }
+
+      outputs.assign(batch.size(), QgsFeatureList());
+      const std::size_t run_count = (batch.size() + s_run_size - 1) / s_run_size;
+      parallel_for(run_count, thread_count, [&](std::size_t run, int worker) {
+         std::vector<std::uint32_t>& candidates = worker_candidates[worker];
+         const std::size_t end = std::min(batch.size(), (run + 1) * s_run_size);
+         for (std::size_t position = run * s_run_size; position < end; ++position) {
+            const std::uint32_t probe = order[position];
+            const QgsFeature& probe_feature = batch[probe];
+            candidates.clear();
+            if (probe_feature.hasGeometry()) {
+               const QgsRectangle bounds = probe_feature.geometry().boundingBox();
+               m_join_features.index().query(bounds.xMinimum(), bounds.yMinimum(), bounds.xMaximum(), bounds.yMaximum(), candidates);
+               std::sort(candidates.begin(), candidates.end());
+            }
+
+            QgsFeatureList& output = outputs[probe];
+            for (std::uint32_t row : candidates) {
+               const QgsGeometryEngine* join_geometry = caches[worker].get(m_join_features, row);
+               if (!join_geometry || !matches(*join_geometry, probe_feature.geometry().constGet(), m_settings.predicate)) {
+                  continue;
+               }
+               QgsAttributes values = probe_feature.attributes();
+               values.resize(probe_field_count);
+               for (int field : attributes) {
+                  values.append(m_join_features.attribute(row, field));
+               }
+               QgsFeature joined(fields, probe_feature.id());
+               joined.setGeometry(probe_feature.geometry());
+               joined.setAttributes(values);
+               output.append(joined);
+               if (m_settings.first_match_only) {
+                  break;
+               }
+            }
+            if (!output.isEmpty()) {
+               ++matched;
+            } else if (!m_settings.discard_nonmatching) {
+               QgsAttributes values = probe_feature.attributes();
+               values.resize(fields.count());
+               QgsFeature unmatched(fields, probe_feature.id());
+               unmatched.setGeometry(probe_feature.geometry());
+               unmatched.setAttributes(values);
+               output.append(unmatched);
+            }
+         }
+      });
+
+      // Write in probe order.
+      QgsFeatureList joined;
+      for (QgsFeatureList& output : outputs) {
+         joined.append(output);
+      }
+      if (!joined.isEmpty() && !sink.addFeatures(joined, QgsFeatureSink::FastInsert)) {
+         return WriteFailed;
+      }
+      if (feedback) {
+         feedback->setProgress(10.0 + 90.0 * std::min(1.0, static_cast<double>(features_read) / static_cast<double>(feature_count)));
+      }
+   }
+   m_matched_count = matched;
+   return Success;
+}
@@ -0,0 +1,98 @@
+#ifndef _SPATIAL_JOIN_ENGINE_H_
+#define _SPATIAL_JOIN_ENGINE_H_
+
+#include "feature_store.h"
+
+#include "qgscoordinatetransformcontext.h"
+#include "qgsfields.h"
+
+#include <QString>
+
+#include <cstddef>
+
+class QgsFeatureSink;
+class QgsFeatureSource;
+class QgsFeedback;
+
+/// Spatial relation between a probe feature and a join feature.
+enum class SpatialJoinPredicate {
+   /// The geometries share at least one point.
+   Intersects,
+   /// The join geometry contains the probe geometry, e.g. a zone containing a point.
+   Contains,
+   /// The join geometry lies within the probe geometry.
+   Within
+};
+
+/// @brief Settings of a spatial join.
+struct SpatialJoinSettings {
+   SpatialJoinPredicate predicate = SpatialJoinPredicate::Intersects;
+   /// Join only the first matching feature, by join feature order, instead of one output per match.
+   bool first_match_only = false;
+   /// Drop probe features without a match instead of writing them with null join attributes.
+   bool discard_nonmatching = false;
+   /// Indices of the join fields to add to the output, empty for all fields.
+   QgsAttributeList join_fields;
+   /// Prefix of the join field names in the output.
+   QString prefix;
+   /// Number of probe features read and joined at a time.
+   int batch_size = 65536;
+   /// Maximum number of vertices of the prepared join geometries kept per worker thread.
+   std::size_t cache_vertices = 4000000;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+};
+
+/// @brief Joins the attributes of the features of one source to the features of another by location.
+///
+/// Testing every pair with QgsGeometry::intersects() converts both geometries to GEOS again for
+/// every pair. This engine loads the join side, typically polygon zones, once into a
+/// FeatureStore indexed by a HilbertRTree. The probe side, e.g. GPS points, is read in batches:
+/// every batch is sorted along a Hilbert curve and split into runs of neighbouring features,
+/// and the runs are joined on all cores. Each worker keeps the join geometries it needs
+/// prepared with QgsGeometryEngine::prepareGeometry() in its own cache, bounded by vertex count
+/// and evicting the least recently used ones, so neighbouring probes reuse the prepared zones.
+/// The joined features are written to the sink in probe order.
+class SpatialJoinEngine
+{
+public:
+   /// Result codes of run().
+   enum Result {
+      Success = 0,
+      InvalidSource = 1,
+      WriteFailed = 2,
+      Canceled = 3
+   };
+
+   /// @brief Constructor.
+   /// @param join_source The features whose attributes are joined, must outlive run().
+   /// @param settings The join and processing options.
+   SpatialJoinEngine(const QgsFeatureSource& join_source, const SpatialJoinSettings& settings);
+
+   /// @brief Fields of the joined features: the probe fields followed by the join fields.
+   QgsFields output_fields(const QgsFields& probe_fields) const;
+
+   /// @brief Joins the probe features and writes them to the sink.
+   /// @param probe_source The features to join to, the output has their geometries.
+   /// @param sink Receives features with output_fields().
+   /// @param transform_context Transform context for the transformation of the join features to the probe CRS.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return One of the Result codes.
+   int run(const QgsFeatureSource& probe_source, QgsFeatureSink& sink, const QgsCoordinateTransformContext& transform_context,
+           QgsFeedback* feedback = nullptr);
+
+   /// Number of probe features with at least one match in the last run.
+   long long matched_count() const {
+      return m_matched_count;
+   }
+
+private:
+   QgsAttributeList join_attributes() const;
+
+   const QgsFeatureSource& m_join_source;
+   SpatialJoinSettings m_settings;
+   FeatureStore m_join_features;
+   long long m_matched_count = 0;
+};
+
+#endif
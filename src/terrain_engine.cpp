@@ -0,0 +1,165 @@
+#include "terrain_engine.h"
+#include "parallel_for.h"
+
+#include "qgsfeedback.h"
+#include "qgsogrutils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <vector>
+
+#include <gdal.h>
+
+TerrainEngine::TerrainEngine(const TerrainSettings& settings) : m_settings(settings) {
+}
+
+QString TerrainEngine::derivative_name(TerrainDerivative derivative) {
+   switch (derivative) {
+   case TerrainDerivative::Slope:
+      return QStringLiteral("Slope");
+   case TerrainDerivative::Aspect:
+      return QStringLiteral("Aspect");
+   case TerrainDerivative::Hillshade:
+      return QStringLiteral("Hillshade");
+   case TerrainDerivative::MultidirectionalHillshade:
+      return QStringLiteral("Multidirectional hillshade");
+   case TerrainDerivative::Ruggedness:
+      return QStringLiteral("Ruggedness");
+   case TerrainDerivative::TotalCurvature:
+      return QStringLiteral("Total curvature");
+   }
+   return QString();
+}
+
+int TerrainEngine::process_raster(const QString& input_file, const QString& output_file, QgsFeedback* feedback) const {
+   GDALAllRegister();
+
+   gdal::dataset_unique_ptr input(GDALOpen(input_file.toUtf8().constData(), GA_ReadOnly));
+   if (!input) {
+      return InputOpenFailed;
+   }
+   GDALRasterBandH input_band = GDALGetRasterBand(input.get(), 1);
+   if (!input_band) {
+      return InputBandFailed;
+   }
+   const int width = GDALGetRasterXSize(input.get());
+   const int height = GDALGetRasterYSize(input.get());
+
+   double geo_transform[6];
+   if (GDALGetGeoTransform(input.get(), geo_transform) != CE_None) {
+      return InputOpenFailed;
+   }
+
+   TerrainKernelParameters parameters;
+   parameters.cell_size_x = std::abs(geo_transform[1]);
+   parameters.cell_size_y = std::abs(geo_transform[5]);
+   parameters.z_factor = m_settings.z_factor;
+   parameters.input_nodata = static_cast<float>(GDALGetRasterNoDataValue(input_band, nullptr));
+   parameters.output_nodata = m_settings.output_nodata;
+   parameters.set_light(m_settings.light_azimuth, m_settings.light_altitude);
+
+   GDALDriverH driver = GDALGetDriverByName(m_settings.output_format.toLocal8Bit().constData());
+   if (!driver || !GDALGetMetadataItem(driver, GDAL_DCAP_CREATE, nullptr)) {
+      return OutputDriverFailed;
+   }
+
+   char** options = nullptr;
+   options = CSLSetNameValue(options, "TILED", "YES");
+   options = CSLSetNameValue(options, "BIGTIFF", "IF_SAFER");
+   gdal::dataset_unique_ptr output(GDALCreate(driver, output_file.toUtf8().constData(), width, height, 1, GDT_Float32,
+                                              m_settings.output_format == QLatin1String("GTiff") ? options : nullptr));
+   CSLDestroy(options);
+   if (!output) {
+      return OutputCreateFailed;
+   }
+   GDALSetGeoTransform(output.get(), geo_transform);
+   GDALSetProjection(output.get(), GDALGetProjectionRef(input.get()));
+
+   GDALRasterBandH output_band = GDALGetRasterBand(output.get(), 1);
+   if (!output_band) {
+      return OutputBandFailed;
+   }
+   GDALSetRasterNoDataValue(output_band, parameters.output_nodata);
+
+   const int band_rows = std::max(1, m_settings.band_rows);
+   const std::size_t band_count = (static_cast<std::size_t>(height) + band_rows - 1) / band_rows;
+   const int thread_count = resolve_thread_count(m_settings.thread_count);
+   const int stride = width + 2;
+   const SimdLevel simd_level = m_settings.use_simd ? terrain_simd::detect_simd_level() : SimdLevel::Scalar;
+
+   // GDAL dataset handles must not be shared between threads, so every worker reads through its own.
+   std::vector<gdal::dataset_unique_ptr> worker_inputs(thread_count);
+   std::vector<std::vector<float>> worker_input_buffers(thread_count);
+   std::vector<std::vector<float>> worker_output_buffers(thread_count);
+
+   std::mutex output_mutex;
+   std::size_t bands_done = 0;
+   std::atomic<bool> failed(false);
+   std::atomic<bool> canceled(false);
+
+   parallel_for(band_count, thread_count, [&](std::size_t band, int worker) {
+      if (canceled || failed) {
+         return;
+      }
+      if (feedback && feedback->isCanceled()) {
+         canceled = true;
+         return;
+      }
+
+      gdal::dataset_unique_ptr& worker_input = worker_inputs[worker];
+      if (!worker_input) {
+         worker_input.reset(GDALOpen(input_file.toUtf8().constData(), GA_ReadOnly));
+         if (!worker_input) {
+            failed = true;
+            return;
+         }
+      }
+      GDALRasterBandH worker_band = GDALGetRasterBand(worker_input.get(), 1);
+
+      const int first_row = static_cast<int>(band) * band_rows;
+      const int row_count = std::min(band_rows, height - first_row);
+      // Rows of the band plus the halo row above and below that lies inside the raster.
+      const int read_first = std::max(0, first_row - 1);
+      const int read_last = std::min(height - 1, first_row + row_count);
+      const int read_count = read_last - read_first + 1;
+
+      std::vector<float>& input_buffer = worker_input_buffers[worker];
+      std::vector<float>& output_buffer = worker_output_buffers[worker];
+      input_buffer.assign(static_cast<std::size_t>(row_count + 2) * stride, parameters.input_nodata);
+      output_buffer.resize(static_cast<std::size_t>(row_count) * width);
+
+      // Padded row 0 holds raster row first_row - 1, read straight into the padded layout.
+      float* target = input_buffer.data() + static_cast<std::size_t>(read_first - first_row + 1) * stride + 1;
+      if (GDALRasterIO(worker_band, GF_Read, 0, read_first, width, read_count, target, width, read_count, GDT_Float32,
+                       0, stride * static_cast<int>(sizeof(float))) != CE_None) {
+         failed = true;
+         return;
+      }
+
+      terrain_simd::process_band(simd_level, m_settings.derivative, parameters, input_buffer.data(), width, row_count,
+                                 output_buffer.data());
+
+      std::lock_guard<std::mutex> lock(output_mutex);
+      if (GDALRasterIO(output_band, GF_Write, 0, first_row, width, row_count, output_buffer.data(), width, row_count,
+                       GDT_Float32, 0, 0) != CE_None) {
+         failed = true;
+         return;
+      }
+      ++bands_done;
+      if (feedback) {
+         feedback->setProgress(100.0 * static_cast<double>(bands_done) / static_cast<double>(band_count));
+      }
+   });
+
+   if (canceled) {
+      // Close the partially written output before deleting it.
+      gdal::fast_delete_and_close(output, driver, output_file);
+      return Canceled;
+   }
+   if (failed) {
+      return ReadWriteFailed;
+   }
+   return Success;
+}
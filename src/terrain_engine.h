@@ -0,0 +1,71 @@
+#ifndef _TERRAIN_ENGINE_H_
+#define _TERRAIN_ENGINE_H_
+
+#include "terrain_simd.h"
+
+#include <QString>
+
+class QgsFeedback;
+
+/// @brief Settings of a terrain engine run.
+struct TerrainSettings {
+   TerrainDerivative derivative = TerrainDerivative::Slope;
+   /// Scale factor for z-values if the x-/y-units differ from the z-units.
+   double z_factor = 1.0;
+   /// Hillshade light azimuth in degrees.
+   double light_azimuth = 300.0;
+   /// Hillshade light altitude in degrees.
+   double light_altitude = 40.0;
+   /// Nodata value written to the output raster.
+   float output_nodata = -9999.0f;
+   /// Number of raster rows processed by one work item.
+   int band_rows = 256;
+   /// Use the AVX2 or SSE4.2 kernels when the CPU supports them.
+   bool use_simd = true;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+   /// GDAL short name of the output format.
+   QString output_format = QStringLiteral("GTiff");
+};
+
+/// @brief Multithreaded replacement of QgsNineCellFilter.
+///
+/// The DEM is split into bands of rows. Every worker reads a band together with a
+/// one row halo above and below through its own GDAL dataset handle, applies the
+/// nine-cell kernel of the selected derivative and writes the band to the output.
+/// Unlike QgsNineCellFilter::processRasterCPU, which walks the raster one scanline at
+/// a time on the calling thread, all bands are processed concurrently.
+class TerrainEngine
+{
+public:
+   /// Result codes of process_raster(), matching QgsNineCellFilter::processRaster().
+   enum Result {
+      Success = 0,
+      InputOpenFailed = 1,
+      OutputDriverFailed = 2,
+      OutputCreateFailed = 3,
+      InputBandFailed = 4,
+      OutputBandFailed = 5,
+      ReadWriteFailed = 6,
+      Canceled = 7
+   };
+
+   /// @brief Constructor.
+   /// @param settings The derivative and processing options.
+   explicit TerrainEngine(const TerrainSettings& settings);
+
+   /// @brief Computes the derivative of the first band of input_file into output_file.
+   /// @param input_file Path of the DEM, any GDAL readable raster.
+   /// @param output_file Path of the Float32 raster to create.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return One of the Result codes.
+   int process_raster(const QString& input_file, const QString& output_file, QgsFeedback* feedback = nullptr) const;
+
+   /// Returns a user visible name of a derivative.
+   static QString derivative_name(TerrainDerivative derivative);
+
+private:
+   TerrainSettings m_settings;
+};
+
+#endif
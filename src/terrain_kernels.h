@@ -0,0 +1,263 @@
+#ifndef _TERRAIN_KERNELS_H_
+#define _TERRAIN_KERNELS_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+/// The terrain derivatives computed by the terrain engine.
+enum class TerrainDerivative {
+   Slope,
+   Aspect,
+   Hillshade,
+   MultidirectionalHillshade,
+   Ruggedness,
+   TotalCurvature
+};
+
+/// @brief Constants shared by all cells of a nine-cell kernel run.
+///
+/// The values and their types mirror the members of QgsNineCellFilter and QgsHillshadeFilter,
+/// so the kernels round exactly like QGIS does, with the hillshade trigonometry precomputed
+/// once instead of per cell.
+struct TerrainKernelParameters {
+   double cell_size_x = 1.0;
+   double cell_size_y = 1.0;
+   double z_factor = 1.0;
+   float input_nodata = -1.0f;
+   float output_nodata = -9999.0f;
+
+   /// Cosine of the light zenith angle.
+   float cos_zenith = 0.0f;
+   /// Sine of the light zenith angle.
+   float sin_zenith = 1.0f;
+   /// Light azimuth in radians.
+   float azimuth_rad = 0.0f;
+
+   /// @brief Sets the hillshade light source like QgsHillshadeFilter::setLightAzimuth() and
+   /// setLightAngle(), which take the zenith angle of the light.
+   /// @param azimuth Light azimuth in degrees, clockwise from north.
+   /// @param altitude Light altitude above the horizon in degrees.
+   void set_light(double azimuth, double altitude) {
+      const float zenith = static_cast<float>(90.0 - altitude);
+      cos_zenith = std::cos(zenith * static_cast<float>(s_pi) / 180.0f);
+      sin_zenith = std::sin(zenith * static_cast<float>(s_pi) / 180.0f);
+      azimuth_rad = static_cast<float>(azimuth) * static_cast<float>(s_pi) / 180.0f;
+   }
+
+   static constexpr double s_pi = 3.14159265358979323846;
+};
+
+namespace terrain_kernels {
+
+/// @brief Adds one row (or column) of the Horn (1981) derivative, falling back to a one-sided
+/// difference when a border cell is nodata, like QgsDerivativeFilter does. As in QGIS, the
+/// difference is taken in float and summed in double.
+inline void accumulate_horn(float low, float centre, float high, float nodata, int scale, double& sum, int& weight) {
+   if (high != nodata && low != nodata) {
+      sum += scale * (high - low);
+      weight += 2 * scale;
+   } else if (high == nodata && low != nodata && centre != nodata) {
+      sum += scale * (centre - low);
+      weight += scale;
+   } else if (low == nodata && high != nodata && centre != nodata) {
+      sum += scale * (high - centre);
+      weight += scale;
+   }
+}
+
+/// @brief First derivative in x-direction (west to east) of the window centred on mid[1],
+/// QgsDerivativeFilter::calcFirstDerX().
+/// @param top The row north of the centre cell, starting at the north-west cell.
+/// @param mid The row of the centre cell, starting at the west cell.
+/// @param bottom The row south of the centre cell, starting at the south-west cell.
+inline float derivative_x(const TerrainKernelParameters& p, const float* top, const float* mid, const float* bottom) {
+   double sum = 0.0;
+   int weight = 0;
+   accumulate_horn(top[0], top[1], top[2], p.input_nodata, 1, sum, weight);
+   accumulate_horn(mid[0], mid[1], mid[2], p.input_nodata, 2, sum, weight);
+   accumulate_horn(bottom[0], bottom[1], bottom[2], p.input_nodata, 1, sum, weight);
+   if (weight == 0) {
+      return p.output_nodata;
+   }
+   return static_cast<float>(sum / (weight * p.cell_size_x) * p.z_factor);
+}
+
+/// @brief First derivative in y-direction (south to north) of the window centred on mid[1],
+/// QgsDerivativeFilter::calcFirstDerY().
+inline float derivative_y(const TerrainKernelParameters& p, const float* top, const float* mid, const float* bottom) {
+   double sum = 0.0;
+   int weight = 0;
+   accumulate_horn(bottom[0], mid[0], top[0], p.input_nodata, 1, sum, weight);
+   accumulate_horn(bottom[1], mid[1], top[1], p.input_nodata, 2, sum, weight);
+   accumulate_horn(bottom[2], mid[2], top[2], p.input_nodata, 1, sum, weight);
+   if (weight == 0) {
+      return p.output_nodata;
+   }
+   return static_cast<float>(sum / (weight * p.cell_size_y) * p.z_factor);
+}
+
+/// @brief Base of the kernels that only depend on the Horn derivatives of the window.
+///
+/// Derived kernels implement from_derivatives(), which the SIMD code path calls on
+/// derivatives computed for a whole row at once.
+template <typename Derived>
+struct DerivativeKernel {
+   static float apply(const TerrainKernelParameters& p, const float* top, const float* mid, const float* bottom) {
+      return Derived::from_derivatives(p, derivative_x(p, top, mid, bottom), derivative_y(p, top, mid, bottom));
+   }
+};
+
+/// Slope in degrees, QgsSlopeFilter. The arc tangent is taken in float, the conversion to degrees in double.
+struct SlopeKernel : DerivativeKernel<SlopeKernel> {
+   static float from_derivatives(const TerrainKernelParameters& p, float der_x, float der_y) {
+      if (der_x == p.output_nodata || der_y == p.output_nodata) {
+         return p.output_nodata;
+      }
+      return static_cast<float>(std::atan(std::sqrt(der_x * der_x + der_y * der_y)) * 180.0 / TerrainKernelParameters::s_pi);
+   }
+};
+
+/// Aspect in degrees clockwise from north, nodata on flat cells, QgsAspectFilter.
+struct AspectKernel : DerivativeKernel<AspectKernel> {
+   static float from_derivatives(const TerrainKernelParameters& p, float der_x, float der_y) {
+      if (der_x == p.output_nodata || der_y == p.output_nodata || (der_x == 0.0f && der_y == 0.0f)) {
+         return p.output_nodata;
+      }
+      return static_cast<float>(180.0 + std::atan2(der_x, der_y) * 180.0 / TerrainKernelParameters::s_pi);
+   }
+};
+
+/// Hillshade brightness in [0, 255] for a single light source, QgsHillshadeFilter.
+struct HillshadeKernel : DerivativeKernel<HillshadeKernel> {
+   static float from_derivatives(const TerrainKernelParameters& p, float der_x, float der_y) {
+      if (der_x == p.output_nodata || der_y == p.output_nodata) {
+         return p.output_nodata;
+      }
+      const float slope_rad = std::atan(std::sqrt(der_x * der_x + der_y * der_y));
+      // The aspect of a flat cell is undefined, any value gives the same result as sin(slope) is 0.
+      const float aspect_rad = (der_x == 0.0f && der_y == 0.0f)
+         ? p.azimuth_rad / 2.0f
+         : static_cast<float>(TerrainKernelParameters::s_pi + std::atan2(der_x, der_y));
+      return std::max(0.0f, 255.0f * (p.cos_zenith * std::cos(slope_rad)
+         + p.sin_zenith * std::sin(slope_rad) * std::cos(p.azimuth_rad - aspect_rad)));
+   }
+};
+
+/// @brief Multidirectional hillshade brightness in [0, 255].
+///
+/// Blends the illumination from the north-west quadrant (225, 270, 315 and 360 degrees),
+/// each weighted by sin^2 of the angle between light and aspect (Mark 1992). Only uses
+/// arithmetic and square roots, so the SIMD code path computes bit-identical results.
+struct MultidirectionalHillshadeKernel : DerivativeKernel<MultidirectionalHillshadeKernel> {
+   static float from_derivatives(const TerrainKernelParameters& p, float der_x, float der_y) {
+      if (der_x == p.output_nodata || der_y == p.output_nodata) {
+         return p.output_nodata;
+      }
+      const float xx = der_x * der_x;
+      const float yy = der_y * der_y;
+      const float xx_plus_yy = xx + yy;
+      // cos_zenith and sin_zenith are the sine and cosine of the light altitude.
+      if (xx_plus_yy == 0.0f) {
+         return std::max(0.0f, 255.0f * p.cos_zenith);
+      }
+      const float diagonal = p.sin_zenith * s_sqrt_half;
+      const float shade_225 = std::max(0.0f, p.cos_zenith + (der_x + der_y) * diagonal);
+      const float shade_270 = std::max(0.0f, p.cos_zenith + der_x * p.sin_zenith);
+      const float shade_315 = std::max(0.0f, p.cos_zenith + (der_x - der_y) * diagonal);
+      const float shade_360 = std::max(0.0f, p.cos_zenith - der_y * p.sin_zenith);
+      const float weight_225 = 0.5f * xx_plus_yy - der_x * der_y;
+      const float weight_315 = xx_plus_yy - weight_225;
+      const float shade = weight_225 * shade_225 + yy * shade_270 + weight_315 * shade_315 + xx * shade_360;
+      return 255.0f * (shade / xx_plus_yy / std::sqrt(1.0f + xx_plus_yy));
+   }
+
+   static constexpr float s_sqrt_half = 0.70710678118654752440f;
+};
+
+/// Terrain ruggedness index (Riley et al. 1999), ignoring nodata neighbours.
+struct RuggednessKernel {
+   static float apply(const TerrainKernelParameters& p, const float* top, const float* mid, const float* bottom) {
+      const float centre = mid[1];
+      if (centre == p.input_nodata) {
+         return p.output_nodata;
+      }
+      double sum = 0.0;
+      const float neighbours[8] = {top[0], top[1], top[2], mid[0], mid[2], bottom[0], bottom[1], bottom[2]};
+      for (float value : neighbours) {
+         if (value != p.input_nodata) {
+            const double diff = static_cast<double>(value) - centre;
+            sum += diff * diff;
+         }
+      }
+      return static_cast<float>(std::sqrt(sum));
+   }
+};
+
+/// Total curvature (Wood 1996) from the second derivatives of the window, nodata if any cell is nodata.
+struct TotalCurvatureKernel {
+   static float apply(const TerrainKernelParameters& p, const float* top, const float* mid, const float* bottom) {
+      for (int i = 0; i < 3; ++i) {
+         if (top[i] == p.input_nodata || mid[i] == p.input_nodata || bottom[i] == p.input_nodata) {
+            return p.output_nodata;
+         }
+      }
+      const double cell_size = (p.cell_size_x + p.cell_size_y) / 2.0;
+      const double cell_area = cell_size * cell_size;
+      const double dxx = (mid[0] - 2.0 * mid[1] + mid[2]) / cell_area;
+      const double dyy = (top[1] - 2.0 * mid[1] + bottom[1]) / cell_area;
+      const double dxy = (-top[0] + top[2] + bottom[0] - bottom[2]) / (4.0 * cell_area);
+      return static_cast<float>((dxx * dxx + 2.0 * dxy * dxy + dyy * dyy) * p.z_factor);
+   }
+};
+
+/// @brief Applies a kernel to every cell of a row band.
+///
+/// The input holds row_count + 2 rows of width + 2 cells, i.e. the band surrounded by a
+/// one cell halo that is filled with the input nodata value outside of the raster.
+/// @param input Padded input rows.
+/// @param width Number of output cells per row.
+/// @param row_count Number of output rows.
+/// @param output Output buffer of row_count * width cells.
+template <typename Kernel>
+void process_band(const TerrainKernelParameters& p, const float* input, int width, int row_count, float* output) {
+   const int stride = width + 2;
+   for (int row = 0; row < row_count; ++row) {
+      const float* top = input + static_cast<std::ptrdiff_t>(row) * stride;
+      const float* mid = top + stride;
+      const float* bottom = mid + stride;
+      float* out = output + static_cast<std::ptrdiff_t>(row) * width;
+      for (int col = 0; col < width; ++col) {
+         out[col] = Kernel::apply(p, top + col, mid + col, bottom + col);
+      }
+   }
+}
+
+/// @brief Applies the kernel for a derivative to every cell of a row band, see process_band().
+inline void process_band(TerrainDerivative derivative, const TerrainKernelParameters& p, const float* input, int width,
+                         int row_count, float* output) {
+   switch (derivative) {
+   case TerrainDerivative::Slope:
+      process_band<SlopeKernel>(p, input, width, row_count, output);
+      break;
+   case TerrainDerivative::Aspect:
+      process_band<AspectKernel>(p, input, width, row_count, output);
+      break;
+   case TerrainDerivative::Hillshade:
+      process_band<HillshadeKernel>(p, input, width, row_count, output);
+      break;
+   case TerrainDerivative::MultidirectionalHillshade:
+      process_band<MultidirectionalHillshadeKernel>(p, input, width, row_count, output);
+      break;
+   case TerrainDerivative::Ruggedness:
+      process_band<RuggednessKernel>(p, input, width, row_count, output);
+      break;
+   case TerrainDerivative::TotalCurvature:
+      process_band<TotalCurvatureKernel>(p, input, width, row_count, output);
+      break;
+   }
+}
+
+}
+
+#endif
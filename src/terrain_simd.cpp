@@ -0,0 +1,382 @@
+#include "terrain_simd.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define TERRAIN_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef TERRAIN_SIMD_X86
+/* MSVC emits any intrinsic without compiler flags, GCC and Clang need the target per function. */
+#if defined(__GNUC__) || defined(__clang__)
+#define TERRAIN_TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TERRAIN_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TERRAIN_TARGET_SSE42
+#define TERRAIN_TARGET_AVX2
+#endif
+#endif
+
+namespace terrain_simd {
+
+namespace {
+
+void horn_derivatives_scalar(const TerrainKernelParameters& p, const float* top, const float* mid, const float* bottom,
+                             int first, int width, float* der_x, float* der_y) {
+   for (int col = first; col < width; ++col) {
+      der_x[col] = terrain_kernels::derivative_x(p, top + col, mid + col, bottom + col);
+      der_y[col] = terrain_kernels::derivative_y(p, top + col, mid + col, bottom + col);
+   }
+}
+
+void multidirectional_scalar(const TerrainKernelParameters& p, const float* der_x, const float* der_y, int first,
+                             int width, float* output) {
+   for (int col = first; col < width; ++col) {
+      output[col] = terrain_kernels::MultidirectionalHillshadeKernel::from_derivatives(p, der_x[col], der_y[col]);
+   }
+}
+
+#ifdef TERRAIN_SIMD_X86
+
+// SSE4.2: the differences of four cells per single precision register, summed in two double
+// precision registers.
+
+/// One row of the Horn derivative of four cells, accumulate_horn() with masks instead of
+/// branches. Returns the scaled float differences and the weights, 0 where no difference applies.
+TERRAIN_TARGET_SSE42 inline void horn_term_sse(__m128 low, __m128 centre, __m128 high, __m128 nodata, float scale,
+                                               __m128& diff, __m128& weight) {
+   const __m128 low_valid = _mm_cmpneq_ps(low, nodata);
+   const __m128 high_valid = _mm_cmpneq_ps(high, nodata);
+   const __m128 centre_valid = _mm_cmpneq_ps(centre, nodata);
+   const __m128 both = _mm_and_ps(low_valid, high_valid);
+   const __m128 low_only = _mm_andnot_ps(high_valid, _mm_and_ps(low_valid, centre_valid));
+   const __m128 high_only = _mm_andnot_ps(low_valid, _mm_and_ps(high_valid, centre_valid));
+
+   diff = _mm_and_ps(high_only, _mm_sub_ps(high, centre));
+   diff = _mm_blendv_ps(diff, _mm_sub_ps(centre, low), low_only);
+   diff = _mm_blendv_ps(diff, _mm_sub_ps(high, low), both);
+   diff = _mm_mul_ps(diff, _mm_set1_ps(scale));
+   weight = _mm_or_ps(_mm_and_ps(_mm_or_ps(low_only, high_only), _mm_set1_ps(scale)),
+                      _mm_and_ps(both, _mm_set1_ps(2.0f * scale)));
+}
+
+/// Finishes the derivative of two cells in double precision, like the end of derivative_x().
+TERRAIN_TARGET_SSE42 inline __m128 finish_derivative2_sse(__m128d d0, __m128d d1, __m128d d2, __m128d weight,
+                                                          const TerrainKernelParameters& p, double cell_size) {
+   // The sum starts at +0.0 like the scalar code, so a single -0.0 difference does not give -0.0.
+   const __m128d sum = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_setzero_pd(), d0), d1), d2);
+   const __m128d value = _mm_mul_pd(_mm_div_pd(sum, _mm_mul_pd(weight, _mm_set1_pd(cell_size))), _mm_set1_pd(p.z_factor));
+   const __m128d no_weight = _mm_cmpeq_pd(weight, _mm_setzero_pd());
+   return _mm_cvtpd_ps(_mm_blendv_pd(value, _mm_set1_pd(p.output_nodata), no_weight));
+}
+
+TERRAIN_TARGET_SSE42 inline __m128 finish_derivative_sse(__m128 d0, __m128 d1, __m128 d2, __m128 weight,
+                                                         const TerrainKernelParameters& p, double cell_size) {
+   const __m128 low = finish_derivative2_sse(_mm_cvtps_pd(d0), _mm_cvtps_pd(d1), _mm_cvtps_pd(d2),
+                                             _mm_cvtps_pd(weight), p, cell_size);
+   const __m128 high = finish_derivative2_sse(_mm_cvtps_pd(_mm_movehl_ps(d0, d0)), _mm_cvtps_pd(_mm_movehl_ps(d1, d1)),
+                                              _mm_cvtps_pd(_mm_movehl_ps(d2, d2)),
+                                              _mm_cvtps_pd(_mm_movehl_ps(weight, weight)), p, cell_size);
+   return _mm_movelh_ps(low, high);
+}
+
+TERRAIN_TARGET_SSE42 inline void horn_derivatives4_sse(const TerrainKernelParameters& p, const float* top,
+                                                       const float* mid, const float* bottom, float* der_x,
+                                                       float* der_y) {
+   const __m128 nodata = _mm_set1_ps(p.input_nodata);
+   const __m128 t0 = _mm_loadu_ps(top), t1 = _mm_loadu_ps(top + 1), t2 = _mm_loadu_ps(top + 2);
+   const __m128 m0 = _mm_loadu_ps(mid), m1 = _mm_loadu_ps(mid + 1), m2 = _mm_loadu_ps(mid + 2);
+   const __m128 b0 = _mm_loadu_ps(bottom), b1 = _mm_loadu_ps(bottom + 1), b2 = _mm_loadu_ps(bottom + 2);
+
+   __m128 d0, d1, d2, w0, w1, w2;
+   horn_term_sse(t0, t1, t2, nodata, 1.0f, d0, w0);
+   horn_term_sse(m0, m1, m2, nodata, 2.0f, d1, w1);
+   horn_term_sse(b0, b1, b2, nodata, 1.0f, d2, w2);
+   _mm_storeu_ps(der_x, finish_derivative_sse(d0, d1, d2, _mm_add_ps(_mm_add_ps(w0, w1), w2), p, p.cell_size_x));
+
+   horn_term_sse(b0, m0, t0, nodata, 1.0f, d0, w0);
+   horn_term_sse(b1, m1, t1, nodata, 2.0f, d1, w1);
+   horn_term_sse(b2, m2, t2, nodata, 1.0f, d2, w2);
+   _mm_storeu_ps(der_y, finish_derivative_sse(d0, d1, d2, _mm_add_ps(_mm_add_ps(w0, w1), w2), p, p.cell_size_y));
+}
+
+TERRAIN_TARGET_SSE42 void horn_derivatives_sse(const TerrainKernelParameters& p, const float* top, const float* mid,
+                                               const float* bottom, int width, float* der_x, float* der_y) {
+   int col = 0;
+   for (; col + 4 <= width; col += 4) {
+      horn_derivatives4_sse(p, top + col, mid + col, bottom + col, der_x + col, der_y + col);
+   }
+   horn_derivatives_scalar(p, top, mid, bottom, col, width, der_x, der_y);
+}
+
+TERRAIN_TARGET_SSE42 void multidirectional_sse(const TerrainKernelParameters& p, const float* der_x,
+                                               const float* der_y, int width, float* output) {
+   const __m128 zero = _mm_setzero_ps();
+   const __m128 output_nodata = _mm_set1_ps(p.output_nodata);
+   const __m128 sin_altitude = _mm_set1_ps(p.cos_zenith);
+   const __m128 cos_altitude = _mm_set1_ps(p.sin_zenith);
+   const __m128 diagonal = _mm_set1_ps(p.sin_zenith * terrain_kernels::MultidirectionalHillshadeKernel::s_sqrt_half);
+   const __m128 flat = _mm_set1_ps(std::max(0.0f, 255.0f * p.cos_zenith));
+   int col = 0;
+   for (; col + 4 <= width; col += 4) {
+      const __m128 dx = _mm_loadu_ps(der_x + col);
+      const __m128 dy = _mm_loadu_ps(der_y + col);
+      const __m128 xx = _mm_mul_ps(dx, dx);
+      const __m128 yy = _mm_mul_ps(dy, dy);
+      const __m128 xx_plus_yy = _mm_add_ps(xx, yy);
+      const __m128 shade_225 = _mm_max_ps(_mm_add_ps(sin_altitude, _mm_mul_ps(_mm_add_ps(dx, dy), diagonal)), zero);
+      const __m128 shade_270 = _mm_max_ps(_mm_add_ps(sin_altitude, _mm_mul_ps(dx, cos_altitude)), zero);
+      const __m128 shade_315 = _mm_max_ps(_mm_add_ps(sin_altitude, _mm_mul_ps(_mm_sub_ps(dx, dy), diagonal)), zero);
+      const __m128 shade_360 = _mm_max_ps(_mm_sub_ps(sin_altitude, _mm_mul_ps(dy, cos_altitude)), zero);
+      const __m128 weight_225 = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(0.5f), xx_plus_yy), _mm_mul_ps(dx, dy));
+      const __m128 weight_315 = _mm_sub_ps(xx_plus_yy, weight_225);
+      __m128 shade = _mm_mul_ps(weight_225, shade_225);
+      shade = _mm_add_ps(shade, _mm_mul_ps(yy, shade_270));
+      shade = _mm_add_ps(shade, _mm_mul_ps(weight_315, shade_315));
+      shade = _mm_add_ps(shade, _mm_mul_ps(xx, shade_360));
+      shade = _mm_div_ps(_mm_div_ps(shade, xx_plus_yy), _mm_sqrt_ps(_mm_add_ps(_mm_set1_ps(1.0f), xx_plus_yy)));
+      __m128 result = _mm_mul_ps(_mm_set1_ps(255.0f), shade);
+      result = _mm_blendv_ps(result, flat, _mm_cmpeq_ps(xx_plus_yy, zero));
+      const __m128 nodata = _mm_or_ps(_mm_cmpeq_ps(dx, output_nodata), _mm_cmpeq_ps(dy, output_nodata));
+      _mm_storeu_ps(output + col, _mm_blendv_ps(result, output_nodata, nodata));
+   }
+   multidirectional_scalar(p, der_x, der_y, col, width, output);
+}
+
+// AVX2: the differences of eight cells per single precision register, summed in two double
+// precision registers.
+
+TERRAIN_TARGET_AVX2 inline void horn_term_avx2(__m256 low, __m256 centre, __m256 high, __m256 nodata, float scale,
+                                               __m256& diff, __m256& weight) {
+   const __m256 low_valid = _mm256_cmp_ps(low, nodata, _CMP_NEQ_UQ);
+   const __m256 high_valid = _mm256_cmp_ps(high, nodata, _CMP_NEQ_UQ);
+   const __m256 centre_valid = _mm256_cmp_ps(centre, nodata, _CMP_NEQ_UQ);
+   const __m256 both = _mm256_and_ps(low_valid, high_valid);
+   const __m256 low_only = _mm256_andnot_ps(high_valid, _mm256_and_ps(low_valid, centre_valid));
+   const __m256 high_only = _mm256_andnot_ps(low_valid, _mm256_and_ps(high_valid, centre_valid));
+
+   diff = _mm256_and_ps(high_only, _mm256_sub_ps(high, centre));
+   diff = _mm256_blendv_ps(diff, _mm256_sub_ps(centre, low), low_only);
+   diff = _mm256_blendv_ps(diff, _mm256_sub_ps(high, low), both);
+   diff = _mm256_mul_ps(diff, _mm256_set1_ps(scale));
+   weight = _mm256_or_ps(_mm256_and_ps(_mm256_or_ps(low_only, high_only), _mm256_set1_ps(scale)),
+                         _mm256_and_ps(both, _mm256_set1_ps(2.0f * scale)));
+}
+
+TERRAIN_TARGET_AVX2 inline __m128 finish_derivative4_avx2(__m256d d0, __m256d d1, __m256d d2, __m256d weight,
+                                                          const TerrainKernelParameters& p, double cell_size) {
+   const __m256d sum = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_setzero_pd(), d0), d1), d2);
+   const __m256d value = _mm256_mul_pd(_mm256_div_pd(sum, _mm256_mul_pd(weight, _mm256_set1_pd(cell_size))),
+                                       _mm256_set1_pd(p.z_factor));
+   const __m256d no_weight = _mm256_cmp_pd(weight, _mm256_setzero_pd(), _CMP_EQ_OQ);
+   return _mm256_cvtpd_ps(_mm256_blendv_pd(value, _mm256_set1_pd(p.output_nodata), no_weight));
+}
+
+TERRAIN_TARGET_AVX2 inline __m256 finish_derivative_avx2(__m256 d0, __m256 d1, __m256 d2, __m256 weight,
+                                                         const TerrainKernelParameters& p, double cell_size) {
+   const __m128 low = finish_derivative4_avx2(
+      _mm256_cvtps_pd(_mm256_castps256_ps128(d0)), _mm256_cvtps_pd(_mm256_castps256_ps128(d1)),
+      _mm256_cvtps_pd(_mm256_castps256_ps128(d2)), _mm256_cvtps_pd(_mm256_castps256_ps128(weight)), p, cell_size);
+   const __m128 high = finish_derivative4_avx2(
+      _mm256_cvtps_pd(_mm256_extractf128_ps(d0, 1)), _mm256_cvtps_pd(_mm256_extractf128_ps(d1, 1)),
+      _mm256_cvtps_pd(_mm256_extractf128_ps(d2, 1)), _mm256_cvtps_pd(_mm256_extractf128_ps(weight, 1)), p, cell_size);
+   return _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+}
+
+TERRAIN_TARGET_AVX2 inline void horn_derivatives8_avx2(const TerrainKernelParameters& p, const float* top,
+                                                       const float* mid, const float* bottom, float* der_x,
+                                                       float* der_y) {
+   const __m256 nodata = _mm256_set1_ps(p.input_nodata);
+   const __m256 t0 = _mm256_loadu_ps(top), t1 = _mm256_loadu_ps(top + 1), t2 = _mm256_loadu_ps(top + 2);
+   const __m256 m0 = _mm256_loadu_ps(mid), m1 = _mm256_loadu_ps(mid + 1), m2 = _mm256_loadu_ps(mid + 2);
+   const __m256 b0 = _mm256_loadu_ps(bottom), b1 = _mm256_loadu_ps(bottom + 1), b2 = _mm256_loadu_ps(bottom + 2);
+
+   __m256 d0, d1, d2, w0, w1, w2;
+   horn_term_avx2(t0, t1, t2, nodata, 1.0f, d0, w0);
+   horn_term_avx2(m0, m1, m2, nodata, 2.0f, d1, w1);
+   horn_term_avx2(b0, b1, b2, nodata, 1.0f, d2, w2);
+   _mm256_storeu_ps(der_x, finish_derivative_avx2(d0, d1, d2, _mm256_add_ps(_mm256_add_ps(w0, w1), w2), p,
+                                                  p.cell_size_x));
+
+   horn_term_avx2(b0, m0, t0, nodata, 1.0f, d0, w0);
+   horn_term_avx2(b1, m1, t1, nodata, 2.0f, d1, w1);
+   horn_term_avx2(b2, m2, t2, nodata, 1.0f, d2, w2);
+   _mm256_storeu_ps(der_y, finish_derivative_avx2(d0, d1, d2, _mm256_add_ps(_mm256_add_ps(w0, w1), w2), p,
+                                                  p.cell_size_y));
+}
+
+TERRAIN_TARGET_AVX2 void horn_derivatives_avx2(const TerrainKernelParameters& p, const float* top, const float* mid,
+                                               const float* bottom, int width, float* der_x, float* der_y) {
+   int col = 0;
+   for (; col + 8 <= width; col += 8) {
+      horn_derivatives8_avx2(p, top + col, mid + col, bottom + col, der_x + col, der_y + col);
+   }
+   horn_derivatives_scalar(p, top, mid, bottom, col, width, der_x, der_y);
+}
+
+TERRAIN_TARGET_AVX2 void multidirectional_avx2(const TerrainKernelParameters& p, const float* der_x,
+                                               const float* der_y, int width, float* output) {
+   const __m256 zero = _mm256_setzero_ps();
+   const __m256 output_nodata = _mm256_set1_ps(p.output_nodata);
+   const __m256 sin_altitude = _mm256_set1_ps(p.cos_zenith);
+   const __m256 cos_altitude = _mm256_set1_ps(p.sin_zenith);
+   const __m256 diagonal = _mm256_set1_ps(p.sin_zenith * terrain_kernels::MultidirectionalHillshadeKernel::s_sqrt_half);
+   const __m256 flat = _mm256_set1_ps(std::max(0.0f, 255.0f * p.cos_zenith));
+   int col = 0;
+   for (; col + 8 <= width; col += 8) {
+      const __m256 dx = _mm256_loadu_ps(der_x + col);
+      const __m256 dy = _mm256_loadu_ps(der_y + col);
+      const __m256 xx = _mm256_mul_ps(dx, dx);
+      const __m256 yy = _mm256_mul_ps(dy, dy);
+      const __m256 xx_plus_yy = _mm256_add_ps(xx, yy);
+      const __m256 shade_225 = _mm256_max_ps(_mm256_add_ps(sin_altitude, _mm256_mul_ps(_mm256_add_ps(dx, dy), diagonal)), zero);
+      const __m256 shade_270 = _mm256_max_ps(_mm256_add_ps(sin_altitude, _mm256_mul_ps(dx, cos_altitude)), zero);
+      const __m256 shade_315 = _mm256_max_ps(_mm256_add_ps(sin_altitude, _mm256_mul_ps(_mm256_sub_ps(dx, dy), diagonal)), zero);
+      const __m256 shade_360 = _mm256_max_ps(_mm256_sub_ps(sin_altitude, _mm256_mul_ps(dy, cos_altitude)), zero);
+      const __m256 weight_225 = _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), xx_plus_yy), _mm256_mul_ps(dx, dy));
+      const __m256 weight_315 = _mm256_sub_ps(xx_plus_yy, weight_225);
+      __m256 shade = _mm256_mul_ps(weight_225, shade_225);
+      shade = _mm256_add_ps(shade, _mm256_mul_ps(yy, shade_270));
+      shade = _mm256_add_ps(shade, _mm256_mul_ps(weight_315, shade_315));
+      shade = _mm256_add_ps(shade, _mm256_mul_ps(xx, shade_360));
+      shade = _mm256_div_ps(_mm256_div_ps(shade, xx_plus_yy),
+                            _mm256_sqrt_ps(_mm256_add_ps(_mm256_set1_ps(1.0f), xx_plus_yy)));
+      __m256 result = _mm256_mul_ps(_mm256_set1_ps(255.0f), shade);
+      result = _mm256_blendv_ps(result, flat, _mm256_cmp_ps(xx_plus_yy, zero, _CMP_EQ_OQ));
+      const __m256 nodata = _mm256_or_ps(_mm256_cmp_ps(dx, output_nodata, _CMP_EQ_OQ),
+                                         _mm256_cmp_ps(dy, output_nodata, _CMP_EQ_OQ));
+      _mm256_storeu_ps(output + col, _mm256_blendv_ps(result, output_nodata, nodata));
+   }
+   multidirectional_scalar(p, der_x, der_y, col, width, output);
+}
+
+#endif
+
+/// Slope, aspect and hillshade need atan, atan2, sin and cos in float. No vector implementation
+/// rounds like the C library QGIS calls, so they are finished one cell at a time.
+template <typename Kernel>
+void finish_row(const TerrainKernelParameters& p, const float* der_x, const float* der_y, int width, float* output) {
+   for (int col = 0; col < width; ++col) {
+      output[col] = Kernel::from_derivatives(p, der_x[col], der_y[col]);
+   }
+}
+
+}
+
+SimdLevel detect_simd_level() {
+#ifdef TERRAIN_SIMD_X86
+#ifdef _MSC_VER
+   int info[4];
+   __cpuid(info, 0);
+   const int max_leaf = info[0];
+   __cpuid(info, 1);
+   const bool sse42 = (info[2] & (1 << 20)) != 0;
+   const bool os_saves_avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0
+      && (_xgetbv(0) & 0x6) == 0x6;
+   bool avx2 = false;
+   if (max_leaf >= 7 && os_saves_avx) {
+      __cpuidex(info, 7, 0);
+      avx2 = (info[1] & (1 << 5)) != 0;
+   }
+#else
+   __builtin_cpu_init();
+   const bool sse42 = __builtin_cpu_supports("sse4.2");
+   const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+   if (avx2) {
+      return SimdLevel::Avx2;
+   }
+   if (sse42) {
+      return SimdLevel::Sse42;
+   }
+#endif
+   return SimdLevel::Scalar;
+}
+
+const char* simd_level_name(SimdLevel level) {
+   switch (level) {
+   case SimdLevel::Scalar:
+      return "scalar";
+   case SimdLevel::Sse42:
+      return "SSE4.2";
+   case SimdLevel::Avx2:
+      return "AVX2";
+   }
+   return "";
+}
+
+void horn_derivatives(SimdLevel level, const TerrainKernelParameters& p, const float* top, const float* mid,
+                      const float* bottom, int width, float* der_x, float* der_y) {
+   switch (level) {
+#ifdef TERRAIN_SIMD_X86
+   case SimdLevel::Avx2:
+      horn_derivatives_avx2(p, top, mid, bottom, width, der_x, der_y);
+      return;
+   case SimdLevel::Sse42:
+      horn_derivatives_sse(p, top, mid, bottom, width, der_x, der_y);
+      return;
+#endif
+   default:
+      horn_derivatives_scalar(p, top, mid, bottom, 0, width, der_x, der_y);
+      return;
+   }
+}
+
+void process_band(SimdLevel level, TerrainDerivative derivative, const TerrainKernelParameters& p, const float* input,
+                  int width, int row_count, float* output) {
+   switch (derivative) {
+   case TerrainDerivative::Slope:
+   case TerrainDerivative::Aspect:
+   case TerrainDerivative::Hillshade:
+   case TerrainDerivative::MultidirectionalHillshade:
+      break;
+   default:
+      terrain_kernels::process_band(derivative, p, input, width, row_count, output);
+      return;
+   }
+
+   const int stride = width + 2;
+   std::vector<float> derivatives(static_cast<std::size_t>(width) * 2);
+   float* der_x = derivatives.data();
+   float* der_y = der_x + width;
+   for (int row = 0; row < row_count; ++row) {
+      const float* top = input + static_cast<std::ptrdiff_t>(row) * stride;
+      const float* mid = top + stride;
+      const float* bottom = mid + stride;
+      float* out = output + static_cast<std::ptrdiff_t>(row) * width;
+      horn_derivatives(level, p, top, mid, bottom, width, der_x, der_y);
+
+      switch (derivative) {
+      case TerrainDerivative::Slope:
+         finish_row<terrain_kernels::SlopeKernel>(p, der_x, der_y, width, out);
+         break;
+      case TerrainDerivative::Aspect:
+         finish_row<terrain_kernels::AspectKernel>(p, der_x, der_y, width, out);
+         break;
+      case TerrainDerivative::Hillshade:
+         finish_row<terrain_kernels::HillshadeKernel>(p, der_x, der_y, width, out);
+         break;
+      default:
+#ifdef TERRAIN_SIMD_X86
+         if (level == SimdLevel::Avx2) {
+            multidirectional_avx2(p, der_x, der_y, width, out);
+            break;
+         }
+         if (level == SimdLevel::Sse42) {
+            multidirectional_sse(p, der_x, der_y, width, out);
+            break;
+         }
+#endif
+         multidirectional_scalar(p, der_x, der_y, 0, width, out);
+         break;
+      }
+   }
+}
+
+}
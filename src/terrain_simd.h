@@ -0,0 +1,46 @@
+#ifndef _TERRAIN_SIMD_H_
+#define _TERRAIN_SIMD_H_
+
+#include "terrain_kernels.h"
+
+/// Instruction sets the terrain kernels are compiled for.
+enum class SimdLevel {
+   Scalar,
+   Sse42,
+   Avx2
+};
+
+namespace terrain_simd {
+
+/// Returns the best instruction set supported by the running CPU.
+SimdLevel detect_simd_level();
+
+/// Returns a user visible name of an instruction set.
+const char* simd_level_name(SimdLevel level);
+
+/// @brief Computes the Horn derivatives of a whole row.
+///
+/// The results are bit-identical to terrain_kernels::derivative_x() and derivative_y()
+/// for every level: the nodata fallbacks are evaluated with masks instead of branches, the
+/// differences are taken in float lanes, eight per AVX2 instruction, and summed and divided in
+/// double lanes in the same order as the scalar code.
+/// @param top, mid, bottom Padded input rows, starting at the cell west of the first output cell.
+/// @param width Number of output cells.
+/// @param der_x, der_y Output derivatives, width cells each.
+void horn_derivatives(SimdLevel level, const TerrainKernelParameters& p, const float* top, const float* mid,
+                      const float* bottom, int width, float* der_x, float* der_y);
+
+/// @brief Vectorized counterpart of terrain_kernels::process_band().
+///
+/// Slope, aspect, hillshade and multidirectional hillshade compute their derivatives a row at
+/// a time with horn_derivatives(). The multidirectional hillshade, which only needs arithmetic
+/// and square roots, is finished with SIMD as well. Slope, aspect and hillshade apply their
+/// trigonometry with the C library in a scalar loop over the derivative rows, as no vector
+/// atan, atan2, sin and cos gives the same bits. Derivatives without a vectorized path fall
+/// back to terrain_kernels::process_band().
+void process_band(SimdLevel level, TerrainDerivative derivative, const TerrainKernelParameters& p, const float* input,
+                  int width, int row_count, float* output);
+
+}
+
+#endif
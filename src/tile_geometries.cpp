@@ -0,0 +1,319 @@
+#include "tile_geometries.h"
+
+#include <algorithm>
+
+namespace {
+
+/// Clip rectangle with the Liang-Barsky and Sutherland-Hodgman steps.
+struct ClipBox {
+   double xmin;
+   double ymin;
+   double xmax;
+   double ymax;
+
+   bool contains(double x, double y) const {
+      return x >= xmin && x <= xmax && y >= ymin && y <= ymax;
+   }
+
+   /// Clips the segment a + t (b - a), t in [0, 1], to the box.
+   /// @return False if the segment lies outside, otherwise the clipped range in t0 and t1.
+   bool clip_segment(double ax, double ay, double bx, double by, double& t0, double& t1) const {
+      t0 = 0.0;
+      t1 = 1.0;
+      const double dx = bx - ax;
+      const double dy = by - ay;
+      const double p[4] = {-dx, dx, -dy, dy};
+      const double q[4] = {ax - xmin, xmax - ax, ay - ymin, ymax - ay};
+      for (int edge = 0; edge < 4; ++edge) {
+         if (p[edge] == 0.0) {
+            if (q[edge] < 0.0) {
+               return false;
+            }
+            continue;
+         }
+         const double t = q[edge] / p[edge];
+         if (p[edge] < 0.0) {
+            t0 = std::max(t0, t);
+         } else {
+            t1 = std::min(t1, t);
+         }
+         if (t0 > t1) {
+            return false;
+         }
+      }
+      return true;
+   }
+
+   /// Clips a ring against one edge of the box, 0 to 3 for xmin, xmax, ymin and ymax.
+   void clip_ring(const std::vector<double>& ring, int edge, std::vector<double>& result) const {
+      result.clear();
+      const std::size_t count = ring.size() / 2;
+      auto inside = [&](std::size_t i) {
+         const double x = ring[2 * i];
+         const double y = ring[2 * i + 1];
+         switch (edge) {
+            case 0:
+               return x >= xmin;
+            case 1:
+               return x <= xmax;
+            case 2:
+               return y >= ymin;
+            default:
+               return y <= ymax;
+         }
+      };
+      auto intersect = [&](std::size_t i, std::size_t j) {
+         const double ax = ring[2 * i];
+         const double ay = ring[2 * i + 1];
+         const double bx = ring[2 * j];
+         const double by = ring[2 * j + 1];
+         if (edge < 2) {
+            const double x = edge == 0 ? xmin : xmax;
+            result.push_back(x);
+            result.push_back(ay + (by - ay) * (x - ax) / (bx - ax));
+         } else {
+            const double y = edge == 2 ? ymin : ymax;
+            result.push_back(ax + (bx - ax) * (y - ay) / (by - ay));
+            result.push_back(y);
+         }
+      };
+      for (std::size_t i = 0, previous = count - 1; i < count; previous = i++) {
+         const bool current_inside = inside(i);
+         if (current_inside != inside(previous)) {
+            intersect(previous, i);
+         }
+         if (current_inside) {
+            result.push_back(ring[2 * i]);
+            result.push_back(ring[2 * i + 1]);
+         }
+      }
+   }
+};
+
+/// Squared distance of point p from the segment a-b.
+double segment_distance2(const double* p, const double* a, const double* b) {
+   const double dx = b[0] - a[0];
+   const double dy = b[1] - a[1];
+   const double length2 = dx * dx + dy * dy;
+   double t = 0.0;
+   if (length2 > 0.0) {
+      t = std::clamp(((p[0] - a[0]) * dx + (p[1] - a[1]) * dy) / length2, 0.0, 1.0);
+   }
+   const double ex = a[0] + t * dx - p[0];
+   const double ey = a[1] + t * dy - p[1];
+   return ex * ex + ey * ey;
+}
+
+}
+
+void TileGeometries::clear() {
+   features.clear();
+   layers.clear();
+   feature_ends.clear();
+   part_ends.clear();
+   exterior.clear();
+   xy.clear();
+}
+
+bool TileGeometries::end_part(std::size_t min_vertices, bool exterior_ring) {
+   const std::size_t first = part_ends.empty() ? 0 : part_ends.back();
+   if (xy.size() / 2 - first < min_vertices) {
+      xy.resize(2 * first);
+      return false;
+   }
+   part_ends.push_back(static_cast<std::uint32_t>(xy.size() / 2));
+   exterior.push_back(exterior_ring ? 1 : 0);
+   return true;
+}
+
+bool TileGeometries::end_feature(std::uint32_t feature, std::uint16_t layer) {
+   const std::size_t first = feature_ends.empty() ? 0 : feature_ends.back();
+   if (part_ends.size() == first) {
+      return false;
+   }
+   features.push_back(feature);
+   layers.push_back(layer);
+   feature_ends.push_back(static_cast<std::uint32_t>(part_ends.size()));
+   return true;
+}
+
+void clip_tile_geometries(const TileGeometries& source, const std::vector<MvtGeometryType>& layer_types,
+                          const std::vector<char>& layer_active, double xmin, double ymin, double xmax, double ymax,
+                          TileGeometries& target) {
+   target.clear();
+   const ClipBox box = {xmin, ymin, xmax, ymax};
+   std::vector<double> ring;
+   std::vector<double> clipped;
+
+   for (std::size_t feature = 0; feature < source.feature_count(); ++feature) {
+      const std::uint16_t layer = source.layers[feature];
+      if (!layer_active[layer]) {
+         continue;
+      }
+      const std::uint32_t part_begin = source.first_part(feature);
+      const std::uint32_t part_end = source.feature_ends[feature];
+      const std::uint32_t vertex_begin = source.first_vertex(part_begin);
+      const std::uint32_t vertex_end = source.part_ends[part_end - 1];
+
+      // Most features lie completely inside or outside of a tile, decide those on the bounding box.
+      double fx0 = source.xy[2 * vertex_begin];
+      double fy0 = source.xy[2 * vertex_begin + 1];
+      double fx1 = fx0;
+      double fy1 = fy0;
+      for (std::uint32_t vertex = vertex_begin + 1; vertex < vertex_end; ++vertex) {
+         fx0 = std::min(fx0, source.xy[2 * vertex]);
+         fx1 = std::max(fx1, source.xy[2 * vertex]);
+         fy0 = std::min(fy0, source.xy[2 * vertex + 1]);
+         fy1 = std::max(fy1, source.xy[2 * vertex + 1]);
+      }
+      if (fx0 > xmax || fx1 < xmin || fy0 > ymax || fy1 < ymin) {
+         continue;
+      }
+      if (fx0 >= xmin && fx1 <= xmax && fy0 >= ymin && fy1 <= ymax) {
+         target.xy.insert(target.xy.end(), source.xy.begin() + 2 * vertex_begin, source.xy.begin() + 2 * vertex_end);
+         const std::uint32_t offset = static_cast<std::uint32_t>(target.xy.size() / 2) - vertex_end;
+         for (std::uint32_t part = part_begin; part < part_end; ++part) {
+            target.part_ends.push_back(source.part_ends[part] + offset);
+            target.exterior.push_back(source.exterior[part]);
+         }
+         target.end_feature(source.features[feature], layer);
+         continue;
+      }
+
+      switch (layer_types[layer]) {
+         case MvtGeometryType::Point:
+            for (std::uint32_t vertex = vertex_begin; vertex < vertex_end; ++vertex) {
+               if (box.contains(source.xy[2 * vertex], source.xy[2 * vertex + 1])) {
+                  target.add_vertex(source.xy[2 * vertex], source.xy[2 * vertex + 1]);
+               }
+            }
+            target.end_part(1);
+            break;
+
+         case MvtGeometryType::LineString:
+            for (std::uint32_t part = part_begin; part < part_end; ++part) {
+               // A new part starts wherever the line enters the box.
+               bool open = false;
+               for (std::uint32_t vertex = source.first_vertex(part); vertex + 1 < source.part_ends[part]; ++vertex) {
+                  const double ax = source.xy[2 * vertex];
+                  const double ay = source.xy[2 * vertex + 1];
+                  const double bx = source.xy[2 * vertex + 2];
+                  const double by = source.xy[2 * vertex + 3];
+                  double t0 = 0.0;
+                  double t1 = 1.0;
+                  if (!box.clip_segment(ax, ay, bx, by, t0, t1)) {
+                     if (open) {
+                        target.end_part(2);
+                        open = false;
+                     }
+                     continue;
+                  }
+                  if (!open || t0 > 0.0) {
+                     if (open) {
+                        target.end_part(2);
+                     }
+                     target.add_vertex(ax + t0 * (bx - ax), ay + t0 * (by - ay));
+                     open = true;
+                  }
+                  target.add_vertex(ax + t1 * (bx - ax), ay + t1 * (by - ay));
+                  if (t1 < 1.0) {
+                     target.end_part(2);
+                     open = false;
+                  }
+               }
+               if (open) {
+                  target.end_part(2);
+               }
+            }
+            break;
+
+         case MvtGeometryType::Polygon: {
+            bool exterior_kept = false;
+            for (std::uint32_t part = part_begin; part < part_end; ++part) {
+               const bool exterior_ring = source.exterior[part] != 0;
+               if (!exterior_ring && !exterior_kept) {
+                  continue;
+               }
+               ring.assign(source.xy.begin() + 2 * source.first_vertex(part), source.xy.begin() + 2 * source.part_ends[part]);
+               if (ring.size() >= 4 && ring[0] == ring[ring.size() - 2] && ring[1] == ring.back()) {
+                  ring.resize(ring.size() - 2);
+               }
+               for (int edge = 0; edge < 4 && ring.size() >= 6; ++edge) {
+                  box.clip_ring(ring, edge, clipped);
+                  ring.swap(clipped);
+               }
+               if (ring.size() >= 6) {
+                  target.xy.insert(target.xy.end(), ring.begin(), ring.end());
+                  target.add_vertex(ring[0], ring[1]);
+               }
+               const bool kept = target.end_part(4, exterior_ring);
+               if (exterior_ring) {
+                  exterior_kept = kept;
+               }
+            }
+            break;
+         }
+      }
+      target.end_feature(source.features[feature], layer);
+   }
+}
+
+void PartSimplifier::simplify(const double* xy, std::size_t count, double tolerance, bool ring, std::vector<double>& result) {
+   result.clear();
+   if (count <= (ring ? 4u : 2u) || tolerance <= 0.0) {
+      result.assign(xy, xy + 2 * count);
+      return;
+   }
+   const double tolerance2 = tolerance * tolerance;
+   const std::size_t last = count - 1;
+   m_keep.assign(count, 0);
+   m_keep[0] = 1;
+   m_keep[last] = 1;
+   m_stack.clear();
+   if (ring) {
+      std::size_t farthest = 1;
+      double farthest_distance = -1.0;
+      for (std::size_t i = 1; i < last; ++i) {
+         const double dx = xy[2 * i] - xy[0];
+         const double dy = xy[2 * i + 1] - xy[1];
+         if (dx * dx + dy * dy > farthest_distance) {
+            farthest_distance = dx * dx + dy * dy;
+            farthest = i;
+         }
+      }
+      m_keep[farthest] = 1;
+      m_stack.emplace_back(0, farthest);
+      m_stack.emplace_back(farthest, last);
+   } else {
+      m_stack.emplace_back(0, last);
+   }
+
+   while (!m_stack.empty()) {
+      const auto [first, end] = m_stack.back();
+      m_stack.pop_back();
+      if (end - first < 2) {
+         continue;
+      }
+      std::size_t split = first;
+      double split_distance = tolerance2;
+      for (std::size_t i = first + 1; i < end; ++i) {
+         const double distance = segment_distance2(xy + 2 * i, xy + 2 * first, xy + 2 * end);
+         if (distance > split_distance) {
+            split_distance = distance;
+            split = i;
+         }
+      }
+      if (split != first) {
+         m_keep[split] = 1;
+         m_stack.emplace_back(first, split);
+         m_stack.emplace_back(split, end);
+      }
+   }
+
+   for (std::size_t i = 0; i < count; ++i) {
+      if (m_keep[i]) {
+         result.push_back(xy[2 * i]);
+         result.push_back(xy[2 * i + 1]);
+      }
+   }
+}
@@ -0,0 +1,101 @@
+#ifndef _TILE_GEOMETRIES_H_
+#define _TILE_GEOMETRIES_H_
+
+#include "mvt_encoder.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/// @brief The feature geometries of one vector tile, in nested offset arrays.
+///
+/// Every feature consists of parts, every part of vertices: the parts of feature i are
+/// [feature_ends[i - 1], feature_ends[i]) and the vertices of part j are
+/// [part_ends[j - 1], part_ends[j]) of xy. A point feature has a single part holding all its
+/// points, a line feature one part per line string and a polygon feature one part per ring,
+/// each exterior ring followed by its interior rings.
+struct TileGeometries {
+   /// Index of every feature among the features of its layer.
+   std::vector<std::uint32_t> features;
+   /// Source layer of every feature.
+   std::vector<std::uint16_t> layers;
+   std::vector<std::uint32_t> feature_ends;
+   std::vector<std::uint32_t> part_ends;
+   /// Polygon rings only: 1 for exterior rings, 0 for interior rings.
+   std::vector<std::uint8_t> exterior;
+   /// Interleaved x and y coordinates.
+   std::vector<double> xy;
+
+   void clear();
+
+   std::size_t feature_count() const {
+      return features.size();
+   }
+
+   bool empty() const {
+      return features.empty();
+   }
+
+   std::uint32_t first_part(std::size_t feature) const {
+      return feature == 0 ? 0 : feature_ends[feature - 1];
+   }
+
+   std::uint32_t first_vertex(std::size_t part) const {
+      return part == 0 ? 0 : part_ends[part - 1];
+   }
+
+   void add_vertex(double x, double y) {
+      xy.push_back(x);
+      xy.push_back(y);
+   }
+
+   /// @brief Closes the part made of the vertices added since the previous part.
+   /// @param min_vertices Parts with fewer vertices are dropped.
+   /// @return False if the part was dropped.
+   bool end_part(std::size_t min_vertices, bool exterior_ring = false);
+
+   /// @brief Closes the feature made of the parts added since the previous feature.
+   /// @return False if the feature has no parts, it is dropped then.
+   bool end_feature(std::uint32_t feature, std::uint16_t layer);
+};
+
+/// @brief Clips the geometries of a tile to a rectangle, like clipping a parent tile to a child.
+///
+/// Points outside the rectangle are dropped, line strings are cut at the rectangle edges into
+/// separate parts, and polygon rings are clipped with the Sutherland-Hodgman algorithm, which
+/// may leave edges along the rectangle boundary but keeps every ring closed. Features lying
+/// completely inside the rectangle are copied unchanged.
+/// @param source The geometries to clip.
+/// @param layer_types Geometry type of every source layer.
+/// @param layer_active Features of layers with 0 here are dropped.
+/// @param xmin, ymin, xmax, ymax The clip rectangle.
+/// @param target Receives the clipped geometries, cleared first.
+void clip_tile_geometries(const TileGeometries& source, const std::vector<MvtGeometryType>& layer_types,
+                          const std::vector<char>& layer_active, double xmin, double ymin, double xmax, double ymax,
+                          TileGeometries& target);
+
+/// @brief Douglas-Peucker simplification of line strings and polygon rings.
+///
+/// Keeps the scratch buffers of the recursion between calls, one instance per thread.
+class PartSimplifier
+{
+public:
+   /// @brief Simplifies a part so no removed vertex lies farther than the tolerance from the result.
+   ///
+   /// Rings are split at the vertex farthest from their first vertex, so both halves keep
+   /// their extreme points. The first and last vertex are always kept, a closed ring stays
+   /// closed but may collapse to fewer than four vertices.
+   /// @param xy Interleaved coordinates.
+   /// @param count Number of vertices.
+   /// @param tolerance Maximum distance of removed vertices, in the units of xy.
+   /// @param ring True for polygon rings.
+   /// @param result Receives the kept vertices, interleaved.
+   void simplify(const double* xy, std::size_t count, double tolerance, bool ring, std::vector<double>& result);
+
+private:
+   std::vector<std::uint8_t> m_keep;
+   std::vector<std::pair<std::size_t, std::size_t>> m_stack;
+};
+
+#endif
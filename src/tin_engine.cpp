@@ -0,0 +1,132 @@
+#include "tin_engine.h"
+#include "delaunay_tin.h"
+#include "interpolator_points.h"
+#include "parallel_for.h"
+
+#include "qgscoordinatereferencesystem.h"
+#include "qgsfeaturesource.h"
+#include "qgsfeedback.h"
+#include "qgsogrutils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <gdal.h>
+
+TinEngine::TinEngine(const QList<QgsInterpolator::LayerData>& layer_data, const TinSettings& settings)
+   : m_layer_data(layer_data), m_settings(settings) {
+}
+
+int TinEngine::run(const QString& output_file, const QgsRectangle& extent, int columns, int rows, QgsFeedback* feedback) const {
+   if (m_layer_data.isEmpty() || columns <= 0 || rows <= 0 || extent.isEmpty()) {
+      return InvalidSource;
+   }
+
+   std::vector<double> x;
+   std::vector<double> y;
+   std::vector<double> values;
+   const QgsInterpolator::Result read_result = InterpolatorPoints(m_layer_data).read(x, y, values, feedback);
+   if (read_result == QgsInterpolator::Canceled) {
+      return Canceled;
+   }
+   if (read_result != QgsInterpolator::Success) {
+      return InvalidSource;
+   }
+   DelaunayTin tin;
+   tin.build(std::move(x), std::move(y), std::move(values));
+   if (tin.triangle_count() == 0) {
+      return InvalidSource;
+   }
+   if (feedback && feedback->isCanceled()) {
+      return Canceled;
+   }
+
+   GDALAllRegister();
+   GDALDriverH driver = GDALGetDriverByName(m_settings.output_format.toLocal8Bit().constData());
+   if (!driver || !GDALGetMetadataItem(driver, GDAL_DCAP_CREATE, nullptr)) {
+      return OutputDriverFailed;
+   }
+   char** options = nullptr;
+   options = CSLSetNameValue(options, "TILED", "YES");
+   options = CSLSetNameValue(options, "BIGTIFF", "IF_SAFER");
+   gdal::dataset_unique_ptr output(GDALCreate(driver, output_file.toUtf8().constData(), columns, rows, 1, GDT_Float32,
+                                              m_settings.output_format == QLatin1String("GTiff") ? options : nullptr));
+   CSLDestroy(options);
+   if (!output) {
+      return OutputCreateFailed;
+   }
+   const double cell_size_x = extent.width() / columns;
+   const double cell_size_y = extent.height() / rows;
+   double geo_transform[6] = {extent.xMinimum(), cell_size_x, 0.0, extent.yMaximum(), 0.0, -cell_size_y};
+   GDALSetGeoTransform(output.get(), geo_transform);
+   const QgsCoordinateReferenceSystem crs = m_layer_data.first().source ? m_layer_data.first().source->sourceCrs()
+                                                                        : QgsCoordinateReferenceSystem();
+   if (crs.isValid()) {
+      GDALSetProjection(output.get(), crs.toWkt(QgsCoordinateReferenceSystem::WKT_PREFERRED_GDAL).toUtf8().constData());
+   }
+   GDALRasterBandH output_band = GDALGetRasterBand(output.get(), 1);
+   GDALSetRasterNoDataValue(output_band, m_settings.output_nodata);
+
+   const int band_rows = std::max(1, m_settings.band_rows);
+   const std::size_t band_count = (static_cast<std::size_t>(rows) + band_rows - 1) / band_rows;
+   const int thread_count = resolve_thread_count(m_settings.thread_count);
+   const bool clough_tocher = m_settings.method == QgsTinInterpolator::CloughTocher;
+
+   std::vector<std::vector<float>> worker_buffers(thread_count);
+   std::vector<int> worker_hints(thread_count, 0);
+   std::mutex output_mutex;
+   std::size_t bands_done = 0;
+   std::atomic<bool> failed(false);
+   std::atomic<bool> canceled(false);
+
+   parallel_for(band_count, thread_count, [&](std::size_t band, int worker) {
+      if (canceled || failed) {
+         return;
+      }
+      if (feedback && feedback->isCanceled()) {
+         canceled = true;
+         return;
+      }
+      const int first_row = static_cast<int>(band) * band_rows;
+      const int row_count = std::min(band_rows, rows - first_row);
+      std::vector<float>& buffer = worker_buffers[worker];
+      buffer.resize(static_cast<std::size_t>(row_count) * columns);
+      // Consecutive cells mostly fall into the same or a neighbouring triangle. A cell outside
+      // the hull leaves the hint unchanged, so the walk restarts from the last triangle found.
+      int& hint = worker_hints[worker];
+
+      for (int row = 0; row < row_count; ++row) {
+         const double cell_y = extent.yMaximum() - (first_row + row + 0.5) * cell_size_y;
+         float* output_row = buffer.data() + static_cast<std::size_t>(row) * columns;
+         for (int col = 0; col < columns; ++col) {
+            const double cell_x = extent.xMinimum() + (col + 0.5) * cell_size_x;
+            double value = 0.0;
+            const bool inside = clough_tocher ? tin.interpolate_clough_tocher(cell_x, cell_y, value, hint)
+                                              : tin.interpolate_linear(cell_x, cell_y, value, hint);
+            output_row[col] = inside ? static_cast<float>(value) : m_settings.output_nodata;
+         }
+      }
+
+      std::lock_guard<std::mutex> lock(output_mutex);
+      if (GDALRasterIO(output_band, GF_Write, 0, first_row, columns, row_count, buffer.data(), columns, row_count,
+                       GDT_Float32, 0, 0) != CE_None) {
+         failed = true;
+         return;
+      }
+      ++bands_done;
+      if (feedback) {
+         feedback->setProgress(100.0 * static_cast<double>(bands_done) / static_cast<double>(band_count));
+      }
+   });
+
+   if (canceled) {
+      gdal::fast_delete_and_close(output, driver, output_file);
+      return Canceled;
+   }
+   if (failed) {
+      return WriteFailed;
+   }
+   return Success;
+}
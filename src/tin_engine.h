@@ -0,0 +1,70 @@
+#ifndef _TIN_ENGINE_H_
+#define _TIN_ENGINE_H_
+
+#include "qgsinterpolator.h"
+#include "qgsrectangle.h"
+#include "qgstininterpolator.h"
+
+#include <QList>
+#include <QString>
+
+class QgsFeedback;
+
+/// @brief Settings of a TIN interpolation engine run.
+struct TinSettings {
+   /// Interpolation inside the triangles, like QgsTinInterpolator.
+   QgsTinInterpolator::TinInterpolation method = QgsTinInterpolator::Linear;
+   /// Nodata value written to the output raster, also used for cells outside the convex hull.
+   float output_nodata = -9999.0f;
+   /// Number of raster rows interpolated by one work item.
+   int band_rows = 64;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+   /// GDAL short name of the output format.
+   QString output_format = QStringLiteral("GTiff");
+};
+
+/// @brief Parallel replacement of QgsTinInterpolator together with QgsGridFileWriter.
+///
+/// QgsTinInterpolator builds a QgsDualEdgeTriangulation by inserting the points one by one in
+/// input order, which becomes the bottleneck long before interpolation does on large point sets.
+/// This engine reads the points the same way, triangulates them with a DelaunayTin and
+/// interpolates bands of rows in parallel, every worker walking from the triangle of its
+/// previous cell. The result is written as binary blocks of a Float32 raster.
+///
+/// Break lines and structure lines are inserted as their vertices, without constraining the
+/// triangulation to the lines.
+class TinEngine
+{
+public:
+   /// Result codes of run().
+   enum Result {
+      Success = 0,
+      InvalidSource = 1,
+      OutputDriverFailed = 2,
+      OutputCreateFailed = 3,
+      WriteFailed = 4,
+      Canceled = 5
+   };
+
+   /// @brief Constructor.
+   /// @param layer_data The input sources, as for QgsTinInterpolator.
+   /// @param settings The interpolation and processing options.
+   TinEngine(const QList<QgsInterpolator::LayerData>& layer_data, const TinSettings& settings);
+
+   /// @brief Interpolates a grid into a raster file.
+   ///
+   /// Cells are sampled at their centres, like QgsGridFileWriter.
+   /// @param output_file Path of the Float32 raster to create.
+   /// @param extent Extent of the grid.
+   /// @param columns, rows Size of the grid in cells.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return One of the Result codes.
+   int run(const QString& output_file, const QgsRectangle& extent, int columns, int rows, QgsFeedback* feedback = nullptr) const;
+
+private:
+   QList<QgsInterpolator::LayerData> m_layer_data;
+   TinSettings m_settings;
+};
+
+#endif
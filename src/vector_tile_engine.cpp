@@ -0,0 +1,579 @@
+#include "vector_tile_engine.h"
+#include "feature_store.h"
+#include "mbtiles_writer.h"
+#include "mvt_encoder.h"
+#include "parallel_for.h"
+#include "tile_geometries.h"
+
+#include "qgscoordinatereferencesystem.h"
+#include "qgscoordinatetransform.h"
+#include "qgscurvepolygon.h"
+#include "qgsexception.h"
+#include "qgsexpressioncontextutils.h"
+#include "qgsfeatureiterator.h"
+#include "qgsfeaturerequest.h"
+#include "qgsfeedback.h"
+#include "qgsgeometrycollection.h"
+#include "qgslinestring.h"
+#include "qgspoint.h"
+#include "qgsvectorlayer.h"
+#include "qgsziputils.h"
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace {
+
+/// Half the width of the Web Mercator tile matrix, in metres.
+constexpr double s_web_mercator_max = 20037508.3427892;
+
+/// Number of times a tile over the byte budget is encoded again with stronger generalization.
+constexpr int s_budget_attempts = 6;
+
+/// A layer read into memory. Its ids and attributes are held in a feature store, its
+/// geometries in the root TileGeometries.
+struct SourceLayer {
+   QString name;
+   MvtGeometryType type = MvtGeometryType::Point;
+   int min_zoom = 0;
+   int max_zoom = 24;
+   FeatureStore features;
+};
+
+/// Everything read from the layers, shared read-only by all workers.
+struct SourceData {
+   std::vector<SourceLayer> layers;
+   std::vector<MvtGeometryType> layer_types;
+};
+
+/// A tile of the pyramid together with its clipped geometries.
+struct PyramidTile {
+   int zoom = 0;
+   int column = 0;
+   int row = 0;
+   TileGeometries geometries;
+};
+
+double tile_width(int zoom) {
+   return 2.0 * s_web_mercator_max / static_cast<double>(1 << zoom);
+}
+
+/// Appends the vertices of a curve as one part, segmentizing curved segments.
+bool add_curve(const QgsCurve* curve, TileGeometries& geometries, std::size_t min_vertices, bool exterior) {
+   std::unique_ptr<QgsLineString> segmentized;
+   const QgsLineString* line = dynamic_cast<const QgsLineString*>(curve);
+   if (!line) {
+      segmentized.reset(curve->curveToLine());
+      line = segmentized.get();
+   }
+   const double* x = line->xData();
+   const double* y = line->yData();
+   for (int i = 0; i < line->numPoints(); ++i) {
+      geometries.add_vertex(x[i], y[i]);
+   }
+   return geometries.end_part(min_vertices, exterior);
+}
+
+/// Appends the parts of a geometry of the layer type, skipping parts of other types. Every
+/// point becomes a part of its own.
+void add_geometry(const QgsAbstractGeometry* geometry, MvtGeometryType type, TileGeometries& geometries) {
+   if (const QgsGeometryCollection* collection = dynamic_cast<const QgsGeometryCollection*>(geometry)) {
+      for (int i = 0; i < collection->numGeometries(); ++i) {
+         add_geometry(collection->geometryN(i), type, geometries);
+      }
+      return;
+   }
+   if (type == MvtGeometryType::Point) {
+      if (const QgsPoint* point = dynamic_cast<const QgsPoint*>(geometry)) {
+         geometries.add_vertex(point->x(), point->y());
+         geometries.end_part(1);
+      }
+   } else if (type == MvtGeometryType::LineString) {
+      if (const QgsCurve* curve = dynamic_cast<const QgsCurve*>(geometry)) {
+         add_curve(curve, geometries, 2, false);
+      }
+   } else if (const QgsCurvePolygon* polygon = dynamic_cast<const QgsCurvePolygon*>(geometry)) {
+      if (!polygon->exteriorRing() || !add_curve(polygon->exteriorRing(), geometries, 4, true)) {
+         return;
+      }
+      for (int i = 0; i < polygon->numInteriorRings(); ++i) {
+         add_curve(polygon->interiorRing(i), geometries, 4, false);
+      }
+   }
+}
+
+/// Generalization applied when encoding a tile.
+struct Generalization {
+   double tolerance = 0.0;
+   VectorTileSmallFeatures small_features = VectorTileSmallFeatures::Keep;
+   double min_area = 0.0;
+   double min_length = 0.0;
+   /// Generalize the highest zoom level of every layer too.
+   bool all_zooms = false;
+};
+
+/// Scratch buffers of one worker.
+struct EncodeBuffers {
+   MvtGeometry geometry;
+   PartSimplifier simplifier;
+   std::vector<double> scaled;
+   std::vector<double> simplified;
+   std::vector<std::int32_t> coordinates;
+   std::vector<std::int32_t> points;
+};
+
+/// Area of a polygon feature or length of a line feature, in map units.
+double feature_size(const TileGeometries& geometries, std::size_t feature, MvtGeometryType type) {
+   const double* xy = geometries.xy.data();
+   double size = 0.0;
+   for (std::uint32_t part = geometries.first_part(feature); part < geometries.feature_ends[feature]; ++part) {
+      const std::uint32_t first = geometries.first_vertex(part);
+      const std::uint32_t end = geometries.part_ends[part];
+      double part_size = 0.0;
+      for (std::uint32_t vertex = first + 1; vertex < end; ++vertex) {
+         // Relative to the first vertex, to keep the precision of large Web Mercator coordinates.
+         const double ax = xy[2 * (vertex - 1)] - xy[2 * first];
+         const double ay = xy[2 * (vertex - 1) + 1] - xy[2 * first + 1];
+         const double bx = xy[2 * vertex] - xy[2 * first];
+         const double by = xy[2 * vertex + 1] - xy[2 * first + 1];
+         part_size += type == MvtGeometryType::Polygon ? 0.5 * (ax * by - bx * ay) : std::hypot(bx - ax, by - ay);
+      }
+      if (type == MvtGeometryType::Polygon) {
+         size += geometries.exterior[part] ? std::abs(part_size) : -std::abs(part_size);
+      } else {
+         size += part_size;
+      }
+   }
+   return size;
+}
+
+/// Encodes the features of a tile, returns an empty array if no feature is left.
+QByteArray encode_tile(const PyramidTile& tile, const SourceData& source, const VectorTileSettings& settings,
+                       const Generalization& generalization, EncodeBuffers& buffers) {
+   const TileGeometries& geometries = tile.geometries;
+   const double width = tile_width(tile.zoom);
+   const double left = -s_web_mercator_max + tile.column * width;
+   const double top = s_web_mercator_max - tile.row * width;
+   const double scale = settings.resolution / width;
+   MvtGeometry& geometry = buffers.geometry;
+   std::vector<std::int32_t>& coordinates = buffers.coordinates;
+   std::vector<std::int32_t>& points = buffers.points;
+
+   MvtTileEncoder encoder;
+   std::vector<std::uint32_t> tags;
+   std::size_t feature = 0;
+   while (feature < geometries.feature_count()) {
+      const std::uint16_t layer_index = geometries.layers[feature];
+      const SourceLayer& layer = source.layers[layer_index];
+      const bool visible = tile.zoom >= layer.min_zoom && tile.zoom <= layer.max_zoom;
+      if (visible) {
+         encoder.begin_layer(layer.name, settings.resolution);
+      }
+      // The highest zoom level of a layer keeps the full detail unless the tile is over budget.
+      const bool generalize = layer.type != MvtGeometryType::Point &&
+                              (generalization.all_zooms || tile.zoom < std::min(layer.max_zoom, settings.max_zoom));
+      const double tolerance = generalize ? generalization.tolerance : 0.0;
+      const VectorTileSmallFeatures small_features = generalize ? generalization.small_features : VectorTileSmallFeatures::Keep;
+      const double min_size = layer.type == MvtGeometryType::Polygon ? generalization.min_area : generalization.min_length;
+      double coalesced_area = 0.0;
+      for (; feature < geometries.feature_count() && geometries.layers[feature] == layer_index; ++feature) {
+         if (!visible) {
+            continue;
+         }
+         bool coalesce = false;
+         if (small_features != VectorTileSmallFeatures::Keep && min_size > 0.0) {
+            const double size = feature_size(geometries, feature, layer.type) *
+                                (layer.type == MvtGeometryType::Polygon ? scale * scale : scale);
+            if (size < min_size) {
+               if (small_features == VectorTileSmallFeatures::Drop || layer.type == MvtGeometryType::LineString) {
+                  continue;
+               }
+               coalesced_area += size;
+               if (coalesced_area < min_size) {
+                  continue;
+               }
+               coalesced_area -= min_size;
+               coalesce = true;
+            }
+         }
+
+         geometry.clear();
+         points.clear();
+         if (coalesce) {
+            // A square of the minimum area, centred on the bounding box of the polygon.
+            const std::uint32_t vertex_begin = geometries.first_vertex(geometries.first_part(feature));
+            const std::uint32_t vertex_end = geometries.part_ends[geometries.feature_ends[feature] - 1];
+            double x0 = geometries.xy[2 * vertex_begin];
+            double y0 = geometries.xy[2 * vertex_begin + 1];
+            double x1 = x0;
+            double y1 = y0;
+            for (std::uint32_t vertex = vertex_begin + 1; vertex < vertex_end; ++vertex) {
+               x0 = std::min(x0, geometries.xy[2 * vertex]);
+               x1 = std::max(x1, geometries.xy[2 * vertex]);
+               y0 = std::min(y0, geometries.xy[2 * vertex + 1]);
+               y1 = std::max(y1, geometries.xy[2 * vertex + 1]);
+            }
+            const std::int32_t side = std::max<std::int32_t>(1, static_cast<std::int32_t>(std::lround(std::sqrt(min_size))));
+            const std::int32_t x = static_cast<std::int32_t>(std::lround((0.5 * (x0 + x1) - left) * scale - 0.5 * side));
+            const std::int32_t y = static_cast<std::int32_t>(std::lround((top - 0.5 * (y0 + y1)) * scale - 0.5 * side));
+            const std::int32_t square[8] = {x, y, x, y + side, x + side, y + side, x + side, y};
+            geometry.add_ring(square, 4, true);
+         }
+         bool exterior_kept = false;
+         for (std::uint32_t part = geometries.first_part(feature); !coalesce && part < geometries.feature_ends[feature]; ++part) {
+            const std::uint32_t first = geometries.first_vertex(part);
+            const std::size_t count = geometries.part_ends[part] - first;
+            std::vector<double>& scaled = buffers.scaled;
+            scaled.resize(2 * count);
+            for (std::size_t i = 0; i < count; ++i) {
+               scaled[2 * i] = (geometries.xy[2 * (first + i)] - left) * scale;
+               scaled[2 * i + 1] = (top - geometries.xy[2 * (first + i) + 1]) * scale;
+            }
+            // Simplify in tile coordinates, before rounding.
+            const std::vector<double>* vertices = &scaled;
+            if (tolerance > 0.0) {
+               buffers.simplifier.simplify(scaled.data(), count, tolerance, layer.type == MvtGeometryType::Polygon, buffers.simplified);
+               vertices = &buffers.simplified;
+            }
+            const std::size_t vertex_count = vertices->size() / 2;
+            coordinates.resize(2 * vertex_count);
+            for (std::size_t i = 0; i < 2 * vertex_count; ++i) {
+               coordinates[i] = static_cast<std::int32_t>(std::lround((*vertices)[i]));
+            }
+            switch (layer.type) {
+               case MvtGeometryType::Point:
+                  // A multipoint is a single MoveTo, its parts are collected first.
+                  points.insert(points.end(), coordinates.begin(), coordinates.end());
+                  break;
+               case MvtGeometryType::LineString:
+                  geometry.add_line(coordinates.data(), vertex_count);
+                  break;
+               case MvtGeometryType::Polygon:
+                  // Interior rings of an exterior ring that collapsed are dropped with it.
+                  if (geometries.exterior[part]) {
+                     exterior_kept = geometry.add_ring(coordinates.data(), vertex_count, true);
+                  } else if (exterior_kept) {
+                     geometry.add_ring(coordinates.data(), vertex_count, false);
+                  }
+                  break;
+            }
+         }
+         geometry.add_points(points.data(), points.size() / 2);
+         if (geometry.empty()) {
+            continue;
+         }
+
+         const std::uint32_t row = geometries.features[feature];
+         const QgsFields& fields = layer.features.fields();
+         tags.clear();
+         for (int field = 0; field < fields.count(); ++field) {
+            const std::int64_t value = encoder.value_index(layer.features.attribute(row, field));
+            if (value >= 0) {
+               tags.push_back(encoder.key_index(fields.at(field).name()));
+               tags.push_back(static_cast<std::uint32_t>(value));
+            }
+         }
+         encoder.add_feature(static_cast<std::uint64_t>(layer.features.id(row)), layer.type, tags, geometry);
+      }
+      if (visible) {
+         encoder.end_layer();
+      }
+   }
+   return encoder.empty() ? QByteArray() : encoder.data();
+}
+
+}
+
+VectorTileEngine::VectorTileEngine(const QList<QgsVectorTileWriter::Layer>& layers, const VectorTileSettings& settings)
+   : m_layers(layers), m_settings(settings) {
+}
+
+int VectorTileEngine::write_mbtiles(const QString& output_file, const QgsCoordinateTransformContext& transform_context,
+                                    QgsFeedback* feedback) {
+   m_error_message.clear();
+   m_oversized_tiles = 0;
+   const int min_zoom = std::max(0, m_settings.min_zoom);
+   const int max_zoom = std::min(24, m_settings.max_zoom);
+   if (m_layers.isEmpty() || min_zoom > max_zoom || m_settings.resolution <= 0 || m_settings.tile_buffer < 0) {
+      m_error_message = QStringLiteral("Invalid layers or zoom levels");
+      return InvalidParameters;
+   }
+   if (QFile::exists(output_file)) {
+      m_error_message = QStringLiteral("The output file already exists: %1").arg(output_file);
+      return OutputCreateFailed;
+   }
+
+   // Read every layer once, transformed to the tile matrix CRS, into the geometries of the root tile.
+   const QgsCoordinateReferenceSystem web_mercator(QStringLiteral("EPSG:3857"));
+   SourceData source;
+   PyramidTile root;
+   QgsRectangle extent = m_settings.extent;
+   if (extent.isEmpty()) {
+      extent.setNull();
+   }
+   for (int layer_index = 0; layer_index < m_layers.size(); ++layer_index) {
+      const QgsVectorTileWriter::Layer& config = m_layers.at(layer_index);
+      QgsVectorLayer* layer = config.layer();
+      if (!layer || !layer->isSpatial()) {
+         m_error_message = QStringLiteral("Layer %1 is not a spatial vector layer").arg(layer_index);
+         return InvalidParameters;
+      }
+      SourceLayer source_layer;
+      source_layer.name = config.layerName().isEmpty() ? layer->name() : config.layerName();
+      source_layer.min_zoom = config.minZoom() >= 0 ? config.minZoom() : 0;
+      source_layer.max_zoom = config.maxZoom() >= 0 ? config.maxZoom() : 24;
+      source_layer.features.reset(layer->fields(), layer->fields().allAttributesList());
+      switch (QgsWkbTypes::geometryType(layer->wkbType())) {
+         case Qgis::GeometryType::Point:
+            source_layer.type = MvtGeometryType::Point;
+            break;
+         case Qgis::GeometryType::Line:
+            source_layer.type = MvtGeometryType::LineString;
+            break;
+         case Qgis::GeometryType::Polygon:
+            source_layer.type = MvtGeometryType::Polygon;
+            break;
+         default:
+            m_error_message = QStringLiteral("Layer %1 has an unsupported geometry type").arg(source_layer.name);
+            return InvalidParameters;
+      }
+
+      QgsFeatureRequest request;
+      request.setDestinationCrs(web_mercator, transform_context);
+      if (!m_settings.extent.isEmpty()) {
+         request.setFilterRect(m_settings.extent);
+      }
+      if (!config.filterExpression().isEmpty()) {
+         request.setFilterExpression(config.filterExpression());
+         request.setExpressionContext(layer->createExpressionContext());
+      }
+      QgsFeatureIterator iterator = layer->getFeatures(request);
+      QgsFeature feature;
+      const long long feature_count = layer->featureCount();
+      long long read = 0;
+      while (iterator.nextFeature(feature)) {
+         if (feedback && feedback->isCanceled()) {
+            return Canceled;
+         }
+         if (feedback && feature_count > 0 && ++read % 10000 == 0) {
+            feedback->setProgress(20.0 * (layer_index + static_cast<double>(read) / feature_count) / m_layers.size());
+         }
+         if (!feature.hasGeometry()) {
+            continue;
+         }
+         add_geometry(feature.geometry().constGet(), source_layer.type, root.geometries);
+         if (root.geometries.end_feature(static_cast<std::uint32_t>(source_layer.features.size()), static_cast<std::uint16_t>(layer_index))) {
+            source_layer.features.append(feature, false);
+            if (m_settings.extent.isEmpty()) {
+               extent.combineExtentWith(feature.geometry().boundingBox());
+            }
+         }
+      }
+      source_layer.features.finish();
+      source.layer_types.push_back(source_layer.type);
+      source.layers.push_back(std::move(source_layer));
+   }
+   if (root.geometries.empty() || extent.isNull()) {
+      m_error_message = QStringLiteral("No features to write");
+      return InvalidParameters;
+   }
+
+   MbTilesWriter writer(static_cast<std::size_t>(std::max(1, m_settings.batch_size)));
+   if (!writer.create(output_file)) {
+      m_error_message = writer.error();
+      return OutputCreateFailed;
+   }
+   const QgsCoordinateTransform to_wgs84(web_mercator, QgsCoordinateReferenceSystem(QStringLiteral("EPSG:4326")), transform_context);
+   QgsRectangle bounds;
+   try {
+      bounds = to_wgs84.transformBoundingBox(extent);
+   } catch (QgsCsException&) {
+      bounds = QgsRectangle(-180.0, -85.0511, 180.0, 85.0511);
+   }
+   QJsonArray vector_layers;
+   for (const SourceLayer& layer : source.layers) {
+      QJsonObject fields;
+      for (const QgsField& field : layer.features.fields()) {
+         fields.insert(field.name(), field.isNumeric() ? QStringLiteral("Number")
+                                     : field.type() == QVariant::Bool ? QStringLiteral("Boolean") : QStringLiteral("String"));
+      }
+      QJsonObject vector_layer;
+      vector_layer.insert(QStringLiteral("id"), layer.name);
+      vector_layer.insert(QStringLiteral("fields"), fields);
+      vector_layer.insert(QStringLiteral("minzoom"), std::max(min_zoom, layer.min_zoom));
+      vector_layer.insert(QStringLiteral("maxzoom"), std::min(max_zoom, layer.max_zoom));
+      vector_layers.append(vector_layer);
+   }
+   QVariantMap metadata = m_settings.metadata;
+   if (!metadata.contains(QStringLiteral("name"))) {
+      metadata.insert(QStringLiteral("name"), QStringLiteral("unnamed"));
+   }
+   metadata.insert(QStringLiteral("format"), QStringLiteral("pbf"));
+   metadata.insert(QStringLiteral("minzoom"), QString::number(min_zoom));
+   metadata.insert(QStringLiteral("maxzoom"), QString::number(max_zoom));
+   metadata.insert(QStringLiteral("bounds"), QStringLiteral("%1,%2,%3,%4")
+                                                .arg(bounds.xMinimum())
+                                                .arg(bounds.yMinimum())
+                                                .arg(bounds.xMaximum())
+                                                .arg(bounds.yMaximum()));
+   metadata.insert(QStringLiteral("json"), QString::fromUtf8(QJsonDocument(QJsonObject{{QStringLiteral("vector_layers"), vector_layers}})
+                                                               .toJson(QJsonDocument::Compact)));
+   for (auto it = metadata.constBegin(); it != metadata.constEnd(); ++it) {
+      writer.set_metadata(it.key(), it.value().toString());
+   }
+
+   const int thread_count = resolve_thread_count(m_settings.thread_count);
+   std::vector<std::vector<char>> layer_active(max_zoom + 1, std::vector<char>(source.layers.size(), 0));
+   for (int zoom = 0; zoom <= max_zoom; ++zoom) {
+      for (std::size_t layer = 0; layer < source.layers.size(); ++layer) {
+         layer_active[zoom][layer] = zoom <= source.layers[layer].max_zoom;
+      }
+   }
+   std::vector<EncodeBuffers> worker_buffers(thread_count);
+   Generalization base_generalization;
+   base_generalization.tolerance = std::max(0.0, m_settings.simplify_tolerance);
+   base_generalization.small_features = m_settings.small_features;
+   base_generalization.min_area = std::max(0.0, m_settings.min_polygon_area);
+   base_generalization.min_length = std::max(0.0, m_settings.min_line_length);
+   std::atomic<bool> canceled(false);
+   std::atomic<bool> write_failed(false);
+   std::atomic<int> oversized_tiles(0);
+
+   auto write_tile = [&](const PyramidTile& tile, int worker) {
+      if (tile.zoom < min_zoom) {
+         return;
+      }
+      Generalization generalization = base_generalization;
+      QByteArray compressed;
+      for (int attempt = 0;; ++attempt) {
+         const QByteArray data = encode_tile(tile, source, m_settings, generalization, worker_buffers[worker]);
+         if (data.isEmpty()) {
+            return;
+         }
+         compressed.clear();
+         if (!QgsZipUtils::encodeGzip(data, compressed)) {
+            write_failed = true;
+            return;
+         }
+         if (m_settings.max_tile_bytes <= 0 || compressed.size() <= m_settings.max_tile_bytes) {
+            break;
+         }
+         if (attempt == s_budget_attempts) {
+            ++oversized_tiles;
+            break;
+         }
+         // Over budget: generalize every zoom level, double the tolerance and the minimum sizes.
+         generalization.all_zooms = true;
+         generalization.tolerance = 2.0 * std::max(0.5, generalization.tolerance);
+         generalization.min_area = 4.0 * std::max(0.25, generalization.min_area);
+         generalization.min_length = 2.0 * std::max(0.5, generalization.min_length);
+         if (generalization.small_features == VectorTileSmallFeatures::Keep) {
+            generalization.small_features = VectorTileSmallFeatures::Drop;
+         }
+      }
+      if (!writer.add_tile(tile.zoom, tile.column, tile.row, compressed)) {
+         write_failed = true;
+      }
+   };
+
+   // Clips the geometries of a tile to one of its children, with the buffer of the child.
+   const double buffer_ratio = static_cast<double>(m_settings.tile_buffer) / m_settings.resolution;
+   auto clip_child = [&](const PyramidTile& parent, int child, PyramidTile& result) {
+      result.zoom = parent.zoom + 1;
+      result.column = 2 * parent.column + (child & 1);
+      result.row = 2 * parent.row + (child >> 1);
+      const double width = tile_width(result.zoom);
+      const double left = -s_web_mercator_max + result.column * width;
+      const double top = s_web_mercator_max - result.row * width;
+      result.geometries.clear();
+      if (left > extent.xMaximum() || left + width < extent.xMinimum() || top < extent.yMinimum() || top - width > extent.yMaximum()) {
+         return;
+      }
+      const double buffer = width * buffer_ratio;
+      clip_tile_geometries(parent.geometries, source.layer_types, layer_active[result.zoom], left - buffer, top - width - buffer,
+                           left + width + buffer, top + buffer, result.geometries);
+   };
+
+   // Split the top levels level by level until there are enough tiles to keep every worker busy.
+   std::vector<PyramidTile> level;
+   level.push_back(std::move(root));
+   while (level.front().zoom < max_zoom && level.size() < 4 * static_cast<std::size_t>(thread_count)) {
+      std::vector<PyramidTile> children(4 * level.size());
+      parallel_for(level.size(), thread_count, [&](std::size_t index, int worker) {
+         if (canceled || write_failed) {
+            return;
+         }
+         if (feedback && feedback->isCanceled()) {
+            canceled = true;
+            return;
+         }
+         write_tile(level[index], worker);
+         for (int child = 0; child < 4; ++child) {
+            clip_child(level[index], child, children[4 * index + child]);
+         }
+         level[index].geometries = TileGeometries();
+      });
+      if (canceled || write_failed) {
+         break;
+      }
+      children.erase(std::remove_if(children.begin(), children.end(), [](const PyramidTile& tile) { return tile.geometries.empty(); }),
+                     children.end());
+      level.swap(children);
+      if (level.empty()) {
+         break;
+      }
+   }
+
+   // Complete every remaining tile depth-first, reusing one child tile per depth and worker.
+   const int subtree_zoom = level.empty() ? max_zoom : level.front().zoom;
+   std::vector<std::vector<PyramidTile>> worker_children(thread_count, std::vector<PyramidTile>(max_zoom - subtree_zoom + 1));
+   std::atomic<std::size_t> subtrees_done(0);
+   std::function<void(const PyramidTile&, int)> complete = [&](const PyramidTile& tile, int worker) {
+      if (canceled || write_failed) {
+         return;
+      }
+      if (feedback && feedback->isCanceled()) {
+         canceled = true;
+         return;
+      }
+      write_tile(tile, worker);
+      if (tile.zoom == max_zoom) {
+         return;
+      }
+      PyramidTile& child_tile = worker_children[worker][tile.zoom + 1 - subtree_zoom];
+      for (int child = 0; child < 4; ++child) {
+         clip_child(tile, child, child_tile);
+         if (!child_tile.geometries.empty()) {
+            complete(child_tile, worker);
+         }
+      }
+   };
+   parallel_for(level.size(), thread_count, [&](std::size_t index, int worker) {
+      complete(level[index], worker);
+      level[index].geometries = TileGeometries();
+      const std::size_t done = ++subtrees_done;
+      if (feedback && worker == 0) {
+         feedback->setProgress(20.0 + 80.0 * static_cast<double>(done) / static_cast<double>(level.size()));
+      }
+   });
+
+   const bool written = writer.finish();
+   m_oversized_tiles = oversized_tiles;
+   if (canceled) {
+      return Canceled;
+   }
+   if (write_failed || !written) {
+      m_error_message = writer.error();
+      return WriteFailed;
+   }
+   return Success;
+}
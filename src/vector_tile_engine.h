@@ -0,0 +1,117 @@
+#ifndef _VECTOR_TILE_ENGINE_H_
+#define _VECTOR_TILE_ENGINE_H_
+
+#include "qgscoordinatetransformcontext.h"
+#include "qgsrectangle.h"
+#include "qgsvectortilewriter.h"
+
+#include <QList>
+#include <QString>
+#include <QVariantMap>
+
+class QgsFeedback;
+
+/// Handling of polygons and lines below the minimum size of VectorTileSettings.
+enum class VectorTileSmallFeatures {
+   /// Small features are written like all others.
+   Keep,
+   /// Small features are dropped.
+   Drop,
+   /// Small lines are dropped, and the area of small polygons is accumulated per layer and tile:
+   /// whenever it reaches the minimum area, a square of that area is written in place of the
+   /// polygon, so dense areas keep their density at low zoom levels.
+   Coalesce
+};
+
+/// @brief Settings of a vector tile engine run.
+struct VectorTileSettings {
+   /// Lowest zoom level written.
+   int min_zoom = 0;
+   /// Highest zoom level written, at most 24.
+   int max_zoom = 4;
+   /// Extent to generate tiles for in EPSG:3857, empty for the extent of all features.
+   QgsRectangle extent;
+   /// Size of a tile in tile coordinates, like QgsVectorTileMVTEncoder::setResolution().
+   int resolution = 4096;
+   /// Margin around every tile in tile coordinates, like QgsVectorTileMVTEncoder::setTileBuffer().
+   int tile_buffer = 256;
+   /// Douglas-Peucker tolerance in tile coordinates, applied before the coordinates are rounded.
+   /// 0 writes all vertices.
+   double simplify_tolerance = 0.0;
+   /// What to do with features below min_polygon_area or min_line_length.
+   VectorTileSmallFeatures small_features = VectorTileSmallFeatures::Keep;
+   /// Polygons with a smaller area in square tile coordinates are small features.
+   double min_polygon_area = 0.0;
+   /// Lines with a smaller length in tile coordinates are small features.
+   double min_line_length = 0.0;
+   /// Maximum size of a compressed tile in bytes, 0 for no limit. Larger tiles are encoded again
+   /// with doubled tolerance and minimum sizes, small features dropped, until they fit.
+   int max_tile_bytes = 0;
+   /// Number of tiles written per SQLite transaction.
+   int batch_size = 1000;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+   /// Additional MBTiles metadata such as name, description or attribution.
+   QVariantMap metadata;
+};
+
+/// @brief Parallel replacement of QgsVectorTileWriter for MBTiles output.
+///
+/// QgsVectorTileWriter::writeTiles() visits every tile of every zoom level in turn, and for
+/// each tile QgsVectorTileMVTEncoder::addLayer() requests the features of the tile extent
+/// from the layer and transforms and clips them again. This engine reads each layer once,
+/// transformed to EPSG:3857, and partitions the features top-down through the pyramid: the
+/// geometries of every child tile are clipped from those of its parent, so every level only
+/// clips what is left of the level above. The top levels are split level by level on all
+/// cores until there are enough tiles to go around, then every worker completes whole
+/// subtrees depth-first. Tiles are encoded as Mapbox vector tiles, compressed with gzip and
+/// handed to a single MbTilesWriter.
+///
+/// Below the highest zoom level of a layer its features may be simplified and small features
+/// dropped or coalesced, see VectorTileSettings; the highest level keeps the full detail, as
+/// clients overzoom it. Vertices that collapse onto their neighbours when rounded to tile
+/// coordinates are always removed.
+///
+/// Tiles use the Web Mercator tile matrix, and tiles without features are not written.
+class VectorTileEngine
+{
+public:
+   /// Result codes of write_mbtiles().
+   enum Result {
+      Success = 0,
+      InvalidParameters = 1,
+      OutputCreateFailed = 2,
+      WriteFailed = 3,
+      Canceled = 4
+   };
+
+   /// @brief Constructor.
+   /// @param layers The layers to export, with their filters, names and zoom ranges.
+   /// @param settings The tiling and processing options.
+   VectorTileEngine(const QList<QgsVectorTileWriter::Layer>& layers, const VectorTileSettings& settings);
+
+   /// @brief Writes the tile pyramid into a new MBTiles file.
+   /// @param output_file Path of the file to create.
+   /// @param transform_context Transform context for the transformation of the layers to EPSG:3857.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return One of the Result codes, error_message() describes failures.
+   int write_mbtiles(const QString& output_file, const QgsCoordinateTransformContext& transform_context,
+                     QgsFeedback* feedback = nullptr);
+
+   QString error_message() const {
+      return m_error_message;
+   }
+
+   /// Number of tiles of the last run that exceeded max_tile_bytes even after generalization.
+   int oversized_tiles() const {
+      return m_oversized_tiles;
+   }
+
+private:
+   QList<QgsVectorTileWriter::Layer> m_layers;
+   VectorTileSettings m_settings;
+   QString m_error_message;
+   int m_oversized_tiles = 0;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#include "worker_pool.h"
+#include "parallel_for.h"
+
+WorkerPool::WorkerPool(int thread_count) {
+   const int count = resolve_thread_count(thread_count);
+   m_threads.reserve(count);
+   for (int worker = 0; worker < count; ++worker) {
+      m_threads.emplace_back(&WorkerPool::work, this, worker);
+   }
+}
+
+WorkerPool::~WorkerPool() {
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+   }
+   m_start.notify_all();
+   for (std::thread& thread : m_threads) {
+      thread.join();
+   }
+}
+
+void WorkerPool::run_task(std::size_t count, const std::function<void(std::size_t, int)>& task) {
+   std::lock_guard<std::mutex> run_lock(m_run_mutex);
+   std::exception_ptr error;
+   {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_task = &task;
+      m_count = count;
+      m_next = 0;
+      m_failed = false;
+      m_error = nullptr;
+      m_busy = static_cast<int>(m_threads.size());
+      ++m_generation;
+      m_start.notify_all();
+      m_done.wait(lock, [this]() { return m_busy == 0; });
+      m_task = nullptr;
+      error = m_error;
+      m_error = nullptr;
+   }
+   if (error) {
+      std::rethrow_exception(error);
+   }
+}
+
+void WorkerPool::work(int worker) {
+   std::uint64_t generation = 0;
+   for (;;) {
+      const std::function<void(std::size_t, int)>* task = nullptr;
+      std::size_t count = 0;
+      {
+         std::unique_lock<std::mutex> lock(m_mutex);
+         m_start.wait(lock, [&]() { return m_stop || m_generation != generation; });
+         if (m_stop) {
+            return;
+         }
+         generation = m_generation;
+         task = m_task;
+         count = m_count;
+      }
+      try {
+         for (std::size_t i = m_next++; i < count && !m_failed; i = m_next++) {
+            (*task)(i, worker);
+         }
+      } catch (...) {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         if (!m_error) {
+            m_error = std::current_exception();
+         }
+         m_failed = true;
+      }
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (--m_busy == 0) {
+         m_done.notify_all();
+      }
+   }
+}
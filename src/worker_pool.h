@@ -0,0 +1,76 @@
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// @brief A fixed set of worker threads that live as long as the pool.
+///
+/// parallel_for() starts new threads on every call, so state that QGIS keeps per thread, such
+/// as the PROJ context and the PROJ objects of a coordinate transform with the grid shift
+/// files they have opened, is set up again by every call. The threads of a WorkerPool run the
+/// tasks of all run() calls, so that state is created once per thread and reused.
+class WorkerPool
+{
+public:
+   /// @brief Starts the threads.
+   /// @param thread_count Number of threads, 0 selects one thread per hardware core.
+   explicit WorkerPool(int thread_count);
+
+   /// Stops and joins the threads.
+   ~WorkerPool();
+
+   WorkerPool(const WorkerPool&) = delete;
+   WorkerPool& operator=(const WorkerPool&) = delete;
+
+   int thread_count() const {
+      return static_cast<int>(m_threads.size());
+   }
+
+   /// @brief Runs func(index, worker) for every index in [0, count) on the threads of the pool.
+   ///
+   /// Like parallel_for(), indices are handed out dynamically, the worker id lies in
+   /// [0, thread_count()) and always names the same thread, and the first exception thrown by
+   /// func stops the remaining work and is rethrown to the caller. Blocks until all indices are
+   /// done. Calls from several threads run one after the other.
+   /// @param func Callable taking (std::size_t index, int worker).
+   template <typename Func>
+   void run(std::size_t count, Func&& func) {
+      if (count == 0) {
+         return;
+      }
+      const std::function<void(std::size_t, int)> task = std::ref(func);
+      run_task(count, task);
+   }
+
+private:
+   void run_task(std::size_t count, const std::function<void(std::size_t, int)>& task);
+   void work(int worker);
+
+   /// Serializes run() calls.
+   std::mutex m_run_mutex;
+   std::mutex m_mutex;
+   std::condition_variable m_start;
+   std::condition_variable m_done;
+   /// Task of the current run, set while m_busy is positive.
+   const std::function<void(std::size_t, int)>* m_task = nullptr;
+   std::size_t m_count = 0;
+   std::atomic<std::size_t> m_next{0};
+   std::atomic<bool> m_failed{false};
+   std::exception_ptr m_error;
+   /// Incremented by every run, the threads wait for a new value.
+   std::uint64_t m_generation = 0;
+   /// Threads that have not finished the current run.
+   int m_busy = 0;
+   bool m_stop = false;
+   std::vector<std::thread> m_threads;
+};
+
+#endif
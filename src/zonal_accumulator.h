@@ -0,0 +1,306 @@
+#ifndef _ZONAL_ACCUMULATOR_H_
+#define _ZONAL_ACCUMULATOR_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// @brief Maps raster values to the bins of a ZonalHistogram.
+///
+/// Integer rasters with a small value range get one bin per value, which makes the
+/// histogram statistics exact. Other rasters, floating point ones in particular, get
+/// bin_count bins of equal width between the band minimum and maximum. Their median and
+/// quantiles are interpolated within a bin, so they are only exact to one bin width, and
+/// majority, minority and variety count bins rather than distinct values.
+struct HistogramBinning {
+   double low = 0.0;
+   double bin_width = 1.0;
+   std::uint32_t bin_count = 0;
+   /// One bin per integer value starting at low.
+   bool integer_bins = false;
+
+   std::uint32_t bin_of(double value) const {
+      const double bin = std::floor((value - low) / bin_width);
+      if (bin <= 0.0) {
+         return 0;
+      }
+      return bin >= bin_count ? bin_count - 1 : static_cast<std::uint32_t>(bin);
+   }
+
+   /// Representative value of a bin, the value itself for integer bins.
+   double bin_value(std::uint32_t bin) const {
+      return integer_bins ? low + bin : low + (bin + 0.5) * bin_width;
+   }
+};
+
+/// @brief Weighted value histogram of one zone with bounded memory.
+///
+/// The occupied bins are kept in a list sorted by bin, and the histogram only switches to a
+/// dense array of all bins once that array takes less memory than the list. A zone therefore
+/// needs 16 bytes per occupied bin, at most 8 bytes per bin of the binning, so the thousands
+/// of zones of a large polygon layer over an Int16 or UInt16 raster only pay for the values
+/// they contain. The memory is independent of the number of cells.
+class ZonalHistogram
+{
+public:
+   void add(std::uint32_t bin, double weight, const HistogramBinning& binning) {
+      if (!m_dense.empty()) {
+         m_dense[bin] += weight;
+         return;
+      }
+      const auto entry = std::lower_bound(m_sparse.begin(), m_sparse.end(), bin,
+                                          [](const std::pair<std::uint32_t, double>& a, std::uint32_t b) { return a.first < b; });
+      if (entry != m_sparse.end() && entry->first == bin) {
+         entry->second += weight;
+         return;
+      }
+      // An entry takes twice the memory of a dense bin.
+      if (2 * (m_sparse.size() + 1) <= binning.bin_count) {
+         m_sparse.emplace(entry, bin, weight);
+         return;
+      }
+      make_dense(binning);
+      m_dense[bin] += weight;
+   }
+
+   void merge(const ZonalHistogram& other, const HistogramBinning& binning) {
+      if (!other.m_dense.empty()) {
+         make_dense(binning);
+         for (std::size_t bin = 0; bin < m_dense.size(); ++bin) {
+            m_dense[bin] += other.m_dense[bin];
+         }
+         return;
+      }
+      if (!m_dense.empty()) {
+         for (const std::pair<std::uint32_t, double>& entry : other.m_sparse) {
+            m_dense[entry.first] += entry.second;
+         }
+         return;
+      }
+      // Both lists are sorted, so they are merged in one pass.
+      std::vector<std::pair<std::uint32_t, double>> merged;
+      merged.reserve(m_sparse.size() + other.m_sparse.size());
+      auto a = m_sparse.begin();
+      auto b = other.m_sparse.begin();
+      while (a != m_sparse.end() || b != other.m_sparse.end()) {
+         if (b == other.m_sparse.end() || (a != m_sparse.end() && a->first < b->first)) {
+            merged.push_back(*a++);
+         } else if (a == m_sparse.end() || b->first < a->first) {
+            merged.push_back(*b++);
+         } else {
+            merged.emplace_back(a->first, a->second + b->second);
+            ++a;
+            ++b;
+         }
+      }
+      m_sparse = std::move(merged);
+      if (2 * m_sparse.size() > binning.bin_count) {
+         make_dense(binning);
+      }
+   }
+
+   /// @brief Returns the weighted q-quantile, q in [0, 1].
+   ///
+   /// Integer bins return the exact value, averaging the two middle values when the
+   /// quantile falls between them like QgsZonalStatistics does for the median. Other bins
+   /// interpolate linearly inside the bin.
+   double quantile(double q, const HistogramBinning& binning) const {
+      const std::vector<std::pair<std::uint32_t, double>> bins = occupied_bins();
+      double total = 0.0;
+      for (const std::pair<std::uint32_t, double>& entry : bins) {
+         total += entry.second;
+      }
+      if (total <= 0.0) {
+         return std::numeric_limits<double>::quiet_NaN();
+      }
+      const double target = std::clamp(q, 0.0, 1.0) * total;
+      double cumulative = 0.0;
+      for (std::size_t i = 0; i < bins.size(); ++i) {
+         const double before = cumulative;
+         cumulative += bins[i].second;
+         if (cumulative < target && i + 1 < bins.size()) {
+            continue;
+         }
+         if (!binning.integer_bins) {
+            const double fraction = bins[i].second > 0.0 ? (target - before) / bins[i].second : 0.5;
+            return binning.low + (bins[i].first + std::clamp(fraction, 0.0, 1.0)) * binning.bin_width;
+         }
+         const double value = binning.bin_value(bins[i].first);
+         if (cumulative == target && i + 1 < bins.size() && q > 0.0) {
+            return (value + binning.bin_value(bins[i + 1].first)) / 2.0;
+         }
+         return value;
+      }
+      return binning.bin_value(bins.back().first);
+   }
+
+   /// Value of the heaviest bin, the smallest one on ties.
+   double majority(const HistogramBinning& binning) const {
+      return extreme_bin(binning, true);
+   }
+
+   /// Value of the lightest occupied bin, the smallest one on ties.
+   double minority(const HistogramBinning& binning) const {
+      return extreme_bin(binning, false);
+   }
+
+   /// Number of occupied bins, the number of distinct values for integer bins.
+   std::size_t variety() const {
+      return occupied_bins().size();
+   }
+
+private:
+   void make_dense(const HistogramBinning& binning) {
+      if (!m_dense.empty()) {
+         return;
+      }
+      m_dense.assign(binning.bin_count, 0.0);
+      for (const std::pair<std::uint32_t, double>& entry : m_sparse) {
+         m_dense[entry.first] += entry.second;
+      }
+      m_sparse = {};
+   }
+
+   /// Occupied bins in ascending bin order.
+   std::vector<std::pair<std::uint32_t, double>> occupied_bins() const {
+      std::vector<std::pair<std::uint32_t, double>> bins;
+      if (m_dense.empty()) {
+         bins = m_sparse;
+      } else {
+         for (std::size_t bin = 0; bin < m_dense.size(); ++bin) {
+            if (m_dense[bin] > 0.0) {
+               bins.emplace_back(static_cast<std::uint32_t>(bin), m_dense[bin]);
+            }
+         }
+      }
+      return bins;
+   }
+
+   double extreme_bin(const HistogramBinning& binning, bool heaviest) const {
+      const std::vector<std::pair<std::uint32_t, double>> bins = occupied_bins();
+      if (bins.empty()) {
+         return std::numeric_limits<double>::quiet_NaN();
+      }
+      std::size_t best = 0;
+      for (std::size_t i = 1; i < bins.size(); ++i) {
+         if (heaviest ? bins[i].second > bins[best].second : bins[i].second < bins[best].second) {
+            best = i;
+         }
+      }
+      return binning.bin_value(bins[best].first);
+   }
+
+   /// Occupied bins in ascending bin order, while the histogram is not dense.
+   std::vector<std::pair<std::uint32_t, double>> m_sparse;
+   std::vector<double> m_dense;
+};
+
+/// @brief Running statistics of the raster cells of one zone.
+///
+/// Moments are kept with the weighted form of Welford's algorithm and merged with Chan's
+/// formula, so partial results of the raster tiles a zone covers can be combined in any
+/// order. Cell weights are the covered fraction of the cell, or 1 for cell centre selection.
+struct ZonalAccumulator {
+   double count = 0.0;
+   double sum = 0.0;
+   double mean = 0.0;
+   /// Weighted sum of squared differences from the mean.
+   double m2 = 0.0;
+   double min = std::numeric_limits<double>::max();
+   double max = std::numeric_limits<double>::lowest();
+   /// Weight per distinct value, only filled when requested and no histogram is used.
+   std::unordered_map<double, double> value_counts;
+   /// Bounded value histogram, only filled when a binning is passed to add().
+   ZonalHistogram histogram;
+
+   /// @brief Adds one cell value.
+   /// @param weight Weight of the cell in (0, 1].
+   /// @param count_values Also count the value for majority, minority and variety.
+   /// @param binning If set, tracks the value in the histogram instead of value_counts.
+   void add(double value, double weight, bool count_values, const HistogramBinning* binning = nullptr) {
+      count += weight;
+      sum += value * weight;
+      const double delta = value - mean;
+      mean += delta * weight / count;
+      m2 += weight * delta * (value - mean);
+      if (value < min) {
+         min = value;
+      }
+      if (value > max) {
+         max = value;
+      }
+      if (binning) {
+         histogram.add(binning->bin_of(value), weight, *binning);
+      } else if (count_values) {
+         value_counts[value] += weight;
+      }
+   }
+
+   /// Adds the cells of another accumulator.
+   void merge(const ZonalAccumulator& other, const HistogramBinning* binning = nullptr) {
+      if (other.count == 0.0) {
+         return;
+      }
+      if (count == 0.0) {
+         *this = other;
+         return;
+      }
+      const double total = count + other.count;
+      const double delta = other.mean - mean;
+      mean += delta * other.count / total;
+      m2 += other.m2 + delta * delta * count * other.count / total;
+      count = total;
+      sum += other.sum;
+      min = std::min(min, other.min);
+      max = std::max(max, other.max);
+      for (const auto& [value, cells] : other.value_counts) {
+         value_counts[value] += cells;
+      }
+      if (binning) {
+         histogram.merge(other.histogram, *binning);
+      }
+   }
+
+   /// Population variance, like QgsZonalStatistics.
+   double variance() const {
+      return count > 0.0 ? m2 / count : std::numeric_limits<double>::quiet_NaN();
+   }
+
+   /// Most frequent value, the smallest one on ties.
+   double majority() const {
+      return most_frequent(true);
+   }
+
+   /// Least frequent value, the smallest one on ties.
+   double minority() const {
+      return most_frequent(false);
+   }
+
+   /// Number of distinct values.
+   std::size_t variety() const {
+      return value_counts.size();
+   }
+
+private:
+   double most_frequent(bool highest) const {
+      double best_value = std::numeric_limits<double>::quiet_NaN();
+      double best_count = 0.0;
+      bool first = true;
+      for (const auto& [value, cells] : value_counts) {
+         const bool better = highest ? cells > best_count : cells < best_count;
+         if (first || better || (cells == best_count && value < best_value)) {
+            best_value = value;
+            best_count = cells;
+            first = false;
+         }
+      }
+      return best_value;
+   }
+};
+
+#endif
@@ -0,0 +1,415 @@
+#include "zonal_engine.h"
+#include "parallel_for.h"
+#include "polygon_rasterizer.h"
+#include "zonal_accumulator.h"
+
+#include "qgsfeatureiterator.h"
+#include "qgsfeaturerequest.h"
+#include "qgsfeedback.h"
+#include "qgsgeometry.h"
+#include "qgsproject.h"
+#include "qgsrasterblock.h"
+#include "qgsrasterdataprovider.h"
+#include "qgsrasterlayer.h"
+#include "qgsvectordataprovider.h"
+#include "qgsvectorlayer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace {
+
+/// The cells of one zone inside one raster tile.
+struct TileSpan {
+   std::uint32_t zone;
+   int row;
+   int col_begin;
+   int col_end;
+   float fraction;
+};
+
+/// Number of mutexes guarding the per-zone accumulators, zone z is guarded by z % s_zone_lock_count.
+constexpr std::size_t s_zone_lock_count = 1024;
+
+/// Output order of the statistics, the same as QgsZonalStatistics.
+const QList<QgsZonalStatistics::Statistic> s_statistics_order = {
+   QgsZonalStatistics::Count,
+   QgsZonalStatistics::Sum,
+   QgsZonalStatistics::Mean,
+   QgsZonalStatistics::Median,
+   QgsZonalStatistics::StDev,
+   QgsZonalStatistics::Min,
+   QgsZonalStatistics::Max,
+   QgsZonalStatistics::Range,
+   QgsZonalStatistics::Minority,
+   QgsZonalStatistics::Majority,
+   QgsZonalStatistics::Variety,
+   QgsZonalStatistics::Variance
+};
+
+void geometry_to_rings(const QgsGeometry& geometry, PolygonRings& rings) {
+   rings.clear();
+   const QgsMultiPolygonXY parts = geometry.isMultipart() ? geometry.asMultiPolygon() : QgsMultiPolygonXY({geometry.asPolygon()});
+   for (const QgsPolygonXY& polygon : parts) {
+      for (int ring = 0; ring < polygon.size(); ++ring) {
+         for (const QgsPointXY& point : polygon.at(ring)) {
+            rings.add_point(point.x(), point.y());
+         }
+         rings.close_ring_oriented(ring == 0);
+      }
+   }
+}
+
+QString unique_field_name(const QString& name, const QgsFields& fields, const QList<QgsField>& new_fields) {
+   auto exists = [&](const QString& candidate) {
+      if (fields.lookupField(candidate) >= 0) {
+         return true;
+      }
+      return std::any_of(new_fields.begin(), new_fields.end(), [&](const QgsField& field) { return field.name() == candidate; });
+   };
+   QString candidate = name;
+   for (int suffix = 1; exists(candidate); ++suffix) {
+      candidate = QStringLiteral("%1_%2").arg(name).arg(suffix);
+   }
+   return candidate;
+}
+
+/// @brief Chooses the histogram bins for a raster band.
+/// @return False if the band has no valid range.
+bool histogram_binning(QgsRasterDataProvider* provider, int band, int bin_count, HistogramBinning& binning) {
+   static constexpr double s_max_integer_bins = 65536.0;
+   double low = 0.0;
+   double high = 0.0;
+   bool integer = true;
+   switch (provider->dataType(band)) {
+   case Qgis::DataType::Byte:
+      high = 255.0;
+      break;
+   case Qgis::DataType::Int8:
+      low = -128.0;
+      high = 127.0;
+      break;
+   case Qgis::DataType::UInt16:
+      high = 65535.0;
+      break;
+   case Qgis::DataType::Int16:
+      low = -32768.0;
+      high = 32767.0;
+      break;
+   default: {
+      const QgsRasterBandStats stats = provider->bandStatistics(band, QgsRasterBandStats::Min | QgsRasterBandStats::Max);
+      low = stats.minimumValue;
+      high = stats.maximumValue;
+      integer = provider->dataType(band) == Qgis::DataType::Int32 || provider->dataType(band) == Qgis::DataType::UInt32;
+      break;
+   }
+   }
+   if (!(high >= low)) {
+      return false;
+   }
+
+   binning.low = low;
+   binning.integer_bins = integer && high - low < s_max_integer_bins;
+   if (binning.integer_bins) {
+      binning.bin_width = 1.0;
+      binning.bin_count = static_cast<std::uint32_t>(high - low) + 1;
+   } else {
+      binning.bin_count = static_cast<std::uint32_t>(std::max(1, bin_count));
+      binning.bin_width = high > low ? (high - low) / binning.bin_count : 1.0;
+   }
+   return true;
+}
+
+QVariant statistic_value(const ZonalAccumulator& zone, QgsZonalStatistics::Statistic statistic, const HistogramBinning* binning) {
+   switch (statistic) {
+   case QgsZonalStatistics::Count:
+      return zone.count;
+   case QgsZonalStatistics::Sum:
+      return zone.sum;
+   default:
+      break;
+   }
+   if (zone.count == 0.0) {
+      return QVariant();
+   }
+   switch (statistic) {
+   case QgsZonalStatistics::Mean:
+      return zone.mean;
+   case QgsZonalStatistics::StDev:
+      return std::sqrt(zone.variance());
+   case QgsZonalStatistics::Min:
+      return zone.min;
+   case QgsZonalStatistics::Max:
+      return zone.max;
+   case QgsZonalStatistics::Range:
+      return zone.max - zone.min;
+   case QgsZonalStatistics::Median:
+      return binning ? zone.histogram.quantile(0.5, *binning) : QVariant();
+   case QgsZonalStatistics::Minority:
+      return binning ? zone.histogram.minority(*binning) : zone.minority();
+   case QgsZonalStatistics::Majority:
+      return binning ? zone.histogram.majority(*binning) : zone.majority();
+   case QgsZonalStatistics::Variety:
+      return static_cast<qlonglong>(binning ? zone.histogram.variety() : zone.variety());
+   case QgsZonalStatistics::Variance:
+      return zone.variance();
+   default:
+      return QVariant();
+   }
+}
+
+}
+
+ZonalEngine::ZonalEngine(QgsVectorLayer* polygon_layer, QgsRasterLayer* raster_layer, const ZonalSettings& settings)
+   : m_polygon_layer(polygon_layer), m_raster_layer(raster_layer), m_settings(settings) {
+}
+
+QgsZonalStatistics::Statistics ZonalEngine::supported_statistics(bool histograms) {
+   const QgsZonalStatistics::Statistics histogram_statistics = histograms ? QgsZonalStatistics::Median : QgsZonalStatistics::Statistics();
+   return histogram_statistics | QgsZonalStatistics::Count | QgsZonalStatistics::Sum | QgsZonalStatistics::Mean | QgsZonalStatistics::StDev
+      | QgsZonalStatistics::Min | QgsZonalStatistics::Max | QgsZonalStatistics::Range | QgsZonalStatistics::Minority
+      | QgsZonalStatistics::Majority | QgsZonalStatistics::Variety | QgsZonalStatistics::Variance;
+}
+
+QgsZonalStatistics::Result ZonalEngine::calculate_statistics(QgsFeedback* feedback) {
+   if (!m_polygon_layer || !m_polygon_layer->isValid()) {
+      return QgsZonalStatistics::LayerInvalid;
+   }
+   if (m_polygon_layer->geometryType() != Qgis::GeometryType::Polygon) {
+      return QgsZonalStatistics::LayerTypeWrong;
+   }
+   QgsVectorDataProvider* vector_provider = m_polygon_layer->dataProvider();
+   if (!vector_provider) {
+      return QgsZonalStatistics::LayerInvalid;
+   }
+   if (!m_raster_layer || !m_raster_layer->isValid() || !m_raster_layer->dataProvider()) {
+      return QgsZonalStatistics::RasterInvalid;
+   }
+   if (m_settings.raster_band < 1 || m_settings.raster_band > m_raster_layer->bandCount()) {
+      return QgsZonalStatistics::RasterBandInvalid;
+   }
+
+   const bool histograms = m_settings.histogram_bins > 0;
+   const QgsZonalStatistics::Statistics statistics = m_settings.statistics & supported_statistics(histograms);
+   const bool count_values = statistics & (QgsZonalStatistics::Minority | QgsZonalStatistics::Majority | QgsZonalStatistics::Variety);
+
+   HistogramBinning binning;
+   const bool use_histograms = histograms && (count_values || statistics.testFlag(QgsZonalStatistics::Median) || !m_settings.quantiles.isEmpty());
+   if (use_histograms && !histogram_binning(m_raster_layer->dataProvider(), m_settings.raster_band, m_settings.histogram_bins, binning)) {
+      return QgsZonalStatistics::RasterBandInvalid;
+   }
+   const HistogramBinning* zone_binning = use_histograms ? &binning : nullptr;
+   const bool coverage = m_settings.cell_selection == ZonalCellSelection::CoverageFraction;
+
+   const QgsRectangle raster_extent = m_raster_layer->extent();
+   RasterGrid grid;
+   grid.origin_x = raster_extent.xMinimum();
+   grid.origin_y = raster_extent.yMaximum();
+   grid.cell_size_x = m_raster_layer->rasterUnitsPerPixelX();
+   grid.cell_size_y = m_raster_layer->rasterUnitsPerPixelY();
+   grid.width = m_raster_layer->width();
+   grid.height = m_raster_layer->height();
+
+   // Create the output fields.
+   QList<QgsField> new_fields;
+   QList<QgsZonalStatistics::Statistic> output_statistics;
+   for (QgsZonalStatistics::Statistic statistic : s_statistics_order) {
+      if (!statistics.testFlag(statistic)) {
+         continue;
+      }
+      const QString name = unique_field_name(m_settings.attribute_prefix + QgsZonalStatistics::shortName(statistic),
+                                             m_polygon_layer->fields(), new_fields);
+      const bool integer = statistic == QgsZonalStatistics::Variety;
+      new_fields << QgsField(name, integer ? QVariant::LongLong : QVariant::Double);
+      output_statistics << statistic;
+   }
+   QList<double> quantiles;
+   if (use_histograms) {
+      for (double quantile : m_settings.quantiles) {
+         if (quantile <= 0.0 || quantile >= 1.0) {
+            continue;
+         }
+         const QString name = unique_field_name(m_settings.attribute_prefix + QStringLiteral("q%1").arg(quantile * 100.0),
+                                                m_polygon_layer->fields(), new_fields);
+         new_fields << QgsField(name, QVariant::Double);
+         quantiles << quantile;
+      }
+   }
+   const int tile_size = std::max(16, m_settings.tile_size);
+   const int tiles_x = (grid.width + tile_size - 1) / tile_size;
+   const int tiles_y = (grid.height + tile_size - 1) / tile_size;
+   const std::size_t tile_count = static_cast<std::size_t>(tiles_x) * tiles_y;
+   const int thread_count = resolve_thread_count(m_settings.thread_count);
+
+   // Rasterize the zones batch by batch and bucket their spans by tile.
+   std::vector<std::vector<TileSpan>> tiles(tile_count);
+   std::vector<QgsFeatureId> zone_ids;
+   const long long feature_count = std::max<long long>(1, m_polygon_layer->featureCount());
+
+   QgsFeatureRequest request;
+   request.setNoAttributes();
+   request.setDestinationCrs(m_raster_layer->crs(), QgsProject::instance()->transformContext());
+   QgsFeatureIterator features = m_polygon_layer->getFeatures(request);
+
+   const std::size_t batch_size = static_cast<std::size_t>(std::max(1, m_settings.batch_size));
+   std::vector<PolygonRings> batch_rings(batch_size);
+   std::vector<std::vector<CoverageRun>> batch_runs(batch_size);
+   std::vector<std::vector<ScanlineSpan>> worker_spans(thread_count);
+
+   auto flush_batch = [&](std::size_t count) {
+      const std::uint32_t first_zone = static_cast<std::uint32_t>(zone_ids.size() - count);
+      parallel_for(count, thread_count, [&](std::size_t i, int worker) {
+         std::vector<CoverageRun>& runs = batch_runs[i];
+         runs.clear();
+         if (coverage) {
+            rasterize_polygon_coverage(batch_rings[i], grid, runs);
+            return;
+         }
+         std::vector<ScanlineSpan>& spans = worker_spans[worker];
+         spans.clear();
+         rasterize_polygon(batch_rings[i], grid, spans);
+         for (const ScanlineSpan& span : spans) {
+            runs.push_back({span.row, span.col_begin, span.col_end, 1.0f});
+         }
+      });
+      for (std::size_t i = 0; i < count; ++i) {
+         const std::uint32_t zone = first_zone + static_cast<std::uint32_t>(i);
+         for (const CoverageRun& run : batch_runs[i]) {
+            const std::size_t tile_row = static_cast<std::size_t>(run.row / tile_size) * tiles_x;
+            for (int col = run.col_begin; col < run.col_end;) {
+               const int tile_col = col / tile_size;
+               const int end = std::min(run.col_end, (tile_col + 1) * tile_size);
+               tiles[tile_row + tile_col].push_back({zone, run.row, col, end, run.fraction});
+               col = end;
+            }
+         }
+      }
+   };
+
+   QgsFeature feature;
+   std::size_t batch_count = 0;
+   while (features.nextFeature(feature)) {
+      if (feedback && feedback->isCanceled()) {
+         return QgsZonalStatistics::Canceled;
+      }
+      geometry_to_rings(feature.geometry(), batch_rings[batch_count++]);
+      zone_ids.push_back(feature.id());
+      if (batch_count == batch_size) {
+         flush_batch(batch_count);
+         batch_count = 0;
+         if (feedback) {
+            feedback->setProgress(40.0 * static_cast<double>(zone_ids.size()) / static_cast<double>(feature_count));
+         }
+      }
+   }
+   flush_batch(batch_count);
+   batch_rings.clear();
+   batch_runs.clear();
+
+   // Reduce the zones of every tile, reading each tile once. Raster providers are not thread
+   // safe, so every worker reads through its own clone.
+   std::vector<std::unique_ptr<QgsRasterDataProvider>> providers(thread_count);
+   for (std::unique_ptr<QgsRasterDataProvider>& provider : providers) {
+      provider.reset(m_raster_layer->dataProvider()->clone());
+   }
+
+   // The partial results of a tile are merged into the zones as soon as the tile is done, so
+   // memory is bounded by the zones and the tiles in flight, not by the number of tiles a zone
+   // spans. Merges follow the completion order of the tiles.
+   std::vector<ZonalAccumulator> zones(zone_ids.size());
+   std::vector<std::mutex> zone_locks(s_zone_lock_count);
+   std::atomic<bool> canceled(false);
+   std::atomic<bool> read_failed(false);
+   std::atomic<std::size_t> tiles_done(0);
+   parallel_for(tile_count, thread_count, [&](std::size_t tile, int worker) {
+      std::vector<TileSpan> spans = std::move(tiles[tile]);
+      if (spans.empty() || canceled || read_failed) {
+         return;
+      }
+      if (feedback && feedback->isCanceled()) {
+         canceled = true;
+         return;
+      }
+
+      const int first_row = static_cast<int>(tile / tiles_x) * tile_size;
+      const int first_col = static_cast<int>(tile % tiles_x) * tile_size;
+      const int rows = std::min(tile_size, grid.height - first_row);
+      const int cols = std::min(tile_size, grid.width - first_col);
+      const QgsRectangle extent(grid.origin_x + first_col * grid.cell_size_x,
+                                grid.origin_y - (first_row + rows) * grid.cell_size_y,
+                                grid.origin_x + (first_col + cols) * grid.cell_size_x,
+                                grid.origin_y - first_row * grid.cell_size_y);
+      std::unique_ptr<QgsRasterBlock> block(providers[worker]->block(m_settings.raster_band, extent, cols, rows));
+      if (!block || !block->isValid()) {
+         // Skipping the tile would silently drop its cells from every zone.
+         read_failed = true;
+         return;
+      }
+
+      std::vector<std::pair<std::uint32_t, ZonalAccumulator>> results;
+      for (const TileSpan& span : spans) {
+         if (results.empty() || results.back().first != span.zone) {
+            results.emplace_back(span.zone, ZonalAccumulator());
+         }
+         ZonalAccumulator& zone = results.back().second;
+         const int row = span.row - first_row;
+         for (int col = span.col_begin; col < span.col_end; ++col) {
+            bool is_nodata = false;
+            const double value = block->valueAndNoData(row, col - first_col, is_nodata);
+            if (!is_nodata && !std::isnan(value)) {
+               zone.add(value, span.fraction, count_values, zone_binning);
+            }
+         }
+      }
+      for (const std::pair<std::uint32_t, ZonalAccumulator>& result : results) {
+         std::lock_guard<std::mutex> lock(zone_locks[result.first % s_zone_lock_count]);
+         zones[result.first].merge(result.second, zone_binning);
+      }
+
+      const std::size_t done = ++tiles_done;
+      if (feedback && worker == 0) {
+         feedback->setProgress(40.0 + 55.0 * static_cast<double>(done) / static_cast<double>(tile_count));
+      }
+   });
+   if (canceled) {
+      return QgsZonalStatistics::Canceled;
+   }
+   if (read_failed) {
+      return QgsZonalStatistics::RasterInvalid;
+   }
+
+   // The fields are only added once the statistics are complete, so a canceled or failed run
+   // leaves the layer unchanged. The statistics are written in one batch.
+   if (!vector_provider->addAttributes(new_fields)) {
+      return QgsZonalStatistics::FailedToCreateField;
+   }
+   m_polygon_layer->updateFields();
+   QList<int> field_indices;
+   for (const QgsField& field : new_fields) {
+      field_indices << m_polygon_layer->fields().lookupField(field.name());
+   }
+   QgsChangedAttributesMap changes;
+   for (std::size_t zone = 0; zone < zones.size(); ++zone) {
+      QgsAttributeMap attributes;
+      for (int i = 0; i < output_statistics.size(); ++i) {
+         attributes.insert(field_indices.at(i), statistic_value(zones[zone], output_statistics.at(i), zone_binning));
+      }
+      for (int i = 0; i < quantiles.size(); ++i) {
+         const double value = zones[zone].histogram.quantile(quantiles.at(i), binning);
+         attributes.insert(field_indices.at(output_statistics.size() + i), std::isnan(value) ? QVariant() : QVariant(value));
+      }
+      changes.insert(zone_ids[zone], attributes);
+   }
+   vector_provider->changeAttributeValues(changes);
+
+   if (feedback) {
+      feedback->setProgress(100.0);
+   }
+   return QgsZonalStatistics::Success;
+}
@@ -0,0 +1,86 @@
+#ifndef _ZONAL_ENGINE_H_
+#define _ZONAL_ENGINE_H_
+
+#include "qgszonalstatistics.h"
+
+#include <QList>
+#include <QString>
+
+class QgsFeedback;
+class QgsRasterLayer;
+class QgsVectorLayer;
+
+/// How the cells of a zone are selected.
+enum class ZonalCellSelection {
+   /// Cells whose centre lies inside the polygon, each with weight 1, like QgsZonalStatistics.
+   CellCentre,
+   /// Every cell touched by the polygon, weighted by the exact fraction of its area inside.
+   CoverageFraction
+};
+
+/// @brief Settings of a zonal statistics engine run.
+struct ZonalSettings {
+   /// Prefix of the output field names.
+   QString attribute_prefix;
+   /// Raster band to calculate the statistics for.
+   int raster_band = 1;
+   /// Statistics to calculate, see ZonalEngine::supported_statistics().
+   QgsZonalStatistics::Statistics statistics = QgsZonalStatistics::Count | QgsZonalStatistics::Sum | QgsZonalStatistics::Mean;
+   /// Selection and weighting of the cells of a zone.
+   ZonalCellSelection cell_selection = ZonalCellSelection::CellCentre;
+   /// @brief Number of histogram bins per zone, 0 disables the histograms.
+   ///
+   /// With histograms the median, quantiles, majority, minority and variety are computed from
+   /// a per-zone histogram of bounded size instead of storing all values. Integer rasters with
+   /// at most 65536 distinct values get one bin per value, so the results are exact. Other
+   /// rasters, floating point ones in particular, use this many bins between the band minimum
+   /// and maximum: the median and quantiles are then exact to one bin width, and majority,
+   /// minority and variety count bins. Zones only store the bins they occupy, see ZonalHistogram.
+   int histogram_bins = 0;
+   /// Additional quantiles in (0, 1) written as fields named q<percent>, requires histograms.
+   QList<double> quantiles;
+   /// Width and height of the raster tiles in cells.
+   int tile_size = 512;
+   /// Number of polygons read and rasterized per batch.
+   int batch_size = 16384;
+   /// Number of worker threads, 0 uses one thread per core.
+   int thread_count = 0;
+};
+
+/// @brief Tiled, multithreaded replacement of QgsZonalStatistics.
+///
+/// QgsZonalStatistics::calculateStatistics reads the raster block under every polygon and
+/// tests each cell centre against the geometry. This engine rasterizes every polygon once
+/// into scanline spans, buckets the spans by raster tile, and reads each tile exactly once.
+/// All zones overlapping a tile are reduced in one pass, with the tiles spread over a
+/// thread pool. The results are written with a single changeAttributeValues() call.
+///
+/// Distribution statistics are kept in per-zone histograms of bounded size, and the partial
+/// results of every tile are merged into their zones as soon as the tile is done, so memory
+/// grows neither with the number of cells a zone covers nor with the number of tiles it spans.
+class ZonalEngine
+{
+public:
+   /// @brief Constructor.
+   /// @param polygon_layer The zones, receives the statistics as new fields.
+   /// @param raster_layer The raster to summarize.
+   /// @param settings The statistics and processing options.
+   ZonalEngine(QgsVectorLayer* polygon_layer, QgsRasterLayer* raster_layer, const ZonalSettings& settings);
+
+   /// @brief Calculates the statistics and adds them to the polygon layer.
+   /// @param feedback Optional feedback for progress reports and cancellation.
+   /// @return Success, or the error. After Canceled, RasterInvalid or any other error the
+   /// polygon layer is left unchanged, without the output fields.
+   QgsZonalStatistics::Result calculate_statistics(QgsFeedback* feedback = nullptr);
+
+   /// @brief Statistics this engine can calculate, other requested statistics are ignored.
+   /// @param histograms Whether histograms are enabled, which adds the median.
+   static QgsZonalStatistics::Statistics supported_statistics(bool histograms = false);
+
+private:
+   QgsVectorLayer* m_polygon_layer;
+   QgsRasterLayer* m_raster_layer;
+   ZonalSettings m_settings;
+};
+
+#endif
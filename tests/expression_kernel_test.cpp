@@ -0,0 +1,278 @@
+#include "expression_kernel.h"
+
+#include "qgsapplication.h"
+#include "qgsexpression.h"
+#include "qgsexpressioncontext.h"
+#include "qgsfeature.h"
+#include "qgsfields.h"
+
+#include <QVector>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace {
+
+/// More than one batch, so results are checked across the batch boundary.
+const int s_feature_count = 5000;
+
+QgsFields create_fields() {
+   QgsFields fields;
+   fields.append(QgsField(QStringLiteral("i"), QVariant::Int));
+   fields.append(QgsField(QStringLiteral("l"), QVariant::LongLong));
+   fields.append(QgsField(QStringLiteral("d"), QVariant::Double));
+   fields.append(QgsField(QStringLiteral("b"), QVariant::Bool));
+   fields.append(QgsField(QStringLiteral("s"), QVariant::String));
+   return fields;
+}
+
+/// Features whose attributes are drawn from values that stress the kernels: typed nulls of
+/// every field type, NaN and infinities, integers beyond 2^53 and beyond the int range,
+/// negative halves and strings that convert to false.
+std::vector<QgsFeature> create_features(const QgsFields& fields) {
+   const qlonglong two_53 = qlonglong(1) << 53;
+   const double infinity = std::numeric_limits<double>::infinity();
+   const QVector<QVariant> ints = {QVariant(QVariant::Int), 0, 1, -1, 2, 3, 7,
+                                   std::numeric_limits<int>::max(), std::numeric_limits<int>::min()};
+   const QVector<QVariant> longs = {QVariant(QVariant::LongLong), qlonglong(0), qlonglong(5), qlonglong(-3), two_53,
+                                    two_53 + 1, -(two_53 + 1), qlonglong(1) << 62, qlonglong(3000000000),
+                                    qlonglong(-3000000000)};
+   const QVector<QVariant> doubles = {QVariant(QVariant::Double), 0.0, -0.0, 0.5, -0.5, 1.5, -1.5, 2.5, -2.5, 3.25,
+                                      -7.75, 1e300, std::numeric_limits<double>::quiet_NaN(), infinity, -infinity};
+   const QVector<QVariant> bools = {QVariant(QVariant::Bool), true, false};
+   const QVector<QVariant> strings = {QVariant(QVariant::String),
+                                      QStringLiteral(""),
+                                      QStringLiteral("abc"),
+                                      QStringLiteral("  Mixed Case  "),
+                                      QStringLiteral("false"),
+                                      QStringLiteral("0"),
+                                      QStringLiteral("b"),
+                                      QStringLiteral("héllo wörld")};
+
+   std::mt19937 random(42);
+   auto pick = [&](const QVector<QVariant>& values) { return values[static_cast<int>(random() % values.size())]; };
+   std::vector<QgsFeature> features;
+   features.reserve(s_feature_count);
+   for (int i = 0; i < s_feature_count; ++i) {
+      QgsFeature feature(fields, i);
+      feature.setAttributes(QgsAttributes() << pick(ints) << pick(longs) << pick(doubles) << pick(bools) << pick(strings));
+      features.push_back(feature);
+   }
+   return features;
+}
+
+bool is_integral(const QVariant& value) {
+   return value.userType() == QMetaType::Int || value.userType() == QMetaType::LongLong;
+}
+
+/// Equality of results within the documented exceptions: computed nulls are invalid
+/// QVariants, and integer results of mixed width may be 64 bit where QGIS has an int.
+bool same_value(const QVariant& expected, const QVariant& actual, bool mixed_width) {
+   if (expected.isNull() || actual.isNull()) {
+      return expected.isNull() && actual.isNull();
+   }
+   if (mixed_width && is_integral(expected) && is_integral(actual)) {
+      return expected.toLongLong() == actual.toLongLong();
+   }
+   if (expected.userType() != actual.userType()) {
+      return false;
+   }
+   if (expected.userType() == QMetaType::Double) {
+      const double e = expected.toDouble();
+      const double a = actual.toDouble();
+      return (std::isnan(e) && std::isnan(a)) || (e == a && std::signbit(e) == std::signbit(a));
+   }
+   return expected == actual;
+}
+
+QString describe(const QVariant& value) {
+   if (value.isNull()) {
+      return QStringLiteral("NULL (%1)").arg(value.typeName() ? value.typeName() : "invalid");
+   }
+   return QStringLiteral("%1 (%2)").arg(value.toString(), value.typeName());
+}
+
+QString describe(const QgsFeature& feature) {
+   QStringList values;
+   for (const QVariant& value : feature.attributes()) {
+      values << describe(value);
+   }
+   return values.join(QStringLiteral(", "));
+}
+
+/// Evaluates an expression with the kernels and with QgsExpression for every feature and
+/// compares the values and the filter results row by row.
+bool check_expression(const QgsFields& fields, const std::vector<QgsFeature>& features, const QString& text,
+                      bool mixed_width) {
+   const QByteArray name = text.toUtf8();
+   QgsExpressionContext kernel_context;
+   kernel_context.setFields(fields);
+   ExpressionKernel kernel(text);
+   if (!kernel.prepare(&kernel_context) || !kernel.is_compiled()) {
+      std::printf("FAIL %s: not compiled, %s\n", name.constData(), kernel.fallback_reason().toUtf8().constData());
+      return false;
+   }
+
+   std::vector<QVariant> results(features.size());
+   std::vector<std::uint8_t> accepted(features.size());
+   kernel.evaluate(features.data(), features.size(), results.data());
+   kernel.filter(features.data(), features.size(), accepted.data());
+
+   QgsExpressionContext context;
+   context.setFields(fields);
+   QgsExpression expression(text);
+   expression.prepare(&context);
+   int failures = 0;
+   for (std::size_t i = 0; i < features.size(); ++i) {
+      context.setFeature(features[i]);
+      const QVariant expected = expression.evaluate(&context);
+      const bool value_ok = same_value(expected, results[i], mixed_width);
+      const bool filter_ok = (accepted[i] != 0) == expected.toBool();
+      if ((!value_ok || !filter_ok) && failures++ < 5) {
+         std::printf("FAIL %s: [%s] gives %s, filter %d, QGIS has %s, filter %d\n", name.constData(),
+                     describe(features[i]).toUtf8().constData(), describe(results[i]).toUtf8().constData(),
+                     accepted[i], describe(expected).toUtf8().constData(), expected.toBool() ? 1 : 0);
+      }
+   }
+   if (failures > 0) {
+      std::printf("FAIL %s: %d of %zu features differ\n", name.constData(), failures, features.size());
+      return false;
+   }
+   std::printf("PASS %s\n", name.constData());
+   return true;
+}
+
+}
+
+/// Compares ExpressionKernel with QgsExpression over the compiled operators and functions.
+int main(int argc, char* argv[]) {
+   QgsApplication application(argc, argv, false);
+   QgsApplication::initQgis();
+
+   struct Case {
+      QString expression;
+      /// The result mixes Int and Int64 values, which the kernels return as Int64.
+      bool mixed_width;
+   };
+   const QList<Case> cases = {
+      // Fields, with the typed nulls of QGIS.
+      {QStringLiteral("\"i\""), false},
+      {QStringLiteral("\"l\""), false},
+      {QStringLiteral("\"d\""), false},
+      {QStringLiteral("\"b\""), false},
+      {QStringLiteral("\"s\""), false},
+      // Arithmetic.
+      {QStringLiteral("\"i\" + \"l\""), false},
+      {QStringLiteral("\"i\" + 1"), false},
+      {QStringLiteral("\"d\" - \"i\""), false},
+      {QStringLiteral("\"l\" * \"l\""), false},
+      {QStringLiteral("\"d\" * \"l\""), false},
+      {QStringLiteral("\"i\" / \"l\""), false},
+      {QStringLiteral("\"d\" / \"i\""), false},
+      {QStringLiteral("\"l\" // \"i\""), false},
+      {QStringLiteral("\"d\" // 2"), false},
+      {QStringLiteral("\"l\" % \"i\""), false},
+      {QStringLiteral("\"d\" % 0.75"), false},
+      {QStringLiteral("\"d\" ^ 2"), false},
+      {QStringLiteral("\"i\" ^ \"d\""), false},
+      {QStringLiteral("-\"d\""), false},
+      {QStringLiteral("-\"i\""), false},
+      {QStringLiteral("-\"l\""), false},
+      {QStringLiteral("\"i\" + NULL"), false},
+      // Comparisons.
+      {QStringLiteral("\"i\" = \"d\""), false},
+      {QStringLiteral("\"l\" <> \"i\""), false},
+      {QStringLiteral("\"d\" < \"l\""), false},
+      {QStringLiteral("\"i\" > 2"), false},
+      {QStringLiteral("\"d\" <= 0.5"), false},
+      {QStringLiteral("\"l\" >= \"i\""), false},
+      {QStringLiteral("\"d\" = NULL"), false},
+      {QStringLiteral("\"s\" = 'abc'"), false},
+      {QStringLiteral("\"s\" <> 'false'"), false},
+      {QStringLiteral("\"s\" < 'b'"), false},
+      {QStringLiteral("\"s\" > ''"), false},
+      {QStringLiteral("\"s\" <= 'abc'"), false},
+      {QStringLiteral("\"s\" >= 'b'"), false},
+      {QStringLiteral("\"i\" IS NULL"), false},
+      {QStringLiteral("\"b\" IS NULL"), false},
+      {QStringLiteral("\"s\" IS NOT NULL"), false},
+      {QStringLiteral("\"d\" IS \"i\""), false},
+      {QStringLiteral("\"l\" IS NOT \"i\""), false},
+      {QStringLiteral("\"s\" IS 'abc'"), false},
+      {QStringLiteral("\"s\" IS NOT '0'"), false},
+      // Logic.
+      {QStringLiteral("\"b\" AND \"i\" > 1"), false},
+      {QStringLiteral("\"b\" OR \"d\" < 0"), false},
+      {QStringLiteral("\"d\" AND \"l\""), false},
+      {QStringLiteral("NOT \"b\""), false},
+      {QStringLiteral("NOT \"d\""), false},
+      {QStringLiteral("\"i\" IN (1, 2, 7)"), false},
+      {QStringLiteral("\"d\" IN (0.5, -2.5, NULL)"), false},
+      {QStringLiteral("\"l\" NOT IN (0, 5)"), false},
+      {QStringLiteral("\"s\" IN ('abc', 'false')"), false},
+      {QStringLiteral("\"s\" NOT IN ('b', NULL)"), false},
+      // CASE.
+      {QStringLiteral("CASE WHEN \"b\" THEN \"d\" WHEN \"i\" > 1 THEN -1.5 ELSE 0.25 END"), false},
+      {QStringLiteral("CASE WHEN \"d\" > 0 THEN \"s\" END"), false},
+      {QStringLiteral("CASE WHEN \"b\" THEN \"i\" ELSE \"l\" END"), true},
+      {QStringLiteral("CASE WHEN \"i\" < 0 THEN \"i\" ELSE 3 END"), false},
+      // Math functions.
+      {QStringLiteral("abs(\"l\")"), false},
+      {QStringLiteral("abs(\"d\")"), false},
+      {QStringLiteral("sqrt(\"d\")"), false},
+      {QStringLiteral("sin(\"d\")"), false},
+      {QStringLiteral("cos(\"i\")"), false},
+      {QStringLiteral("tan(\"d\")"), false},
+      {QStringLiteral("asin(\"d\")"), false},
+      {QStringLiteral("acos(\"d\")"), false},
+      {QStringLiteral("atan(\"l\")"), false},
+      {QStringLiteral("atan2(\"d\", \"i\")"), false},
+      {QStringLiteral("exp(\"d\")"), false},
+      {QStringLiteral("ln(\"d\")"), false},
+      {QStringLiteral("log10(\"l\")"), false},
+      {QStringLiteral("floor(\"d\")"), false},
+      {QStringLiteral("ceil(\"d\")"), false},
+      {QStringLiteral("round(\"d\")"), false},
+      {QStringLiteral("round(-\"d\")"), false},
+      {QStringLiteral("round(\"l\")"), false},
+      {QStringLiteral("round(\"i\" / 2)"), false},
+      {QStringLiteral("round(\"d\", 1)"), false},
+      {QStringLiteral("round(\"d\" / 4, 2)"), false},
+      {QStringLiteral("min(\"d\", \"i\")"), false},
+      {QStringLiteral("max(\"l\", \"d\", 1)"), false},
+      {QStringLiteral("min(\"i\", NULL)"), false},
+      {QStringLiteral("clamp(-1, \"d\", 2)"), false},
+      {QStringLiteral("coalesce(\"d\", -1.5)"), false},
+      {QStringLiteral("coalesce(\"i\", \"l\", 0)"), true},
+      {QStringLiteral("coalesce(\"s\", 'none')"), false},
+      // String functions.
+      {QStringLiteral("upper(\"s\")"), false},
+      {QStringLiteral("lower(\"s\")"), false},
+      {QStringLiteral("trim(\"s\")"), false},
+      {QStringLiteral("length(\"s\")"), false},
+      {QStringLiteral("left(\"s\", \"i\")"), false},
+      {QStringLiteral("right(\"s\", \"i\")"), false},
+      {QStringLiteral("left(\"s\", \"l\")"), false},
+      {QStringLiteral("right(\"s\", \"l\")"), false},
+      {QStringLiteral("left(\"s\", 3000000000)"), false},
+      {QStringLiteral("right(\"s\", -2)"), false},
+      {QStringLiteral("\"s\" || 'x'"), false},
+      {QStringLiteral("\"s\" || \"s\""), false},
+      {QStringLiteral("concat(\"s\", NULL, '-', \"s\")"), false},
+   };
+
+   const QgsFields fields = create_fields();
+   const std::vector<QgsFeature> features = create_features(fields);
+   bool ok = true;
+   for (const Case& test : cases) {
+      ok = check_expression(fields, features, test.expression, test.mixed_width) && ok;
+   }
+
+   QgsApplication::exitQgis();
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
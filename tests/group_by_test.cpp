@@ -0,0 +1,261 @@
+#include "group_by_engine.h"
+
+#include "qgsaggregatecalculator.h"
+#include "qgsapplication.h"
+#include "qgsexpression.h"
+#include "qgsexpressioncontextutils.h"
+#include "qgsfeature.h"
+#include "qgsfields.h"
+#include "qgsmemoryproviderutils.h"
+#include "qgsvectordataprovider.h"
+#include "qgsvectorlayer.h"
+
+#include <QDate>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+
+namespace {
+
+const int s_feature_count = 1000;
+
+/// Id the memory provider gives the feature of row i.
+long long feature_id(int i) {
+   return i + 1;
+}
+
+/// A layer with null keys of several types, integers stored as Int and Int64, doubles with
+/// nulls, strings whose lexicographic order differs from their numeric order, and dates.
+std::unique_ptr<QgsVectorLayer> create_layer() {
+   QgsFields fields;
+   fields.append(QgsField(QStringLiteral("cat"), QVariant::String));
+   fields.append(QgsField(QStringLiteral("i32"), QVariant::Int));
+   fields.append(QgsField(QStringLiteral("i64"), QVariant::LongLong));
+   fields.append(QgsField(QStringLiteral("v"), QVariant::Double));
+   fields.append(QgsField(QStringLiteral("name"), QVariant::String));
+   fields.append(QgsField(QStringLiteral("day"), QVariant::Date));
+   std::unique_ptr<QgsVectorLayer> layer(QgsMemoryProviderUtils::createMemoryLayer(QStringLiteral("test"), fields));
+   if (!layer || !layer->isValid()) {
+      return nullptr;
+   }
+
+   const QStringList categories = {QStringLiteral("a"), QStringLiteral("b"), QStringLiteral("c")};
+   QgsFeatureList features;
+   for (int i = 0; i < s_feature_count; ++i) {
+      QgsFeature feature(fields);
+      feature.setAttributes(QgsAttributes()
+                            << (i % 7 == 0 ? QVariant(QVariant::String) : QVariant(categories[i % 3]))
+                            << (i % 11 == 0 ? QVariant(QVariant::Int) : QVariant(i % 5))
+                            << (i % 11 == 0 ? QVariant(QVariant::LongLong) : QVariant(static_cast<qlonglong>(i % 5)))
+                            << (i % 13 == 0 ? QVariant(QVariant::Double) : QVariant(100.0 * std::sin(i) + 0.5 * i))
+                            << (i % 9 == 0 ? QVariant(QVariant::String) : QVariant(QStringLiteral("n%1").arg((i * 37) % 101)))
+                            << (i % 10 == 0 ? QVariant(QVariant::Date) : QVariant(QDate(2020, 1, 1).addDays((i * 53) % 400))));
+      features << feature;
+   }
+   if (!layer->dataProvider()->addFeatures(features)) {
+      return nullptr;
+   }
+   return layer;
+}
+
+bool same_value(const QVariant& expected, const QVariant& actual) {
+   if (expected.isNull() || actual.isNull()) {
+      return expected.isNull() && actual.isNull();
+   }
+   switch (expected.userType()) {
+   case QMetaType::QString:
+      return actual.userType() == QMetaType::QString && expected.toString() == actual.toString();
+   case QMetaType::QDate:
+   case QMetaType::QDateTime:
+      // QgsAggregateCalculator returns dates as date times.
+      return (actual.userType() == QMetaType::QDate || actual.userType() == QMetaType::QDateTime)
+         && expected.toDateTime() == actual.toDateTime();
+   default: {
+      bool ok = false;
+      const double e = expected.toDouble();
+      const double a = actual.toDouble(&ok);
+      // Sums are compensated in the engine, so allow for the rounding of QGIS.
+      return ok && std::abs(a - e) <= 1e-9 * std::max(1.0, std::abs(e));
+   }
+   }
+}
+
+/// Runs the engine grouped by "cat" and checks every aggregate of every group against
+/// QgsAggregateCalculator filtered to the group.
+bool check_aggregates(QgsVectorLayer& layer) {
+   struct Aggregate {
+      QString expression;
+      QgsAggregateCalculator::Aggregate aggregate;
+   };
+   const QList<Aggregate> aggregates = {
+      {QStringLiteral("v"), QgsAggregateCalculator::Count},
+      {QStringLiteral("v"), QgsAggregateCalculator::CountMissing},
+      {QStringLiteral("v"), QgsAggregateCalculator::Sum},
+      {QStringLiteral("v"), QgsAggregateCalculator::Mean},
+      {QStringLiteral("v"), QgsAggregateCalculator::Median},
+      {QStringLiteral("v"), QgsAggregateCalculator::StDev},
+      {QStringLiteral("v"), QgsAggregateCalculator::StDevSample},
+      {QStringLiteral("v"), QgsAggregateCalculator::Min},
+      {QStringLiteral("v"), QgsAggregateCalculator::Max},
+      {QStringLiteral("v"), QgsAggregateCalculator::Range},
+      {QStringLiteral("v"), QgsAggregateCalculator::FirstQuartile},
+      {QStringLiteral("v"), QgsAggregateCalculator::ThirdQuartile},
+      {QStringLiteral("v"), QgsAggregateCalculator::InterQuartileRange},
+      {QStringLiteral("i64"), QgsAggregateCalculator::Sum},
+      {QStringLiteral("\"v\" * 2 + \"i32\""), QgsAggregateCalculator::Mean},
+      {QStringLiteral("name"), QgsAggregateCalculator::Min},
+      {QStringLiteral("name"), QgsAggregateCalculator::Max},
+      {QStringLiteral("name"), QgsAggregateCalculator::CountDistinct},
+      {QStringLiteral("name"), QgsAggregateCalculator::StringMinimumLength},
+      {QStringLiteral("name"), QgsAggregateCalculator::StringMaximumLength},
+      {QStringLiteral("day"), QgsAggregateCalculator::Min},
+      {QStringLiteral("day"), QgsAggregateCalculator::Max},
+   };
+
+   GroupBySettings settings;
+   settings.group_by << QStringLiteral("cat");
+   for (const Aggregate& aggregate : aggregates) {
+      settings.aggregates << GroupAggregate{aggregate.expression, aggregate.aggregate, QString()};
+   }
+   // Small batches on several threads, so the worker tables are merged.
+   settings.batch_size = 97;
+   settings.thread_count = 4;
+   GroupByEngine engine(layer, settings);
+   if (engine.run() != GroupByEngine::Success) {
+      std::printf("FAIL aggregates: the engine failed\n");
+      return false;
+   }
+   // a, b, c and null.
+   if (engine.group_count() != 4) {
+      std::printf("FAIL aggregates: %d groups instead of 4\n", engine.group_count());
+      return false;
+   }
+
+   QgsExpressionContext context(QgsExpressionContextUtils::globalProjectLayerScopes(&layer));
+   bool ok = true;
+   for (const QgsAttributes& row : engine.rows()) {
+      QgsAggregateCalculator calculator(&layer);
+      QgsAggregateCalculator::AggregateParameters parameters;
+      parameters.filter = QgsExpression::createFieldEqualityExpression(QStringLiteral("cat"), row.at(0));
+      calculator.setParameters(parameters);
+      for (int a = 0; a < aggregates.size(); ++a) {
+         bool calculated = false;
+         const QVariant expected = calculator.calculate(aggregates[a].aggregate, aggregates[a].expression, &context, &calculated);
+         const QVariant actual = row.at(1 + a);
+         if (!calculated || !same_value(expected, actual)) {
+            std::printf("FAIL aggregates: aggregate %d of %s for %s is %s, QGIS has %s\n", static_cast<int>(aggregates[a].aggregate),
+                        aggregates[a].expression.toUtf8().constData(), parameters.filter.toUtf8().constData(),
+                        actual.toString().toUtf8().constData(), expected.toString().toUtf8().constData());
+            ok = false;
+         }
+      }
+   }
+   if (ok) {
+      std::printf("PASS aggregates\n");
+   }
+   return ok;
+}
+
+/// Name of a key for the expected groups, by kind of value.
+QString key_name(const QVariant& value) {
+   if (value.isNull()) {
+      return QStringLiteral("null");
+   }
+   if (value.userType() == QMetaType::QString) {
+      return QStringLiteral("s:") + value.toString();
+   }
+   return QStringLiteral("i:") + QString::number(value.toLongLong());
+}
+
+/// Runs the engine with one key expression and checks the groups and their sizes.
+bool check_groups(QgsVectorLayer& layer, const QString& name, const QString& key, const std::map<QString, long long>& expected) {
+   GroupBySettings settings;
+   settings.group_by << key;
+   settings.aggregates << GroupAggregate{QStringLiteral("1"), QgsAggregateCalculator::Count, QString()};
+   settings.batch_size = 97;
+   settings.thread_count = 4;
+   GroupByEngine engine(layer, settings);
+   if (engine.run() != GroupByEngine::Success) {
+      std::printf("FAIL %s: the engine failed\n", name.toUtf8().constData());
+      return false;
+   }
+   std::map<QString, long long> actual;
+   bool ok = true;
+   for (const QgsAttributes& row : engine.rows()) {
+      const QString group = key_name(row.at(0));
+      if (actual.count(group)) {
+         std::printf("FAIL %s: key %s forms several groups\n", name.toUtf8().constData(), group.toUtf8().constData());
+         ok = false;
+      }
+      actual[group] += row.at(1).toLongLong();
+   }
+   if (actual != expected) {
+      std::printf("FAIL %s: %zu groups, expected %zu\n", name.toUtf8().constData(), actual.size(), expected.size());
+      for (const auto& [group, count] : expected) {
+         const auto found = actual.find(group);
+         std::printf("  %s: %lld features, engine has %lld\n", group.toUtf8().constData(), count,
+                     found == actual.end() ? -1 : found->second);
+      }
+      ok = false;
+   }
+   if (ok) {
+      std::printf("PASS %s\n", name.toUtf8().constData());
+   }
+   return ok;
+}
+
+bool check_invalid(QgsVectorLayer& layer, const QString& name, const QString& expression, QgsAggregateCalculator::Aggregate aggregate) {
+   GroupBySettings settings;
+   settings.aggregates << GroupAggregate{expression, aggregate, QString()};
+   GroupByEngine engine(layer, settings);
+   if (engine.run() != GroupByEngine::InvalidParameters) {
+      std::printf("FAIL %s: the run did not fail with InvalidParameters\n", name.toUtf8().constData());
+      return false;
+   }
+   std::printf("PASS %s\n", name.toUtf8().constData());
+   return true;
+}
+
+}
+
+/// Compares GroupByEngine with QgsAggregateCalculator and checks the grouping of null keys and
+/// of equal keys of different types.
+int main(int argc, char* argv[]) {
+   QgsApplication application(argc, argv, false);
+   QgsApplication::initQgis();
+
+   std::unique_ptr<QgsVectorLayer> layer = create_layer();
+   if (!layer) {
+      std::printf("FAIL: cannot create the layer\n");
+      return EXIT_FAILURE;
+   }
+
+   bool ok = check_aggregates(*layer);
+
+   // The same numbers from an Int and an Int64 field, and nulls of both types, form one group
+   // per value. if() is evaluated by QGIS, so the key values keep the types of the fields.
+   std::map<QString, long long> numbers;
+   std::map<QString, long long> mixed;
+   for (int i = 0; i < s_feature_count; ++i) {
+      const QString number = i % 11 == 0 ? QStringLiteral("null") : QStringLiteral("i:%1").arg(i % 5);
+      ++numbers[number];
+      const QString category = i % 7 == 0 ? QStringLiteral("null") : QStringLiteral("s:") + QString(QChar('a' + i % 3));
+      ++mixed[feature_id(i) % 3 == 0 ? category : number];
+   }
+   ok = check_groups(*layer, QStringLiteral("int and int64 keys"), QStringLiteral("if($id % 2 = 0, \"i32\", \"i64\")"), numbers)
+      && ok;
+   // Strings and integers in one key column, with string and integer nulls.
+   ok = check_groups(*layer, QStringLiteral("mixed type keys"), QStringLiteral("if($id % 3 = 0, \"cat\", \"i32\")"), mixed) && ok;
+
+   ok = check_invalid(*layer, QStringLiteral("range of strings"), QStringLiteral("name"), QgsAggregateCalculator::Range) && ok;
+   ok = check_invalid(*layer, QStringLiteral("min of strings and numbers"), QStringLiteral("if($id % 2 = 0, \"name\", \"v\")"),
+                      QgsAggregateCalculator::Min)
+      && ok;
+
+   QgsApplication::exitQgis();
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
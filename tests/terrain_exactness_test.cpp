@@ -0,0 +1,222 @@
+#include "terrain_engine.h"
+
+#include "qgsapplication.h"
+#include "qgsaspectfilter.h"
+#include "qgshillshadefilter.h"
+#include "qgsninecellfilter.h"
+#include "qgsogrutils.h"
+#include "qgsslopefilter.h"
+
+#include <QTemporaryDir>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <gdal.h>
+
+namespace {
+
+const float s_nodata = -9999.0f;
+
+/// Writes a DEM with non-square cells, nodata cells inside, a nodata block on the border and a
+/// flat area, which covers every branch of the Horn derivative and the flat cases of aspect and
+/// hillshade. The width is no multiple of 8, so the SIMD kernels finish rows with the scalar code.
+bool write_dem(const QString& file_name, int width, int height) {
+   GDALDriverH driver = GDALGetDriverByName("GTiff");
+   gdal::dataset_unique_ptr dataset(GDALCreate(driver, file_name.toUtf8().constData(), width, height, 1, GDT_Float32, nullptr));
+   if (!dataset) {
+      return false;
+   }
+   double geo_transform[6] = {500000.0, 0.7, 0.0, 4200000.0, 0.0, -1.3};
+   GDALSetGeoTransform(dataset.get(), geo_transform);
+   GDALRasterBandH band = GDALGetRasterBand(dataset.get(), 1);
+   GDALSetRasterNoDataValue(band, s_nodata);
+
+   std::mt19937 random(42);
+   std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+   std::vector<float> values(static_cast<std::size_t>(width) * height);
+   for (int row = 0; row < height; ++row) {
+      for (int col = 0; col < width; ++col) {
+         float& value = values[static_cast<std::size_t>(row) * width + col];
+         if (row < 6 && col >= width - 5) {
+            value = s_nodata;
+         } else if (row >= height - 8 && col < 10) {
+            value = 120.0f;
+         } else if (random() % 17 == 0) {
+            value = s_nodata;
+         } else {
+            value = static_cast<float>(100.0 + 30.0 * std::sin(col * 0.11) * std::cos(row * 0.07) + row * 0.9) + noise(random);
+         }
+      }
+   }
+   return GDALRasterIO(band, GF_Write, 0, 0, width, height, values.data(), width, height, GDT_Float32, 0, 0) == CE_None;
+}
+
+bool read_raster(const QString& file_name, std::vector<float>& values, double& nodata) {
+   gdal::dataset_unique_ptr dataset(GDALOpen(file_name.toUtf8().constData(), GA_ReadOnly));
+   if (!dataset) {
+      return false;
+   }
+   GDALRasterBandH band = GDALGetRasterBand(dataset.get(), 1);
+   const int width = GDALGetRasterXSize(dataset.get());
+   const int height = GDALGetRasterYSize(dataset.get());
+   nodata = GDALGetRasterNoDataValue(band, nullptr);
+   values.resize(static_cast<std::size_t>(width) * height);
+   return GDALRasterIO(band, GF_Read, 0, 0, width, height, values.data(), width, height, GDT_Float32, 0, 0) == CE_None;
+}
+
+/// @brief Finds out whether QgsHillshadeFilter::setLightAngle() takes the zenith angle or the
+/// altitude of the light.
+///
+/// A flat DEM is lit at 255 * cos(zenith), so a light angle of 30 degrees gives 220.8 if it is
+/// the zenith angle and 127.5 if it is the altitude.
+/// @return 1 for the zenith angle, 0 for the altitude, -1 if the filter gives neither.
+int hillshade_angle_is_zenith(const QString& flat_file, const QString& output_file) {
+   GDALDriverH driver = GDALGetDriverByName("GTiff");
+   {
+      gdal::dataset_unique_ptr dataset(GDALCreate(driver, flat_file.toUtf8().constData(), 5, 5, 1, GDT_Float32, nullptr));
+      if (!dataset) {
+         return -1;
+      }
+      double geo_transform[6] = {0.0, 1.0, 0.0, 5.0, 0.0, -1.0};
+      GDALSetGeoTransform(dataset.get(), geo_transform);
+      std::vector<float> values(25, 50.0f);
+      if (GDALRasterIO(GDALGetRasterBand(dataset.get(), 1), GF_Write, 0, 0, 5, 5, values.data(), 5, 5, GDT_Float32, 0, 0)
+          != CE_None) {
+         return -1;
+      }
+   }
+   QgsHillshadeFilter hillshade(flat_file, output_file, QStringLiteral("GTiff"));
+   hillshade.setLightAngle(30.0f);
+   std::vector<float> values;
+   double nodata = 0.0;
+   if (hillshade.processRaster() != 0 || !read_raster(output_file, values, nodata)) {
+      return -1;
+   }
+   const double centre = values[12];
+   if (std::abs(centre - 255.0 * std::cos(30.0 * M_PI / 180.0)) < 0.01) {
+      return 1;
+   }
+   if (std::abs(centre - 255.0 * std::sin(30.0 * M_PI / 180.0)) < 0.01) {
+      return 0;
+   }
+   std::printf("FAIL: a flat DEM lit at a light angle of 30 gives %.9g\n", centre);
+   return -1;
+}
+
+/// Runs a QGIS filter and the engine with the same settings and compares the output bytes.
+bool compare(const QString& name, QgsNineCellFilter& filter, const QString& dem_file, const QString& qgis_file,
+             const QString& engine_file, TerrainSettings settings) {
+   if (filter.processRaster() != 0) {
+      std::printf("FAIL %s: the QGIS filter failed\n", name.toUtf8().constData());
+      return false;
+   }
+   std::vector<float> expected;
+   double expected_nodata = 0.0;
+   if (!read_raster(qgis_file, expected, expected_nodata)) {
+      std::printf("FAIL %s: cannot read the QGIS output\n", name.toUtf8().constData());
+      return false;
+   }
+   settings.output_nodata = static_cast<float>(expected_nodata);
+
+   bool ok = true;
+   for (bool use_simd : {false, true}) {
+      settings.use_simd = use_simd;
+      const char* level = terrain_simd::simd_level_name(use_simd ? terrain_simd::detect_simd_level() : SimdLevel::Scalar);
+      std::vector<float> actual;
+      double actual_nodata = 0.0;
+      if (TerrainEngine(settings).process_raster(dem_file, engine_file) != TerrainEngine::Success
+          || !read_raster(engine_file, actual, actual_nodata)) {
+         std::printf("FAIL %s (%s): the engine failed\n", name.toUtf8().constData(), level);
+         ok = false;
+         continue;
+      }
+      if (actual.size() != expected.size() || actual_nodata != expected_nodata) {
+         std::printf("FAIL %s (%s): size or nodata differ\n", name.toUtf8().constData(), level);
+         ok = false;
+         continue;
+      }
+      std::size_t mismatches = 0;
+      for (std::size_t i = 0; i < expected.size(); ++i) {
+         if (std::memcmp(&expected[i], &actual[i], sizeof(float)) != 0) {
+            if (mismatches == 0) {
+               std::printf("FAIL %s (%s): cell %zu is %.9g, QGIS has %.9g\n", name.toUtf8().constData(), level, i,
+                           actual[i], expected[i]);
+            }
+            ++mismatches;
+         }
+      }
+      if (mismatches > 0) {
+         std::printf("FAIL %s (%s): %zu of %zu cells differ\n", name.toUtf8().constData(), level, mismatches,
+                     expected.size());
+         ok = false;
+      } else {
+         std::printf("PASS %s (%s)\n", name.toUtf8().constData(), level);
+      }
+   }
+   return ok;
+}
+
+}
+
+/// Runs QgsSlopeFilter, QgsAspectFilter and QgsHillshadeFilter and the TerrainEngine with and
+/// without SIMD on the same DEM and checks that the output rasters are bit-identical.
+int main(int argc, char* argv[]) {
+   QgsApplication application(argc, argv, false);
+   QgsApplication::initQgis();
+   GDALAllRegister();
+
+   QTemporaryDir directory;
+   const QString dem_file = directory.filePath(QStringLiteral("dem.tif"));
+   const QString qgis_file = directory.filePath(QStringLiteral("qgis.tif"));
+   const QString engine_file = directory.filePath(QStringLiteral("engine.tif"));
+   if (!directory.isValid() || !write_dem(dem_file, 67, 41)) {
+      std::printf("FAIL: cannot write the DEM\n");
+      return EXIT_FAILURE;
+   }
+
+   // The engine takes the altitude of the light, so the hillshade comparison needs to know
+   // which angle QgsHillshadeFilter takes.
+   const int angle_is_zenith = hillshade_angle_is_zenith(directory.filePath(QStringLiteral("flat.tif")), qgis_file);
+   if (angle_is_zenith < 0) {
+      std::printf("FAIL: cannot find out the light angle convention of QgsHillshadeFilter\n");
+      return EXIT_FAILURE;
+   }
+   std::printf("QgsHillshadeFilter takes the %s of the light\n", angle_is_zenith ? "zenith angle" : "altitude");
+
+   bool ok = true;
+   for (double z_factor : {1.0, 2.5}) {
+      TerrainSettings settings;
+      settings.z_factor = z_factor;
+      // Small bands, so the halo rows between bands are compared as well.
+      settings.band_rows = 7;
+      const QString suffix = QStringLiteral(" z=%1").arg(z_factor);
+
+      QgsSlopeFilter slope(dem_file, qgis_file, QStringLiteral("GTiff"));
+      slope.setZFactor(z_factor);
+      settings.derivative = TerrainDerivative::Slope;
+      ok = compare(QStringLiteral("slope") + suffix, slope, dem_file, qgis_file, engine_file, settings) && ok;
+
+      QgsAspectFilter aspect(dem_file, qgis_file, QStringLiteral("GTiff"));
+      aspect.setZFactor(z_factor);
+      settings.derivative = TerrainDerivative::Aspect;
+      ok = compare(QStringLiteral("aspect") + suffix, aspect, dem_file, qgis_file, engine_file, settings) && ok;
+
+      settings.light_azimuth = 315.0;
+      settings.light_altitude = 35.0;
+      QgsHillshadeFilter hillshade(dem_file, qgis_file, QStringLiteral("GTiff"));
+      hillshade.setZFactor(z_factor);
+      hillshade.setLightAzimuth(static_cast<float>(settings.light_azimuth));
+      hillshade.setLightAngle(static_cast<float>(angle_is_zenith ? 90.0 - settings.light_altitude : settings.light_altitude));
+      settings.derivative = TerrainDerivative::Hillshade;
+      ok = compare(QStringLiteral("hillshade") + suffix, hillshade, dem_file, qgis_file, engine_file, settings) && ok;
+   }
+
+   QgsApplication::exitQgis();
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}